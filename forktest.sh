@@ -0,0 +1,29 @@
+#!/bin/bash
+
+# fork under load, with each trace format: no child may hang.
+# usage: forktest.sh [forks]
+
+PATH_ROOT="$( cd "$( dirname "${BASH_SOURCE[0]}" )" >/dev/null && pwd )"
+PATH_SO="$PATH_ROOT/bin/linux/alloc2log.so"
+FORKS=${1:-200}
+
+# the children's traces go somewhere to throw away
+PATH_RUN=$(mktemp -d)
+trap 'rm -rf "$PATH_RUN"' EXIT
+cd "$PATH_RUN" || exit 1
+
+FAILED=0
+for FORMAT in text binary; do
+    echo "forktest, $FORMAT traces:"
+    if ! A2L_FORMAT=$FORMAT LD_PRELOAD=$PATH_SO \
+         "$PATH_ROOT/bin/linux/forktest" "$FORKS" 2>/dev/null; then
+        FAILED=1
+    fi
+    rm -rf "$PATH_RUN"/a2l-*
+done
+
+if [ $FAILED -ne 0 ]; then
+    echo "FAILED"
+    exit 1
+fi
+echo "ok"
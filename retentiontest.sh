@@ -0,0 +1,47 @@
+#!/bin/bash
+
+# a trace small enough that its first segments are compacted away: the
+# heap a2l-analyze's -o series rebuilds must never go negative, must
+# end where a2l-export's massif snapshots do, and must still hold the
+# blocks churntest leaked before the segments that are left.
+# usage: retentiontest.sh [seconds]
+
+PATH_ROOT="$( cd "$( dirname "${BASH_SOURCE[0]}" )" >/dev/null && pwd )"
+PATH_SO="$PATH_ROOT/bin/linux/alloc2log.so"
+PATH_BIN="$PATH_ROOT/bin/linux"
+SECONDS_RUN=${1:-6}
+
+PATH_RUN=$(mktemp -d)
+trap 'rm -rf "$PATH_RUN"' EXIT
+TRACE="$PATH_RUN/churn.a2l"
+
+fail() {
+    echo "FAILED: $1"
+    exit 1
+}
+
+LEAKED=$(A2L_FORMAT=binary A2L_LOGFILE=$TRACE \
+         A2L_DISK_CAP=6M A2L_SEGMENT_SIZE=1M A2L_KEYFRAME_INTERVAL=1 \
+         LD_PRELOAD=$PATH_SO \
+         "$PATH_BIN/churntest" 4 "$SECONDS_RUN" 2>/dev/null) || fail "churntest didn't run"
+
+SUMMARY=$("$PATH_BIN/a2l-analyze" -r bytes -n 1 "$TRACE" | head -4)
+echo "$SUMMARY"
+echo "$SUMMARY" | grep -q "rebuilt from keyframe" ||
+    fail "no segments compacted, or no keyframe left to rebuild the heap from"
+
+# time_s,total,... a row per bucket
+"$PATH_BIN/a2l-analyze" -o "$PATH_RUN/series.csv" "$TRACE" >/dev/null ||
+    fail "a2l-analyze -o"
+LOWEST=$(awk -F, 'NR == 2 || (NR > 2 && $2 < low) { low = $2 } END { print low }' "$PATH_RUN/series.csv")
+LAST=$(tail -n 1 "$PATH_RUN/series.csv" | cut -d, -f2)
+
+"$PATH_BIN/a2l-export" -f massif -o "$PATH_RUN/massif" "$TRACE" >/dev/null 2>&1 ||
+    fail "a2l-export -f massif"
+MASSIF=$(grep mem_heap_B= "$PATH_RUN/massif" | tail -n 1 | cut -d= -f2)
+
+echo "leaked $LEAKED B; -o lowest $LOWEST B, last $LAST B; massif last $MASSIF B"
+[ "$LOWEST" -ge 0 ] || fail "the -o series went negative"
+[ "$LAST" -eq "$MASSIF" ] || fail "-o and massif end on different heaps"
+[ "$LAST" -ge "$LEAKED" ] || fail "the heap lost the leaks compaction dropped"
+echo "ok"
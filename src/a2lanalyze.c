@@ -0,0 +1,2848 @@
+#define _GNU_SOURCE
+// a2l-analyze -- ranked per-site reports from a binary trace
+//
+// usage: a2l-analyze [-c] [-j threads] [-n rows] [-d depth] [-b buckets] [-r reports]
+//                    [-o file] [-F csv|json|folded|pprof|callgrind [-w weight] [-D base]]
+//                    [-m mem-limit [-T tmpdir]] <trace>
+//        a2l-analyze [-c] [-j threads] [-n rows] [-d depth] -q query <trace>
+//        a2l-analyze --follow [-i seconds] [-j threads] [-n rows] [-d depth]
+//                    [-r reports | -q query] <trace or dir>
+//
+// reports, -r as a comma list (default all): bytes, count, peak, leaks.
+// a site is an allocating stack.  a free counts against the site that
+// made the block, from the alloc_bytes and alloc_stack_id the trace
+// carries, so frees need no pairing; see -m for traces without it.
+//
+// blocks are shared out to -j threads (default: every core) as
+// contiguous ranges, read in order; a thread that runs dry steals the
+// back half of the busiest range left.  each thread sums into its own
+// tables, merged at the end.
+//
+// peak live bytes is sampled: the trace's span is cut into at least -b
+// buckets (default 1000) of a power of two nanoseconds, each thread
+// sums every site's net bytes per bucket, and a site's peak is the
+// highest running total at a bucket's end.
+// leak candidates are sites with bytes still live when the trace ends,
+// marked growing if they peaked in its last tenth.  on a compacted
+// trace live bytes start from the heap its first events had, rebuilt
+// from a keyframe (a2l_read_start_heap), not from none.
+//
+// -o writes the same buckets out as memory over time, for plotting:
+// live bytes at each bucket's end, in all and for the -n sites with
+// the highest peaks, as csv (a row per bucket) or json (-F, or a name
+// ending in .json).  -o - puts it on stdout instead of the reports.
+//
+// -F folded writes each site as a folded stack instead, outermost
+// frame first, "main;parse;malloc 1234", for flamegraph.pl and the
+// like; -w weighs them by bytes (default), allocs or live bytes.  -D
+// compares against a base trace, as "stack base value" lines for a
+// differential flame graph.  frames are module!function, so a
+// function's call sites fold together.  -F without -o goes to stdout.
+//
+// -F pprof writes a gzipped profile.proto (see a2lpprof.h) for pprof
+// and what reads its profiles: allocs and bytes, made and still live,
+// per site.  compare two with pprof's -diff_base rather than -D.
+//
+// -F callgrind writes the call graph of the symbolized stacks (see
+// a2lcallgrind.h), for kcachegrind and callgrind_annotate: allocs,
+// bytes, and bytes live at the trace's peak, each function's own and
+// inclusive of what it calls.  the peak is the bucket whose end has
+// the most bytes live in all, and a site's share is its live bytes
+// there.
+//
+// -m pairs every free with the alloc before it at the same pointer,
+// for traces whose frees don't say what they released (converted text
+// logs, blocks alloc2log didn't track), in about mem-limit bytes (K/M/G
+// suffixes ok) on any size of trace.  allocs are summed as usual while
+// every event is spilled to one of a number of partition files by
+// pointer hash, so a pointer's whole history lands in one file; each
+// partition is then sorted by pointer and time, in memory or as sorted
+// runs merged from a scratch file, and walked to pair its frees.  the
+// spill files are in -T (default $TMPDIR, else /tmp), unlinked as soon
+// as they're open.  with more partitions than files can be open at
+// once, the trace is read once per batch of partitions.
+//
+// -q answers a query instead (see a2lquery.h for the language):
+//
+//   a2l-analyze -q "where size >= 4K and module ~ libfoo group by thread" t.a2l
+//   a2l-analyze -q "where time >= 12:30 and time < 12:31 group by time 1" t.a2l
+//
+// the time range, thread and sites every match must have pick the
+// blocks to read, from <trace>.idx when a2l-index has made one (its
+// bloom filters skip blocks without the sites), else from the block
+// headers.  threads share those blocks out as above, filter each
+// batch of events and sum what's left by the group's key.  -n is the
+// default limit.
+//
+// -c keeps what each group of blocks added up to in <trace>.cache (see
+// a2lcache.h), and takes it from there next time instead of reading
+// the blocks: running the reports again, or a query with another
+// order or limit, reads nothing; a trace that has grown reads its new
+// blocks.  threads take a group at a time, sum it on its own and add
+// it in.  not with -m, whose pairing spans the whole trace.
+//
+// --follow tails a trace still being written, or every trace in a
+// directory (a session of several processes, forks and all), and
+// prints the reports, or -q's answer, every -i seconds (default 1):
+//
+//   a2l-analyze --follow -r bytes,leaks a2l-1234.a2l
+//   a2l-analyze --follow -i 5 -q "group by module" /var/tmp/session
+//
+// each round reopens the trace and reads only the blocks added since,
+// found again by the last one read (compaction can drop blocks from
+// the front), and adds them to sums kept per site; so memory is
+// bounded by the number of sites, not the trace.  a last block whose
+// checksum fails is still being written and waits for the next round.
+// a round reads for at most -i seconds and says how far behind it is.
+// peaks are sampled once a round, growing means peaked in the last
+// tenth of them.  it stops on a signal, or once the traced processes
+// have exited and everything they wrote is read.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+#include <signal.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#include "a2lread.h"
+#include "a2lidx.h"
+#include "a2lquery.h"
+#include "a2lcache.h"
+#include "a2lpprof.h"
+#include "a2lcallgrind.h"
+
+#define A2L_ANALYZE_GRAIN 16            // blocks taken at a time
+#define A2L_ANALYZE_BATCH 4096          // events decoded at a time
+#define A2L_ANALYZE_MAX_THREADS 256
+#define A2L_ANALYZE_SPILL_MIN 4096      // a thread's buffer per partition, at least
+#define A2L_ANALYZE_FILES_SPARE 64      // fds left for everything else
+#define A2L_FOLLOW_MAX_TRACES 64        // --follow: traces in a directory
+
+#define A2L_REPORT_BYTES 1
+#define A2L_REPORT_COUNT 2
+#define A2L_REPORT_PEAK  4
+#define A2L_REPORT_LEAKS 8
+
+// -F
+enum {
+    A2L_EXPORT_NONE,
+    A2L_EXPORT_CSV,
+    A2L_EXPORT_JSON,
+    A2L_EXPORT_FOLDED,
+    A2L_EXPORT_PPROF,
+    A2L_EXPORT_CALLGRIND
+};
+
+// -w, what a folded stack weighs
+enum {
+    A2L_WEIGHT_BYTES,
+    A2L_WEIGHT_ALLOCS,
+    A2L_WEIGHT_LIVE
+};
+
+typedef struct {
+    uint32_t stack_id;
+    uint32_t used;
+    uint64_t allocs, frees;
+    uint64_t bytes_alloced, bytes_freed;
+    int64_t start_live, start_blocks; // the heap's as the events left begin
+    int64_t peak_live;              // from the buckets, once merged
+    uint32_t peak_bucket;
+    uint32_t open_bucket;           // a worker's bytes for it, not yet in deltas
+    int64_t open_delta;
+}a2l_site_t;
+
+// sites' sums by stack id; for -q, groups' by key
+typedef struct {
+    a2l_site_t *slots;
+    uint32_t mask, count;
+}a2l_sitemap_t;
+
+// a site's net bytes in one time bucket
+typedef struct {
+    uint32_t stack_id;
+    uint32_t bucket;
+    int64_t delta;
+    uint64_t used;
+}a2l_delta_t;
+
+typedef struct {
+    a2l_delta_t *slots;
+    uint64_t mask, count;
+}a2l_deltamap_t;
+
+// an event in a partition file
+typedef struct {
+    uint64_t ptr;
+    uint64_t ts;
+    uint64_t bytes;                 // the alloc's, or the free's alloc_bytes
+    uint32_t stack_id;              // the alloc's, or the free's alloc_stack_id
+    uint32_t type;
+}a2l_spill_t;
+
+// a sorted run being merged
+typedef struct {
+    uint64_t next, end;             // records in the scratch file not yet read
+    a2l_spill_t *buf;
+    uint32_t pos, count;
+}a2l_run_t;
+
+// a partition's walk, one pointer at a time
+typedef struct {
+    uint64_t ptr;
+    int started, live;
+    uint64_t bytes;
+    uint32_t stack_id;
+}a2l_pairing_t;
+
+struct a2l_analyze;
+
+typedef struct {
+    struct a2l_analyze *a;
+    int index;
+    pthread_t thread;
+
+    // blocks [next, end) not yet taken, by this thread or a thief
+    pthread_mutex_t lock;
+    uint64_t next, end;
+
+    a2l_sitemap_t sites;
+    a2l_deltamap_t deltas;
+    uint64_t events, untracked_frees, bad_blocks, steals;
+    uint64_t unknown_frees;         // of a block, but not saying what it was
+    uint64_t matched;               // -q
+    uint64_t reused;                // -c: groups from the cache
+    uint64_t read_blocks, read_bytes; // -c: of the groups decoded instead
+    int failed;
+
+    // -m: events waiting for their partition file, then a partition
+    a2l_spill_t *spill;             // spill_records for each file open
+    uint32_t *spill_count;
+    a2l_spill_t *run;
+    uint64_t paired_frees, spilled;
+
+    // -c: a group's sums, before they're added to the above
+    a2l_sitemap_t group_sites;
+    a2l_deltamap_t group_deltas;
+}a2l_worker_t;
+
+typedef struct a2l_analyze {
+    a2l_reader_t *reader;
+    uint32_t bucket_shift;          // buckets are 2^shift ns, from ts 0
+    uint32_t num_buckets;
+    uint64_t first_bucket;          // the trace's first
+    int num_workers;
+    a2l_worker_t *workers;
+
+    // -m
+    uint64_t mem_limit;
+    const char *tmpdir;
+    uint32_t num_partitions;
+    uint32_t files_per_pass;
+    uint32_t pass, pass_first, pass_end;        // partitions [first, end) this pass
+    int *files;                                 // theirs, from pass_first
+    uint32_t spill_records;                     // a thread's buffer per file
+    uint64_t run_records;                       // sorted in memory at once, per thread
+    uint32_t next_partition;                    // for pairing threads to take
+
+    // -q: workers share out positions in blocks, not blocks
+    const a2l_query_t *query;
+    const uint64_t *blocks;
+    uint64_t num_selected;
+
+    // -c: threads take groups of blocks, each summed on its own
+    const char *trace;
+    const char *cache_name;
+    uint64_t cache_params;
+    a2l_cache_t *cache;
+    a2l_cachegroup_t *groups;
+    uint64_t num_groups, next_group;
+    uint64_t *group_blocks;                     // -q: each group's first position in blocks
+    a2l_cacheentry_t **entries;                 // each group's, for the next cache
+}a2l_analyze_t;
+
+static void
+a2l_analyze_usage(void) {
+    fprintf(stderr, "usage: a2l-analyze [-c] [-j threads] [-n rows] [-d depth] [-b buckets] "
+                    "[-r bytes,count,peak,leaks] [-o file] [-F csv|json|folded|pprof|callgrind [-w bytes|allocs|live] "
+                    "[-D base]] [-m mem-limit [-T tmpdir]] <trace>\n"
+                    "       a2l-analyze [-c] [-j threads] [-n rows] [-d depth] -q query <trace>\n"
+                    "       a2l-analyze --follow [-i seconds] [-j threads] [-n rows] [-d depth] "
+                    "[-r reports | -q query] <trace or dir>\n");
+}
+
+static double
+a2l_analyze_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// bytes, K/M/G suffixes ok
+static uint64_t
+a2l_analyze_parse_bytes(const char *str) {
+    char *end;
+    uint64_t bytes = strtoull(str, &end, 10);
+
+    switch (*end) {
+    case 'g': case 'G': bytes <<= 10; // fallthrough
+    case 'm': case 'M': bytes <<= 10; // fallthrough
+    case 'k': case 'K': bytes <<= 10;
+    }
+    return bytes;
+}
+
+// human readable byte count into buf
+static const char *
+a2l_analyze_bytes(char *buf, size_t len, double bytes) {
+    const char *units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    int unit = 0;
+
+    while ((bytes >= 1024.0 || bytes <= -1024.0) && unit < 4) {
+        bytes /= 1024.0;
+        unit++;
+    }
+    snprintf(buf, len, unit ? "%.1f %s" : "%.0f %s", bytes, units[unit]);
+    return buf;
+}
+
+//
+// tables
+//
+
+static int
+a2l_sitemap_init(a2l_sitemap_t *m, uint32_t size) {
+    m->slots = calloc(size, sizeof(a2l_site_t));
+    m->mask = size - 1;
+    m->count = 0;
+    return m->slots ? 0 : -1;
+}
+
+static a2l_site_t *
+a2l_sitemap_get(a2l_sitemap_t *m, uint32_t stack_id) {
+    uint32_t slot = (stack_id * 2654435761u) & m->mask;
+
+    while (m->slots[slot].used && m->slots[slot].stack_id != stack_id)
+        slot = (slot + 1) & m->mask;
+    if (m->slots[slot].used)
+        return &m->slots[slot];
+
+    // half full: double, then look again
+    if ((m->count + 1) * 2 > m->mask) {
+        a2l_sitemap_t grown;
+        if (a2l_sitemap_init(&grown, (m->mask + 1) * 2) < 0)
+            return NULL;
+        for (uint32_t i = 0; i <= m->mask; i++) {
+            if (m->slots[i].used) {
+                uint32_t s = (m->slots[i].stack_id * 2654435761u) & grown.mask;
+                while (grown.slots[s].used)
+                    s = (s + 1) & grown.mask;
+                grown.slots[s] = m->slots[i];
+            }
+        }
+        grown.count = m->count;
+        free(m->slots);
+        *m = grown;
+        return a2l_sitemap_get(m, stack_id);
+    }
+
+    m->slots[slot].used = 1;
+    m->slots[slot].stack_id = stack_id;
+    m->count++;
+    return &m->slots[slot];
+}
+
+static int
+a2l_deltamap_init(a2l_deltamap_t *m, uint64_t size) {
+    m->slots = calloc(size, sizeof(a2l_delta_t));
+    m->mask = size - 1;
+    m->count = 0;
+    return m->slots ? 0 : -1;
+}
+
+static inline uint64_t
+a2l_deltamap_hash(uint32_t stack_id, uint32_t bucket) {
+    uint64_t h = ((uint64_t)stack_id << 32 | bucket) * 0x9e3779b97f4a7c15ULL;
+    return h ^ (h >> 29);
+}
+
+static int
+a2l_deltamap_add(a2l_deltamap_t *m, uint32_t stack_id, uint32_t bucket, int64_t delta) {
+    uint64_t slot = a2l_deltamap_hash(stack_id, bucket) & m->mask;
+
+    while (m->slots[slot].used &&
+           (m->slots[slot].stack_id != stack_id || m->slots[slot].bucket != bucket))
+        slot = (slot + 1) & m->mask;
+    if (m->slots[slot].used) {
+        m->slots[slot].delta += delta;
+        return 0;
+    }
+
+    if ((m->count + 1) * 2 > m->mask) {
+        a2l_deltamap_t grown;
+        if (a2l_deltamap_init(&grown, (m->mask + 1) * 2) < 0)
+            return -1;
+        for (uint64_t i = 0; i <= m->mask; i++) {
+            const a2l_delta_t *d = &m->slots[i];
+            if (d->used) {
+                uint64_t s = a2l_deltamap_hash(d->stack_id, d->bucket) & grown.mask;
+                while (grown.slots[s].used)
+                    s = (s + 1) & grown.mask;
+                grown.slots[s] = *d;
+            }
+        }
+        grown.count = m->count;
+        free(m->slots);
+        *m = grown;
+        return a2l_deltamap_add(m, stack_id, bucket, delta);
+    }
+
+    m->slots[slot].used = 1;
+    m->slots[slot].stack_id = stack_id;
+    m->slots[slot].bucket = bucket;
+    m->slots[slot].delta = delta;
+    m->count++;
+    return 0;
+}
+
+//
+// workers
+//
+
+// the next blocks for w: its own, else half of someone else's
+static int
+a2l_analyze_take(a2l_worker_t *w, uint64_t *first, uint64_t *end) {
+    a2l_analyze_t *a = w->a;
+
+    pthread_mutex_lock(&w->lock);
+    if (w->next < w->end) {
+        *first = w->next;
+        *end = w->end - w->next > A2L_ANALYZE_GRAIN ? w->next + A2L_ANALYZE_GRAIN : w->end;
+        w->next = *end;
+        pthread_mutex_unlock(&w->lock);
+        return 1;
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    // the victim with the most left
+    for (;;) {
+        a2l_worker_t *victim = NULL;
+        uint64_t most = 0;
+
+        for (int i = 0; i < a->num_workers; i++) {
+            a2l_worker_t *v = &a->workers[i];
+            uint64_t left = __atomic_load_n(&v->end, __ATOMIC_RELAXED) -
+                            __atomic_load_n(&v->next, __ATOMIC_RELAXED);
+            if (v != w && left > most && left < UINT64_MAX / 2) {
+                most = left;
+                victim = v;
+            }
+        }
+        if (!victim)
+            return 0;
+
+        pthread_mutex_lock(&victim->lock);
+        uint64_t left = victim->end - victim->next;
+        if (left == 0) {
+            // taken from under us; look again
+            pthread_mutex_unlock(&victim->lock);
+            continue;
+        }
+        uint64_t mid = victim->end - (left + 1) / 2;
+        uint64_t stolen_end = victim->end;
+        victim->end = mid;
+        pthread_mutex_unlock(&victim->lock);
+
+        pthread_mutex_lock(&w->lock);
+        w->next = mid;
+        w->end = stolen_end;
+        w->steals++;
+        pthread_mutex_unlock(&w->lock);
+        return a2l_analyze_take(w, first, end);
+    }
+}
+
+// an alloc (delta >= 0) or free against site id, at ts
+static inline int
+a2l_analyze_count(a2l_worker_t *w, a2l_site_t **cached, uint32_t id, int64_t delta, uint64_t ts) {
+    const a2l_analyze_t *a = w->a;
+    a2l_site_t *site = *cached;
+
+    // runs of one site are common
+    if (!site || site->stack_id != id) {
+        if (!(site = *cached = a2l_sitemap_get(&w->sites, id)))
+            return -1;
+    }
+    if (delta >= 0) {
+        site->allocs++;
+        site->bytes_alloced += (uint64_t)delta;
+    } else {
+        site->frees++;
+        site->bytes_freed += (uint64_t)-delta;
+    }
+
+    // a block's events mostly share a bucket: add up there first
+    uint64_t bucket = (ts >> a->bucket_shift) - a->first_bucket;
+    if (bucket >= a->num_buckets)
+        bucket = a->num_buckets - 1;
+    if (bucket != site->open_bucket) {
+        if (site->open_delta &&
+            a2l_deltamap_add(&w->deltas, id, site->open_bucket, site->open_delta) < 0)
+            return -1;
+        site->open_bucket = (uint32_t)bucket;
+        site->open_delta = 0;
+    }
+    site->open_delta += delta;
+    return 0;
+}
+
+static inline uint32_t
+a2l_analyze_partition(const a2l_analyze_t *a, uint64_t ptr) {
+    return (uint32_t)((((ptr >> 4) * 0x9e3779b97f4a7c15ULL) >> 32) % a->num_partitions);
+}
+
+static int
+a2l_analyze_spill_flush(a2l_worker_t *w, uint32_t file) {
+    const a2l_analyze_t *a = w->a;
+    size_t len = w->spill_count[file] * sizeof(a2l_spill_t);
+
+    // whole records in one append, so threads' writes don't interleave
+    if (len && write(a->files[file], w->spill + (uint64_t)file * a->spill_records, len) != (ssize_t)len) {
+        fprintf(stderr, "a2l-analyze: can't write to %s: %s\n", a->tmpdir,
+                errno ? strerror(errno) : "disk full");
+        return -1;
+    }
+    w->spill_count[file] = 0;
+    return 0;
+}
+
+static inline int
+a2l_analyze_spill(a2l_worker_t *w, const a2l_batch_t *b, uint32_t i) {
+    const a2l_analyze_t *a = w->a;
+    uint32_t part = a2l_analyze_partition(a, b->ptr[i]);
+
+    if (part < a->pass_first || part >= a->pass_end)
+        return 0;
+
+    uint32_t file = part - a->pass_first;
+    a2l_spill_t *s = &w->spill[(uint64_t)file * a->spill_records + w->spill_count[file]++];
+    s->ptr = b->ptr[i];
+    s->ts = b->ts[i];
+    s->bytes = b->bytes[i];
+    s->stack_id = b->type[i] == A2L_REC_ALLOC ? b->stack_id[i] : b->alloc_stack_id[i];
+    s->type = b->type[i];
+    w->spilled++;
+    if (w->spill_count[file] == a->spill_records)
+        return a2l_analyze_spill_flush(w, file);
+    return 0;
+}
+
+static int
+a2l_analyze_batch(a2l_worker_t *w, const a2l_batch_t *b) {
+    const a2l_analyze_t *a = w->a;
+    a2l_site_t *site = NULL;
+
+    for (uint32_t i = 0; i < b->count; i++) {
+        uint32_t id;
+        int64_t delta;
+
+        // -m: frees wait for pairing; allocs are counted the first pass
+        if (a->mem_limit) {
+            if (b->ptr[i] && a2l_analyze_spill(w, b, i) < 0)
+                return -1;
+            if (a->pass)
+                continue;
+            if (b->type[i] != A2L_REC_ALLOC) {
+                if (!b->ptr[i])
+                    w->untracked_frees++;
+                continue;
+            }
+        }
+
+        if (b->type[i] == A2L_REC_ALLOC) {
+            id = b->stack_id[i];
+            delta = (int64_t)b->bytes[i];
+        } else {
+            // a block alloc2log didn't track: no site, no size
+            if (!b->bytes[i] && !b->alloc_stack_id[i]) {
+                w->untracked_frees++;
+                w->unknown_frees += b->ptr[i] != 0;
+                continue;
+            }
+            id = b->alloc_stack_id[i];
+            delta = -(int64_t)b->bytes[i];
+        }
+        if (a2l_analyze_count(w, &site, id, delta, b->ts[i]) < 0)
+            return -1;
+    }
+    if (!a->pass)
+        w->events += b->count;
+    return 0;
+}
+
+// bucket sums still open go into the deltas
+static int
+a2l_analyze_close_buckets(a2l_worker_t *w) {
+    for (uint32_t i = 0; i <= w->sites.mask; i++) {
+        a2l_site_t *s = &w->sites.slots[i];
+        if (s->used && s->open_delta) {
+            if (a2l_deltamap_add(&w->deltas, s->stack_id, s->open_bucket, s->open_delta) < 0)
+                return -1;
+            s->open_delta = 0;
+        }
+    }
+    return 0;
+}
+
+static void *
+a2l_analyze_worker(void *arg) {
+    a2l_worker_t *w = arg;
+    a2l_batch_t *b = a2l_batch_alloc(A2L_ANALYZE_BATCH);
+    uint64_t first, end;
+    a2l_iter_t it;
+
+    if (!b) {
+        w->failed = 1;
+        return NULL;
+    }
+
+    while (!w->failed && a2l_analyze_take(w, &first, &end)) {
+        a2l_iter_init(&it, w->a->reader, first, end);
+        while (a2l_iter_batch(&it, b)) {
+            if (a2l_analyze_batch(w, b) < 0) {
+                w->failed = 1;
+                break;
+            }
+        }
+        w->bad_blocks += it.bad_blocks;
+        a2l_iter_free(&it);
+    }
+
+    for (uint32_t i = 0; w->a->mem_limit && !w->failed && i < w->a->pass_end - w->a->pass_first; i++)
+        if (a2l_analyze_spill_flush(w, i) < 0)
+            w->failed = 1;
+    if (!w->failed && a2l_analyze_close_buckets(w) < 0)
+        w->failed = 1;
+
+    a2l_batch_free(b);
+    return NULL;
+}
+
+//
+// pairing
+//
+
+// by pointer, then time; a free before an alloc at the same time
+static inline int
+a2l_analyze_spill_before(const a2l_spill_t *a, const a2l_spill_t *b) {
+    if (a->ptr != b->ptr)
+        return a->ptr < b->ptr;
+    if (a->ts != b->ts)
+        return a->ts < b->ts;
+    return a->type > b->type;
+}
+
+static int
+a2l_analyze_cmp_spill(const void *pa, const void *pb) {
+    const a2l_spill_t *a = pa, *b = pb;
+    return a2l_analyze_spill_before(a, b) ? -1 : a2l_analyze_spill_before(b, a);
+}
+
+// the next of a partition's events, sorted: a free takes the alloc
+// before it at its pointer, unless it says what it freed
+static inline int
+a2l_analyze_pair_next(a2l_worker_t *w, a2l_pairing_t *p, a2l_site_t **cached, const a2l_spill_t *s) {
+    if (!p->started || s->ptr != p->ptr) {
+        p->started = 1;
+        p->ptr = s->ptr;
+        p->live = 0;
+    }
+
+    if (s->type == A2L_REC_ALLOC) {
+        p->live = 1;
+        p->bytes = s->bytes;
+        p->stack_id = s->stack_id;
+        return 0;
+    }
+
+    uint64_t bytes = s->bytes;
+    uint32_t id = s->stack_id;
+    if (!bytes && !id) {
+        if (!p->live) {
+            w->untracked_frees++;
+            return 0;
+        }
+        bytes = p->bytes;
+        id = p->stack_id;
+        w->paired_frees++;
+    }
+    p->live = 0;
+    return a2l_analyze_count(w, cached, id, -(int64_t)bytes, s->ts);
+}
+
+static int
+a2l_analyze_read(int fd, void *buf, size_t len, uint64_t offset) {
+    while (len) {
+        ssize_t n = pread(fd, buf, len, (off_t)offset);
+        if (n <= 0) {
+            fprintf(stderr, "a2l-analyze: can't read a partition: %s\n", n ? strerror(errno) : "short file");
+            return -1;
+        }
+        buf = (char *)buf + n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+// an unlinked file in tmpdir
+static int
+a2l_analyze_tempfile(const a2l_analyze_t *a) {
+    char path[4096];
+
+    snprintf(path, sizeof(path), "%s/a2l-analyze.XXXXXX", a->tmpdir);
+    int fd = mkostemp(path, O_APPEND);
+    if (fd < 0) {
+        fprintf(stderr, "a2l-analyze: can't create a file in %s: %s\n", a->tmpdir, strerror(errno));
+        return -1;
+    }
+    unlink(path);
+    return fd;
+}
+
+static inline int
+a2l_analyze_run_before(const a2l_run_t *runs, uint32_t x, uint32_t y) {
+    return a2l_analyze_spill_before(&runs[x].buf[runs[x].pos], &runs[y].buf[runs[y].pos]);
+}
+
+static void
+a2l_analyze_sift(const a2l_run_t *runs, uint32_t *heap, uint32_t n, uint32_t i) {
+    for (;;) {
+        uint32_t least = i, l = 2 * i + 1, r = l + 1;
+        if (l < n && a2l_analyze_run_before(runs, heap[l], heap[least]))
+            least = l;
+        if (r < n && a2l_analyze_run_before(runs, heap[r], heap[least]))
+            least = r;
+        if (least == i)
+            return;
+        uint32_t t = heap[i];
+        heap[i] = heap[least];
+        heap[least] = t;
+        i = least;
+    }
+}
+
+// a partition too big to sort at once: sorted runs into a scratch
+// file, then merged
+static int
+a2l_analyze_pair_runs(a2l_worker_t *w, int fd, uint64_t n, a2l_pairing_t *p, a2l_site_t **cached) {
+    const a2l_analyze_t *a = w->a;
+    uint64_t run = a->run_records;
+    uint32_t num_runs = (uint32_t)((n + run - 1) / run);
+    int scratch = a2l_analyze_tempfile(a), ret = -1;
+
+    if (scratch < 0)
+        return -1;
+    for (uint64_t first = 0; first < n; first += run) {
+        uint64_t count = n - first < run ? n - first : run;
+        size_t len = count * sizeof(a2l_spill_t);
+        if (a2l_analyze_read(fd, w->run, len, first * sizeof(a2l_spill_t)) < 0)
+            goto out;
+        qsort(w->run, count, sizeof(a2l_spill_t), a2l_analyze_cmp_spill);
+        if (write(scratch, w->run, len) != (ssize_t)len) {
+            fprintf(stderr, "a2l-analyze: can't write to %s: %s\n", a->tmpdir,
+                    errno ? strerror(errno) : "disk full");
+            goto out;
+        }
+    }
+
+    // the run buffer, shared out for reading
+    a2l_run_t *runs = calloc(num_runs, sizeof(a2l_run_t));
+    uint32_t *heap = malloc(num_runs * sizeof(uint32_t)), num_heap = 0;
+    uint64_t share = run / num_runs;
+    a2l_spill_t *bufs = w->run, *single = NULL;
+    if (!share) {
+        // more runs than records fit: a record each, over budget
+        share = 1;
+        bufs = single = malloc(num_runs * sizeof(a2l_spill_t));
+    }
+    if (!runs || !heap || !bufs) {
+        fprintf(stderr, "a2l-analyze: out of memory\n");
+        free(runs);
+        free(heap);
+        goto out;
+    }
+
+    int failed = 0;
+    for (uint32_t i = 0; i < num_runs && !failed; i++) {
+        a2l_run_t *r = &runs[i];
+        r->next = (uint64_t)i * run;
+        r->end = r->next + run < n ? r->next + run : n;
+        r->buf = bufs + i * share;
+        r->count = (uint32_t)(r->end - r->next < share ? r->end - r->next : share);
+        failed = a2l_analyze_read(scratch, r->buf, r->count * sizeof(a2l_spill_t),
+                                  r->next * sizeof(a2l_spill_t)) < 0;
+        r->next += r->count;
+        heap[num_heap++] = i;
+    }
+    for (uint32_t i = num_heap / 2; i-- > 0;)
+        a2l_analyze_sift(runs, heap, num_heap, i);
+
+    while (!failed && num_heap) {
+        a2l_run_t *r = &runs[heap[0]];
+
+        if (a2l_analyze_pair_next(w, p, cached, &r->buf[r->pos]) < 0) {
+            failed = 1;
+            break;
+        }
+        if (++r->pos == r->count) {
+            r->pos = 0;
+            r->count = (uint32_t)(r->end - r->next < share ? r->end - r->next : share);
+            if (!r->count) {
+                heap[0] = heap[--num_heap];
+            } else {
+                failed = a2l_analyze_read(scratch, r->buf, r->count * sizeof(a2l_spill_t),
+                                          r->next * sizeof(a2l_spill_t)) < 0;
+                r->next += r->count;
+            }
+        }
+        a2l_analyze_sift(runs, heap, num_heap, 0);
+    }
+
+    free(single);
+    free(runs);
+    free(heap);
+    ret = failed ? -1 : 0;
+out:
+    close(scratch);
+    return ret;
+}
+
+static int
+a2l_analyze_pair(a2l_worker_t *w, int fd) {
+    off_t size = lseek(fd, 0, SEEK_END);
+    uint64_t n = size > 0 ? (uint64_t)size / sizeof(a2l_spill_t) : 0;
+    a2l_pairing_t p = {0};
+    a2l_site_t *site = NULL;
+
+    if (n > w->a->run_records)
+        return a2l_analyze_pair_runs(w, fd, n, &p, &site);
+
+    if (a2l_analyze_read(fd, w->run, n * sizeof(a2l_spill_t), 0) < 0)
+        return -1;
+    qsort(w->run, n, sizeof(a2l_spill_t), a2l_analyze_cmp_spill);
+    for (uint64_t i = 0; i < n; i++)
+        if (a2l_analyze_pair_next(w, &p, &site, &w->run[i]) < 0)
+            return -1;
+    return 0;
+}
+
+static void *
+a2l_analyze_pairer(void *arg) {
+    a2l_worker_t *w = arg;
+    a2l_analyze_t *a = w->a;
+
+    for (;;) {
+        uint32_t part = __atomic_fetch_add(&a->next_partition, 1, __ATOMIC_RELAXED);
+        if (w->failed || part >= a->pass_end)
+            break;
+
+        int fd = a->files[part - a->pass_first];
+        if (a2l_analyze_pair(w, fd) < 0)
+            w->failed = 1;
+        // done with it: give the space back now
+        close(fd);
+        a->files[part - a->pass_first] = -1;
+    }
+    if (!w->failed && a2l_analyze_close_buckets(w) < 0)
+        w->failed = 1;
+    return NULL;
+}
+
+// every worker through fn, then back
+static int
+a2l_analyze_run(a2l_analyze_t *a, void *(*fn)(void *)) {
+    int failed = 0;
+
+    for (int i = 0; i < a->num_workers; i++) {
+        if (pthread_create(&a->workers[i].thread, NULL, fn, &a->workers[i]) != 0) {
+            fprintf(stderr, "a2l-analyze: can't start threads: %s\n", strerror(errno));
+            exit(1);
+        }
+    }
+    for (int i = 0; i < a->num_workers; i++) {
+        pthread_join(a->workers[i].thread, NULL);
+        failed |= a->workers[i].failed;
+    }
+    return failed ? -1 : 0;
+}
+
+// an even share of blocks each, to start
+static void
+a2l_analyze_share(a2l_analyze_t *a, uint64_t num_blocks) {
+    for (int i = 0; i < a->num_workers; i++) {
+        a2l_worker_t *w = &a->workers[i];
+        w->next = num_blocks * i / a->num_workers;
+        w->end = num_blocks * (i + 1) / a->num_workers;
+    }
+}
+
+// n workers for a, with tables to start from
+static int
+a2l_analyze_workers(a2l_analyze_t *a, int n, uint64_t num_deltas) {
+    if (!(a->workers = calloc(n, sizeof(a2l_worker_t))))
+        return -1;
+    a->num_workers = n;
+    for (int i = 0; i < n; i++) {
+        a2l_worker_t *w = &a->workers[i];
+        w->a = a;
+        w->index = i;
+        pthread_mutex_init(&w->lock, NULL);
+        if (a2l_sitemap_init(&w->sites, 1024) < 0 || a2l_deltamap_init(&w->deltas, num_deltas) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+// -m: partitions of about what a thread can sort at once, and as many
+// open at once as the fd limit and the spill buffers' budget allow
+static int
+a2l_analyze_plan(a2l_analyze_t *a, uint64_t num_events) {
+    uint64_t per_thread = a->mem_limit / 2 / a->num_workers;
+    struct rlimit rl;
+
+    a->run_records = per_thread / sizeof(a2l_spill_t);
+    if (per_thread < 16 * A2L_ANALYZE_SPILL_MIN) {
+        fprintf(stderr, "a2l-analyze: -m %" PRIu64 " is too little for %d threads\n",
+                a->mem_limit, a->num_workers);
+        return -1;
+    }
+    uint64_t parts = num_events / a->run_records + 1;
+    a->num_partitions = parts < UINT32_MAX ? (uint32_t)parts : UINT32_MAX;
+
+    // more files open, fewer passes over the trace
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        getrlimit(RLIMIT_NOFILE, &rl);
+    }
+    uint64_t files = rl.rlim_cur > 2 * A2L_ANALYZE_FILES_SPARE ? rl.rlim_cur - A2L_ANALYZE_FILES_SPARE :
+                                                                 A2L_ANALYZE_FILES_SPARE;
+    if (files > per_thread / A2L_ANALYZE_SPILL_MIN)
+        files = per_thread / A2L_ANALYZE_SPILL_MIN;
+    if (files > a->num_partitions)
+        files = a->num_partitions;
+    a->files_per_pass = (uint32_t)files;
+    a->spill_records = (uint32_t)(per_thread / files / sizeof(a2l_spill_t));
+    if (a->spill_records > 8192)
+        a->spill_records = 8192;
+
+    if (!(a->files = malloc(files * sizeof(int))))
+        return -1;
+    for (int i = 0; i < a->num_workers; i++) {
+        a2l_worker_t *w = &a->workers[i];
+        w->spill = malloc(files * a->spill_records * sizeof(a2l_spill_t));
+        w->spill_count = calloc(files, sizeof(uint32_t));
+        w->run = malloc(a->run_records * sizeof(a2l_spill_t));
+        if (!w->spill || !w->spill_count || !w->run) {
+            fprintf(stderr, "a2l-analyze: out of memory\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// -m: the trace, once per batch of partitions, then each partition paired
+static int
+a2l_analyze_spilled(a2l_analyze_t *a, uint64_t num_blocks) {
+    for (a->pass_first = 0; a->pass_first < a->num_partitions; a->pass_first = a->pass_end, a->pass++) {
+        a->pass_end = a->pass_first + a->files_per_pass < a->num_partitions ?
+                      a->pass_first + a->files_per_pass : a->num_partitions;
+        for (uint32_t i = 0; i < a->pass_end - a->pass_first; i++)
+            if ((a->files[i] = a2l_analyze_tempfile(a)) < 0)
+                return -1;
+
+        a2l_analyze_share(a, num_blocks);
+        if (a2l_analyze_run(a, a2l_analyze_worker) < 0)
+            return -1;
+        a->next_partition = a->pass_first;
+        if (a2l_analyze_run(a, a2l_analyze_pairer) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+//
+// reports
+//
+
+static int
+a2l_analyze_cmp_delta(const void *pa, const void *pb) {
+    const a2l_delta_t *a = pa, *b = pb;
+    if (a->stack_id != b->stack_id)
+        return a->stack_id < b->stack_id ? -1 : 1;
+    return a->bucket < b->bucket ? -1 : a->bucket > b->bucket;
+}
+
+static int
+a2l_analyze_cmp_site(const void *pa, const void *pb) {
+    const a2l_site_t *a = pa, *b = pb;
+    return a->stack_id < b->stack_id ? -1 : a->stack_id > b->stack_id;
+}
+
+static int
+a2l_analyze_cmp_sitelive(const void *pa, const void *pb) {
+    const a2l_sitelive_t *a = pa, *b = pb;
+    return a->stack_id < b->stack_id ? -1 : a->stack_id > b->stack_id;
+}
+
+// per-site peaks from every worker's buckets.  sites sorted by id.
+// the buckets, sorted, go to *kept if it isn't NULL.
+static int
+a2l_analyze_peaks(a2l_analyze_t *a, a2l_site_t *sites, uint32_t num_sites, a2l_delta_t **kept, uint64_t *num_kept) {
+    uint64_t num_deltas = 0, n = 0;
+
+    for (int i = 0; i < a->num_workers; i++)
+        num_deltas += a->workers[i].deltas.count;
+
+    a2l_delta_t *deltas = malloc((num_deltas ? num_deltas : 1) * sizeof(a2l_delta_t));
+    if (!deltas)
+        return -1;
+    for (int i = 0; i < a->num_workers; i++) {
+        a2l_deltamap_t *m = &a->workers[i].deltas;
+        for (uint64_t j = 0; j <= m->mask; j++)
+            if (m->slots[j].used)
+                deltas[n++] = m->slots[j];
+        free(m->slots);
+        m->slots = NULL;
+    }
+    qsort(deltas, n, sizeof(a2l_delta_t), a2l_analyze_cmp_delta);
+
+    // live bytes start from the heap the events left began with
+    for (uint32_t s = 0; s < num_sites; s++) {
+        sites[s].peak_live = sites[s].start_live > 0 ? sites[s].start_live : 0;
+        sites[s].peak_bucket = 0;
+    }
+
+    // both sorted by stack id: walk them together
+    uint32_t s = 0;
+    for (uint64_t i = 0; i < n;) {
+        uint32_t id = deltas[i].stack_id;
+
+        while (s < num_sites && sites[s].stack_id < id)
+            s++;
+        a2l_site_t *site = s < num_sites && sites[s].stack_id == id ? &sites[s] : NULL;
+        int64_t live = site ? site->start_live : 0, peak = site ? site->peak_live : 0;
+        uint32_t peak_bucket = 0;
+
+        while (i < n && deltas[i].stack_id == id) {
+            uint32_t bucket = deltas[i].bucket;
+            while (i < n && deltas[i].stack_id == id && deltas[i].bucket == bucket)
+                live += deltas[i++].delta;
+            if (live > peak) {
+                peak = live;
+                peak_bucket = bucket;
+            }
+        }
+        if (site) {
+            site->peak_live = peak;
+            site->peak_bucket = peak_bucket;
+        }
+    }
+
+    if (kept) {
+        *kept = deltas;
+        *num_kept = n;
+    } else
+        free(deltas);
+    return 0;
+}
+
+static int64_t
+a2l_analyze_live(const a2l_site_t *s) {
+    return (int64_t)(s->bytes_alloced - s->bytes_freed) + s->start_live;
+}
+
+// a compacted trace's heap as its events left begin, into the sites
+// (sorted by id, with room for h's more): their live bytes and blocks
+// count from it.  the number of sites now.
+static uint32_t
+a2l_analyze_seed(a2l_site_t *sites, uint32_t num_sites, const a2l_startheap_t *h) {
+    uint32_t n = num_sites;
+
+    for (uint32_t i = 0, s = 0; i < h->num_sites; i++) {
+        const a2l_sitelive_t *l = &h->sites[i];
+        a2l_site_t *site;
+
+        while (s < num_sites && sites[s].stack_id < l->stack_id)
+            s++;
+        if (s < num_sites && sites[s].stack_id == l->stack_id) {
+            site = &sites[s];
+        } else {
+            // none of its events are left
+            site = &sites[n++];
+            memset(site, 0, sizeof(*site));
+            site->stack_id = l->stack_id;
+            site->used = 1;
+        }
+        site->start_live = l->bytes;
+        site->start_blocks = l->blocks;
+    }
+    if (n > num_sites)
+        qsort(sites, n, sizeof(a2l_site_t), a2l_analyze_cmp_site);
+    return n;
+}
+
+static int
+a2l_analyze_cmp_bytes(const void *pa, const void *pb) {
+    const a2l_site_t *a = pa, *b = pb;
+    return a->bytes_alloced < b->bytes_alloced ? 1 : a->bytes_alloced > b->bytes_alloced ? -1 : 0;
+}
+
+static int
+a2l_analyze_cmp_count(const void *pa, const void *pb) {
+    const a2l_site_t *a = pa, *b = pb;
+    return a->allocs < b->allocs ? 1 : a->allocs > b->allocs ? -1 : 0;
+}
+
+static int
+a2l_analyze_cmp_peak(const void *pa, const void *pb) {
+    const a2l_site_t *a = pa, *b = pb;
+    return a->peak_live < b->peak_live ? 1 : a->peak_live > b->peak_live ? -1 : 0;
+}
+
+static int
+a2l_analyze_cmp_live(const void *pa, const void *pb) {
+    int64_t a = a2l_analyze_live(pa), b = a2l_analyze_live(pb);
+    return a < b ? 1 : a > b ? -1 : 0;
+}
+
+// the site's innermost frames, outward
+static void
+a2l_analyze_print_site(const a2l_reader_t *r, uint32_t stack_id, int depth) {
+    const a2l_stack_t *stack = a2l_read_stack(r, stack_id);
+    char frame[512];
+
+    if (!stack_id) {
+        printf("(unknown)\n");
+        return;
+    }
+    printf("%08x", stack_id);
+    for (uint32_t i = 0; stack && i < stack->num_frames && (int)i < depth; i++) {
+        a2l_read_frame_name(r, &stack->frames[i], frame, sizeof(frame));
+        printf(i ? " < %s" : "  %s", frame);
+    }
+    printf("\n");
+}
+
+static void
+a2l_analyze_report(const a2l_analyze_t *a, const char *title, a2l_site_t *sites, uint32_t num_sites,
+                   int (*cmp)(const void *, const void *), int leaks, int rows, int depth) {
+    char b0[32], b1[32], b2[32];
+    int shown = 0;
+
+    qsort(sites, num_sites, sizeof(a2l_site_t), cmp);
+
+    printf("\n%s\n", title);
+    printf("%12s %10s %12s %10s %12s  site\n", "bytes", "allocs", "live", "blocks", "peak live");
+    for (uint32_t i = 0; i < num_sites && shown < rows; i++) {
+        const a2l_site_t *s = &sites[i];
+        int64_t live = a2l_analyze_live(s);
+
+        if (leaks && live <= 0)
+            break;
+        // peaked in the last tenth of the trace
+        int growing = leaks && (uint64_t)s->peak_bucket * 10 >= (uint64_t)a->num_buckets * 9;
+
+        printf("%12s %10" PRIu64 " %12s %10" PRId64 " %12s %c",
+               a2l_analyze_bytes(b0, sizeof(b0), (double)s->bytes_alloced), s->allocs,
+               a2l_analyze_bytes(b1, sizeof(b1), (double)live), (int64_t)(s->allocs - s->frees) + s->start_blocks,
+               a2l_analyze_bytes(b2, sizeof(b2), (double)s->peak_live), growing ? '+' : ' ');
+        printf(" ");
+        a2l_analyze_print_site(a->reader, s->stack_id, depth);
+        shown++;
+    }
+    if (!shown)
+        printf("  none\n");
+}
+
+static int
+a2l_analyze_reports(const char *list) {
+    int reports = 0;
+    char *copy = strdup(list), *save = NULL;
+
+    for (char *name = strtok_r(copy, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+        if (!strcmp(name, "bytes"))      reports |= A2L_REPORT_BYTES;
+        else if (!strcmp(name, "count")) reports |= A2L_REPORT_COUNT;
+        else if (!strcmp(name, "peak"))  reports |= A2L_REPORT_PEAK;
+        else if (!strcmp(name, "leaks")) reports |= A2L_REPORT_LEAKS;
+        else {
+            fprintf(stderr, "a2l-analyze: unknown report %s\n", name);
+            reports = -1;
+            break;
+        }
+    }
+    free(copy);
+    return reports;
+}
+
+//
+// memory over time, -o
+//
+
+static void
+a2l_analyze_json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\')
+            fprintf(f, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(f, "\\u%04x", c);
+        else
+            fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+// a site's id and innermost frames, as one line of text
+static void
+a2l_analyze_site_name(const a2l_reader_t *r, uint32_t stack_id, int depth, char *buf, size_t len) {
+    const a2l_stack_t *stack = a2l_read_stack(r, stack_id);
+    char frame[512];
+    size_t n;
+
+    if (!stack_id) {
+        snprintf(buf, len, "(unknown)");
+        return;
+    }
+    n = (size_t)snprintf(buf, len, "%08x", stack_id);
+    for (uint32_t i = 0; stack && i < stack->num_frames && (int)i < depth && n < len; i++) {
+        a2l_read_frame_name(r, &stack->frames[i], frame, sizeof(frame));
+        n += (size_t)snprintf(buf + n, len - n, i ? " < %s" : " %s", frame);
+    }
+}
+
+// bucket b's end, in ns into the trace; the last is cut short at its end
+static uint64_t
+a2l_analyze_bucket_end(const a2l_analyze_t *a, uint32_t b) {
+    uint64_t last_ts = a2l_read_info(a->reader)->last_ts, end = a->first_bucket + b + 1;
+    return end > last_ts >> a->bucket_shift ? last_ts : end << a->bucket_shift;
+}
+
+// live bytes at the end of every bucket, in all and for the rows
+// sites with the highest peaks, as csv or json.  deltas are sorted by
+// site, then bucket.
+static int
+a2l_analyze_series(const a2l_analyze_t *a, const a2l_site_t *sites, uint32_t num_sites,
+                   const a2l_delta_t *deltas, uint64_t num_deltas, int rows, int depth, FILE *f, int json) {
+    const a2l_readinfo_t *info = a2l_read_info(a->reader);
+    a2l_site_t *top = malloc((num_sites ? num_sites : 1) * sizeof(a2l_site_t));
+    uint32_t num_top = 0;
+    char name[2048];
+
+    if (!top)
+        return -1;
+    memcpy(top, sites, num_sites * sizeof(a2l_site_t));
+    qsort(top, num_sites, sizeof(a2l_site_t), a2l_analyze_cmp_peak);
+    while (num_top < num_sites && (int)num_top < rows && top[num_top].peak_live > 0)
+        num_top++;
+    // by id, to walk with the deltas
+    qsort(top, num_top, sizeof(a2l_site_t), a2l_analyze_cmp_site);
+
+    // a column each, after the total's
+    uint32_t cols = num_top + 1;
+    int64_t *live = calloc((uint64_t)a->num_buckets * cols, sizeof(int64_t));
+    if (!live) {
+        free(top);
+        return -1;
+    }
+    // running totals start from the heap the events left began with
+    for (uint32_t i = 0; i < num_sites; i++)
+        live[0] += sites[i].start_live;
+    for (uint32_t t = 0; t < num_top; t++)
+        live[1 + t] += top[t].start_live;
+    for (uint64_t i = 0, t = 0; i < num_deltas; i++) {
+        while (t < num_top && top[t].stack_id < deltas[i].stack_id)
+            t++;
+        live[(uint64_t)deltas[i].bucket * cols] += deltas[i].delta;
+        if (t < num_top && top[t].stack_id == deltas[i].stack_id)
+            live[(uint64_t)deltas[i].bucket * cols + 1 + t] += deltas[i].delta;
+    }
+    for (uint32_t b = 1; b < a->num_buckets; b++)
+        for (uint32_t c = 0; c < cols; c++)
+            live[(uint64_t)b * cols + c] += live[(uint64_t)(b - 1) * cols + c];
+
+    if (!json) {
+        fprintf(f, "time_s,total");
+        for (uint32_t t = 0; t < num_top; t++) {
+            a2l_analyze_site_name(a->reader, top[t].stack_id, depth, name, sizeof(name));
+            fputs(",\"", f);
+            for (const char *p = name; *p; p++) {
+                if (*p == '"')
+                    fputc('"', f);
+                fputc(*p, f);
+            }
+            fputc('"', f);
+        }
+        fprintf(f, ",other\n");
+        for (uint32_t b = 0; b < a->num_buckets; b++) {
+            const int64_t *row = &live[(uint64_t)b * cols];
+            int64_t other = row[0];
+
+            fprintf(f, "%.6f,%" PRId64, a2l_analyze_bucket_end(a, b) / 1e9, row[0]);
+            for (uint32_t c = 1; c < cols; c++) {
+                fprintf(f, ",%" PRId64, row[c]);
+                other -= row[c];
+            }
+            fprintf(f, ",%" PRId64 "\n", other);
+        }
+    } else {
+        fprintf(f, "{\"pid\": %u, \"bucket_s\": %.9f,\n \"time_s\": [", info->pid,
+                (double)(1ULL << a->bucket_shift) / 1e9);
+        for (uint32_t b = 0; b < a->num_buckets; b++)
+            fprintf(f, b ? ", %.6f" : "%.6f", a2l_analyze_bucket_end(a, b) / 1e9);
+        fprintf(f, "],\n \"total\": [");
+        for (uint32_t b = 0; b < a->num_buckets; b++)
+            fprintf(f, b ? ", %" PRId64 : "%" PRId64, live[(uint64_t)b * cols]);
+        fprintf(f, "],\n \"other\": [");
+        for (uint32_t b = 0; b < a->num_buckets; b++) {
+            int64_t other = live[(uint64_t)b * cols];
+            for (uint32_t c = 1; c < cols; c++)
+                other -= live[(uint64_t)b * cols + c];
+            fprintf(f, b ? ", %" PRId64 : "%" PRId64, other);
+        }
+        fprintf(f, "],\n \"sites\": [");
+        for (uint32_t t = 0; t < num_top; t++) {
+            a2l_analyze_site_name(a->reader, top[t].stack_id, depth, name, sizeof(name));
+            fprintf(f, "%s\n  {\"site\": \"%08x\", \"name\": ", t ? "," : "", top[t].stack_id);
+            a2l_analyze_json_string(f, name);
+            fprintf(f, ", \"peak\": %" PRId64 ", \"live\": [", top[t].peak_live);
+            for (uint32_t b = 0; b < a->num_buckets; b++)
+                fprintf(f, b ? ", %" PRId64 : "%" PRId64, live[(uint64_t)b * cols + 1 + t]);
+            fprintf(f, "]}");
+        }
+        fprintf(f, "]}\n");
+    }
+    free(live);
+    free(top);
+    return ferror(f) ? -1 : 0;
+}
+
+//
+// folded stacks, -F folded
+//
+
+// a folded stack's weight, in the trace and (-D) in the base
+typedef struct {
+    char *stack;
+    int64_t value, base;
+}a2l_folded_t;
+
+typedef struct {
+    a2l_folded_t *stacks;
+    uint64_t count, max;
+}a2l_foldedlist_t;
+
+static int64_t
+a2l_analyze_weight(const a2l_site_t *s, int weight) {
+    switch (weight) {
+    case A2L_WEIGHT_ALLOCS: return (int64_t)s->allocs;
+    case A2L_WEIGHT_LIVE:   return a2l_analyze_live(s);
+    }
+    return (int64_t)s->bytes_alloced;
+}
+
+// a frame as a flame graph wants it: module!function, without the
+// offset that would split a function by call site.  unsymbolized
+// frames keep theirs, it's all they have.
+static void
+a2l_analyze_function(const a2l_reader_t *r, const a2l_frame_t *frame, char *buf, size_t len) {
+    char *plus;
+
+    a2l_read_frame_name(r, frame, buf, len);
+    if (a2l_read_symbol(r, frame->symbol_id) && (plus = strrchr(buf, '+')))
+        *plus = 0;
+}
+
+// sites as folded stacks, outermost frame first, into l
+static int
+a2l_analyze_fold_sites(const a2l_reader_t *r, const a2l_site_t *sites, uint32_t num_sites, int weight,
+                       int base, a2l_foldedlist_t *l) {
+    char frame[512];
+
+    for (uint32_t i = 0; i < num_sites; i++) {
+        const a2l_stack_t *stack = a2l_read_stack(r, sites[i].stack_id);
+        int64_t v = a2l_analyze_weight(&sites[i], weight);
+        size_t len = 0, max = 256;
+        char *text = malloc(max);
+
+        if (v <= 0) {
+            free(text);
+            continue;
+        }
+        if (!text)
+            return -1;
+        text[0] = 0;
+        for (uint32_t j = stack && sites[i].stack_id ? stack->num_frames : 0; j > 0; j--) {
+            a2l_analyze_function(r, &stack->frames[j - 1], frame, sizeof(frame));
+            size_t n = strlen(frame);
+            if (len + n + 2 > max) {
+                char *grown = realloc(text, max = (len + n + 2) * 2);
+                if (!grown) {
+                    free(text);
+                    return -1;
+                }
+                text = grown;
+            }
+            if (len)
+                text[len++] = ';';
+            // ; splits frames, and a newline would split the line
+            for (size_t k = 0; k < n; k++)
+                text[len++] = frame[k] == ';' ? ':' : frame[k] == '\n' ? ' ' : frame[k];
+            text[len] = 0;
+        }
+        if (!len) {
+            free(text);
+            if (!(text = strdup("(unknown)")))
+                return -1;
+        }
+
+        if (l->count == l->max) {
+            uint64_t grown_max = l->max ? l->max * 2 : 1024;
+            a2l_folded_t *grown = realloc(l->stacks, grown_max * sizeof(a2l_folded_t));
+            if (!grown) {
+                free(text);
+                return -1;
+            }
+            l->stacks = grown;
+            l->max = grown_max;
+        }
+        l->stacks[l->count].stack = text;
+        l->stacks[l->count].value = base ? 0 : v;
+        l->stacks[l->count].base = base ? v : 0;
+        l->count++;
+    }
+    return 0;
+}
+
+static int
+a2l_analyze_cmp_folded(const void *pa, const void *pb) {
+    return strcmp(((const a2l_folded_t *)pa)->stack, ((const a2l_folded_t *)pb)->stack);
+}
+
+// "stack value" lines, or with a base "stack base value" as
+// difffolded.pl writes them; stacks that fold alike are summed
+static int
+a2l_analyze_write_folded(FILE *f, a2l_foldedlist_t *l, int diff) {
+    qsort(l->stacks, l->count, sizeof(a2l_folded_t), a2l_analyze_cmp_folded);
+    for (uint64_t i = 0, j; i < l->count; i = j) {
+        int64_t value = 0, base = 0;
+
+        for (j = i; j < l->count && !strcmp(l->stacks[j].stack, l->stacks[i].stack); j++) {
+            value += l->stacks[j].value;
+            base += l->stacks[j].base;
+        }
+        if (diff)
+            fprintf(f, "%s %" PRId64 " %" PRId64 "\n", l->stacks[i].stack, base, value);
+        else
+            fprintf(f, "%s %" PRId64 "\n", l->stacks[i].stack, value);
+    }
+    for (uint64_t i = 0; i < l->count; i++)
+        free(l->stacks[i].stack);
+    free(l->stacks);
+    return ferror(f) ? -1 : 0;
+}
+
+// every worker's site sums into m
+static int
+a2l_analyze_gather(const a2l_analyze_t *a, a2l_sitemap_t *m) {
+    for (int i = 0; i < a->num_workers; i++) {
+        const a2l_sitemap_t *sites = &a->workers[i].sites;
+
+        for (uint32_t j = 0; j <= sites->mask; j++) {
+            const a2l_site_t *s = &sites->slots[j];
+            a2l_site_t *g;
+            if (!s->used)
+                continue;
+            if (!(g = a2l_sitemap_get(m, s->stack_id)))
+                return -1;
+            g->allocs += s->allocs;
+            g->frees += s->frees;
+            g->bytes_alloced += s->bytes_alloced;
+            g->bytes_freed += s->bytes_freed;
+        }
+    }
+    return 0;
+}
+
+// sites as folded stacks, against the base trace's if there is one.
+// the base is summed plainly on as many threads; its stack ids are its
+// own, so the two meet by their folded text.
+static int
+a2l_analyze_stacks(const a2l_analyze_t *a, const a2l_site_t *sites, uint32_t num_sites, int weight,
+                   const char *base_path, FILE *f) {
+    a2l_foldedlist_t l = {0};
+    char error[256];
+
+    if (a2l_analyze_fold_sites(a->reader, sites, num_sites, weight, 0, &l) < 0)
+        return -1;
+    if (base_path) {
+        a2l_analyze_t base;
+        a2l_sitemap_t merged = {0};
+        int failed;
+
+        memset(&base, 0, sizeof(base));
+        if (!(base.reader = a2l_read_open(base_path, error, sizeof(error)))) {
+            fprintf(stderr, "a2l-analyze: %s\n", error);
+            exit(1);
+        }
+        base.bucket_shift = 63;
+        base.num_buckets = 1;
+        failed = a2l_analyze_workers(&base, a->num_workers, 1024) < 0 ||
+                 a2l_sitemap_init(&merged, 1024) < 0;
+        if (!failed) {
+            a2l_analyze_share(&base, a2l_read_info(base.reader)->num_blocks);
+            failed = a2l_analyze_run(&base, a2l_analyze_worker) < 0 || a2l_analyze_gather(&base, &merged) < 0;
+        }
+        for (int i = 0; base.workers && i < base.num_workers; i++) {
+            free(base.workers[i].sites.slots);
+            free(base.workers[i].deltas.slots);
+        }
+        free(base.workers);
+
+        for (uint32_t i = 0; !failed && i <= merged.mask; i++)
+            if (merged.slots[i].used)
+                failed = a2l_analyze_fold_sites(base.reader, &merged.slots[i], 1, weight, 1, &l) < 0;
+        free(merged.slots);
+        a2l_read_close(base.reader);
+        if (failed)
+            return -1;
+    }
+    return a2l_analyze_write_folded(f, &l, base_path != NULL);
+}
+
+//
+// pprof, -F pprof
+//
+
+static int
+a2l_analyze_pprof(const a2l_analyze_t *a, const a2l_site_t *sites, uint32_t num_sites, FILE *f) {
+    a2l_pprofsite_t *ps = malloc((num_sites ? num_sites : 1) * sizeof(a2l_pprofsite_t));
+
+    if (!ps)
+        return -1;
+    for (uint32_t i = 0; i < num_sites; i++) {
+        const a2l_site_t *s = &sites[i];
+        int64_t live = a2l_analyze_live(s), blocks = (int64_t)(s->allocs - s->frees) + s->start_blocks;
+
+        memset(&ps[i], 0, sizeof(ps[i]));
+        ps[i].stack_id = s->stack_id;
+        ps[i].alloc_objects = (int64_t)s->allocs;
+        ps[i].alloc_space = (int64_t)s->bytes_alloced;
+        // in use counts from the keyframe heap on a compacted trace;
+        // frees still outnumber allocs if there was none to rebuild it
+        ps[i].inuse_objects = blocks > 0 ? blocks : 0;
+        ps[i].inuse_space = live > 0 ? live : 0;
+    }
+    int ret = a2l_pprof_write(a->reader, ps, num_sites, f);
+    free(ps);
+    return ret;
+}
+
+//
+// callgrind, -F callgrind
+//
+
+// deltas are sorted by site, then bucket
+static int
+a2l_analyze_callgrind(const a2l_analyze_t *a, const char *trace, const a2l_site_t *sites, uint32_t num_sites,
+                      const a2l_delta_t *deltas, uint64_t num_deltas, FILE *f) {
+    a2l_callgrindsite_t *cs = malloc((num_sites ? num_sites : 1) * sizeof(a2l_callgrindsite_t));
+    int64_t *live = calloc(a->num_buckets, sizeof(int64_t));
+
+    if (!cs || !live) {
+        free(cs);
+        free(live);
+        return -1;
+    }
+
+    // the peak: the bucket with the most live at its end, counting
+    // from the heap the events left began with
+    for (uint32_t i = 0; i < num_sites; i++)
+        live[0] += sites[i].start_live;
+    for (uint64_t i = 0; i < num_deltas; i++)
+        live[deltas[i].bucket] += deltas[i].delta;
+    uint32_t peak_bucket = 0;
+    for (uint32_t b = 1; b < a->num_buckets; b++) {
+        live[b] += live[b - 1];
+        if (live[b] > live[peak_bucket])
+            peak_bucket = b;
+    }
+
+    // each site's live bytes then, walking both by id
+    uint64_t d = 0;
+    for (uint32_t i = 0; i < num_sites; i++) {
+        const a2l_site_t *s = &sites[i];
+        int64_t peak = s->start_live;
+
+        while (d < num_deltas && deltas[d].stack_id < s->stack_id)
+            d++;
+        for (; d < num_deltas && deltas[d].stack_id == s->stack_id; d++)
+            if (deltas[d].bucket <= peak_bucket)
+                peak += deltas[d].delta;
+        memset(&cs[i], 0, sizeof(cs[i]));
+        cs[i].stack_id = s->stack_id;
+        cs[i].allocs = (int64_t)s->allocs;
+        cs[i].bytes = (int64_t)s->bytes_alloced;
+        cs[i].peak = peak > 0 ? peak : 0;
+    }
+    int ret = a2l_callgrind_write(a->reader, trace, cs, num_sites, f);
+    free(cs);
+    free(live);
+    return ret;
+}
+
+//
+// queries, -q
+//
+
+// the module of a site's innermost frame
+static uint32_t
+a2l_analyze_module(const a2l_reader_t *r, uint32_t stack_id) {
+    const a2l_stack_t *stack = a2l_read_stack(r, stack_id);
+    return stack && stack->num_frames ? stack->frames[0].module_id : 0;
+}
+
+static int
+a2l_analyze_query_batch(a2l_worker_t *w, a2l_qeval_t *ev, const a2l_batch_t *b, uint32_t *sel) {
+    const a2l_analyze_t *a = w->a;
+    const a2l_query_t *q = a->query;
+    uint32_t n = a2l_query_filter(q, ev, b, sel);
+    uint32_t module_site = 0, module = 0;
+    a2l_site_t *group = NULL;
+
+    w->events += b->count;
+    w->matched += n;
+    for (uint32_t k = 0; k < n; k++) {
+        uint32_t i = sel[k], key = 0;
+
+        switch (q->group) {
+        case A2L_QG_SITE:   key = ev->site[i]; break;
+        case A2L_QG_THREAD: key = b->tid[i]; break;
+        case A2L_QG_TYPE:   key = b->type[i]; break;
+        case A2L_QG_SIZE:   key = b->bytes[i] ? 64 - (uint32_t)__builtin_clzll(b->bytes[i]) : 0; break;
+        case A2L_QG_TIME:   key = (uint32_t)(b->ts[i] / q->bucket_ns); break;
+        case A2L_QG_MODULE:
+            if (!k || ev->site[i] != module_site) {
+                module_site = ev->site[i];
+                module = a2l_analyze_module(a->reader, module_site);
+            }
+            key = module;
+            break;
+        }
+
+        if (!group || group->stack_id != key) {
+            if (!(group = a2l_sitemap_get(&w->sites, key)))
+                return -1;
+        }
+        if (b->type[i] == A2L_REC_ALLOC) {
+            group->allocs++;
+            group->bytes_alloced += b->bytes[i];
+        } else {
+            group->frees++;
+            group->bytes_freed += b->bytes[i];
+        }
+    }
+    return 0;
+}
+
+// the heap's sites that pass the where clause, as the query's rows
+// (sites, or their modules), in place.  for a2l_query_by_site queries.
+static int
+a2l_analyze_seed_query(const a2l_analyze_t *a, a2l_startheap_t *h) {
+    const a2l_query_t *q = a->query;
+    a2l_batch_t *b = a2l_batch_alloc(A2L_ANALYZE_BATCH);
+    uint32_t *sel = malloc(A2L_ANALYZE_BATCH * sizeof(uint32_t));
+    uint32_t kept = 0;
+    a2l_qeval_t ev;
+
+    memset(&ev, 0, sizeof(ev));
+    if (!b || !sel || a2l_qeval_init(&ev, q, A2L_ANALYZE_BATCH) < 0) {
+        a2l_batch_free(b);
+        free(sel);
+        return -1;
+    }
+
+    // each site as an alloc of its own; the rest doesn't matter here
+    for (uint32_t i = 0; i < h->num_sites; i += b->count) {
+        b->count = h->num_sites - i < b->capacity ? h->num_sites - i : b->capacity;
+        memset(b->ts, 0, b->count * sizeof(uint64_t));
+        memset(b->ptr, 0, b->count * sizeof(uint64_t));
+        memset(b->bytes, 0, b->count * sizeof(uint64_t));
+        memset(b->tid, 0, b->count * sizeof(uint32_t));
+        memset(b->type, A2L_REC_ALLOC, b->count);
+        for (uint32_t j = 0; j < b->count; j++)
+            b->stack_id[j] = b->alloc_stack_id[j] = h->sites[i + j].stack_id;
+
+        uint32_t n = a2l_query_filter(q, &ev, b, sel);
+        for (uint32_t k = 0; k < n; k++) {
+            a2l_sitelive_t l = h->sites[i + sel[k]];
+            if (q->group == A2L_QG_MODULE)
+                l.stack_id = a2l_analyze_module(a->reader, l.stack_id);
+            h->sites[kept++] = l;
+        }
+    }
+    h->num_sites = kept;
+
+    // a module's sites into one row
+    if (q->group == A2L_QG_MODULE) {
+        qsort(h->sites, kept, sizeof(a2l_sitelive_t), a2l_analyze_cmp_sitelive);
+        h->num_sites = 0;
+        for (uint32_t i = 0; i < kept; i++) {
+            a2l_sitelive_t *last = h->num_sites ? &h->sites[h->num_sites - 1] : NULL;
+            if (last && last->stack_id == h->sites[i].stack_id) {
+                last->bytes += h->sites[i].bytes;
+                last->blocks += h->sites[i].blocks;
+            } else
+                h->sites[h->num_sites++] = h->sites[i];
+        }
+    }
+
+    a2l_qeval_free(&ev);
+    a2l_batch_free(b);
+    free(sel);
+    return 0;
+}
+
+// blocks [first, end), or with -q positions in blocks, through it
+static int
+a2l_analyze_scan(a2l_worker_t *w, a2l_iter_t *it, uint64_t first, uint64_t end,
+                 a2l_batch_t *b, a2l_qeval_t *ev, uint32_t *sel) {
+    const a2l_analyze_t *a = w->a;
+
+    for (uint64_t i = first, j; i < end; i = j) {
+        // consecutive blocks in one go
+        if (a->blocks) {
+            for (j = i + 1; j < end && a->blocks[j] == a->blocks[j - 1] + 1; j++)
+                ;
+            it->block = a->blocks[i];
+            it->end_block = a->blocks[j - 1] + 1;
+        } else {
+            j = end;
+            it->block = first;
+            it->end_block = end;
+        }
+        while (a2l_iter_batch(it, b)) {
+            if ((a->query ? a2l_analyze_query_batch(w, ev, b, sel) : a2l_analyze_batch(w, b)) < 0)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+// blocks from a list: -q's picks, or --follow's new ones
+static void *
+a2l_analyze_list_worker(void *arg) {
+    a2l_worker_t *w = arg;
+    const a2l_analyze_t *a = w->a;
+    a2l_batch_t *b = a2l_batch_alloc(A2L_ANALYZE_BATCH);
+    uint32_t *sel = malloc(A2L_ANALYZE_BATCH * sizeof(uint32_t));
+    uint64_t first, end;
+    a2l_qeval_t ev;
+    a2l_iter_t it;
+
+    memset(&ev, 0, sizeof(ev));
+    if (!b || !sel || (a->query && a2l_qeval_init(&ev, a->query, A2L_ANALYZE_BATCH) < 0)) {
+        a2l_batch_free(b);
+        free(sel);
+        w->failed = 1;
+        return NULL;
+    }
+
+    // the iterator keeps its buffer from block to block
+    a2l_iter_init(&it, a->reader, 0, 0);
+    while (!w->failed && a2l_analyze_take(w, &first, &end))
+        if (a2l_analyze_scan(w, &it, first, end, b, &ev, sel) < 0)
+            w->failed = 1;
+    w->bad_blocks += it.bad_blocks;
+    a2l_iter_free(&it);
+
+    a2l_qeval_free(&ev);
+    a2l_batch_free(b);
+    free(sel);
+    return NULL;
+}
+
+// the blocks that can hold matches into *blocks, ascending: from the
+// index if there's one, else the block headers.  the count, or -1.
+static int64_t
+a2l_analyze_select(const a2l_analyze_t *a, const char *trace, const a2l_qbounds_t *qb,
+                   uint64_t **blocks, int *indexed) {
+    const a2l_readinfo_t *info = a2l_read_info(a->reader);
+    char path[4096], error[256];
+    a2l_index_t *ix = NULL;
+    int64_t n = 0;
+
+    *blocks = NULL;
+    *indexed = 0;
+    snprintf(path, sizeof(path), A2L_INDEX_PATH_FMT, trace);
+    if (access(path, R_OK) == 0 && !(ix = a2l_index_open(a->reader, path, error, sizeof(error))))
+        fprintf(stderr, "a2l-analyze: %s; reading block headers instead\n", error);
+
+    if (ix) {
+        a2l_idxquery_t iq = {qb->from, qb->to, qb->by_tid, qb->by_site, qb->tid, qb->site};
+        n = a2l_index_select(ix, &iq, blocks);
+        *indexed = 1;
+    } else if ((*blocks = malloc((info->num_blocks ? info->num_blocks : 1) * sizeof(uint64_t)))) {
+        for (uint64_t i = 0; i < info->num_blocks; i++) {
+            const a2l_blockheader_t *bh = a2l_read_block(a->reader, i);
+            if (bh->first_ts < qb->to && bh->last_ts >= qb->from && (!qb->by_tid || bh->tid == qb->tid))
+                (*blocks)[n++] = i;
+        }
+    } else
+        n = -1;
+
+    // the sites every match is among: none, or a block's bloom filter
+    // has none of them.  past a few, testing costs more than it saves.
+    if (n > 0 && qb->sites && qb->sites->num_matches <= 64) {
+        int64_t kept = 0;
+        for (int64_t i = 0; i < n; i++) {
+            const a2l_idxblock_t *ib = ix ? a2l_index_block(ix, (*blocks)[i]) : NULL;
+            int any = ib == NULL && qb->sites->num_matches;
+            for (uint32_t s = 0; ib && !any && s <= qb->sites->match_mask; s++)
+                any = qb->sites->matches[s] && a2l_index_bloom_test(ib->bloom, qb->sites->matches[s] - 1);
+            if (any)
+                (*blocks)[kept++] = (*blocks)[i];
+        }
+        n = kept;
+    }
+
+    a2l_index_close(ix);
+    return n;
+}
+
+static int64_t
+a2l_analyze_column(const a2l_site_t *g, int column) {
+    switch (column) {
+    case A2L_QC_BYTES:  return (int64_t)g->bytes_alloced;
+    case A2L_QC_ALLOCS: return (int64_t)g->allocs;
+    case A2L_QC_FREES:  return (int64_t)g->frees;
+    case A2L_QC_FREED:  return (int64_t)g->bytes_freed;
+    case A2L_QC_LIVE:   return a2l_analyze_live(g);
+    case A2L_QC_EVENTS: return (int64_t)(g->allocs + g->frees);
+    }
+    return g->stack_id;
+}
+
+static int
+a2l_analyze_cmp_group(const void *pa, const void *pb, void *arg) {
+    const a2l_query_t *q = arg;
+    const a2l_site_t *a = pa, *b = pb;
+    int64_t x = a2l_analyze_column(a, q->order), y = a2l_analyze_column(b, q->order);
+
+    if (x != y)
+        return (x < y) == !q->descending ? -1 : 1;
+    // ties by key
+    return a->stack_id < b->stack_id ? -1 : a->stack_id > b->stack_id;
+}
+
+static void
+a2l_analyze_print_key(const a2l_analyze_t *a, uint32_t key, int depth) {
+    const a2l_query_t *q = a->query;
+    char b0[32], b1[32];
+
+    switch (q->group) {
+    case A2L_QG_SITE:
+        a2l_analyze_print_site(a->reader, key, depth);
+        break;
+    case A2L_QG_THREAD:
+        printf("thread %u\n", key);
+        break;
+    case A2L_QG_TYPE:
+        printf("%s\n", key == A2L_REC_ALLOC ? "alloc" : "free");
+        break;
+    case A2L_QG_SIZE:
+        if (!key)
+            printf("0 B\n");
+        else
+            printf("%s - %s\n", a2l_analyze_bytes(b0, sizeof(b0), (double)(1ULL << (key - 1))),
+                   a2l_analyze_bytes(b1, sizeof(b1), (double)((1ULL << (key - 1)) * 2 - 1)));
+        break;
+    case A2L_QG_TIME:
+        printf("%.3f s\n", (double)key * q->bucket_ns / 1e9);
+        break;
+    case A2L_QG_MODULE: {
+        const a2l_module_t *module = a2l_read_module(a->reader, key);
+        printf("%s\n", module && module->path ? module->path : "(unknown)");
+        break;
+    }
+    }
+}
+
+static void
+a2l_analyze_answer(const a2l_analyze_t *a, a2l_site_t *groups, uint32_t num_groups, int rows, int depth) {
+    static const char *keys[] = {"site", "thread", "module", "type", "size", "time"};
+    const a2l_query_t *q = a->query;
+    char b0[32], b1[32], b2[32];
+    uint32_t limit = q->limit ? q->limit : (uint32_t)rows;
+
+    qsort_r(groups, num_groups, sizeof(a2l_site_t), a2l_analyze_cmp_group, (void *)q);
+
+    printf("\n%12s %10s %10s %12s %12s  %s\n", "bytes", "allocs", "frees", "freed", "live", keys[q->group]);
+    for (uint32_t i = 0; i < num_groups && i < limit; i++) {
+        const a2l_site_t *g = &groups[i];
+
+        printf("%12s %10" PRIu64 " %10" PRIu64 " %12s %12s  ",
+               a2l_analyze_bytes(b0, sizeof(b0), (double)g->bytes_alloced), g->allocs, g->frees,
+               a2l_analyze_bytes(b1, sizeof(b1), (double)g->bytes_freed),
+               a2l_analyze_bytes(b2, sizeof(b2), (double)a2l_analyze_live(g)));
+        a2l_analyze_print_key(a, g->stack_id, depth);
+    }
+    if (!num_groups)
+        printf("  none\n");
+    else if (num_groups > limit)
+        printf("  (%u more)\n", num_groups - limit);
+}
+
+//
+// cache, -c
+//
+
+static void
+a2l_analyze_clear(a2l_sitemap_t *sites, a2l_deltamap_t *deltas) {
+    memset(sites->slots, 0, (sites->mask + 1) * sizeof(a2l_site_t));
+    sites->count = 0;
+    memset(deltas->slots, 0, (deltas->mask + 1) * sizeof(a2l_delta_t));
+    deltas->count = 0;
+}
+
+// a cached group's sums into w's tables; its buckets were 2^shift ns
+static int
+a2l_analyze_fold(a2l_worker_t *w, const a2l_cacheentry_t *e, uint32_t shift) {
+    const a2l_analyze_t *a = w->a;
+    const a2l_cachesum_t *sums = a2l_cache_sums(e);
+    const a2l_cachedelta_t *deltas = a2l_cache_deltas(e);
+
+    for (uint32_t i = 0; i < e->num_sums; i++) {
+        a2l_site_t *site = a2l_sitemap_get(&w->sites, sums[i].key);
+        if (!site)
+            return -1;
+        site->allocs += sums[i].allocs;
+        site->frees += sums[i].frees;
+        site->bytes_alloced += sums[i].bytes_alloced;
+        site->bytes_freed += sums[i].bytes_freed;
+    }
+    for (uint64_t i = 0; i < e->num_deltas; i++) {
+        uint64_t bucket = deltas[i].bucket >> (a->bucket_shift - shift);
+        bucket = bucket > a->first_bucket ? bucket - a->first_bucket : 0;
+        if (bucket >= a->num_buckets)
+            bucket = a->num_buckets - 1;
+        if (a2l_deltamap_add(&w->deltas, deltas[i].stack_id, (uint32_t)bucket, deltas[i].delta) < 0)
+            return -1;
+    }
+    w->events += e->events;
+    w->matched += e->matched;
+    w->untracked_frees += e->untracked_frees;
+    w->unknown_frees += e->unknown_frees;
+    w->bad_blocks += e->bad_blocks;
+    return 0;
+}
+
+// w's tables and counters as a cache entry
+static a2l_cacheentry_t *
+a2l_analyze_entry(const a2l_worker_t *w, uint64_t hash) {
+    const a2l_analyze_t *a = w->a;
+    uint64_t num_deltas = 0;
+
+    for (uint64_t i = 0; i <= w->deltas.mask; i++)
+        num_deltas += w->deltas.slots[i].used && w->deltas.slots[i].delta;
+
+    a2l_cacheentry_t *e = malloc(sizeof(a2l_cacheentry_t) + w->sites.count * sizeof(a2l_cachesum_t) +
+                                 num_deltas * sizeof(a2l_cachedelta_t));
+    if (!e)
+        return NULL;
+    memset(e, 0, sizeof(*e));
+    e->hash = hash;
+    e->events = w->events;
+    e->matched = w->matched;
+    e->untracked_frees = w->untracked_frees;
+    e->unknown_frees = w->unknown_frees;
+    e->bad_blocks = w->bad_blocks;
+    e->num_sums = w->sites.count;
+    e->num_deltas = num_deltas;
+
+    a2l_cachesum_t *sums = (a2l_cachesum_t *)a2l_cache_sums(e);
+    uint32_t n = 0;
+    for (uint32_t i = 0; i <= w->sites.mask; i++) {
+        const a2l_site_t *s = &w->sites.slots[i];
+        if (s->used) {
+            memset(&sums[n], 0, sizeof(sums[n]));
+            sums[n].key = s->stack_id;
+            sums[n].allocs = s->allocs;
+            sums[n].frees = s->frees;
+            sums[n].bytes_alloced = s->bytes_alloced;
+            sums[n].bytes_freed = s->bytes_freed;
+            n++;
+        }
+    }
+    a2l_cachedelta_t *deltas = (a2l_cachedelta_t *)a2l_cache_deltas(e);
+    n = 0;
+    for (uint64_t i = 0; i <= w->deltas.mask; i++) {
+        const a2l_delta_t *d = &w->deltas.slots[i];
+        if (d->used && d->delta) {
+            memset(&deltas[n], 0, sizeof(deltas[n]));
+            deltas[n].stack_id = d->stack_id;
+            deltas[n].bucket = a->first_bucket + d->bucket;
+            deltas[n].delta = d->delta;
+            n++;
+        }
+    }
+    return e;
+}
+
+// group g on tables and counters of its own, from the cache or the
+// trace; then its entry for the next cache, and its sums into w's
+static int
+a2l_analyze_group(a2l_worker_t *w, uint64_t g, a2l_iter_t *it, a2l_batch_t *b, a2l_qeval_t *ev, uint32_t *sel) {
+    a2l_analyze_t *a = w->a;
+    const a2l_cachegroup_t *group = &a->groups[g];
+    uint64_t first = a->blocks ? a->group_blocks[g] : group->first;
+    uint64_t end = a->blocks ? a->group_blocks[g + 1] : group->end;
+    int failed = 0;
+
+    // -q: none of its blocks can match
+    if (first == end)
+        return 0;
+
+    a2l_sitemap_t sites = w->sites;
+    a2l_deltamap_t deltas = w->deltas;
+    uint64_t events = w->events, matched = w->matched, untracked_frees = w->untracked_frees;
+    uint64_t unknown_frees = w->unknown_frees, bad_blocks = w->bad_blocks;
+
+    a2l_analyze_clear(&w->group_sites, &w->group_deltas);
+    w->sites = w->group_sites;
+    w->deltas = w->group_deltas;
+    w->events = w->matched = w->untracked_frees = w->unknown_frees = w->bad_blocks = 0;
+
+    const a2l_cacheentry_t *cached = a->cache ? a2l_cache_find(a->cache, group->hash) : NULL;
+    if (cached) {
+        failed = a2l_analyze_fold(w, cached, a2l_cache_shift(a->cache)) < 0;
+        w->reused++;
+    } else {
+        uint64_t iter_bad = it->bad_blocks;
+        for (uint64_t i = first; i < end; i++) {
+            const a2l_blockheader_t *bh = a2l_read_block(a->reader, a->blocks ? a->blocks[i] : i);
+            w->read_bytes += bh->header_bytes + bh->stored_bytes;
+        }
+        w->read_blocks += end - first;
+        failed = a2l_analyze_scan(w, it, first, end, b, ev, sel) < 0 || a2l_analyze_close_buckets(w) < 0;
+        w->bad_blocks += it->bad_blocks - iter_bad;
+    }
+    if (!failed && !(a->entries[g] = a2l_analyze_entry(w, group->hash)))
+        failed = 1;
+
+    // the tables may have grown: keep them for the next group
+    w->group_sites = w->sites;
+    w->group_deltas = w->deltas;
+    w->sites = sites;
+    w->deltas = deltas;
+    w->events = events;
+    w->matched = matched;
+    w->untracked_frees = untracked_frees;
+    w->unknown_frees = unknown_frees;
+    w->bad_blocks = bad_blocks;
+    return failed ? -1 : a2l_analyze_fold(w, a->entries[g], a->bucket_shift);
+}
+
+static void *
+a2l_analyze_cache_worker(void *arg) {
+    a2l_worker_t *w = arg;
+    a2l_analyze_t *a = w->a;
+    a2l_batch_t *b = a2l_batch_alloc(A2L_ANALYZE_BATCH);
+    uint32_t *sel = malloc(A2L_ANALYZE_BATCH * sizeof(uint32_t));
+    a2l_qeval_t ev;
+    a2l_iter_t it;
+
+    memset(&ev, 0, sizeof(ev));
+    if (!b || !sel || (a->query && a2l_qeval_init(&ev, a->query, A2L_ANALYZE_BATCH) < 0) ||
+        a2l_sitemap_init(&w->group_sites, 1024) < 0 || a2l_deltamap_init(&w->group_deltas, 1024) < 0) {
+        w->failed = 1;
+    }
+
+    // groups one at a time: they're big enough to share out that way
+    a2l_iter_init(&it, a->reader, 0, 0);
+    while (!w->failed) {
+        uint64_t g = __atomic_fetch_add(&a->next_group, 1, __ATOMIC_RELAXED);
+        if (g >= a->num_groups)
+            break;
+        if (a2l_analyze_group(w, g, &it, b, &ev, sel) < 0)
+            w->failed = 1;
+    }
+    a2l_iter_free(&it);
+
+    free(w->group_sites.slots);
+    free(w->group_deltas.slots);
+    a2l_qeval_free(&ev);
+    a2l_batch_free(b);
+    free(sel);
+    return NULL;
+}
+
+// the trace's groups, what -q needs of them, and the cache from last time
+static int
+a2l_analyze_cached(a2l_analyze_t *a, uint32_t shift) {
+    const a2l_readinfo_t *info = a2l_read_info(a->reader);
+    char error[256];
+    int64_t n;
+
+    if ((n = a2l_cache_groups(a->reader, &a->groups)) < 0 ||
+        !(a->entries = calloc(n + 1, sizeof(a2l_cacheentry_t *))) ||
+        (a->blocks && !(a->group_blocks = malloc((n + 1) * sizeof(uint64_t))))) {
+        fprintf(stderr, "a2l-analyze: out of memory\n");
+        return -1;
+    }
+    a->num_groups = (uint64_t)n;
+
+    // -q: each group's selected blocks, as positions in blocks
+    for (uint64_t g = 0, p = 0; a->blocks && g <= a->num_groups; g++) {
+        uint64_t first = g < a->num_groups ? a->groups[g].first : info->num_blocks;
+        while (p < a->num_selected && a->blocks[p] < first)
+            p++;
+        a->group_blocks[g] = p;
+    }
+
+    a->cache = a2l_cache_open(a->trace, a->cache_name, info, a->cache_params, shift, error, sizeof(error));
+    if (!a->cache && error[0])
+        fprintf(stderr, "a2l-analyze: %s; starting over\n", error);
+    return a2l_analyze_run(a, a2l_analyze_cache_worker);
+}
+
+//
+// following, --follow
+//
+
+// a trace being followed
+typedef struct {
+    char *path;
+    a2l_reader_t *reader;           // its latest listing, for names
+    a2l_query_t query;              // -q, with its times for this trace
+    int has_query;
+    a2l_sitemap_t sites;            // sums so far
+    uint64_t done;                  // the latest listing's first block not summed
+    a2l_blockheader_t last;         // the last of them, to find it again
+    uint64_t events, untracked_frees, unknown_frees, bad_blocks, matched;
+    uint64_t new_events, new_bytes; // since the last report
+    uint64_t behind;                // blocks left for the next round
+    uint32_t rounds;
+    int started;
+}a2l_follow_t;
+
+static volatile sig_atomic_t a2l__analyze_quit = 0;
+
+static void
+a2l_analyze_on_signal(int sig) {
+    (void)sig;
+    a2l__analyze_quit = 1;
+}
+
+static int
+a2l_analyze_same_block(const a2l_blockheader_t *a, const a2l_blockheader_t *b) {
+    return a->checksum == b->checksum && a->tid == b->tid && a->num_events == b->num_events &&
+           a->stored_bytes == b->stored_bytes && a->first_ts == b->first_ts && a->last_ts == b->last_ts;
+}
+
+// the first of r's blocks f hasn't summed.  blocks are only added at
+// the end, or compacted away from the front, so the last one summed is
+// at or before where it was; if it's gone, so is everything before it.
+static uint64_t
+a2l_analyze_tail(const a2l_follow_t *f, const a2l_reader_t *r) {
+    uint64_t n = a2l_read_info(r)->num_blocks;
+
+    if (!f->started)
+        return 0;
+    for (uint64_t i = f->done < n ? f->done : n; i > 0; i--)
+        if (a2l_analyze_same_block(a2l_read_block(r, i - 1), &f->last))
+            return i;
+    return 0;
+}
+
+// the workers' sums into f's, and the workers cleared for next time
+static int
+a2l_analyze_follow_merge(a2l_analyze_t *a, a2l_follow_t *f) {
+    for (int i = 0; i < a->num_workers; i++) {
+        a2l_worker_t *w = &a->workers[i];
+
+        for (uint32_t j = 0; j <= w->sites.mask; j++) {
+            const a2l_site_t *s = &w->sites.slots[j];
+            a2l_site_t *m;
+            if (!s->used)
+                continue;
+            if (!(m = a2l_sitemap_get(&f->sites, s->stack_id)))
+                return -1;
+            m->allocs += s->allocs;
+            m->frees += s->frees;
+            m->bytes_alloced += s->bytes_alloced;
+            m->bytes_freed += s->bytes_freed;
+            f->new_bytes += s->bytes_alloced;
+        }
+        f->events += w->events;
+        f->new_events += w->events;
+        f->matched += w->matched;
+        f->untracked_frees += w->untracked_frees;
+        f->unknown_frees += w->unknown_frees;
+        f->bad_blocks += w->bad_blocks;
+
+        a2l_analyze_clear(&w->sites, &w->deltas);
+        w->events = w->matched = w->untracked_frees = w->unknown_frees = w->bad_blocks = 0;
+    }
+    return 0;
+}
+
+// f's new blocks, until the deadline; -1 if the trace can't be read
+static int
+a2l_analyze_follow_trace(a2l_analyze_t *a, a2l_follow_t *f, const char *query_text, double deadline) {
+    char error[256];
+    a2l_reader_t *r = a2l_read_open(f->path, error, sizeof(error));
+
+    // not there yet, or caught mid-rename: next round
+    if (!r)
+        return -1;
+    const a2l_readinfo_t *info = a2l_read_info(r);
+
+    // the same path, another run: start over
+    if (f->reader && (info->pid != a2l_read_info(f->reader)->pid ||
+                      info->start_ns != a2l_read_info(f->reader)->start_ns)) {
+        memset(f->sites.slots, 0, (f->sites.mask + 1) * sizeof(a2l_site_t));
+        f->sites.count = 0;
+        f->done = f->events = f->untracked_frees = f->unknown_frees = f->bad_blocks = f->matched = 0;
+        f->rounds = f->started = 0;
+        if (f->has_query)
+            a2l_query_free(&f->query);
+        f->has_query = 0;
+    }
+    if (query_text && !f->has_query) {
+        if (a2l_query_parse(&f->query, query_text, info, error, sizeof(error)) < 0) {
+            fprintf(stderr, "a2l-analyze: %s\n", error);
+            exit(1);
+        }
+        f->has_query = 1;
+    }
+    if (f->has_query && f->query.group == A2L_QG_TIME && info->last_ts / f->query.bucket_ns >= UINT32_MAX) {
+        fprintf(stderr, "a2l-analyze: too many time buckets; make them wider\n");
+        exit(1);
+    }
+
+    // a last block still being written fails its checksum: not yet
+    uint64_t first = a2l_analyze_tail(f, r), end = info->num_blocks;
+    if (end > first) {
+        const a2l_blockheader_t *bh = a2l_read_block(r, end - 1);
+        if (a2l_checksum((const uint8_t *)bh + bh->header_bytes, bh->stored_bytes) != bh->checksum)
+            end--;
+    }
+
+    a2l_qbounds_t qb;
+    memset(&qb, 0, sizeof(qb));
+    qb.to = UINT64_MAX;
+    if (f->has_query) {
+        if (a2l_query_bind(&f->query, r) < 0) {
+            a2l_read_close(r);
+            return -1;
+        }
+        a2l_query_bounds(&f->query, &qb);
+    }
+    a->reader = r;
+    a->query = f->has_query ? &f->query : NULL;
+    a->num_buckets = 1;
+
+    // a slice at a time, so a backlog can't hold up the report for long
+    uint64_t slice = (uint64_t)A2L_ANALYZE_GRAIN * a->num_workers * 4;
+    uint64_t *list = malloc(slice * sizeof(uint64_t));
+    int failed = !list;
+    while (!failed && first < end && a2l_analyze_now() < deadline) {
+        uint64_t n = 0, stop = end - first > slice ? first + slice : end;
+
+        for (uint64_t i = first; i < stop; i++) {
+            const a2l_blockheader_t *bh = a2l_read_block(r, i);
+            if (bh->first_ts < qb.to && bh->last_ts >= qb.from && (!qb.by_tid || bh->tid == qb.tid))
+                list[n++] = i;
+        }
+        a->blocks = list;
+        a2l_analyze_share(a, n);
+        failed = a2l_analyze_run(a, a2l_analyze_list_worker) < 0 || a2l_analyze_follow_merge(a, f) < 0;
+
+        f->last = *a2l_read_block(r, stop - 1);
+        f->started = 1;
+        first = stop;
+    }
+    free(list);
+    a->blocks = NULL;
+    if (failed) {
+        fprintf(stderr, "a2l-analyze: out of memory\n");
+        exit(1);
+    }
+    f->behind = end - first;
+    f->done = first;
+
+    a2l_read_close(f->reader);
+    f->reader = r;
+    return 0;
+}
+
+static void
+a2l_analyze_follow_report(a2l_analyze_t *a, a2l_follow_t *f, int reports, int rows, int depth, double dt) {
+    const a2l_readinfo_t *info = a2l_read_info(f->reader);
+    char b0[32];
+
+    // peaks, as sampled once a round
+    for (uint32_t i = 0; i <= f->sites.mask; i++) {
+        a2l_site_t *s = &f->sites.slots[i];
+        if (s->used && a2l_analyze_live(s) > s->peak_live) {
+            s->peak_live = a2l_analyze_live(s);
+            s->peak_bucket = f->rounds;
+        }
+    }
+    f->rounds++;
+
+    a2l_site_t *sites = malloc((f->sites.count + 1) * sizeof(a2l_site_t));
+    uint32_t n = 0;
+    if (!sites) {
+        fprintf(stderr, "a2l-analyze: out of memory\n");
+        exit(1);
+    }
+    for (uint32_t i = 0; i <= f->sites.mask; i++)
+        if (f->sites.slots[i].used)
+            sites[n++] = f->sites.slots[i];
+
+    printf("\n%s: pid %u, %.3f s traced; %" PRIu64 " events, %.0f/s; %s/s allocated\n",
+           f->path, info->pid, (info->last_ts - info->first_ts) / 1e9, f->events, f->new_events / dt,
+           a2l_analyze_bytes(b0, sizeof(b0), f->new_bytes / dt));
+    if (f->behind)
+        printf("%" PRIu64 " blocks behind\n", f->behind);
+    if (f->bad_blocks)
+        printf("%" PRIu64 " damaged blocks skipped\n", f->bad_blocks);
+    f->new_events = f->new_bytes = 0;
+
+    a->reader = f->reader;
+    a->query = f->has_query ? &f->query : NULL;
+    // a round is a bucket: growing means it peaked in the last tenth of them
+    a->num_buckets = f->rounds;
+    if (a->query) {
+        printf("%" PRIu64 " events matched\n", f->matched);
+        a2l_analyze_answer(a, sites, n, rows, depth);
+    } else {
+        if (reports & A2L_REPORT_BYTES)
+            a2l_analyze_report(a, "top sites by bytes allocated", sites, n, a2l_analyze_cmp_bytes, 0, rows, depth);
+        if (reports & A2L_REPORT_COUNT)
+            a2l_analyze_report(a, "top sites by allocations", sites, n, a2l_analyze_cmp_count, 0, rows, depth);
+        if (reports & A2L_REPORT_PEAK)
+            a2l_analyze_report(a, "top sites by peak live bytes", sites, n, a2l_analyze_cmp_peak, 0, rows, depth);
+        if (reports & A2L_REPORT_LEAKS)
+            a2l_analyze_report(a, "leak candidates: live now (+ still growing)", sites, n,
+                               a2l_analyze_cmp_live, 1, rows, depth);
+    }
+    free(sites);
+}
+
+// path's traces: it, or if it's a directory, the traces in it
+static int
+a2l_analyze_follow_list(const char *path, a2l_follow_t *follows, int num_follows) {
+    struct stat st;
+
+    if (stat(path, &st) < 0 || !S_ISDIR(st.st_mode)) {
+        if (!num_follows)
+            follows[num_follows++].path = strdup(path);
+        return num_follows;
+    }
+
+    DIR *dir = opendir(path);
+    struct dirent *d;
+    while (dir && (d = readdir(dir)) && num_follows < A2L_FOLLOW_MAX_TRACES) {
+        size_t len = strlen(d->d_name);
+        char file[4096];
+
+        if (len < 5 || strcmp(d->d_name + len - 4, ".a2l"))
+            continue;
+        snprintf(file, sizeof(file), "%s/%s", path, d->d_name);
+        int known = 0;
+        for (int i = 0; i < num_follows && !known; i++)
+            known = !strcmp(follows[i].path, file);
+        if (!known)
+            follows[num_follows++].path = strdup(file);
+    }
+    if (dir)
+        closedir(dir);
+    return num_follows;
+}
+
+// every interval seconds, sum what's new and report, until interrupted
+// or every traced process has exited and its trace is read
+static int
+a2l_analyze_follow(a2l_analyze_t *a, const char *path, double interval, const char *query_text,
+                   int reports, int rows, int depth) {
+    a2l_follow_t *follows = calloc(A2L_FOLLOW_MAX_TRACES, sizeof(a2l_follow_t));
+    int num_follows = 0, tty = isatty(STDOUT_FILENO);
+
+    if (!follows)
+        return -1;
+    signal(SIGINT, a2l_analyze_on_signal);
+    signal(SIGTERM, a2l_analyze_on_signal);
+
+    // buckets are rounds
+    a->bucket_shift = 63;
+    double last = a2l_analyze_now();
+    for (;;) {
+        double round_start = a2l_analyze_now();
+        int running = 0, pending = 0;
+
+        num_follows = a2l_analyze_follow_list(path, follows, num_follows);
+        for (int i = 0; i < num_follows; i++) {
+            a2l_follow_t *f = &follows[i];
+            if (!f->sites.slots && a2l_sitemap_init(&f->sites, 1024) < 0)
+                return -1;
+            if (a2l_analyze_follow_trace(a, f, query_text, round_start + interval) < 0) {
+                pending = 1;
+                continue;
+            }
+            uint32_t pid = a2l_read_info(f->reader)->pid;
+            running |= pid && (kill((pid_t)pid, 0) == 0 || errno != ESRCH);
+            pending |= f->behind != 0;
+        }
+
+        double now = a2l_analyze_now();
+        if (tty)
+            printf("\033[H\033[2J");
+        printf("a2l-analyze --follow %s, every %.1f s%s\n", path, interval,
+               num_follows ? "" : ": no traces yet");
+        for (int i = 0; i < num_follows; i++)
+            if (follows[i].reader)
+                a2l_analyze_follow_report(a, &follows[i], reports, rows, depth, now - last > 0 ? now - last : 1);
+        fflush(stdout);
+        last = now;
+
+        if (a2l__analyze_quit || (num_follows && !running && !pending))
+            break;
+        double left = round_start + interval - a2l_analyze_now();
+        if (left > 0) {
+            struct timespec ts;
+            ts.tv_sec = (time_t)left;
+            ts.tv_nsec = (long)((left - (double)ts.tv_sec) * 1e9);
+            nanosleep(&ts, NULL);
+        }
+        if (a2l__analyze_quit)
+            break;
+    }
+
+    for (int i = 0; i < num_follows; i++) {
+        a2l_read_close(follows[i].reader);
+        if (follows[i].has_query)
+            a2l_query_free(&follows[i].query);
+        free(follows[i].sites.slots);
+        free(follows[i].path);
+    }
+    free(follows);
+    return 0;
+}
+
+int
+main(int argc, char **argv) {
+    int num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int rows = 10, depth = 4, reports = A2L_REPORT_BYTES | A2L_REPORT_COUNT |
+                                        A2L_REPORT_PEAK | A2L_REPORT_LEAKS;
+    uint32_t num_buckets = 1000;
+    char error[256], b0[32], b1[32];
+    const char *query_text = NULL, *out_path = NULL, *format_name = NULL, *base_path = NULL;
+    int format = A2L_EXPORT_NONE, weight = A2L_WEIGHT_BYTES;
+    char cache_name[64];
+    int use_cache = 0, follow = 0;
+    double interval = 1;
+    a2l_analyze_t a;
+    a2l_query_t query;
+    int opt;
+    static const struct option long_options[] = {
+        {"follow", no_argument, NULL, 'f'},
+        {NULL, 0, NULL, 0}
+    };
+
+    memset(&a, 0, sizeof(a));
+
+    while ((opt = getopt_long(argc, argv, "j:n:d:b:r:m:T:q:ci:o:F:w:D:h", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'j': num_threads = atoi(optarg); break;
+        case 'n': rows = atoi(optarg); break;
+        case 'd': depth = atoi(optarg); break;
+        case 'b': num_buckets = (uint32_t)atol(optarg); break;
+        case 'm': a.mem_limit = a2l_analyze_parse_bytes(optarg); break;
+        case 'T': a.tmpdir = optarg; break;
+        case 'q': query_text = optarg; break;
+        case 'c': use_cache = 1; break;
+        case 'f': follow = 1; break;
+        case 'i': interval = atof(optarg); break;
+        case 'o': out_path = optarg; break;
+        case 'F': format_name = optarg; break;
+        case 'D': base_path = optarg; break;
+        case 'w':
+            if (!strcmp(optarg, "bytes"))       weight = A2L_WEIGHT_BYTES;
+            else if (!strcmp(optarg, "allocs")) weight = A2L_WEIGHT_ALLOCS;
+            else if (!strcmp(optarg, "live"))   weight = A2L_WEIGHT_LIVE;
+            else {
+                fprintf(stderr, "a2l-analyze: -w is bytes, allocs or live\n");
+                return 1;
+            }
+            break;
+        case 'r':
+            if ((reports = a2l_analyze_reports(optarg)) < 0)
+                return 1;
+            break;
+        default:
+            a2l_analyze_usage();
+            return 1;
+        }
+    }
+    if (optind != argc - 1 || num_buckets == 0 || !(interval > 0)) {
+        a2l_analyze_usage();
+        return 1;
+    }
+    if ((query_text || use_cache) && a.mem_limit) {
+        fprintf(stderr, "a2l-analyze: -%c and -m don't go together\n", query_text ? 'q' : 'c');
+        return 1;
+    }
+    // -o alone is csv, unless the file's name says json
+    size_t out_len = out_path ? strlen(out_path) : 0;
+    if (format_name) {
+        static const char *formats[] = {"", "csv", "json", "folded", "pprof", "callgrind"};
+        for (format = A2L_EXPORT_CALLGRIND; format > A2L_EXPORT_NONE && strcmp(format_name, formats[format]); format--)
+            ;
+        if (format == A2L_EXPORT_NONE) {
+            fprintf(stderr, "a2l-analyze: -F is csv, json, folded, pprof or callgrind\n");
+            return 1;
+        }
+    } else if (out_path)
+        format = out_len > 5 && !strcmp(out_path + out_len - 5, ".json") ? A2L_EXPORT_JSON : A2L_EXPORT_CSV;
+    if (format && !out_path)
+        out_path = "-";
+    if (format && (query_text || follow)) {
+        fprintf(stderr, "a2l-analyze: -o and -F don't go with %s\n", follow ? "--follow" : "-q");
+        return 1;
+    }
+    if (base_path && format != A2L_EXPORT_FOLDED) {
+        fprintf(stderr, "a2l-analyze: -D compares folded stacks: give -F folded%s\n",
+                format == A2L_EXPORT_PPROF ? " (pprof has -diff_base)" : "");
+        return 1;
+    }
+    if (format == A2L_EXPORT_PPROF && !strcmp(out_path, "-") && isatty(STDOUT_FILENO)) {
+        fprintf(stderr, "a2l-analyze: -F pprof is gzipped: give -o or redirect it\n");
+        return 1;
+    }
+    if (follow && (use_cache || a.mem_limit)) {
+        fprintf(stderr, "a2l-analyze: --follow and -%c don't go together\n", use_cache ? 'c' : 'm');
+        return 1;
+    }
+    if (num_threads < 1)
+        num_threads = 1;
+    if (num_threads > A2L_ANALYZE_MAX_THREADS)
+        num_threads = A2L_ANALYZE_MAX_THREADS;
+    if (!a.tmpdir && !(a.tmpdir = getenv("TMPDIR")))
+        a.tmpdir = "/tmp";
+
+    const char *trace = argv[optind];
+    if (follow) {
+        if (a2l_analyze_workers(&a, num_threads, 1024) < 0 ||
+            a2l_analyze_follow(&a, trace, interval, query_text, reports, rows, depth) < 0) {
+            fprintf(stderr, "a2l-analyze: out of memory\n");
+            return 1;
+        }
+        return 0;
+    }
+
+    double start = a2l_analyze_now();
+    if (!(a.reader = a2l_read_open(trace, error, sizeof(error)))) {
+        fprintf(stderr, "a2l-analyze: %s\n", error);
+        return 1;
+    }
+    const a2l_readinfo_t *info = a2l_read_info(a.reader);
+
+    // the widest power of two ns that still cuts the trace into
+    // num_buckets: buckets nest, so cached ones add up into them
+    while (a.bucket_shift < 63 && ((info->last_ts - info->first_ts) >> (a.bucket_shift + 1)) >= num_buckets)
+        a.bucket_shift++;
+    a.first_bucket = info->first_ts >> a.bucket_shift;
+    a.num_buckets = (uint32_t)((info->last_ts >> a.bucket_shift) - a.first_bucket + 1);
+
+    // -q: just the blocks that can hold matches
+    uint64_t *blocks = NULL, num_blocks = info->num_blocks;
+    int indexed = 0;
+    if (query_text) {
+        a2l_qbounds_t bounds;
+
+        if (a2l_query_parse(&query, query_text, info, error, sizeof(error)) < 0) {
+            fprintf(stderr, "a2l-analyze: %s\n", error);
+            return 1;
+        }
+        if (query.group == A2L_QG_TIME && info->last_ts / query.bucket_ns >= UINT32_MAX) {
+            fprintf(stderr, "a2l-analyze: too many time buckets; make them wider\n");
+            return 1;
+        }
+        a2l_query_bounds(&query, &bounds);
+        int64_t n;
+        if (a2l_query_bind(&query, a.reader) < 0 ||
+            (n = a2l_analyze_select(&a, trace, &bounds, &blocks, &indexed)) < 0) {
+            fprintf(stderr, "a2l-analyze: out of memory\n");
+            return 1;
+        }
+        num_blocks = (uint64_t)n;
+        a.query = &query;
+        a.blocks = blocks;
+        a.num_selected = num_blocks;
+    }
+
+    uint64_t trace_bytes = 0;
+    for (uint64_t i = 0; i < num_blocks; i++) {
+        const a2l_blockheader_t *bh = a2l_read_block(a.reader, blocks ? blocks[i] : i);
+        trace_bytes += bh->header_bytes + bh->stored_bytes;
+    }
+    if (a2l_analyze_workers(&a, num_threads, 1 << 16) < 0) {
+        fprintf(stderr, "a2l-analyze: out of memory\n");
+        return 1;
+    }
+
+    // -c: the reports, or each query's rows, have a cache of their own
+    uint32_t cache_shift = a.query ? 0 : a.bucket_shift;
+    if (use_cache) {
+        a.trace = trace;
+        a.cache_name = cache_name;
+        if (a.query) {
+            char key[4096];
+            size_t len = a2l_query_key(&query, key, sizeof(key));
+            a.cache_params = a2l_cache_hash(key, len < sizeof(key) ? len : sizeof(key), A2L_CACHE_HASH_SEED);
+            snprintf(cache_name, sizeof(cache_name), "query-%016" PRIx64, a.cache_params);
+        } else {
+            a.cache_params = a2l_cache_hash("reports", 7, A2L_CACHE_HASH_SEED);
+            snprintf(cache_name, sizeof(cache_name), "reports");
+        }
+    }
+
+    int failed;
+    if (use_cache) {
+        failed = a2l_analyze_cached(&a, cache_shift) < 0;
+    } else if (a.query) {
+        a2l_analyze_share(&a, num_blocks);
+        failed = a2l_analyze_run(&a, a2l_analyze_list_worker) < 0;
+    } else if (a.mem_limit) {
+        if (a2l_analyze_plan(&a, info->num_events) < 0)
+            return 1;
+        failed = a2l_analyze_spilled(&a, info->num_blocks) < 0;
+    } else {
+        a2l_analyze_share(&a, info->num_blocks);
+        failed = a2l_analyze_run(&a, a2l_analyze_worker) < 0;
+    }
+
+    // compacted: the heap the events left began with
+    a2l_startheap_t heap;
+    memset(&heap, 0, sizeof(heap));
+    heap.keyframe = -1;
+    int seeded = !a.query || a2l_query_by_site(a.query);
+    if (!failed && seeded && (a2l_read_start_heap(a.reader, &heap) < 0 ||
+                              (a.query && a2l_analyze_seed_query(&a, &heap) < 0)))
+        failed = 1;
+
+    // merge
+    a2l_sitemap_t merged;
+    uint64_t events = 0, untracked_frees = 0, bad_blocks = 0, steals = 0, paired = 0, spilled = 0;
+    uint64_t unknown_frees = 0, matched = 0, reused = 0, read_blocks = 0, read_bytes = 0;
+    failed |= a2l_sitemap_init(&merged, 1024) < 0;
+    for (int i = 0; i < num_threads; i++) {
+        a2l_worker_t *w = &a.workers[i];
+
+        events += w->events;
+        untracked_frees += w->untracked_frees;
+        bad_blocks += w->bad_blocks;
+        steals += w->steals;
+        paired += w->paired_frees;
+        unknown_frees += w->unknown_frees;
+        matched += w->matched;
+        reused += w->reused;
+        read_blocks += w->read_blocks;
+        read_bytes += w->read_bytes;
+        spilled += w->spilled;
+        for (uint32_t j = 0; !failed && j <= w->sites.mask; j++) {
+            const a2l_site_t *s = &w->sites.slots[j];
+            a2l_site_t *m;
+            if (!s->used)
+                continue;
+            if (!(m = a2l_sitemap_get(&merged, s->stack_id))) {
+                failed = 1;
+                break;
+            }
+            m->allocs += s->allocs;
+            m->frees += s->frees;
+            m->bytes_alloced += s->bytes_alloced;
+            m->bytes_freed += s->bytes_freed;
+        }
+        free(w->sites.slots);
+        free(w->spill);
+        free(w->spill_count);
+        free(w->run);
+    }
+
+    uint32_t num_sites = 0;
+    a2l_delta_t *deltas = NULL;
+    uint64_t num_deltas = 0;
+    a2l_site_t *sites = failed ? NULL : malloc(((uint64_t)merged.count + heap.num_sites + 1) * sizeof(a2l_site_t));
+    if (sites) {
+        for (uint32_t j = 0; j <= merged.mask; j++)
+            if (merged.slots[j].used)
+                sites[num_sites++] = merged.slots[j];
+        qsort(sites, num_sites, sizeof(a2l_site_t), a2l_analyze_cmp_site);
+        num_sites = a2l_analyze_seed(sites, num_sites, &heap);
+        if (!a.query && a2l_analyze_peaks(&a, sites, num_sites, format == A2L_EXPORT_CSV || format == A2L_EXPORT_JSON ||
+                                         format == A2L_EXPORT_CALLGRIND ? &deltas : NULL,
+                                         &num_deltas) < 0)
+            failed = 1;
+    }
+    a2l_start_heap_free(&heap);
+    if (failed || !sites) {
+        fprintf(stderr, "a2l-analyze: analysis failed\n");
+        return 1;
+    }
+
+    // what this run used, for the next
+    uint64_t groups_used = 0;
+    if (use_cache) {
+        if (a2l_cache_write(trace, cache_name, info, a.cache_params, cache_shift, a.entries, a.num_groups,
+                            error, sizeof(error)) < 0)
+            fprintf(stderr, "a2l-analyze: %s\n", error);
+        for (uint64_t i = 0; i < a.num_groups; i++) {
+            groups_used += a.entries[i] != NULL;
+            free(a.entries[i]);
+        }
+        free(a.entries);
+        free(a.groups);
+        free(a.group_blocks);
+        a2l_cache_close(a.cache);
+    }
+    double elapsed = a2l_analyze_now() - start;
+    // -c: what was decoded, not what the cache stood in for
+    if (use_cache) {
+        num_blocks = read_blocks;
+        trace_bytes = read_bytes;
+    }
+
+    // -o and -F: an export, alone on stdout if it goes there
+    if (format) {
+        FILE *f = strcmp(out_path, "-") ? fopen(out_path, "w") : stdout;
+        int bad = !f;
+
+        if (!bad && format == A2L_EXPORT_FOLDED)
+            bad = a2l_analyze_stacks(&a, sites, num_sites, weight, base_path, f) < 0;
+        else if (!bad && format == A2L_EXPORT_PPROF)
+            bad = a2l_analyze_pprof(&a, sites, num_sites, f) < 0;
+        else if (!bad && format == A2L_EXPORT_CALLGRIND)
+            bad = a2l_analyze_callgrind(&a, trace, sites, num_sites, deltas, num_deltas, f) < 0;
+        else if (!bad)
+            bad = a2l_analyze_series(&a, sites, num_sites, deltas, num_deltas, rows, depth, f,
+                                     format == A2L_EXPORT_JSON) < 0;
+        if (bad || (f != stdout && fclose(f) != 0)) {
+            fprintf(stderr, "a2l-analyze: can't write %s: %s\n", out_path, strerror(errno));
+            return 1;
+        }
+        free(deltas);
+        if (f == stdout) {
+            free(sites);
+            free(merged.slots);
+            free(a.workers);
+            free(a.files);
+            a2l_read_close(a.reader);
+            return 0;
+        }
+    }
+
+    if (a.query) {
+        printf("%s: pid %u, %.3f s traced\n", trace, info->pid, (info->last_ts - info->first_ts) / 1e9);
+        printf("%" PRIu64 " of %" PRIu64 " events matched; read %" PRIu64 " of %" PRIu64 " blocks "
+               "(picked by %s), %s in %.2f s on %d threads\n",
+               matched, events, num_blocks, info->num_blocks, indexed ? "the index" : "block headers",
+               a2l_analyze_bytes(b0, sizeof(b0), (double)trace_bytes), elapsed, num_threads);
+        // the heap compacted segments left is known by site only
+        if (info->segments_compacted && heap.keyframe >= 0)
+            printf("%u compacted segments skipped; live counts from the heap they left, "
+                   "rebuilt from keyframe %" PRId64 "\n", info->segments_compacted, heap.keyframe);
+        else if (info->segments_compacted)
+            printf("%u compacted segments skipped; live counts only the events left%s\n",
+                   info->segments_compacted, seeded ? ": no whole keyframe" : " unless the query "
+                   "filters and groups by site or module alone");
+        if (bad_blocks + heap.bad_blocks)
+            printf("%" PRIu64 " damaged blocks skipped\n", bad_blocks + heap.bad_blocks);
+        if (use_cache)
+            printf("%" PRIu64 " of %" PRIu64 " block groups from the cache\n", reused, groups_used);
+        a2l_analyze_answer(&a, sites, num_sites, rows, depth);
+
+        a2l_query_free(&query);
+        free(blocks);
+        free(sites);
+        free(merged.slots);
+        free(a.workers);
+        a2l_read_close(a.reader);
+        return 0;
+    }
+
+    uint64_t allocs = 0, frees = 0, bytes = 0;
+    for (uint32_t i = 0; i < num_sites; i++) {
+        allocs += sites[i].allocs;
+        frees += sites[i].frees;
+        bytes += sites[i].bytes_alloced;
+    }
+
+    printf("%s: pid %u, %.3f s traced\n", trace, info->pid, (info->last_ts - info->first_ts) / 1e9);
+    printf("%" PRIu64 " events: %" PRIu64 " allocs of %s, %" PRIu64 " frees, %" PRIu64 " of untracked blocks\n",
+           events, allocs, a2l_analyze_bytes(b0, sizeof(b0), (double)bytes), frees, untracked_frees);
+    printf("%u sites; read %s in %.2f s on %d threads (%s/s, %" PRIu64 " steals)\n",
+           num_sites, a2l_analyze_bytes(b0, sizeof(b0), (double)trace_bytes), elapsed, num_threads,
+           a2l_analyze_bytes(b1, sizeof(b1), trace_bytes / (elapsed > 0 ? elapsed : 1)), steals);
+    if (info->segments_compacted && heap.keyframe >= 0)
+        printf("%u compacted segments skipped; the heap they left, %s in %" PRId64 " blocks, "
+               "rebuilt from keyframe %" PRId64 "\n", info->segments_compacted,
+               a2l_analyze_bytes(b0, sizeof(b0), (double)heap.bytes), heap.blocks, heap.keyframe);
+    else if (info->segments_compacted)
+        printf("%u compacted segments skipped, and no whole keyframe left: live bytes count "
+               "only the events left\n", info->segments_compacted);
+    if (bad_blocks + heap.bad_blocks)
+        printf("%" PRIu64 " damaged blocks skipped\n", bad_blocks + heap.bad_blocks);
+    if (use_cache)
+        printf("%" PRIu64 " of %" PRIu64 " block groups from the cache\n", reused, groups_used);
+    if (a.mem_limit)
+        printf("%" PRIu64 " frees paired by pointer; %s spilled to %u partitions, %u passes\n",
+               paired, a2l_analyze_bytes(b0, sizeof(b0), (double)spilled * sizeof(a2l_spill_t)),
+               a.num_partitions, a.pass);
+    else if (unknown_frees)
+        printf("%" PRIu64 " frees don't say what they freed: -m pairs them by pointer\n", unknown_frees);
+
+    if (reports & A2L_REPORT_BYTES)
+        a2l_analyze_report(&a, "top sites by bytes allocated", sites, num_sites,
+                           a2l_analyze_cmp_bytes, 0, rows, depth);
+    if (reports & A2L_REPORT_COUNT)
+        a2l_analyze_report(&a, "top sites by allocations", sites, num_sites,
+                           a2l_analyze_cmp_count, 0, rows, depth);
+    if (reports & A2L_REPORT_PEAK)
+        a2l_analyze_report(&a, "top sites by peak live bytes", sites, num_sites,
+                           a2l_analyze_cmp_peak, 0, rows, depth);
+    if (reports & A2L_REPORT_LEAKS)
+        a2l_analyze_report(&a, "leak candidates: live at exit (+ still growing)", sites, num_sites,
+                           a2l_analyze_cmp_live, 1, rows, depth);
+
+    free(sites);
+    free(merged.slots);
+    free(a.workers);
+    free(a.files);
+    a2l_read_close(a.reader);
+    return 0;
+}
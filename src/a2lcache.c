@@ -0,0 +1,223 @@
+#define _GNU_SOURCE
+// a2lcache.c -- a2l-analyze's cache of partial results; see a2lcache.h.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "a2lcache.h"
+
+struct a2l_cache {
+    const uint8_t *map;
+    size_t size;
+    const a2l_cacheheader_t *header;
+    const a2l_cacheref_t *refs;
+};
+
+static int
+a2l__cache_fail(char *error, size_t error_len, const char *fmt, ...) {
+    va_list args;
+
+    if (error && error_len) {
+        va_start(args, fmt);
+        vsnprintf(error, error_len, fmt, args);
+        va_end(args);
+    }
+    return -1;
+}
+
+int64_t
+a2l_cache_groups(const a2l_reader_t *r, a2l_cachegroup_t **groups) {
+    uint64_t num_blocks = a2l_read_info(r)->num_blocks, n = 0;
+    uint64_t h = A2L_CACHE_HASH_SEED;
+
+    // at least one block each
+    if (!(*groups = malloc((num_blocks ? num_blocks : 1) * sizeof(a2l_cachegroup_t))))
+        return -1;
+    uint32_t segment = num_blocks ? a2l_read_block_segment(r, 0) : 0;
+    for (uint64_t i = 0, first = 0; i < num_blocks; i++) {
+        const a2l_blockheader_t *bh = a2l_read_block(r, i);
+        uint32_t next_segment = i + 1 < num_blocks ? a2l_read_block_segment(r, i + 1) : segment;
+
+        // the header past its magic: sizes, checksum, thread, times
+        h = a2l_cache_hash((const uint8_t *)bh + sizeof(bh->magic), sizeof(*bh) - sizeof(bh->magic), h);
+        uint64_t cut = (bh->checksum * 0x9e3779b97f4a7c15ULL) >> 40;
+        if (cut % A2L_CACHE_GROUP == 0 || i + 1 - first == 4 * A2L_CACHE_GROUP || i + 1 == num_blocks ||
+            next_segment != segment) {
+            (*groups)[n].first = first;
+            (*groups)[n].end = i + 1;
+            (*groups)[n].hash = h;
+            n++;
+            first = i + 1;
+            h = A2L_CACHE_HASH_SEED;
+        }
+        segment = next_segment;
+    }
+    return (int64_t)n;
+}
+
+a2l_cache_t *
+a2l_cache_open(const char *trace, const char *name, const a2l_readinfo_t *info,
+               uint64_t params, uint32_t shift, char *error, size_t error_len) {
+    char path[4096];
+    struct stat st;
+    a2l_cache_t *c;
+
+    if (error && error_len)
+        error[0] = 0;
+    snprintf(path, sizeof(path), A2L_CACHE_DIR_FMT "/%s", trace, name);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        if (errno != ENOENT)
+            a2l__cache_fail(error, error_len, "can't open %s: %s", path, strerror(errno));
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(a2l_cacheheader_t)) {
+        close(fd);
+        a2l__cache_fail(error, error_len, "%s: not a cache", path);
+        return NULL;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        a2l__cache_fail(error, error_len, "can't map %s: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    // a cache for something else isn't an error, just no use
+    const a2l_cacheheader_t *h = map;
+    const char *problem = NULL;
+    if (h->magic != A2L_CACHE_MAGIC || h->header_bytes != sizeof(a2l_cacheheader_t) ||
+        h->version != A2L_CACHE_VERSION)
+        problem = "not a cache";
+    else if (h->refs_offset + h->num_groups * sizeof(a2l_cacheref_t) != (uint64_t)st.st_size)
+        problem = "cache is truncated";
+    if (problem || h->pid != info->pid || h->start_ns != info->start_ns || h->params != params ||
+        h->shift > shift || !(c = calloc(1, sizeof(a2l_cache_t)))) {
+        munmap(map, st.st_size);
+        if (problem)
+            a2l__cache_fail(error, error_len, "%s: %s", path, problem);
+        return NULL;
+    }
+
+    c->map = map;
+    c->size = st.st_size;
+    c->header = h;
+    c->refs = (const a2l_cacheref_t *)(c->map + h->refs_offset);
+    return c;
+}
+
+void
+a2l_cache_close(a2l_cache_t *c) {
+    if (!c)
+        return;
+    munmap((void *)c->map, c->size);
+    free(c);
+}
+
+uint32_t
+a2l_cache_shift(const a2l_cache_t *c) {
+    return c->header->shift;
+}
+
+const a2l_cacheentry_t *
+a2l_cache_find(const a2l_cache_t *c, uint64_t hash) {
+    uint64_t lo = 0, hi = c->header->num_groups;
+
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (c->refs[mid].hash < hash)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == c->header->num_groups || c->refs[lo].hash != hash)
+        return NULL;
+
+    const a2l_cacheentry_t *e = (const a2l_cacheentry_t *)(c->map + c->refs[lo].offset);
+    if (c->refs[lo].offset + sizeof(*e) > c->header->refs_offset ||
+        c->refs[lo].offset + a2l_cache_entry_bytes(e) > c->header->refs_offset || e->hash != hash)
+        return NULL;
+    return e;
+}
+
+static int
+a2l__cache_cmp_ref(const void *pa, const void *pb) {
+    const a2l_cacheref_t *a = pa, *b = pb;
+    return a->hash < b->hash ? -1 : a->hash > b->hash;
+}
+
+int
+a2l_cache_write(const char *trace, const char *name, const a2l_readinfo_t *info, uint64_t params,
+                uint32_t shift, a2l_cacheentry_t *const *entries, uint64_t num_entries,
+                char *error, size_t error_len) {
+    char dir[4096], path[4096], tmp[4096 + 8];
+    a2l_cacheheader_t h;
+    uint64_t offset = sizeof(h), n = 0;
+    int ret = -1;
+
+    snprintf(dir, sizeof(dir), A2L_CACHE_DIR_FMT, trace);
+    if (mkdir(dir, 0777) < 0 && errno != EEXIST)
+        return a2l__cache_fail(error, error_len, "can't create %s: %s", dir, strerror(errno));
+    snprintf(path, sizeof(path), A2L_CACHE_DIR_FMT "/%s", trace, name);
+
+    a2l_cacheref_t *refs = malloc((num_entries ? num_entries : 1) * sizeof(a2l_cacheref_t));
+    if (!refs)
+        return a2l__cache_fail(error, error_len, "out of memory");
+
+    memset(&h, 0, sizeof(h));
+    h.magic = A2L_CACHE_MAGIC;
+    h.version = A2L_CACHE_VERSION;
+    h.header_bytes = sizeof(h);
+    h.pid = info->pid;
+    h.shift = shift;
+    h.start_ns = info->start_ns;
+    h.params = params;
+
+    // written aside, then renamed over, as indexes are
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "wb");
+    if (!f) {
+        a2l__cache_fail(error, error_len, "can't create %s: %s", tmp, strerror(errno));
+        free(refs);
+        return -1;
+    }
+    int bad = fwrite(&h, sizeof(h), 1, f) != 1;
+    for (uint64_t i = 0; !bad && i < num_entries; i++) {
+        const a2l_cacheentry_t *e = entries[i];
+        if (!e)
+            continue;
+        // a group can repeat, whole blocks and all: once is enough
+        refs[n].hash = e->hash;
+        refs[n].offset = offset;
+        n++;
+        offset += a2l_cache_entry_bytes(e);
+        bad = fwrite(e, a2l_cache_entry_bytes(e), 1, f) != 1;
+    }
+    qsort(refs, n, sizeof(a2l_cacheref_t), a2l__cache_cmp_ref);
+    uint64_t unique = 0;
+    for (uint64_t i = 0; i < n; i++)
+        if (!unique || refs[unique - 1].hash != refs[i].hash)
+            refs[unique++] = refs[i];
+    h.num_groups = unique;
+    h.refs_offset = offset;
+    bad = bad || fwrite(refs, sizeof(a2l_cacheref_t), unique, f) != unique ||
+          fseek(f, 0, SEEK_SET) != 0 || fwrite(&h, sizeof(h), 1, f) != 1;
+    if (fclose(f) != 0 || bad) {
+        unlink(tmp);
+        a2l__cache_fail(error, error_len, "can't write %s: %s", tmp, strerror(errno));
+    } else if (rename(tmp, path) < 0) {
+        unlink(tmp);
+        a2l__cache_fail(error, error_len, "can't rename %s: %s", tmp, strerror(errno));
+    } else
+        ret = 0;
+
+    free(refs);
+    return ret;
+}
@@ -0,0 +1,134 @@
+// a2lcache.h -- a2l-analyze's cache of partial results, -c.
+//
+// a trace's blocks are cut into groups where their contents say so:
+// a group ends after a block whose checksum hashes to 0 mod
+// A2L_CACHE_GROUP, at the end of a segment (or of the file), or else
+// 4 * A2L_CACHE_GROUP blocks after the group began.  groups never span
+// segments, so each segment's groups depend on its blocks alone: a
+// trace that grows keeps all but its last group, and one that loses
+// old segments keeps every group of those left.  a group's key hashes
+// its blocks' headers, checksums included.
+//
+// what an analysis sums per group is kept in <trace>.cache/<name>, one
+// file per kind of analysis (the reports; each query's where and group
+// by), rewritten after each run with the groups that run used:
+//
+//   a2l_cacheheader_t
+//   per group:  a2l_cacheentry_t, a2l_cachesum_t [num_sums],
+//               a2l_cachedelta_t [num_deltas]
+//   a2l_cacheref_t [num_groups]   by hash, for finding entries
+//
+// deltas are net bytes per (site, time bucket), buckets numbered from
+// ts 0 in 2^shift nanoseconds.  buckets nest, so a file made with a
+// smaller shift can be summed up into a larger one.
+//
+// everything is little-endian, and a cache is only for the trace it
+// was made from: another pid, start time or params and it's ignored.
+
+#ifndef A2L__CACHE_H
+#define A2L__CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "a2lread.h"
+
+#define A2L_CACHE_MAGIC    0x434c3241  // 'A2LC'
+#define A2L_CACHE_VERSION  1
+#define A2L_CACHE_DIR_FMT  "%s.cache"
+#define A2L_CACHE_GROUP    64          // blocks in a group, on average
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_bytes;          // sizeof(a2l_cacheheader_t)
+    uint32_t pid;
+    uint32_t shift;                 // deltas' buckets are 2^shift ns
+    uint64_t start_ns;
+    uint64_t params;                // the analysis's, hashed
+    uint64_t num_groups;
+    uint64_t refs_offset;
+}a2l_cacheheader_t;
+
+typedef struct {
+    uint64_t hash;
+    uint64_t events, matched;       // events read, and that a query kept
+    uint64_t untracked_frees, unknown_frees, bad_blocks;
+    uint32_t num_sums;
+    uint32_t _pad;
+    uint64_t num_deltas;
+}a2l_cacheentry_t;
+
+typedef struct {
+    uint32_t key;                   // stack id, or a query's group key
+    uint32_t _pad;
+    uint64_t allocs, frees;
+    uint64_t bytes_alloced, bytes_freed;
+}a2l_cachesum_t;
+
+typedef struct {
+    uint32_t stack_id;
+    uint32_t _pad;
+    uint64_t bucket;                // ts >> shift
+    int64_t delta;
+}a2l_cachedelta_t;
+
+typedef struct {
+    uint64_t hash;
+    uint64_t offset;
+}a2l_cacheref_t;
+
+// blocks [first, end) of a reader
+typedef struct {
+    uint64_t first, end;
+    uint64_t hash;
+}a2l_cachegroup_t;
+
+typedef struct a2l_cache a2l_cache_t;
+
+static inline uint64_t
+a2l_cache_hash(const void *data, size_t len, uint64_t h) {
+    const uint8_t *p = data;
+
+    // fnv-1a
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ p[i]) * 0x100000001b3ULL;
+    return h;
+}
+#define A2L_CACHE_HASH_SEED 0xcbf29ce484222325ULL
+
+static inline uint64_t
+a2l_cache_entry_bytes(const a2l_cacheentry_t *e) {
+    return sizeof(*e) + e->num_sums * sizeof(a2l_cachesum_t) + e->num_deltas * sizeof(a2l_cachedelta_t);
+}
+
+static inline const a2l_cachesum_t *
+a2l_cache_sums(const a2l_cacheentry_t *e) {
+    return (const a2l_cachesum_t *)(e + 1);
+}
+
+static inline const a2l_cachedelta_t *
+a2l_cache_deltas(const a2l_cacheentry_t *e) {
+    return (const a2l_cachedelta_t *)(a2l_cache_sums(e) + e->num_sums);
+}
+
+// r's blocks in groups, into *groups (malloced).  the count, or -1.
+int64_t a2l_cache_groups(const a2l_reader_t *r, a2l_cachegroup_t **groups);
+
+// <trace>.cache/<name> if it's for this trace and params and its
+// shift is at most shift; else NULL, and error says why if it's
+// anything but not being there
+a2l_cache_t *a2l_cache_open(const char *trace, const char *name, const a2l_readinfo_t *info,
+                            uint64_t params, uint32_t shift, char *error, size_t error_len);
+void a2l_cache_close(a2l_cache_t *c);
+uint32_t a2l_cache_shift(const a2l_cache_t *c);
+// the group's entry, or NULL
+const a2l_cacheentry_t *a2l_cache_find(const a2l_cache_t *c, uint64_t hash);
+
+// entries[i] for each group, in a new <trace>.cache/<name>.  -1 on
+// failure, with the reason in error.
+int a2l_cache_write(const char *trace, const char *name, const a2l_readinfo_t *info, uint64_t params,
+                    uint32_t shift, a2l_cacheentry_t *const *entries, uint64_t num_entries,
+                    char *error, size_t error_len);
+
+#endif
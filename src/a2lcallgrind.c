@@ -0,0 +1,331 @@
+#define _GNU_SOURCE
+// a2lcallgrind.c -- allocation costs in callgrind's format; see a2lcallgrind.h.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+
+#include "a2lcallgrind.h"
+
+// caller and callee pairs a stack remembers, so recursion counts once;
+// pairs past these are counted again
+#define A2L_CALLGRIND_MAX_PAIRS 128
+
+// keys of functions: a symbol's id, a frame's address, or no stack
+#define A2L_CALLGRIND_SYMBOL   (1ULL << 63)
+#define A2L_CALLGRIND_NO_STACK (~0ULL)
+
+typedef struct {
+    uint64_t key;
+    a2l_frame_t frame;              // the first seen, to name it by
+    uint64_t entry;                 // calls land here: the symbol's start
+    uint32_t module;                // ob id, 0 if none
+    int named;                      // its name is out, so just (id) now
+}a2l__callgrind_function_t;
+
+// a cost line: a function's own (callee 0), or its calls to callee,
+// at addr in it
+typedef struct {
+    uint32_t fn, callee;            // function ids; fn 0 if empty
+    uint64_t addr;
+    int64_t calls;
+    int64_t cost[3];
+}a2l__callgrind_cost_t;
+
+typedef struct {
+    const a2l_reader_t *r;
+    a2l__callgrind_function_t *functions;   // by id - 1
+    uint32_t num_functions;
+    uint32_t *function_slots;       // id, by hash of key
+    uint32_t function_mask;
+    uint32_t *modules;              // module ids, by ob id - 1
+    uint8_t *module_named;
+    uint32_t num_modules;
+    a2l__callgrind_cost_t *costs;   // by hash of fn, callee and addr
+    uint32_t cost_mask, num_costs;
+    int failed;
+}a2l__callgrind_t;
+
+static uint32_t
+a2l__callgrind_hash(uint64_t key) {
+    return (uint32_t)((key * 0x9e3779b97f4a7c15ULL) >> 32);
+}
+
+//
+// tables
+//
+
+// ob id of a module, 0 if there's none
+static uint32_t
+a2l__callgrind_module(a2l__callgrind_t *c, uint32_t module_id) {
+    if (!a2l_read_module(c->r, module_id))
+        return 0;
+    // few enough to look through
+    for (uint32_t i = 0; i < c->num_modules; i++)
+        if (c->modules[i] == module_id)
+            return i + 1;
+
+    uint32_t *modules = realloc(c->modules, (c->num_modules + 1) * sizeof(uint32_t));
+    if (modules)
+        c->modules = modules;
+    uint8_t *named = realloc(c->module_named, c->num_modules + 1);
+    if (named)
+        c->module_named = named;
+    if (!modules || !named) {
+        c->failed = 1;
+        return 0;
+    }
+    c->modules[c->num_modules] = module_id;
+    c->module_named[c->num_modules] = 0;
+    return ++c->num_modules;
+}
+
+// a frame's function id; 0 if out of memory
+static uint32_t
+a2l__callgrind_function(a2l__callgrind_t *c, const a2l_frame_t *frame) {
+    const a2l_symbol_t *symbol = frame ? a2l_read_symbol(c->r, frame->symbol_id) : NULL;
+    uint64_t key = !frame ? A2L_CALLGRIND_NO_STACK : symbol ? A2L_CALLGRIND_SYMBOL | symbol->id : frame->addr;
+
+    if (2 * (c->num_functions + 1) > c->function_mask + 1) {
+        uint32_t mask = c->function_mask ? c->function_mask * 2 + 1 : 1023;
+        uint32_t *slots = calloc(mask + 1, sizeof(uint32_t));
+        a2l__callgrind_function_t *functions = realloc(c->functions, (mask + 1) / 2 * sizeof(*functions));
+        if (functions)
+            c->functions = functions;
+        if (!slots || !functions) {
+            free(slots);
+            c->failed = 1;
+            return 0;
+        }
+        for (uint32_t i = 0; i < c->num_functions; i++) {
+            uint32_t j = a2l__callgrind_hash(c->functions[i].key) & mask;
+            while (slots[j])
+                j = (j + 1) & mask;
+            slots[j] = i + 1;
+        }
+        free(c->function_slots);
+        c->function_slots = slots;
+        c->function_mask = mask;
+    }
+
+    uint32_t j = a2l__callgrind_hash(key) & c->function_mask;
+    while (c->function_slots[j] && c->functions[c->function_slots[j] - 1].key != key)
+        j = (j + 1) & c->function_mask;
+    if (c->function_slots[j])
+        return c->function_slots[j];
+
+    a2l__callgrind_function_t *fn = &c->functions[c->num_functions];
+    memset(fn, 0, sizeof(*fn));
+    fn->key = key;
+    if (frame) {
+        fn->frame = *frame;
+        fn->entry = symbol ? symbol->addr : frame->addr;
+        fn->module = a2l__callgrind_module(c, frame->module_id);
+    }
+    c->function_slots[j] = ++c->num_functions;
+    return c->num_functions;
+}
+
+static a2l__callgrind_cost_t *
+a2l__callgrind_cost(a2l__callgrind_t *c, uint32_t fn, uint32_t callee, uint64_t addr) {
+    uint64_t key = ((uint64_t)fn << 32 | callee) ^ addr * 0xff51afd7ed558ccdULL;
+
+    if (2 * (c->num_costs + 1) > c->cost_mask + 1) {
+        uint32_t mask = c->cost_mask ? c->cost_mask * 2 + 1 : 4095;
+        a2l__callgrind_cost_t *costs = calloc(mask + 1, sizeof(*costs));
+        if (!costs) {
+            c->failed = 1;
+            return NULL;
+        }
+        for (uint32_t i = 0; c->costs && i <= c->cost_mask; i++) {
+            const a2l__callgrind_cost_t *e = &c->costs[i];
+            if (!e->fn)
+                continue;
+            uint32_t j = a2l__callgrind_hash(((uint64_t)e->fn << 32 | e->callee) ^ e->addr * 0xff51afd7ed558ccdULL) & mask;
+            while (costs[j].fn)
+                j = (j + 1) & mask;
+            costs[j] = *e;
+        }
+        free(c->costs);
+        c->costs = costs;
+        c->cost_mask = mask;
+    }
+
+    uint32_t j = a2l__callgrind_hash(key) & c->cost_mask;
+    a2l__callgrind_cost_t *e;
+    while ((e = &c->costs[j])->fn && (e->fn != fn || e->callee != callee || e->addr != addr))
+        j = (j + 1) & c->cost_mask;
+    if (!e->fn) {
+        e->fn = fn;
+        e->callee = callee;
+        e->addr = addr;
+        c->num_costs++;
+    }
+    return e;
+}
+
+static void
+a2l__callgrind_add(a2l__callgrind_cost_t *e, const a2l_callgrindsite_t *site) {
+    e->calls += site->allocs;
+    e->cost[0] += site->allocs;
+    e->cost[1] += site->bytes;
+    e->cost[2] += site->peak;
+}
+
+//
+// the call graph
+//
+
+static void
+a2l__callgrind_site(a2l__callgrind_t *c, const a2l_callgrindsite_t *site) {
+    const a2l_stack_t *stack = site->stack_id ? a2l_read_stack(c->r, site->stack_id) : NULL;
+    uint32_t pairs[2 * A2L_CALLGRIND_MAX_PAIRS];
+    uint32_t num_pairs = 0;
+    a2l__callgrind_cost_t *e;
+
+    if (!stack || !stack->num_frames) {
+        uint32_t fn = a2l__callgrind_function(c, NULL);
+        if (fn && (e = a2l__callgrind_cost(c, fn, 0, 0)))
+            a2l__callgrind_add(e, site);
+        return;
+    }
+
+    // the innermost frame's own cost
+    uint32_t callee = a2l__callgrind_function(c, &stack->frames[0]);
+    if (!callee || !(e = a2l__callgrind_cost(c, callee, 0, stack->frames[0].addr)))
+        return;
+    a2l__callgrind_add(e, site);
+
+    // then each caller's call to the frame below, once per pair
+    for (uint32_t i = 1; i < stack->num_frames; i++) {
+        uint32_t fn = a2l__callgrind_function(c, &stack->frames[i]);
+        int seen = 0;
+
+        if (!fn)
+            return;
+        for (uint32_t k = 0; k < num_pairs && !seen; k++)
+            seen = pairs[2 * k] == fn && pairs[2 * k + 1] == callee;
+        if (!seen) {
+            if (!(e = a2l__callgrind_cost(c, fn, callee, stack->frames[i].addr)))
+                return;
+            a2l__callgrind_add(e, site);
+            if (num_pairs < A2L_CALLGRIND_MAX_PAIRS) {
+                pairs[2 * num_pairs] = fn;
+                pairs[2 * num_pairs++ + 1] = callee;
+            }
+        }
+        callee = fn;
+    }
+}
+
+static int
+a2l__callgrind_cmp_cost(const void *pa, const void *pb) {
+    const a2l__callgrind_cost_t *a = pa, *b = pb;
+    if (a->fn != b->fn)
+        return a->fn < b->fn ? -1 : 1;
+    if (a->callee != b->callee)
+        return a->callee < b->callee ? -1 : 1;
+    return a->addr < b->addr ? -1 : a->addr > b->addr;
+}
+
+//
+// the output
+//
+
+// "(id) name" the first time, "(id)" after
+static void
+a2l__callgrind_ob(a2l__callgrind_t *c, FILE *f, const char *spec, uint32_t ob) {
+    if (!ob)
+        fprintf(f, "%s=???\n", spec);
+    else if (c->module_named[ob - 1])
+        fprintf(f, "%s=(%u)\n", spec, ob);
+    else {
+        c->module_named[ob - 1] = 1;
+        fprintf(f, "%s=(%u) %s\n", spec, ob, a2l_read_module(c->r, c->modules[ob - 1])->path);
+    }
+}
+
+static void
+a2l__callgrind_fn(a2l__callgrind_t *c, FILE *f, const char *spec, uint32_t id) {
+    a2l__callgrind_function_t *fn = &c->functions[id - 1];
+    const a2l_symbol_t *symbol;
+    char name[1024];
+
+    if (fn->named) {
+        fprintf(f, "%s=(%u)\n", spec, id);
+        return;
+    }
+    fn->named = 1;
+    if (fn->key == A2L_CALLGRIND_NO_STACK)
+        snprintf(name, sizeof(name), "(no stack)");
+    else if ((symbol = a2l_read_symbol(c->r, fn->frame.symbol_id)))
+        snprintf(name, sizeof(name), "%s", symbol->name);
+    else
+        a2l_read_frame_name(c->r, &fn->frame, name, sizeof(name));
+    fprintf(f, "%s=(%u) %s\n", spec, id, name);
+}
+
+int
+a2l_callgrind_write(const a2l_reader_t *r, const char *trace, const a2l_callgrindsite_t *sites,
+                    uint64_t num_sites, FILE *f) {
+    a2l__callgrind_t c;
+    int64_t totals[3] = {0, 0, 0};
+    int ret = -1;
+
+    memset(&c, 0, sizeof(c));
+    c.r = r;
+    for (uint64_t i = 0; i < num_sites && !c.failed; i++) {
+        if (!sites[i].allocs && !sites[i].peak)
+            continue;
+        a2l__callgrind_site(&c, &sites[i]);
+        totals[0] += sites[i].allocs;
+        totals[1] += sites[i].bytes;
+        totals[2] += sites[i].peak;
+    }
+    if (c.failed) {
+        errno = ENOMEM;
+        goto done;
+    }
+
+    // packed, and in order: each function's own costs, then its calls
+    uint32_t n = 0;
+    for (uint32_t i = 0; c.costs && i <= c.cost_mask; i++)
+        if (c.costs[i].fn)
+            c.costs[n++] = c.costs[i];
+    qsort(c.costs, n, sizeof(a2l__callgrind_cost_t), a2l__callgrind_cmp_cost);
+
+    fprintf(f, "# callgrind format\nversion: 1\ncreator: a2l-analyze\n");
+    fprintf(f, "pid: %u\ncmd: %s\npositions: instr\n", a2l_read_info(r)->pid, trace);
+    fprintf(f, "event: Allocs : allocations\nevent: Bytes : bytes allocated\n"
+               "event: Peak : bytes live at the peak\nevents: Allocs Bytes Peak\n");
+    fprintf(f, "summary: %" PRId64 " %" PRId64 " %" PRId64 "\n\nfl=(1) ???\n", totals[0], totals[1], totals[2]);
+
+    for (uint32_t i = 0; i < n; i++) {
+        const a2l__callgrind_cost_t *e = &c.costs[i];
+
+        if (!i || e->fn != c.costs[i - 1].fn) {
+            fputc('\n', f);
+            a2l__callgrind_ob(&c, f, "ob", c.functions[e->fn - 1].module);
+            a2l__callgrind_fn(&c, f, "fn", e->fn);
+        }
+        if (e->callee) {
+            const a2l__callgrind_function_t *callee = &c.functions[e->callee - 1];
+            a2l__callgrind_ob(&c, f, "cob", callee->module);
+            a2l__callgrind_fn(&c, f, "cfn", e->callee);
+            fprintf(f, "calls=%" PRId64 " 0x%" PRIx64 "\n", e->calls, callee->entry);
+        }
+        fprintf(f, "0x%" PRIx64 " %" PRId64 " %" PRId64 " %" PRId64 "\n", e->addr, e->cost[0], e->cost[1], e->cost[2]);
+    }
+    fprintf(f, "\ntotals: %" PRId64 " %" PRId64 " %" PRId64 "\n", totals[0], totals[1], totals[2]);
+    ret = ferror(f) ? -1 : 0;
+
+done:
+    free(c.functions);
+    free(c.function_slots);
+    free(c.modules);
+    free(c.module_named);
+    free(c.costs);
+    return ret;
+}
@@ -0,0 +1,36 @@
+// a2lcallgrind.h -- allocation costs in callgrind's format, for
+// a2l-analyze -F callgrind and kcachegrind, callgrind_annotate and
+// the like.
+//
+// three events: allocations, bytes allocated, and bytes live when the
+// whole heap peaked.  a site's costs are its innermost frame's own
+// (exclusive) cost, at that frame's address; every caller above it
+// gets them as the cost of a call to the frame below, so a function's
+// inclusive cost is its own plus its calls'.  calls= counts the
+// allocations made through the call.  a function called twice in one
+// stack has that stack's costs once per caller and callee pair, so
+// recursion doesn't count a site again.
+//
+// a function is a symbol (module!name), or, unsymbolized, its frame's
+// address; ob= is its module.  positions are instruction addresses.
+
+#ifndef A2L__CALLGRIND_H
+#define A2L__CALLGRIND_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "a2lread.h"
+
+typedef struct {
+    uint32_t stack_id;
+    uint32_t _pad;
+    int64_t allocs, bytes, peak;
+}a2l_callgrindsite_t;
+
+// sites of r's trace, named in the output as trace, into f; -1 with
+// errno on failure
+int a2l_callgrind_write(const a2l_reader_t *r, const char *trace, const a2l_callgrindsite_t *sites,
+                        uint64_t num_sites, FILE *f);
+
+#endif
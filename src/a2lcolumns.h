@@ -0,0 +1,69 @@
+// a2lcolumns.h -- columnar trace layout, written by a2l-export -f columns.
+//
+// a directory, one file per column, one row per alloc or free:
+//
+//   ts.a2lc       u64  nanoseconds since the trace began
+//   type.a2lc     u8   A2L_REC_ALLOC or A2L_REC_FREE
+//   size.a2lc     u64  bytes allocated, or freed (0 if not tracked)
+//   stack.a2lc    u32  stack id of the call
+//   thread.a2lc   u32  thread id
+//   ptr.a2lc      u64  the block's address
+//   stacks.tsv         stack id (hex), tab, frames ';' separated,
+//                      innermost first, each module!symbol+0xoffset
+//
+// row i of every column is the same event.  rows are in trace order:
+// each thread's events in time order, threads interleaved a block at
+// a time; sort on ts for strict time order, or export with -t, which
+// writes rows in time order to begin with.
+//
+// a column file is an a2l_colheader_t, chunks of up to chunk_rows
+// values, then an a2l_colchunk_t index.  each chunk decodes on its
+// own: decompress (A2L_CODEC_LZ, a2llz.h), unshuffle, undo deltas,
+// giving a little-endian array of width byte values.  min and max in
+// the index let a scan skip chunks.  with no encoding and
+// A2L_CODEC_NONE (a2l-export -u) the chunks are back to back, so the
+// whole column is one flat array at header_bytes: mmap it and go.
+//
+// everything is little-endian.
+
+#ifndef A2L__COLUMNS_H
+#define A2L__COLUMNS_H
+
+#include <stdint.h>
+
+#define A2L_COLUMN_MAGIC   0x434c3241  // 'A2LC'
+#define A2L_COLUMN_VERSION 1
+#define A2L_COLUMN_EXT     ".a2lc"
+#define A2L_COLUMN_STACKS  "stacks.tsv"
+
+// encoding flags, undone in reverse order
+#define A2L_COLENC_DELTA   1           // value - previous value, wrapping
+#define A2L_COLENC_SHUFFLE 2           // byte k of every value, k = 0..width-1
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_bytes;          // sizeof(a2l_colheader_t)
+    char name[16];
+    uint8_t width;                  // bytes per value
+    uint8_t encoding;               // A2L_COLENC_*
+    uint16_t _pad;
+    uint32_t chunk_rows;
+    uint64_t rows;
+    uint64_t index_offset;
+    uint32_t num_chunks;
+    uint32_t pid;
+    uint64_t start_realtime_ns;     // CLOCK_REALTIME at ts 0
+}a2l_colheader_t;
+
+typedef struct {
+    uint64_t offset;
+    uint32_t stored_bytes;
+    uint32_t rows;
+    uint16_t codec;                 // A2L_CODEC_*
+    uint16_t _pad;
+    uint32_t checksum;              // a2l_checksum() of the stored bytes
+    uint64_t min, max;              // of the values, unsigned
+}a2l_colchunk_t;
+
+#endif
@@ -0,0 +1,829 @@
+#define _GNU_SOURCE
+// a2l-convert -- convert a text log to a binary trace
+//
+// usage: a2l-convert [-j threads] [-o trace] <log>
+//
+// writes <log> less .log plus .a2l unless -o says otherwise.  the log
+// is cut into chunks at record boundaries, parsed and encoded into
+// compressed blocks by -j threads (default: every core), and written
+// in the log's order.  a stack's definitions are written before the
+// chunk that first uses it.
+//
+// text logs have no clock: each event is stamped with its record's
+// byte offset in the log, which keeps the log's order.  they don't
+// record the size or stack of the block a free releases either, so
+// frees have alloc_bytes and alloc_stack_id 0, as if untracked.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "a2lformat.h"
+#include "a2llz.h"
+#include "a2ltext.h"
+
+#define A2L_CONVERT_CHUNK (64ULL*1024*1024)  // text per chunk
+#define A2L_CONVERT_BLOCK (64*1024)          // block payload
+#define A2L_CONVERT_RECORD_MAX 64            // one encoded event
+#define A2L_CONVERT_MAX_THREADS 256
+#define A2L_CONVERT_PATH_MAX 4096
+
+#define A2L_CONVERT_BLOCK_BYTES \
+    (sizeof(a2l_blockheader_t) + A2L_LZ_BOUND(A2L_CONVERT_BLOCK))
+
+// a stack, as a chunk first saw it
+typedef struct {
+    uint32_t hash_id;
+    uint32_t num_frames;
+    uint64_t first_frame;           // into the chunk's frames
+}a2l_convstack_t;
+
+// one chunk of the log, parsed
+typedef struct {
+    uint64_t begin, end;
+    uint8_t *blocks;                // block headers and payloads, ready to write
+    size_t blocks_len, blocks_max;
+    a2l_convstack_t *stacks;
+    uint32_t num_stacks, max_stacks;
+    a2l_textframe_t *frames;        // into the mapped log
+    uint64_t num_frames, max_frames;
+    uint64_t records, malformed;
+    int done, failed;
+}a2l_convchunk_t;
+
+// a thread's events, building up into a block
+typedef struct {
+    uint64_t tid;
+    int used;
+    uint8_t *buf, *p;
+    uint32_t num_events;
+    uint64_t first_ts, prev_ts;
+}a2l_convbuilder_t;
+
+typedef struct {
+    uint32_t hash_id;
+    uint32_t generation;            // chunk it was seen in
+}a2l_convseen_t;
+
+typedef struct a2l_convert a2l_convert_t;
+
+typedef struct {
+    a2l_convert_t *c;
+    pthread_t thread;
+    a2l_convbuilder_t *builders;
+    uint32_t builder_mask, num_builders;
+    a2l_convseen_t *seen;
+    uint32_t seen_mask, num_seen, generation;
+    uint32_t *lz_table;
+}a2l_convworker_t;
+
+// definitions, as written out
+typedef struct {
+    const char *path;
+    uint32_t path_len;
+    uint32_t id;                    // with base, if known
+    uint64_t base;
+    uint32_t unknown_id;            // for symbolized frames before a base is known
+}a2l_convmodule_t;
+
+typedef struct {
+    const char *name;
+    uint32_t name_len;
+    uint32_t module_id;
+    uint32_t id;
+}a2l_convsymbol_t;
+
+struct a2l_convert {
+    a2l_textlog_t log;
+    a2l_convchunk_t *chunks;
+    uint32_t num_chunks;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t next_chunk;            // for workers to take
+    uint32_t written;               // chunks the writer is done with
+    uint32_t max_ahead;
+
+    // the writer's
+    FILE *out;
+    uint64_t offset;
+    a2l_blockindex_t *index;
+    uint32_t num_index, max_index;
+    uint32_t *stacks_defined;       // open addressing on hash_id + 1
+    uint32_t stacks_mask, num_stacks;
+    a2l_convmodule_t *modules;
+    uint32_t modules_mask, num_modules, next_module_id;
+    a2l_convsymbol_t *symbols;
+    uint32_t symbols_mask, num_symbols;
+    uint8_t *defs, *defs_p;
+    uint32_t *lz_table;
+    uint8_t *block;
+};
+
+static void
+a2l_convert_usage(void) {
+    fprintf(stderr, "usage: a2l-convert [-j threads] [-o trace] <log>\n");
+}
+
+static double
+a2l_convert_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void *
+a2l_convert_grow(void *array, uint64_t *capacity, uint64_t needed, size_t size) {
+    if (needed <= *capacity)
+        return array;
+
+    uint64_t n = *capacity ? *capacity : 64;
+    while (n < needed)
+        n *= 2;
+    array = realloc(array, n * size);
+    if (!array) {
+        fprintf(stderr, "a2l-convert: out of memory\n");
+        exit(1);
+    }
+    *capacity = n;
+    return array;
+}
+
+#define A2L_CONVERT_GROW(array, capacity, needed) do {                  \
+        uint64_t cap64 = (capacity);                                    \
+        (array) = a2l_convert_grow((array), &cap64, (needed), sizeof(*(array))); \
+        (capacity) = cap64;                                             \
+    } while (0)
+
+static uint32_t
+a2l_convert_hash(const char *s, size_t len, uint64_t seed) {
+    uint64_t h = 0xcbf29ce484222325ULL ^ seed;
+
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (uint8_t)s[i]) * 0x100000001b3ULL;
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+// compress a block's payload and add it, header first, to out
+static void
+a2l_convert_block(uint8_t **out, size_t *len, size_t *max, uint32_t flags, uint64_t tid,
+                  const uint8_t *raw, size_t raw_bytes, uint32_t num_events,
+                  uint64_t first_ts, uint64_t last_ts, uint32_t *lz_table) {
+    a2l_blockheader_t header;
+    uint64_t cap = *max;
+
+    *out = a2l_convert_grow(*out, &cap, *len + A2L_CONVERT_BLOCK_BYTES, 1);
+    *max = cap;
+
+    uint8_t *payload = *out + *len + sizeof(header);
+    memset(&header, 0, sizeof(header));
+    header.magic = A2L_BLOCK_MAGIC;
+    header.codec = A2L_CODEC_NONE;
+    header.header_bytes = sizeof(header);
+    header.raw_bytes = (uint32_t)raw_bytes;
+    header.stored_bytes = (uint32_t)raw_bytes;
+    header.tid = (uint32_t)tid;
+    header.num_events = num_events;
+    header.flags = flags;
+    header.first_ts = first_ts;
+    header.last_ts = last_ts;
+
+    size_t stored = a2l_lz_compress(raw, raw_bytes, payload, lz_table);
+    if (stored < raw_bytes) {
+        header.codec = A2L_CODEC_LZ;
+        header.stored_bytes = (uint32_t)stored;
+    } else {
+        memcpy(payload, raw, raw_bytes);
+    }
+    header.checksum = a2l_checksum(payload, header.stored_bytes);
+    memcpy(*out + *len, &header, sizeof(header));
+    *len += sizeof(header) + header.stored_bytes;
+}
+
+//
+// workers: parse and encode a chunk
+//
+
+static void
+a2l_convert_flush(a2l_convworker_t *w, a2l_convchunk_t *chunk, a2l_convbuilder_t *b) {
+    if (!b->num_events)
+        return;
+
+    a2l_convert_block(&chunk->blocks, &chunk->blocks_len, &chunk->blocks_max, 0, b->tid,
+                      b->buf, b->p - b->buf, b->num_events, b->first_ts, b->prev_ts, w->lz_table);
+    b->p = b->buf;
+    b->num_events = 0;
+}
+
+static a2l_convbuilder_t *
+a2l_convert_builder(a2l_convworker_t *w, uint64_t tid) {
+    uint32_t slot = (uint32_t)(tid * 2654435761u) & w->builder_mask;
+
+    while (w->builders[slot].used && w->builders[slot].tid != tid)
+        slot = (slot + 1) & w->builder_mask;
+    if (w->builders[slot].used)
+        return &w->builders[slot];
+
+    if ((w->num_builders + 1) * 2 > w->builder_mask) {
+        a2l_convbuilder_t *old = w->builders;
+        uint32_t old_mask = w->builder_mask;
+
+        w->builder_mask = old_mask * 2 + 1;
+        w->builders = calloc(w->builder_mask + 1, sizeof(a2l_convbuilder_t));
+        if (!w->builders) {
+            fprintf(stderr, "a2l-convert: out of memory\n");
+            exit(1);
+        }
+        for (uint32_t i = 0; i <= old_mask; i++) {
+            if (old[i].used) {
+                uint32_t s = (uint32_t)(old[i].tid * 2654435761u) & w->builder_mask;
+                while (w->builders[s].used)
+                    s = (s + 1) & w->builder_mask;
+                w->builders[s] = old[i];
+            }
+        }
+        free(old);
+        return a2l_convert_builder(w, tid);
+    }
+
+    a2l_convbuilder_t *b = &w->builders[slot];
+    b->used = 1;
+    b->tid = tid;
+    b->p = b->buf = malloc(A2L_CONVERT_BLOCK);
+    if (!b->buf) {
+        fprintf(stderr, "a2l-convert: out of memory\n");
+        exit(1);
+    }
+    w->num_builders++;
+    return b;
+}
+
+// 1 the first time this chunk sees hash_id
+static int
+a2l_convert_first_sight(a2l_convworker_t *w, uint32_t hash_id) {
+    uint32_t slot = (hash_id * 2654435761u) & w->seen_mask;
+
+    while (w->seen[slot].generation == w->generation && w->seen[slot].hash_id != hash_id)
+        slot = (slot + 1) & w->seen_mask;
+    if (w->seen[slot].generation == w->generation)
+        return 0;
+
+    if ((w->num_seen + 1) * 2 > w->seen_mask) {
+        a2l_convseen_t *old = w->seen;
+        uint32_t old_mask = w->seen_mask;
+
+        w->seen_mask = old_mask * 2 + 1;
+        w->seen = calloc(w->seen_mask + 1, sizeof(a2l_convseen_t));
+        if (!w->seen) {
+            fprintf(stderr, "a2l-convert: out of memory\n");
+            exit(1);
+        }
+        for (uint32_t i = 0; i <= old_mask; i++) {
+            if (old[i].generation == w->generation) {
+                uint32_t s = (old[i].hash_id * 2654435761u) & w->seen_mask;
+                while (w->seen[s].generation == w->generation)
+                    s = (s + 1) & w->seen_mask;
+                w->seen[s] = old[i];
+            }
+        }
+        free(old);
+        return a2l_convert_first_sight(w, hash_id);
+    }
+
+    w->seen[slot].hash_id = hash_id;
+    w->seen[slot].generation = w->generation;
+    w->num_seen++;
+    return 1;
+}
+
+static void
+a2l_convert_chunk(a2l_convworker_t *w, a2l_convchunk_t *chunk) {
+    a2l_textparser_t tp;
+    a2l_textrecord_t *rec = malloc(sizeof(a2l_textrecord_t));
+
+    if (!rec) {
+        chunk->failed = 1;
+        return;
+    }
+
+    // a fresh seen set: generation 0 is never current
+    w->generation++;
+    w->num_seen = 0;
+
+    a2l_text_init(&tp, &w->c->log, chunk->begin, chunk->end);
+    while (a2l_text_next(&tp, rec)) {
+        if (!rec->call) {
+            tp.malformed++;
+            continue;
+        }
+
+        if (a2l_convert_first_sight(w, rec->hash_id)) {
+            A2L_CONVERT_GROW(chunk->stacks, chunk->max_stacks, chunk->num_stacks + 1);
+            A2L_CONVERT_GROW(chunk->frames, chunk->max_frames, chunk->num_frames + rec->num_frames);
+            a2l_convstack_t *s = &chunk->stacks[chunk->num_stacks++];
+            s->hash_id = rec->hash_id;
+            s->num_frames = rec->num_frames;
+            s->first_frame = chunk->num_frames;
+            memcpy(chunk->frames + chunk->num_frames, rec->frames,
+                   rec->num_frames * sizeof(a2l_textframe_t));
+            chunk->num_frames += rec->num_frames;
+        }
+
+        a2l_convbuilder_t *b = a2l_convert_builder(w, rec->thread_id);
+        if (b->p - b->buf > A2L_CONVERT_BLOCK - A2L_CONVERT_RECORD_MAX)
+            a2l_convert_flush(w, chunk, b);
+        if (!b->num_events)
+            b->first_ts = b->prev_ts = rec->offset;
+
+        uint64_t dt = rec->offset - b->prev_ts;
+        b->prev_ts = rec->offset;
+        b->num_events++;
+        if (rec->call_len == 4 && memcmp(rec->call, "free", 4) == 0) {
+            *b->p++ = A2L_REC_FREE;
+            b->p = a2l_put_varint(b->p, dt);
+            b->p = a2l_put_varint(b->p, rec->ptr);
+            b->p = a2l_put_varint(b->p, rec->hash_id);
+            b->p = a2l_put_varint(b->p, 0);
+            b->p = a2l_put_varint(b->p, 0);
+        } else {
+            *b->p++ = A2L_REC_ALLOC;
+            b->p = a2l_put_varint(b->p, dt);
+            b->p = a2l_put_varint(b->p, rec->ptr);
+            b->p = a2l_put_varint(b->p, rec->bytes > 0 ? (uint64_t)rec->bytes : 0);
+            b->p = a2l_put_varint(b->p, rec->hash_id);
+        }
+    }
+
+    for (uint32_t i = 0; i <= w->builder_mask; i++)
+        if (w->builders[i].used)
+            a2l_convert_flush(w, chunk, &w->builders[i]);
+
+    chunk->records = tp.records;
+    chunk->malformed = tp.malformed;
+    free(rec);
+}
+
+static void *
+a2l_convert_worker(void *arg) {
+    a2l_convworker_t *w = arg;
+    a2l_convert_t *c = w->c;
+
+    w->builder_mask = 63;
+    w->builders = calloc(w->builder_mask + 1, sizeof(a2l_convbuilder_t));
+    w->seen_mask = 4095;
+    w->seen = calloc(w->seen_mask + 1, sizeof(a2l_convseen_t));
+    w->lz_table = malloc(A2L_LZ_TABLE_ENTRIES * sizeof(uint32_t));
+    if (!w->builders || !w->seen || !w->lz_table) {
+        fprintf(stderr, "a2l-convert: out of memory\n");
+        exit(1);
+    }
+
+    for (;;) {
+        // no further ahead of the writer than max_ahead chunks
+        pthread_mutex_lock(&c->lock);
+        while (c->next_chunk < c->num_chunks && c->next_chunk >= c->written + c->max_ahead)
+            pthread_cond_wait(&c->cond, &c->lock);
+        uint32_t i = c->next_chunk < c->num_chunks ? c->next_chunk++ : c->num_chunks;
+        pthread_mutex_unlock(&c->lock);
+        if (i == c->num_chunks)
+            break;
+
+        a2l_convert_chunk(w, &c->chunks[i]);
+
+        pthread_mutex_lock(&c->lock);
+        c->chunks[i].done = 1;
+        pthread_cond_broadcast(&c->cond);
+        pthread_mutex_unlock(&c->lock);
+    }
+
+    for (uint32_t i = 0; i <= w->builder_mask; i++)
+        free(w->builders[i].buf);
+    free(w->builders);
+    free(w->seen);
+    free(w->lz_table);
+    return NULL;
+}
+
+//
+// writer: definitions, then each chunk's blocks, in order
+//
+
+static int
+a2l_convert_write(a2l_convert_t *c, const void *data, size_t len) {
+    if (fwrite(data, 1, len, c->out) != len) {
+        fprintf(stderr, "a2l-convert: write failed: %s\n", strerror(errno));
+        return -1;
+    }
+    c->offset += len;
+    return 0;
+}
+
+// a buffer of blocks, each into the index
+static int
+a2l_convert_write_blocks(a2l_convert_t *c, const uint8_t *blocks, size_t len) {
+    for (size_t off = 0; off < len;) {
+        const a2l_blockheader_t *bh = (const a2l_blockheader_t *)(blocks + off);
+
+        A2L_CONVERT_GROW(c->index, c->max_index, c->num_index + 1);
+        a2l_blockindex_t *ix = &c->index[c->num_index++];
+        memset(ix, 0, sizeof(*ix));
+        ix->offset = c->offset + off;
+        ix->first_ts = bh->first_ts;
+        ix->last_ts = bh->last_ts;
+        ix->tid = bh->tid;
+        ix->num_events = bh->num_events;
+        ix->flags = bh->flags;
+        off += bh->header_bytes + bh->stored_bytes;
+    }
+    return a2l_convert_write(c, blocks, len);
+}
+
+static int
+a2l_convert_flush_defs(a2l_convert_t *c) {
+    uint8_t *out = c->block;
+    size_t len = 0, max = A2L_CONVERT_BLOCK_BYTES;
+
+    if (c->defs_p == c->defs)
+        return 0;
+    a2l_convert_block(&out, &len, &max, A2L_BLOCK_DEFINITIONS, 0, c->defs, c->defs_p - c->defs,
+                      0, 0, 0, c->lz_table);
+    c->defs_p = c->defs;
+    return a2l_convert_write_blocks(c, out, len);
+}
+
+// room for a definition of up to bytes
+static int
+a2l_convert_defs_room(a2l_convert_t *c, size_t bytes) {
+    if (c->defs + A2L_CONVERT_BLOCK - c->defs_p < (ptrdiff_t)bytes)
+        return a2l_convert_flush_defs(c);
+    return 0;
+}
+
+static int
+a2l_convert_define_module(a2l_convert_t *c, const a2l_convmodule_t *m, uint32_t id, uint64_t base) {
+    uint32_t len = m->path_len < 2048 ? m->path_len : 2048;
+
+    if (a2l_convert_defs_room(c, len + 32) < 0)
+        return -1;
+    *c->defs_p++ = A2L_REC_MODULE;
+    c->defs_p = a2l_put_varint(c->defs_p, id);
+    c->defs_p = a2l_put_varint(c->defs_p, base);
+    c->defs_p = a2l_put_varint(c->defs_p, len);
+    memcpy(c->defs_p, m->path, len);
+    c->defs_p += len;
+    return 0;
+}
+
+// the module id for a frame: by its path and, without a symbol to go
+// by, its base.  0 on a write error.
+static uint32_t
+a2l_convert_module(a2l_convert_t *c, const a2l_textframe_t *f) {
+    uint32_t slot = a2l_convert_hash(f->bin, f->bin_len, 0) & c->modules_mask;
+    a2l_convmodule_t *m;
+
+    while ((m = &c->modules[slot])->path &&
+           (m->path_len != f->bin_len || memcmp(m->path, f->bin, f->bin_len) != 0))
+        slot = (slot + 1) & c->modules_mask;
+
+    if (!m->path) {
+        if ((c->num_modules + 1) * 2 > c->modules_mask) {
+            a2l_convmodule_t *old = c->modules;
+            uint32_t old_mask = c->modules_mask;
+
+            c->modules_mask = old_mask * 2 + 1;
+            c->modules = calloc(c->modules_mask + 1, sizeof(a2l_convmodule_t));
+            if (!c->modules) {
+                fprintf(stderr, "a2l-convert: out of memory\n");
+                exit(1);
+            }
+            for (uint32_t i = 0; i <= old_mask; i++) {
+                if (old[i].path) {
+                    uint32_t s = a2l_convert_hash(old[i].path, old[i].path_len, 0) & c->modules_mask;
+                    while (c->modules[s].path)
+                        s = (s + 1) & c->modules_mask;
+                    c->modules[s] = old[i];
+                }
+            }
+            free(old);
+            return a2l_convert_module(c, f);
+        }
+        m->path = f->bin;
+        m->path_len = f->bin_len;
+        c->num_modules++;
+    }
+
+    // symbolized: any module of that path will do
+    if (f->func_len) {
+        if (m->id)
+            return m->id;
+        if (!m->unknown_id) {
+            m->unknown_id = ++c->next_module_id;
+            if (a2l_convert_define_module(c, m, m->unknown_id, 0) < 0)
+                return 0;
+        }
+        return m->unknown_id;
+    }
+
+    // offset is from the base: a new base, a new module
+    uint64_t base = f->addr - f->offset;
+    if (!m->id || m->base != base) {
+        m->id = ++c->next_module_id;
+        m->base = base;
+        if (a2l_convert_define_module(c, m, m->id, base) < 0)
+            return 0;
+    }
+    return m->id;
+}
+
+// 0 on a write error
+static uint32_t
+a2l_convert_symbol(a2l_convert_t *c, const a2l_textframe_t *f, uint32_t module_id) {
+    uint32_t slot = a2l_convert_hash(f->func, f->func_len, module_id) & c->symbols_mask;
+    a2l_convsymbol_t *s;
+
+    while ((s = &c->symbols[slot])->name &&
+           (s->module_id != module_id || s->name_len != f->func_len ||
+            memcmp(s->name, f->func, f->func_len) != 0))
+        slot = (slot + 1) & c->symbols_mask;
+    if (s->name)
+        return s->id;
+
+    if ((c->num_symbols + 1) * 2 > c->symbols_mask) {
+        a2l_convsymbol_t *old = c->symbols;
+        uint32_t old_mask = c->symbols_mask;
+
+        c->symbols_mask = old_mask * 2 + 1;
+        c->symbols = calloc(c->symbols_mask + 1, sizeof(a2l_convsymbol_t));
+        if (!c->symbols) {
+            fprintf(stderr, "a2l-convert: out of memory\n");
+            exit(1);
+        }
+        for (uint32_t i = 0; i <= old_mask; i++) {
+            if (old[i].name) {
+                uint32_t n = a2l_convert_hash(old[i].name, old[i].name_len, old[i].module_id) &
+                             c->symbols_mask;
+                while (c->symbols[n].name)
+                    n = (n + 1) & c->symbols_mask;
+                c->symbols[n] = old[i];
+            }
+        }
+        free(old);
+        return a2l_convert_symbol(c, f, module_id);
+    }
+
+    uint32_t len = f->func_len < 2048 ? f->func_len : 2048;
+    s->name = f->func;
+    s->name_len = f->func_len;
+    s->module_id = module_id;
+    s->id = ++c->num_symbols;
+
+    if (a2l_convert_defs_room(c, len + 48) < 0)
+        return 0;
+    *c->defs_p++ = A2L_REC_SYMBOL;
+    c->defs_p = a2l_put_varint(c->defs_p, s->id);
+    c->defs_p = a2l_put_varint(c->defs_p, module_id);
+    c->defs_p = a2l_put_varint(c->defs_p, f->addr - f->offset);
+    c->defs_p = a2l_put_varint(c->defs_p, len);
+    memcpy(c->defs_p, f->func, len);
+    c->defs_p += len;
+    return s->id;
+}
+
+// 1 if hash_id is newly defined
+static int
+a2l_convert_new_stack(a2l_convert_t *c, uint32_t hash_id) {
+    uint32_t slot = (hash_id * 2654435761u) & c->stacks_mask;
+
+    while (c->stacks_defined[slot] && c->stacks_defined[slot] != hash_id + 1)
+        slot = (slot + 1) & c->stacks_mask;
+    if (c->stacks_defined[slot])
+        return 0;
+
+    if ((c->num_stacks + 1) * 2 > c->stacks_mask) {
+        uint32_t *old = c->stacks_defined, old_mask = c->stacks_mask;
+
+        c->stacks_mask = old_mask * 2 + 1;
+        c->stacks_defined = calloc(c->stacks_mask + 1, sizeof(uint32_t));
+        if (!c->stacks_defined) {
+            fprintf(stderr, "a2l-convert: out of memory\n");
+            exit(1);
+        }
+        for (uint32_t i = 0; i <= old_mask; i++) {
+            if (old[i]) {
+                uint32_t s = ((old[i] - 1) * 2654435761u) & c->stacks_mask;
+                while (c->stacks_defined[s])
+                    s = (s + 1) & c->stacks_mask;
+                c->stacks_defined[s] = old[i];
+            }
+        }
+        free(old);
+        return a2l_convert_new_stack(c, hash_id);
+    }
+
+    c->stacks_defined[slot] = hash_id + 1;
+    c->num_stacks++;
+    return 1;
+}
+
+static int
+a2l_convert_define_stacks(a2l_convert_t *c, const a2l_convchunk_t *chunk) {
+    uint32_t module_ids[A2L_TEXT_MAX_FRAMES], symbol_ids[A2L_TEXT_MAX_FRAMES];
+
+    for (uint32_t i = 0; i < chunk->num_stacks; i++) {
+        const a2l_convstack_t *s = &chunk->stacks[i];
+        const a2l_textframe_t *frames = chunk->frames + s->first_frame;
+
+        if (!a2l_convert_new_stack(c, s->hash_id))
+            continue;
+
+        // modules and symbols first: a definition precedes its use
+        for (uint32_t j = 0; j < s->num_frames; j++) {
+            if (!(module_ids[j] = a2l_convert_module(c, &frames[j])))
+                return -1;
+            symbol_ids[j] = 0;
+            if (frames[j].func_len && !(symbol_ids[j] = a2l_convert_symbol(c, &frames[j], module_ids[j])))
+                return -1;
+        }
+
+        if (a2l_convert_defs_room(c, 16 + (size_t)s->num_frames * 3 * 10) < 0)
+            return -1;
+        *c->defs_p++ = A2L_REC_STACK;
+        c->defs_p = a2l_put_varint(c->defs_p, s->hash_id);
+        c->defs_p = a2l_put_varint(c->defs_p, s->num_frames);
+        uint64_t prev = 0;
+        for (uint32_t j = 0; j < s->num_frames; j++) {
+            c->defs_p = a2l_put_varint(c->defs_p, a2l_zigzag((int64_t)(frames[j].addr - prev)));
+            c->defs_p = a2l_put_varint(c->defs_p, module_ids[j]);
+            c->defs_p = a2l_put_varint(c->defs_p, symbol_ids[j]);
+            prev = frames[j].addr;
+        }
+    }
+    return a2l_convert_flush_defs(c);
+}
+
+// pid from an a2l-<pid>.log name, or 0
+static uint32_t
+a2l_convert_pid(const char *path) {
+    const char *name = strrchr(path, '/');
+    unsigned pid = 0;
+
+    name = name ? name + 1 : path;
+    if (sscanf(name, "a2l-%u", &pid) != 1)
+        return 0;
+    return pid;
+}
+
+int
+main(int argc, char **argv) {
+    int num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    const char *out_path = NULL;
+    char default_out[A2L_CONVERT_PATH_MAX], error[256];
+    a2l_convert_t c;
+    int opt;
+
+    memset(&c, 0, sizeof(c));
+
+    while ((opt = getopt(argc, argv, "j:o:h")) != -1) {
+        switch (opt) {
+        case 'j': num_threads = atoi(optarg); break;
+        case 'o': out_path = optarg; break;
+        default:
+            a2l_convert_usage();
+            return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        a2l_convert_usage();
+        return 1;
+    }
+    if (num_threads < 1)
+        num_threads = 1;
+    if (num_threads > A2L_CONVERT_MAX_THREADS)
+        num_threads = A2L_CONVERT_MAX_THREADS;
+
+    const char *log_path = argv[optind];
+    if (!out_path) {
+        size_t len = strlen(log_path);
+        if (len > 4 && strcmp(log_path + len - 4, ".log") == 0)
+            len -= 4;
+        snprintf(default_out, sizeof(default_out), "%.*s.a2l", (int)len, log_path);
+        out_path = default_out;
+    }
+
+    double start = a2l_convert_now();
+    if (a2l_text_open(&c.log, log_path, error, sizeof(error)) < 0) {
+        fprintf(stderr, "a2l-convert: %s\n", error);
+        return 1;
+    }
+
+    // chunks start at records
+    c.num_chunks = (uint32_t)(c.log.size / A2L_CONVERT_CHUNK) + 1;
+    uint64_t *bounds = malloc((c.num_chunks + 1) * sizeof(uint64_t));
+    c.chunks = calloc(c.num_chunks, sizeof(a2l_convchunk_t));
+    c.modules_mask = c.symbols_mask = c.stacks_mask = 1023;
+    c.modules = calloc(c.modules_mask + 1, sizeof(a2l_convmodule_t));
+    c.symbols = calloc(c.symbols_mask + 1, sizeof(a2l_convsymbol_t));
+    c.stacks_defined = calloc(c.stacks_mask + 1, sizeof(uint32_t));
+    c.defs = c.defs_p = malloc(A2L_CONVERT_BLOCK);
+    c.block = malloc(A2L_CONVERT_BLOCK_BYTES);
+    c.lz_table = malloc(A2L_LZ_TABLE_ENTRIES * sizeof(uint32_t));
+    if (!bounds || !c.chunks || !c.modules || !c.symbols || !c.stacks_defined ||
+        !c.defs || !c.block || !c.lz_table) {
+        fprintf(stderr, "a2l-convert: out of memory\n");
+        return 1;
+    }
+    if (c.log.size)
+        a2l_text_split(&c.log, c.num_chunks, bounds);
+    else
+        bounds[0] = bounds[1] = 0;
+    for (uint32_t i = 0; i < c.num_chunks; i++) {
+        c.chunks[i].begin = bounds[i];
+        c.chunks[i].end = bounds[i + 1];
+    }
+    free(bounds);
+
+    if (!(c.out = fopen(out_path, "wb"))) {
+        fprintf(stderr, "a2l-convert: can't create %s: %s\n", out_path, strerror(errno));
+        return 1;
+    }
+    setvbuf(c.out, NULL, _IOFBF, 1 << 20);
+
+    // no clock in a text log: times are byte offsets
+    a2l_fileheader_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = A2L_TRACE_MAGIC;
+    header.version = A2L_TRACE_VERSION;
+    header.header_bytes = sizeof(header);
+    header.pid = a2l_convert_pid(log_path);
+    if (a2l_convert_write(&c, &header, sizeof(header)) < 0)
+        return 1;
+
+    pthread_mutex_init(&c.lock, NULL);
+    pthread_cond_init(&c.cond, NULL);
+    c.max_ahead = 2 * (uint32_t)num_threads;
+    a2l_convworker_t *workers = calloc(num_threads, sizeof(a2l_convworker_t));
+    if (!workers) {
+        fprintf(stderr, "a2l-convert: out of memory\n");
+        return 1;
+    }
+    for (int i = 0; i < num_threads; i++) {
+        workers[i].c = &c;
+        if (pthread_create(&workers[i].thread, NULL, a2l_convert_worker, &workers[i]) != 0) {
+            fprintf(stderr, "a2l-convert: can't start threads: %s\n", strerror(errno));
+            return 1;
+        }
+    }
+
+    uint64_t records = 0, malformed = 0;
+    int failed = 0;
+    for (uint32_t i = 0; i < c.num_chunks; i++) {
+        a2l_convchunk_t *chunk = &c.chunks[i];
+
+        pthread_mutex_lock(&c.lock);
+        while (!chunk->done)
+            pthread_cond_wait(&c.cond, &c.lock);
+        pthread_mutex_unlock(&c.lock);
+
+        if (!failed && (chunk->failed || a2l_convert_define_stacks(&c, chunk) < 0 ||
+                        a2l_convert_write_blocks(&c, chunk->blocks, chunk->blocks_len) < 0))
+            failed = 1;
+        records += chunk->records;
+        malformed += chunk->malformed;
+        free(chunk->blocks);
+        free(chunk->stacks);
+        free(chunk->frames);
+        memset(chunk, 0, sizeof(*chunk));
+
+        pthread_mutex_lock(&c.lock);
+        c.written = i + 1;
+        pthread_cond_broadcast(&c.cond);
+        pthread_mutex_unlock(&c.lock);
+    }
+    for (int i = 0; i < num_threads; i++)
+        pthread_join(workers[i].thread, NULL);
+
+    a2l_filetrailer_t trailer;
+    trailer.index_offset = c.offset;
+    trailer.num_blocks = c.num_index;
+    trailer.magic = A2L_TRAILER_MAGIC;
+    if (failed || a2l_convert_write(&c, c.index, c.num_index * sizeof(a2l_blockindex_t)) < 0 ||
+        a2l_convert_write(&c, &trailer, sizeof(trailer)) < 0 || fclose(c.out) != 0) {
+        fprintf(stderr, "a2l-convert: can't write %s\n", out_path);
+        return 1;
+    }
+
+    double elapsed = a2l_convert_now() - start;
+    printf("%" PRIu64 " records, %u stacks: %.1f MiB of log to %.1f MiB in %s, %.2f s on %d threads (%.0f MiB/s)\n",
+           records, c.num_stacks, c.log.size / (1024.0 * 1024.0), c.offset / (1024.0 * 1024.0),
+           out_path, elapsed, num_threads, c.log.size / (1024.0 * 1024.0) / (elapsed > 0 ? elapsed : 1));
+    if (malformed)
+        printf("%" PRIu64 " malformed records skipped\n", malformed);
+
+    a2l_text_close(&c.log);
+    return 0;
+}
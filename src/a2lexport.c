@@ -0,0 +1,1453 @@
+#define _GNU_SOURCE
+// a2l-export -- convert a binary trace for other tools
+//
+// usage: a2l-export [-f columns] [-u] [-t] [-o dir] <trace>
+//        a2l-export -f chrome|perfetto [-s ms] [-o file] <trace>
+//        a2l-export -f massif [-n snapshots] [-d every] [-o file] <trace>
+//
+// <trace> is a binary trace (A2L_FORMAT=binary), or the manifest of a
+// segmented one.  -f columns, the default, writes the columnar layout
+// described in a2lcolumns.h into dir, <trace>.columns unless given;
+// -u leaves the columns unencoded and uncompressed, to mmap as arrays.
+// -t writes rows in time order across threads (a2l_merge) rather than
+// in trace order.
+//
+// -f chrome writes a timeline for trace viewers (chrome://tracing,
+// ui.perfetto.dev) in the trace event json format, to <trace>.json
+// unless given; -f perfetto writes the same as perfetto's protobuf
+// trace, to <trace>.pftrace.  events are summed per thread in slices
+// of -s milliseconds (default 10): each thread's busy slices are
+// spans, from their first event to their last, named for the site
+// that allocated most in them, with their counts; per thread, a
+// counter of bytes allocated and freed each slice; for the process,
+// a counter of live bytes.  times are CLOCK_MONOTONIC, and pids and
+// tids the real ones, so the spans line up with the program's own
+// trace events loaded beside them.
+//
+// -f massif writes heap snapshots as valgrind's massif does, for
+// ms_print and the like, to <trace>.massif: -n of them (default 100)
+// evenly over the trace, every -d-th (default 10) and the last with a
+// heap tree, the sites' live bytes by call path, paths under 1% of the
+// heap folded into one line; and the peak's tree.  one pass keeps each
+// site's live bytes; the peak is copied whenever the heap starts to
+// shrink from more than 1% above the last copy, as massif's
+// --peak-inaccuracy has it.  frees that don't say what they freed
+// can't be counted and are left out.  a trace whose first segments
+// were compacted has lost the start of its heap: the snapshots start
+// at the first whole keyframe left, seeded from its live blocks, and
+// replay the events after it as a2lformat.h says.
+//
+// events stream through in batches (liba2lread): memory is a chunk per
+// column, a slice's sums per thread, or the live sites, plus the
+// definitions, whatever the trace's size.  compacted segments have no
+// events left and are skipped.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#include "a2lread.h"
+#include "a2llz.h"
+#include "a2lcolumns.h"
+#include "a2lpb.h"
+
+#define A2L_EXPORT_CHUNK_ROWS (64*1024)
+#define A2L_EXPORT_BATCH (16*1024)
+#define A2L_EXPORT_PATH_MAX 4096
+#define A2L_EXPORT_SLICE_SITES 8        // sites a thread's slice keeps count of
+#define A2L_EXPORT_MASSIF_THRESHOLD 1.0 // percent of the heap a tree's path needs
+
+typedef struct {
+    const char *name;
+    uint8_t width;
+    uint8_t encoding;
+    int fd;
+    uint8_t *values;                // chunk_rows values
+    uint32_t num_values;
+    uint64_t rows;
+    uint64_t offset;                // where the next chunk goes
+    a2l_colchunk_t *chunks;
+    uint32_t num_chunks, max_chunks;
+}a2l_column_t;
+
+enum {
+    A2L_COL_TS,
+    A2L_COL_TYPE,
+    A2L_COL_SIZE,
+    A2L_COL_STACK,
+    A2L_COL_THREAD,
+    A2L_COL_PTR,
+    A2L_COL_COUNT
+};
+
+typedef struct {
+    a2l_reader_t *reader;
+    a2l_column_t columns[A2L_COL_COUNT];
+    int raw;                        // -u
+    int time_order;                 // -t
+
+    // scratch
+    uint8_t *shuffled, *stored;
+    uint32_t *lz_table;
+
+    uint64_t bytes_written;
+    uint64_t events, slices;        // -f chrome, perfetto; slices are massif's snapshots
+}a2l_export_t;
+
+static void
+a2l_export_usage(void) {
+    fprintf(stderr, "usage: a2l-export [-f columns] [-u] [-t] [-o dir] <trace>\n"
+                    "       a2l-export -f chrome|perfetto [-s ms] [-o file] <trace>\n"
+                    "       a2l-export -f massif [-n snapshots] [-d every] [-o file] <trace>\n");
+}
+
+//
+// columns
+//
+
+static int
+a2l_column_open(a2l_column_t *c, const char *dir, const char *name, int width, int encoding) {
+    char path[A2L_EXPORT_PATH_MAX];
+
+    memset(c, 0, sizeof(*c));
+    c->name = name;
+    c->width = (uint8_t)width;
+    c->encoding = (uint8_t)encoding;
+    c->offset = sizeof(a2l_colheader_t);
+
+    if (snprintf(path, sizeof(path), "%s/%s" A2L_COLUMN_EXT, dir, name) >= (int)sizeof(path)) {
+        fprintf(stderr, "a2l-export: path too long: %s/%s" A2L_COLUMN_EXT "\n", dir, name);
+        return -1;
+    }
+    c->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    c->values = malloc((size_t)A2L_EXPORT_CHUNK_ROWS * width);
+    if (c->fd < 0 || !c->values) {
+        fprintf(stderr, "a2l-export: can't create %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static int
+a2l_column_pwrite(a2l_export_t *x, a2l_column_t *c, const void *data, size_t len, uint64_t offset) {
+    if (pwrite(c->fd, data, len, offset) != (ssize_t)len) {
+        fprintf(stderr, "a2l-export: can't write %s: %s\n", c->name, strerror(errno));
+        return -1;
+    }
+    x->bytes_written += len;
+    return 0;
+}
+
+// encode, compress and write the chunk's values
+static int
+a2l_column_flush(a2l_export_t *x, a2l_column_t *c) {
+    uint32_t n = c->num_values, w = c->width;
+    size_t raw_bytes = (size_t)n * w;
+    const uint8_t *data = c->values;
+
+    if (!n)
+        return 0;
+
+    // min and max before encoding changes them
+    uint64_t min = UINT64_MAX, max = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        uint64_t v = 0;
+        memcpy(&v, c->values + (size_t)i * w, w);
+        if (v < min) min = v;
+        if (v > max) max = v;
+    }
+
+    if (c->encoding & A2L_COLENC_DELTA) {
+        // back to front, in place; w is 8 for every delta column
+        uint64_t *v = (uint64_t *)c->values;
+        for (uint32_t i = n; i-- > 1;)
+            v[i] -= v[i - 1];
+    }
+    if (c->encoding & A2L_COLENC_SHUFFLE) {
+        for (uint32_t i = 0; i < n; i++)
+            for (uint32_t k = 0; k < w; k++)
+                x->shuffled[(size_t)k * n + i] = c->values[(size_t)i * w + k];
+        data = x->shuffled;
+    }
+
+    a2l_colchunk_t chunk = {0};
+    chunk.offset = c->offset;
+    chunk.rows = n;
+    chunk.min = min;
+    chunk.max = max;
+    chunk.codec = A2L_CODEC_NONE;
+    chunk.stored_bytes = (uint32_t)raw_bytes;
+    if (!x->raw) {
+        size_t stored = a2l_lz_compress(data, raw_bytes, x->stored, x->lz_table);
+        if (stored < raw_bytes) {
+            chunk.codec = A2L_CODEC_LZ;
+            chunk.stored_bytes = (uint32_t)stored;
+            data = x->stored;
+        }
+    }
+    chunk.checksum = a2l_checksum(data, chunk.stored_bytes);
+
+    if (a2l_column_pwrite(x, c, data, chunk.stored_bytes, c->offset) < 0)
+        return -1;
+
+    if (c->num_chunks == c->max_chunks) {
+        uint32_t max = c->max_chunks ? c->max_chunks * 2 : 64;
+        a2l_colchunk_t *chunks = realloc(c->chunks, max * sizeof(a2l_colchunk_t));
+        if (!chunks) {
+            fprintf(stderr, "a2l-export: out of memory\n");
+            return -1;
+        }
+        c->chunks = chunks;
+        c->max_chunks = max;
+    }
+    c->chunks[c->num_chunks++] = chunk;
+    c->offset += chunk.stored_bytes;
+    c->rows += n;
+    c->num_values = 0;
+    return 0;
+}
+
+// n values, each as wide as the column
+static int
+a2l_column_append(a2l_export_t *x, a2l_column_t *c, const void *values, uint32_t n) {
+    const uint8_t *v = values;
+
+    while (n) {
+        uint32_t take = A2L_EXPORT_CHUNK_ROWS - c->num_values;
+        if (take > n)
+            take = n;
+        memcpy(c->values + (size_t)c->num_values * c->width, v, (size_t)take * c->width);
+        c->num_values += take;
+        v += (size_t)take * c->width;
+        n -= take;
+
+        if (c->num_values == A2L_EXPORT_CHUNK_ROWS && a2l_column_flush(x, c) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+// the last chunk, the index, then the header
+static int
+a2l_column_close(a2l_export_t *x, a2l_column_t *c) {
+    a2l_colheader_t header = {0};
+
+    if (a2l_column_flush(x, c) < 0 ||
+        a2l_column_pwrite(x, c, c->chunks, c->num_chunks * sizeof(a2l_colchunk_t), c->offset) < 0)
+        return -1;
+
+    header.magic = A2L_COLUMN_MAGIC;
+    header.version = A2L_COLUMN_VERSION;
+    header.header_bytes = sizeof(a2l_colheader_t);
+    snprintf(header.name, sizeof(header.name), "%s", c->name);
+    header.width = c->width;
+    header.encoding = c->encoding;
+    header.chunk_rows = A2L_EXPORT_CHUNK_ROWS;
+    header.rows = c->rows;
+    header.index_offset = c->offset;
+    header.num_chunks = c->num_chunks;
+    header.pid = a2l_read_info(x->reader)->pid;
+    header.start_realtime_ns = a2l_read_info(x->reader)->start_realtime_ns;
+    if (a2l_column_pwrite(x, c, &header, sizeof(header), 0) < 0)
+        return -1;
+
+    close(c->fd);
+    free(c->values);
+    free(c->chunks);
+    return 0;
+}
+
+//
+// stacks dictionary
+//
+
+static int
+a2l_export_stacks(a2l_export_t *x, const char *dir) {
+    char path[A2L_EXPORT_PATH_MAX], frame[1024];
+
+    if (snprintf(path, sizeof(path), "%s/" A2L_COLUMN_STACKS, dir) >= (int)sizeof(path)) {
+        fprintf(stderr, "a2l-export: path too long: %s/" A2L_COLUMN_STACKS "\n", dir);
+        return -1;
+    }
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        fprintf(stderr, "a2l-export: can't create %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < a2l_read_num_stacks(x->reader); i++) {
+        const a2l_stack_t *stack = a2l_read_stack_at(x->reader, i);
+
+        fprintf(out, "%08x\t", stack->id);
+        for (uint32_t j = 0; j < stack->num_frames; j++) {
+            a2l_read_frame_name(x->reader, &stack->frames[j], frame, sizeof(frame));
+            fprintf(out, j ? ";%s" : "%s", frame);
+        }
+        fputc('\n', out);
+    }
+
+    x->bytes_written += ftell(out);
+    if (fclose(out) != 0) {
+        fprintf(stderr, "a2l-export: can't write %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static int
+a2l_export_columns(a2l_export_t *x, const char *dir) {
+    a2l_column_t *c = x->columns;
+    a2l_merge_t *merge = NULL;
+    a2l_iter_t it;
+    int delta = x->raw ? 0 : A2L_COLENC_DELTA;
+    int shuffle = x->raw ? 0 : A2L_COLENC_SHUFFLE;
+
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        fprintf(stderr, "a2l-export: can't create %s: %s\n", dir, strerror(errno));
+        return -1;
+    }
+
+    x->shuffled = malloc((size_t)A2L_EXPORT_CHUNK_ROWS * sizeof(uint64_t));
+    x->stored = malloc(A2L_LZ_BOUND((size_t)A2L_EXPORT_CHUNK_ROWS * sizeof(uint64_t)));
+    x->lz_table = malloc(A2L_LZ_TABLE_ENTRIES * sizeof(uint32_t));
+    if (!x->shuffled || !x->stored || !x->lz_table) {
+        fprintf(stderr, "a2l-export: out of memory\n");
+        return -1;
+    }
+
+    // timestamps climb: their deltas are small
+    if (a2l_column_open(&x->columns[A2L_COL_TS], dir, "ts", 8, delta | shuffle) < 0 ||
+        a2l_column_open(&x->columns[A2L_COL_TYPE], dir, "type", 1, 0) < 0 ||
+        a2l_column_open(&x->columns[A2L_COL_SIZE], dir, "size", 8, shuffle) < 0 ||
+        a2l_column_open(&x->columns[A2L_COL_STACK], dir, "stack", 4, shuffle) < 0 ||
+        a2l_column_open(&x->columns[A2L_COL_THREAD], dir, "thread", 4, shuffle) < 0 ||
+        a2l_column_open(&x->columns[A2L_COL_PTR], dir, "ptr", 8, shuffle) < 0)
+        return -1;
+
+    a2l_batch_t *b = a2l_batch_alloc(A2L_EXPORT_BATCH);
+    if (!b) {
+        fprintf(stderr, "a2l-export: out of memory\n");
+        return -1;
+    }
+
+    // a column at a time, a batch at a time
+    a2l_iter_init(&it, x->reader, 0, a2l_read_info(x->reader)->num_blocks);
+    if (x->time_order && !(merge = a2l_merge_open(&x->reader, 1))) {
+        fprintf(stderr, "a2l-export: out of memory\n");
+        return -1;
+    }
+    while (merge ? a2l_merge_batch(merge, b) : a2l_iter_batch(&it, b)) {
+        if (a2l_column_append(x, &c[A2L_COL_TS], b->ts, b->count) < 0 ||
+            a2l_column_append(x, &c[A2L_COL_TYPE], b->type, b->count) < 0 ||
+            a2l_column_append(x, &c[A2L_COL_SIZE], b->bytes, b->count) < 0 ||
+            a2l_column_append(x, &c[A2L_COL_STACK], b->stack_id, b->count) < 0 ||
+            a2l_column_append(x, &c[A2L_COL_THREAD], b->tid, b->count) < 0 ||
+            a2l_column_append(x, &c[A2L_COL_PTR], b->ptr, b->count) < 0)
+            return -1;
+    }
+    uint64_t bad_blocks = merge ? a2l_merge_bad_blocks(merge) : it.bad_blocks;
+    if (bad_blocks)
+        fprintf(stderr, "a2l-export: %" PRIu64 " damaged blocks skipped\n", bad_blocks);
+    a2l_merge_close(merge);
+    a2l_iter_free(&it);
+    a2l_batch_free(b);
+
+    for (int i = 0; i < A2L_COL_COUNT; i++)
+        if (a2l_column_close(x, &x->columns[i]) < 0)
+            return -1;
+    return a2l_export_stacks(x, dir);
+}
+
+//
+// time slices, -f chrome and -f perfetto
+//
+
+// a thread's events in the slice being summed
+typedef struct {
+    uint32_t tid;
+    uint32_t counted;               // its counters were set last slice: zero them
+    uint64_t events, allocs, frees;
+    uint64_t bytes_alloced, bytes_freed;
+    uint64_t first_ts, last_ts;
+    uint64_t uuid;                  // perfetto: its slices' track
+    uint32_t num_sites;
+    uint32_t site[A2L_EXPORT_SLICE_SITES];
+    uint64_t site_bytes[A2L_EXPORT_SLICE_SITES];
+}a2l_slicethread_t;
+
+typedef struct {
+    a2l_export_t *x;
+    FILE *f;
+    int perfetto;
+    uint32_t pid;
+    uint64_t start_ns;              // events' ts are from here
+    uint64_t slice_ns;
+    uint64_t slice;                 // being summed
+    int started;
+    int64_t live;
+    a2l_slicethread_t *threads;
+    uint32_t num_threads, max_threads;
+    uint32_t *slots;                // thread index + 1, by tid
+    uint32_t mask;
+    uint32_t *active;               // threads with events or counters to zero
+    uint32_t num_active;
+    uint64_t slices, events;        // written
+    a2l_pb_t packet, event, msg;    // perfetto's scratch
+    uint64_t process_uuid, heap_uuid;
+}a2l_slices_t;
+
+// perfetto's trace.proto: the fields used
+#define A2L_PF_TRACE_PACKET              1
+#define A2L_PF_PACKET_CLOCK_SNAPSHOT     6
+#define A2L_PF_PACKET_TIMESTAMP          8
+#define A2L_PF_PACKET_SEQUENCE_ID        10
+#define A2L_PF_PACKET_TRACK_EVENT        11
+#define A2L_PF_PACKET_SEQUENCE_FLAGS     13
+#define A2L_PF_PACKET_CLOCK_ID           58
+#define A2L_PF_PACKET_TRACK_DESCRIPTOR   60
+#define A2L_PF_SNAPSHOT_CLOCKS           1
+#define A2L_PF_SNAPSHOT_PRIMARY_CLOCK    2
+#define A2L_PF_CLOCK_ID                  1
+#define A2L_PF_CLOCK_TIMESTAMP           2
+#define A2L_PF_TRACK_UUID                1
+#define A2L_PF_TRACK_NAME                2
+#define A2L_PF_TRACK_PROCESS             3
+#define A2L_PF_TRACK_THREAD              4
+#define A2L_PF_TRACK_PARENT_UUID         5
+#define A2L_PF_TRACK_COUNTER             8
+#define A2L_PF_PROCESS_PID               1
+#define A2L_PF_THREAD_PID                1
+#define A2L_PF_THREAD_TID                2
+#define A2L_PF_COUNTER_UNIT              3
+#define A2L_PF_EVENT_DEBUG_ANNOTATIONS   4
+#define A2L_PF_EVENT_TYPE                9
+#define A2L_PF_EVENT_TRACK_UUID          11
+#define A2L_PF_EVENT_CATEGORIES          22
+#define A2L_PF_EVENT_NAME                23
+#define A2L_PF_EVENT_COUNTER_VALUE       30
+#define A2L_PF_ANNOTATION_UINT_VALUE     3
+#define A2L_PF_ANNOTATION_NAME           10
+
+#define A2L_PF_CLOCK_REALTIME            1
+#define A2L_PF_CLOCK_MONOTONIC           3
+#define A2L_PF_SEQ_CLEARED               1   // sequence_flags: incremental state cleared
+#define A2L_PF_SEQ_NEEDS_STATE           2
+#define A2L_PF_SLICE_BEGIN               1
+#define A2L_PF_SLICE_END                 2
+#define A2L_PF_COUNTER                   4
+#define A2L_PF_UNIT_BYTES                3
+
+// a perfetto track's uuid: tracks are global to a trace, and traces
+// can be concatenated, so it's the pid's and tid's as well
+static uint64_t
+a2l_slices_uuid(uint32_t pid, uint32_t tid, uint32_t kind) {
+    uint64_t z = (((uint64_t)pid << 32 | tid) << 2 | kind) + 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static void
+a2l_export_json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fprintf(f, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            fprintf(f, "\\u%04x", (unsigned char)*s);
+        else
+            fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+// packet is a TracePacket at ts; out it goes as one of the Trace's
+static void
+a2l_perfetto_begin(a2l_slices_t *s, uint64_t ts) {
+    s->packet.len = 0;
+    a2l_pb_int(&s->packet, A2L_PF_PACKET_TIMESTAMP, ts);
+    a2l_pb_int(&s->packet, A2L_PF_PACKET_CLOCK_ID, A2L_PF_CLOCK_MONOTONIC);
+    a2l_pb_int(&s->packet, A2L_PF_PACKET_SEQUENCE_ID, 1);
+}
+
+static int
+a2l_perfetto_end(a2l_slices_t *s) {
+    uint8_t head[16];
+    a2l_pb_t h = {head, 0, sizeof(head), 0};
+
+    if (s->packet.failed) {
+        fprintf(stderr, "a2l-export: out of memory\n");
+        return -1;
+    }
+    a2l_pb_varint(&h, (uint64_t)A2L_PF_TRACE_PACKET << 3 | 2);
+    a2l_pb_varint(&h, s->packet.len);
+    // a failed write shows in ferror, at the end
+    if (fwrite(head, 1, h.len, s->f) != h.len || fwrite(s->packet.p, 1, s->packet.len, s->f) != s->packet.len)
+        return -1;
+    return 0;
+}
+
+// a TrackDescriptor: a thread's (tid set), the process's (tid 0), or
+// a counter of bytes under parent
+static int
+a2l_perfetto_track(a2l_slices_t *s, uint64_t ts, uint64_t uuid, uint64_t parent, uint32_t tid, const char *name) {
+    a2l_perfetto_begin(s, ts);
+    s->event.len = 0;
+    a2l_pb_int(&s->event, A2L_PF_TRACK_UUID, uuid);
+    if (name)
+        a2l_pb_string(&s->event, A2L_PF_TRACK_NAME, name);
+    s->msg.len = 0;
+    if (parent) {
+        a2l_pb_int(&s->event, A2L_PF_TRACK_PARENT_UUID, parent);
+        a2l_pb_int(&s->msg, A2L_PF_COUNTER_UNIT, A2L_PF_UNIT_BYTES);
+        a2l_pb_message(&s->event, A2L_PF_TRACK_COUNTER, &s->msg);
+    } else if (tid) {
+        a2l_pb_int(&s->msg, A2L_PF_THREAD_PID, s->pid);
+        a2l_pb_int(&s->msg, A2L_PF_THREAD_TID, tid);
+        a2l_pb_message(&s->event, A2L_PF_TRACK_THREAD, &s->msg);
+    } else {
+        a2l_pb_int(&s->msg, A2L_PF_PROCESS_PID, s->pid);
+        a2l_pb_message(&s->event, A2L_PF_TRACK_PROCESS, &s->msg);
+    }
+    a2l_pb_message(&s->packet, A2L_PF_PACKET_TRACK_DESCRIPTOR, &s->event);
+    return a2l_perfetto_end(s);
+}
+
+static void
+a2l_perfetto_annotation(a2l_slices_t *s, const char *name, uint64_t value) {
+    s->msg.len = 0;
+    a2l_pb_string(&s->msg, A2L_PF_ANNOTATION_NAME, name);
+    a2l_pb_int(&s->msg, A2L_PF_ANNOTATION_UINT_VALUE, value);
+    a2l_pb_message(&s->event, A2L_PF_EVENT_DEBUG_ANNOTATIONS, &s->msg);
+}
+
+static int
+a2l_perfetto_counter(a2l_slices_t *s, uint64_t ts, uint64_t uuid, int64_t value) {
+    a2l_perfetto_begin(s, ts);
+    a2l_pb_int(&s->packet, A2L_PF_PACKET_SEQUENCE_FLAGS, A2L_PF_SEQ_NEEDS_STATE);
+    s->event.len = 0;
+    a2l_pb_int(&s->event, A2L_PF_EVENT_TYPE, A2L_PF_COUNTER);
+    a2l_pb_int(&s->event, A2L_PF_EVENT_TRACK_UUID, uuid);
+    a2l_pb_int(&s->event, A2L_PF_EVENT_COUNTER_VALUE, (uint64_t)value);
+    a2l_pb_message(&s->packet, A2L_PF_PACKET_TRACK_EVENT, &s->event);
+    return a2l_perfetto_end(s);
+}
+
+// the clock, and the process's tracks
+static int
+a2l_slices_start(a2l_slices_t *s) {
+    const a2l_readinfo_t *info = a2l_read_info(s->x->reader);
+
+    if (!s->perfetto) {
+        fprintf(s->f, "{\"traceEvents\":[\n");
+        return 0;
+    }
+
+    // timestamps are CLOCK_MONOTONIC, as the trace has them; the
+    // realtime clock beside it gives the wall clock
+    s->packet.len = 0;
+    a2l_pb_int(&s->packet, A2L_PF_PACKET_SEQUENCE_ID, 1);
+    a2l_pb_int(&s->packet, A2L_PF_PACKET_SEQUENCE_FLAGS, A2L_PF_SEQ_CLEARED);
+    s->event.len = 0;
+    s->msg.len = 0;
+    a2l_pb_int(&s->msg, A2L_PF_CLOCK_ID, A2L_PF_CLOCK_MONOTONIC);
+    a2l_pb_int(&s->msg, A2L_PF_CLOCK_TIMESTAMP, info->start_ns);
+    a2l_pb_message(&s->event, A2L_PF_SNAPSHOT_CLOCKS, &s->msg);
+    if (info->start_realtime_ns) {
+        s->msg.len = 0;
+        a2l_pb_int(&s->msg, A2L_PF_CLOCK_ID, A2L_PF_CLOCK_REALTIME);
+        a2l_pb_int(&s->msg, A2L_PF_CLOCK_TIMESTAMP, info->start_realtime_ns);
+        a2l_pb_message(&s->event, A2L_PF_SNAPSHOT_CLOCKS, &s->msg);
+    }
+    a2l_pb_int(&s->event, A2L_PF_SNAPSHOT_PRIMARY_CLOCK, A2L_PF_CLOCK_MONOTONIC);
+    a2l_pb_message(&s->packet, A2L_PF_PACKET_CLOCK_SNAPSHOT, &s->event);
+    if (a2l_perfetto_end(s) < 0)
+        return -1;
+
+    s->process_uuid = a2l_slices_uuid(s->pid, 0, 0);
+    s->heap_uuid = a2l_slices_uuid(s->pid, 0, 1);
+    if (a2l_perfetto_track(s, s->start_ns, s->process_uuid, 0, 0, NULL) < 0 ||
+        a2l_perfetto_track(s, s->start_ns, s->heap_uuid, s->process_uuid, 0, "heap live") < 0)
+        return -1;
+    return 0;
+}
+
+// tid's sums, new (with its tracks) on its first event
+static a2l_slicethread_t *
+a2l_slices_thread(a2l_slices_t *s, uint32_t tid, uint64_t ts) {
+    if (s->mask) {
+        uint32_t i = (tid * 2654435761u) & s->mask;
+        while (s->slots[i] && s->threads[s->slots[i] - 1].tid != tid)
+            i = (i + 1) & s->mask;
+        if (s->slots[i])
+            return &s->threads[s->slots[i] - 1];
+    }
+
+    if (s->num_threads == s->max_threads) {
+        uint32_t max = s->max_threads ? s->max_threads * 2 : 64;
+        a2l_slicethread_t *threads = realloc(s->threads, max * sizeof(a2l_slicethread_t));
+        uint32_t *active = threads ? realloc(s->active, max * sizeof(uint32_t)) : NULL;
+        uint32_t *slots = active ? calloc(max * 2, sizeof(uint32_t)) : NULL;
+        if (threads)
+            s->threads = threads;
+        if (active)
+            s->active = active;
+        if (!slots) {
+            fprintf(stderr, "a2l-export: out of memory\n");
+            return NULL;
+        }
+        free(s->slots);
+        s->slots = slots;
+        s->mask = max * 2 - 1;
+        s->max_threads = max;
+        for (uint32_t j = 0; j < s->num_threads; j++) {
+            uint32_t i = (s->threads[j].tid * 2654435761u) & s->mask;
+            while (s->slots[i])
+                i = (i + 1) & s->mask;
+            s->slots[i] = j + 1;
+        }
+    }
+
+    uint32_t i = (tid * 2654435761u) & s->mask;
+    while (s->slots[i])
+        i = (i + 1) & s->mask;
+    s->slots[i] = s->num_threads + 1;
+    a2l_slicethread_t *t = &s->threads[s->num_threads++];
+    memset(t, 0, sizeof(*t));
+    t->tid = tid;
+
+    // perfetto: a track of slices under the thread, and two counters under that
+    if (s->perfetto) {
+        t->uuid = a2l_slices_uuid(s->pid, tid, 0);
+        if (a2l_perfetto_track(s, ts, t->uuid, 0, tid, "allocations") < 0 ||
+            a2l_perfetto_track(s, ts, a2l_slices_uuid(s->pid, tid, 1), t->uuid, 0, "bytes allocated") < 0 ||
+            a2l_perfetto_track(s, ts, a2l_slices_uuid(s->pid, tid, 2), t->uuid, 0, "bytes freed") < 0)
+            return NULL;
+    }
+    return t;
+}
+
+// bytes against site, of the few a slice keeps: when they're all
+// taken, the least makes way and its count carries over, so a site
+// that allocates a lot shows up however late in the slice it starts
+static void
+a2l_slices_site(a2l_slicethread_t *t, uint32_t site, uint64_t bytes) {
+    uint32_t min = 0;
+
+    for (uint32_t i = 0; i < t->num_sites; i++) {
+        if (t->site[i] == site) {
+            t->site_bytes[i] += bytes;
+            return;
+        }
+        if (t->site_bytes[i] < t->site_bytes[min])
+            min = i;
+    }
+    if (t->num_sites < A2L_EXPORT_SLICE_SITES) {
+        min = t->num_sites++;
+        t->site_bytes[min] = 0;
+    }
+    t->site[min] = site;
+    t->site_bytes[min] += bytes;
+}
+
+// a thread's slice: a span from its first event to its last, named for
+// the site that allocated most in it, and its counters
+static int
+a2l_slices_write_thread(a2l_slices_t *s, a2l_slicethread_t *t, uint64_t begin) {
+    const a2l_stack_t *stack = NULL;
+    char name[512] = "free";
+    uint32_t top = 0;
+
+    for (uint32_t i = 1; i < t->num_sites; i++)
+        if (t->site_bytes[i] > t->site_bytes[top])
+            top = i;
+    if (t->allocs) {
+        snprintf(name, sizeof(name), "allocs");
+        if (t->site[top] && (stack = a2l_read_stack(s->x->reader, t->site[top])) && stack->num_frames)
+            a2l_read_frame_name(s->x->reader, &stack->frames[0], name, sizeof(name));
+    }
+    uint64_t first = s->start_ns + t->first_ts, last = s->start_ns + t->last_ts;
+
+    if (!s->perfetto) {
+        fprintf(s->f, "{\"name\":");
+        a2l_export_json_string(s->f, name);
+        fprintf(s->f, ",\"cat\":\"alloc2log\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%u,\"tid\":%u,"
+                "\"args\":{\"allocs\":%" PRIu64 ",\"frees\":%" PRIu64 ",\"bytes allocated\":%" PRIu64 ","
+                "\"bytes freed\":%" PRIu64 "}},\n",
+                first / 1e3, (last - first) / 1e3, s->pid, t->tid, t->allocs, t->frees,
+                t->bytes_alloced, t->bytes_freed);
+        fprintf(s->f, "{\"name\":\"tid %u bytes\",\"cat\":\"alloc2log\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":%u,"
+                "\"args\":{\"allocated\":%" PRIu64 ",\"freed\":%" PRIu64 "}},\n",
+                t->tid, begin / 1e3, s->pid, t->bytes_alloced, t->bytes_freed);
+        return 0;
+    }
+
+    a2l_perfetto_begin(s, first);
+    a2l_pb_int(&s->packet, A2L_PF_PACKET_SEQUENCE_FLAGS, A2L_PF_SEQ_NEEDS_STATE);
+    s->event.len = 0;
+    a2l_pb_int(&s->event, A2L_PF_EVENT_TYPE, A2L_PF_SLICE_BEGIN);
+    a2l_pb_int(&s->event, A2L_PF_EVENT_TRACK_UUID, t->uuid);
+    a2l_pb_string(&s->event, A2L_PF_EVENT_CATEGORIES, "alloc2log");
+    a2l_pb_string(&s->event, A2L_PF_EVENT_NAME, name);
+    a2l_perfetto_annotation(s, "allocs", t->allocs);
+    a2l_perfetto_annotation(s, "frees", t->frees);
+    a2l_perfetto_annotation(s, "bytes allocated", t->bytes_alloced);
+    a2l_perfetto_annotation(s, "bytes freed", t->bytes_freed);
+    a2l_pb_message(&s->packet, A2L_PF_PACKET_TRACK_EVENT, &s->event);
+    if (a2l_perfetto_end(s) < 0)
+        return -1;
+
+    a2l_perfetto_begin(s, last);
+    a2l_pb_int(&s->packet, A2L_PF_PACKET_SEQUENCE_FLAGS, A2L_PF_SEQ_NEEDS_STATE);
+    s->event.len = 0;
+    a2l_pb_int(&s->event, A2L_PF_EVENT_TYPE, A2L_PF_SLICE_END);
+    a2l_pb_int(&s->event, A2L_PF_EVENT_TRACK_UUID, t->uuid);
+    a2l_pb_message(&s->packet, A2L_PF_PACKET_TRACK_EVENT, &s->event);
+    if (a2l_perfetto_end(s) < 0)
+        return -1;
+
+    return a2l_perfetto_counter(s, begin, a2l_slices_uuid(s->pid, t->tid, 1), (int64_t)t->bytes_alloced) < 0 ||
+           a2l_perfetto_counter(s, begin, a2l_slices_uuid(s->pid, t->tid, 2), (int64_t)t->bytes_freed) < 0 ? -1 : 0;
+}
+
+// the slice being summed out, and the next one begun.  threads busy in
+// it stay on the list, so their counters go back to 0 in the next
+static int
+a2l_slices_flush(a2l_slices_t *s) {
+    uint64_t begin = s->start_ns + s->slice * s->slice_ns;
+    uint32_t kept = 0;
+    int busy = 0;
+
+    for (uint32_t i = 0; i < s->num_active; i++) {
+        a2l_slicethread_t *t = &s->threads[s->active[i]];
+
+        if (t->events) {
+            if (a2l_slices_write_thread(s, t, begin) < 0)
+                return -1;
+            t->counted = 1;
+            s->active[kept++] = s->active[i];
+            busy = 1;
+        } else if (t->counted) {
+            if (!s->perfetto)
+                fprintf(s->f, "{\"name\":\"tid %u bytes\",\"cat\":\"alloc2log\",\"ph\":\"C\",\"ts\":%.3f,"
+                        "\"pid\":%u,\"args\":{\"allocated\":0,\"freed\":0}},\n", t->tid, begin / 1e3, s->pid);
+            else if (a2l_perfetto_counter(s, begin, a2l_slices_uuid(s->pid, t->tid, 1), 0) < 0 ||
+                     a2l_perfetto_counter(s, begin, a2l_slices_uuid(s->pid, t->tid, 2), 0) < 0)
+                return -1;
+            t->counted = 0;
+        }
+        t->events = t->allocs = t->frees = t->bytes_alloced = t->bytes_freed = 0;
+        t->num_sites = 0;
+    }
+    s->num_active = kept;
+
+    // the heap as the slice ends
+    if (busy) {
+        uint64_t end = begin + s->slice_ns;
+        if (!s->perfetto)
+            fprintf(s->f, "{\"name\":\"heap\",\"cat\":\"alloc2log\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":%u,"
+                    "\"args\":{\"live\":%" PRId64 "}},\n", end / 1e3, s->pid, s->live);
+        else if (a2l_perfetto_counter(s, end, s->heap_uuid, s->live) < 0)
+            return -1;
+        s->slices++;
+    }
+    s->slice++;
+    return ferror(s->f) ? -1 : 0;
+}
+
+static int
+a2l_slices_batch(a2l_slices_t *s, const a2l_batch_t *b) {
+    a2l_slicethread_t *t = NULL;
+
+    for (uint32_t i = 0; i < b->count; i++) {
+        uint64_t slice = b->ts[i] / s->slice_ns;
+
+        if (!s->started) {
+            s->slice = slice;
+            s->started = 1;
+        }
+        if (slice > s->slice) {
+            // one more for the counters to drop back, then skip the quiet ones
+            if (a2l_slices_flush(s) < 0 || (slice > s->slice && s->num_active && a2l_slices_flush(s) < 0))
+                return -1;
+            s->slice = slice;
+            t = NULL;
+        }
+        if (!t || t->tid != b->tid[i]) {
+            if (!(t = a2l_slices_thread(s, b->tid[i], s->start_ns + b->ts[i])))
+                return -1;
+        }
+        if (!t->events) {
+            if (!t->counted)
+                s->active[s->num_active++] = (uint32_t)(t - s->threads);
+            t->first_ts = b->ts[i];
+        }
+        t->events++;
+        t->last_ts = b->ts[i];
+        if (b->type[i] == A2L_REC_ALLOC) {
+            t->allocs++;
+            t->bytes_alloced += b->bytes[i];
+            s->live += (int64_t)b->bytes[i];
+            a2l_slices_site(t, b->stack_id[i], b->bytes[i]);
+        } else {
+            t->frees++;
+            t->bytes_freed += b->bytes[i];
+            s->live -= (int64_t)b->bytes[i];
+        }
+    }
+    s->events += b->count;
+    return 0;
+}
+
+// events in time order, summed per thread per slice of slice_ns
+static int
+a2l_export_slices(a2l_export_t *x, const char *path, int perfetto, uint64_t slice_ns) {
+    const a2l_readinfo_t *info = a2l_read_info(x->reader);
+    a2l_merge_t *merge = NULL;
+    a2l_batch_t *b = NULL;
+    a2l_slices_t s;
+    int ret = -1;
+
+    memset(&s, 0, sizeof(s));
+    s.x = x;
+    s.perfetto = perfetto;
+    s.pid = info->pid;
+    s.start_ns = info->start_ns;
+    s.slice_ns = slice_ns;
+    if (!(s.f = fopen(path, "w"))) {
+        fprintf(stderr, "a2l-export: can't create %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (!(b = a2l_batch_alloc(A2L_EXPORT_BATCH)) || !(merge = a2l_merge_open(&x->reader, 1)))
+        fprintf(stderr, "a2l-export: out of memory\n");
+    else if (a2l_slices_start(&s) == 0) {
+        int bad = 0;
+        while (!bad && a2l_merge_batch(merge, b))
+            bad = a2l_slices_batch(&s, b) < 0;
+        // the last slice, and the counters back to 0 after it
+        if (!bad && s.started && (a2l_slices_flush(&s) < 0 || (s.num_active && a2l_slices_flush(&s) < 0)))
+            bad = 1;
+        if (!bad) {
+            if (a2l_merge_bad_blocks(merge))
+                fprintf(stderr, "a2l-export: %" PRIu64 " damaged blocks skipped\n", a2l_merge_bad_blocks(merge));
+            // json has no trailing commas: metadata closes the list
+            if (!perfetto)
+                fprintf(s.f, "{\"name\":\"process_labels\",\"ph\":\"M\",\"pid\":%u,"
+                        "\"args\":{\"labels\":\"alloc2log\"}}\n],\"displayTimeUnit\":\"ms\"}\n", s.pid);
+            x->events = s.events;
+            x->slices = s.slices;
+            x->bytes_written = (uint64_t)ftell(s.f);
+            ret = 0;
+        }
+    }
+    int failed = ferror(s.f);
+    if (fclose(s.f) != 0 || failed) {
+        fprintf(stderr, "a2l-export: can't write %s: %s\n", path, strerror(errno));
+        ret = -1;
+    }
+
+    a2l_merge_close(merge);
+    a2l_batch_free(b);
+    free(s.threads);
+    free(s.slots);
+    free(s.active);
+    free(s.packet.p);
+    free(s.event.p);
+    free(s.msg.p);
+    return ret;
+}
+
+//
+// massif snapshots, -f massif
+//
+
+// a site's live bytes
+typedef struct {
+    uint32_t stack_id;
+    uint32_t used;
+    int64_t live;
+}a2l_livesite_t;
+
+// a site in a heap tree
+typedef struct {
+    const a2l_stack_t *stack;       // NULL if unknown
+    int64_t bytes;
+}a2l_heapitem_t;
+
+// a run of items with the same frame at a tree's depth
+typedef struct {
+    size_t first, count;
+    int64_t bytes;
+}a2l_heapgroup_t;
+
+// a block the heap was seeded with, or allocated while the keyframe
+// was being copied
+typedef struct {
+    uint64_t ptr;                   // 0 if the slot is empty
+    uint64_t bytes;
+    uint32_t stack_id;
+    uint32_t _pad;
+}a2l_liveblock_t;
+
+typedef struct {
+    uint64_t ts;
+    char *text;                     // from time= on
+    size_t len;
+}a2l_snapshot_t;
+
+typedef struct {
+    a2l_export_t *x;
+    double threshold;               // percent of the heap
+    a2l_livesite_t *sites;          // by stack id
+    uint32_t mask, count;
+    int64_t total;
+    a2l_livesite_t *peak;           // the sites at the peak, live > 0
+    uint32_t num_peak, max_peak;
+    int64_t peak_total;
+    uint64_t peak_ts;
+    a2l_heapitem_t *items;          // scratch for a tree
+    uint32_t max_items;
+    a2l_livesite_t *scratch;        // the sites for a detailed snapshot
+    uint32_t max_scratch;
+    a2l_snapshot_t *snapshots;      // made so far, the peak last
+    uint32_t num_snapshots;
+    uint32_t periodic, detailed;    // -n, -d
+    uint32_t next;                  // periodic snapshot due next, at next_ts
+    uint64_t next_ts, first_ts, span;
+    uint64_t untracked;             // frees with no site or size
+    a2l_liveblock_t *blocks;        // by ptr; NULL if not seeded
+    uint32_t block_mask, num_blocks;
+    uint64_t start_ts;              // the keyframe's: earlier events are in it
+    uint64_t copied_ts;             // until then, events may be in it or not
+}a2l_massif_t;
+
+static a2l_livesite_t *
+a2l_massif_site(a2l_massif_t *m, uint32_t stack_id) {
+    if (2 * (m->count + 1) > m->mask + 1) {
+        uint32_t mask = m->mask ? m->mask * 2 + 1 : 4095;
+        a2l_livesite_t *sites = calloc(mask + 1, sizeof(a2l_livesite_t));
+        if (!sites)
+            return NULL;
+        for (uint32_t i = 0; m->sites && i <= m->mask; i++) {
+            if (!m->sites[i].used)
+                continue;
+            uint32_t j = (m->sites[i].stack_id * 2654435761u) & mask;
+            while (sites[j].used)
+                j = (j + 1) & mask;
+            sites[j] = m->sites[i];
+        }
+        free(m->sites);
+        m->sites = sites;
+        m->mask = mask;
+    }
+    uint32_t i = (stack_id * 2654435761u) & m->mask;
+    while (m->sites[i].used && m->sites[i].stack_id != stack_id)
+        i = (i + 1) & m->mask;
+    if (!m->sites[i].used) {
+        m->sites[i].used = 1;
+        m->sites[i].stack_id = stack_id;
+        m->count++;
+    }
+    return &m->sites[i];
+}
+
+// the sites with live bytes, into *out
+static int
+a2l_massif_live(a2l_massif_t *m, a2l_livesite_t **out, uint32_t *num, uint32_t *max) {
+    *num = 0;
+    for (uint32_t i = 0; m->sites && i <= m->mask; i++) {
+        if (!m->sites[i].used || m->sites[i].live <= 0)
+            continue;
+        if (*num == *max) {
+            uint32_t grown_max = *max ? *max * 2 : 1024;
+            a2l_livesite_t *grown = realloc(*out, grown_max * sizeof(a2l_livesite_t));
+            if (!grown)
+                return -1;
+            *out = grown;
+            *max = grown_max;
+        }
+        (*out)[(*num)++] = m->sites[i];
+    }
+    return 0;
+}
+
+// by frames, innermost first, so a node's items are a run; a stack
+// that ends sorts before those that go on
+static int
+a2l_massif_cmp_item(const void *pa, const void *pb) {
+    const a2l_heapitem_t *a = pa, *b = pb;
+    uint32_t na = a->stack ? a->stack->num_frames : 0, nb = b->stack ? b->stack->num_frames : 0;
+
+    for (uint32_t i = 0; i < na && i < nb; i++)
+        if (a->stack->frames[i].addr != b->stack->frames[i].addr)
+            return a->stack->frames[i].addr < b->stack->frames[i].addr ? -1 : 1;
+    return na < nb ? -1 : na > nb;
+}
+
+static int
+a2l_massif_cmp_group(const void *pa, const void *pb) {
+    const a2l_heapgroup_t *a = pa, *b = pb;
+    return a->bytes < b->bytes ? 1 : a->bytes > b->bytes ? -1 : 0;
+}
+
+// a frame as massif has them: 0x4005A3: f (in /usr/bin/prog)
+static void
+a2l_massif_frame(const a2l_reader_t *r, const a2l_frame_t *frame, char *buf, size_t len) {
+    const a2l_symbol_t *symbol = a2l_read_symbol(r, frame->symbol_id);
+    const a2l_module_t *module = a2l_read_module(r, frame->module_id);
+
+    if (module)
+        snprintf(buf, len, "0x%" PRIX64 ": %s (in %s)", frame->addr, symbol ? symbol->name : "???", module->path);
+    else
+        snprintf(buf, len, "0x%" PRIX64 ": ???", frame->addr);
+}
+
+// a node of items[0, n), which share their first depth frames, then
+// its children: the next frame's runs at or above the threshold,
+// largest first, and the rest as one line
+static int
+a2l_massif_node(a2l_massif_t *m, FILE *f, a2l_heapitem_t *items, size_t n, uint32_t depth,
+                int64_t bytes, const char *label, int64_t threshold) {
+    a2l_heapgroup_t *groups = malloc((n ? n : 1) * sizeof(a2l_heapgroup_t));
+    uint32_t num_groups = 0, above = 0;
+    int64_t below = 0;
+    char frame[1024];
+
+    if (!groups)
+        return -1;
+    for (size_t i = 0; i < n; i++) {
+        const a2l_stack_t *s = items[i].stack;
+        if (!s || s->num_frames <= depth)
+            continue;
+        if (!num_groups || s->frames[depth].addr != items[groups[num_groups - 1].first].stack->frames[depth].addr) {
+            groups[num_groups].first = i;
+            groups[num_groups].count = 0;
+            groups[num_groups].bytes = 0;
+            num_groups++;
+        }
+        groups[num_groups - 1].count++;
+        groups[num_groups - 1].bytes += items[i].bytes;
+    }
+    qsort(groups, num_groups, sizeof(a2l_heapgroup_t), a2l_massif_cmp_group);
+    while (above < num_groups && groups[above].bytes >= threshold)
+        above++;
+    for (uint32_t i = above; i < num_groups; i++)
+        below += groups[i].bytes;
+
+    fprintf(f, "%*sn%u: %" PRId64 " %s\n", (int)depth, "", above + (above < num_groups), bytes, label);
+    for (uint32_t i = 0; i < above; i++) {
+        const a2l_heapgroup_t *g = &groups[i];
+        a2l_massif_frame(m->x->reader, &items[g->first].stack->frames[depth], frame, sizeof(frame));
+        if (a2l_massif_node(m, f, items + g->first, g->count, depth + 1, g->bytes, frame, threshold) < 0) {
+            free(groups);
+            return -1;
+        }
+    }
+    if (above < num_groups)
+        fprintf(f, "%*sn0: %" PRId64 " in %u place%s, %sbelow massif's threshold (%.2f%%)\n", (int)depth + 1, "",
+                below, num_groups - above, num_groups - above > 1 ? "s" : "", above ? "" : "all ", m->threshold);
+    free(groups);
+    return 0;
+}
+
+// a snapshot of the heap at ts, with its tree if kind isn't "empty"
+static int
+a2l_massif_snapshot(a2l_massif_t *m, uint64_t ts, const a2l_livesite_t *sites, uint32_t num_sites,
+                    int64_t total, const char *kind) {
+    a2l_snapshot_t *grown = realloc(m->snapshots, (m->num_snapshots + 1) * sizeof(a2l_snapshot_t));
+    if (!grown)
+        return -1;
+    m->snapshots = grown;
+    a2l_snapshot_t *s = &m->snapshots[m->num_snapshots];
+    s->ts = ts;
+    s->text = NULL;
+    FILE *f = open_memstream(&s->text, &s->len);
+    if (!f)
+        return -1;
+    m->num_snapshots++;
+
+    fprintf(f, "time=%" PRIu64 "\nmem_heap_B=%" PRId64 "\nmem_heap_extra_B=0\nmem_stacks_B=0\nheap_tree=%s\n",
+            ts / 1000000, total > 0 ? total : 0, kind);
+    if (strcmp(kind, "empty") != 0) {
+        int64_t heap = 0;
+
+        if (num_sites > m->max_items) {
+            a2l_heapitem_t *items = realloc(m->items, num_sites * sizeof(a2l_heapitem_t));
+            if (!items) {
+                fclose(f);
+                return -1;
+            }
+            m->items = items;
+            m->max_items = num_sites;
+        }
+        for (uint32_t i = 0; i < num_sites; i++) {
+            m->items[i].stack = sites[i].stack_id ? a2l_read_stack(m->x->reader, sites[i].stack_id) : NULL;
+            m->items[i].bytes = sites[i].live;
+            heap += sites[i].live;
+        }
+        qsort(m->items, num_sites, sizeof(a2l_heapitem_t), a2l_massif_cmp_item);
+        if (a2l_massif_node(m, f, m->items, num_sites, 0, heap,
+                            "(heap allocation functions) malloc/new/new[], --alloc-fns, etc.",
+                            (int64_t)(heap * m->threshold / 100)) < 0) {
+            fclose(f);
+            return -1;
+        }
+    }
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+// the heap as it is, as the peak, if it's grown past the last one
+// kept by more than the threshold's worth of itself: massif's
+// --peak-inaccuracy, so a heap that climbs isn't copied at each step
+static int
+a2l_massif_peak(a2l_massif_t *m, uint64_t ts) {
+    if (m->total <= 0 || (double)m->total <= (double)m->peak_total * (1 + m->threshold / 100))
+        return 0;
+    m->peak_total = m->total;
+    m->peak_ts = ts;
+    return a2l_massif_live(m, &m->peak, &m->num_peak, &m->max_peak);
+}
+
+static uint32_t
+a2l_massif_block_slot(const a2l_massif_t *m, uint64_t ptr) {
+    uint32_t i = (uint32_t)((ptr >> 4) * 2654435761u) & m->block_mask;
+
+    while (m->blocks[i].ptr && m->blocks[i].ptr != ptr)
+        i = (i + 1) & m->block_mask;
+    return i;
+}
+
+static int
+a2l_massif_block_add(a2l_massif_t *m, uint64_t ptr, uint64_t bytes, uint32_t stack_id) {
+    if (!m->blocks || 2 * (m->num_blocks + 1) > m->block_mask + 1) {
+        uint32_t old_mask = m->block_mask;
+        a2l_liveblock_t *old = m->blocks;
+        uint32_t mask = old ? old_mask * 2 + 1 : 4095;
+
+        if (!(m->blocks = calloc((size_t)mask + 1, sizeof(a2l_liveblock_t)))) {
+            m->blocks = old;
+            return -1;
+        }
+        m->block_mask = mask;
+        for (uint32_t i = 0; old && i <= old_mask; i++)
+            if (old[i].ptr)
+                m->blocks[a2l_massif_block_slot(m, old[i].ptr)] = old[i];
+        free(old);
+    }
+    a2l_liveblock_t *l = &m->blocks[a2l_massif_block_slot(m, ptr)];
+    m->num_blocks += !l->ptr;
+    l->ptr = ptr;
+    l->bytes = bytes;
+    l->stack_id = stack_id;
+    return 0;
+}
+
+// empty slot i, moving back the blocks that probed past it
+static void
+a2l_massif_block_remove(a2l_massif_t *m, uint32_t i) {
+    uint32_t j = i;
+
+    for (;;) {
+        j = (j + 1) & m->block_mask;
+        if (!m->blocks[j].ptr)
+            break;
+        uint32_t home = (uint32_t)((m->blocks[j].ptr >> 4) * 2654435761u) & m->block_mask;
+        // j stays if its home is cyclically in (i, j]
+        if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+            continue;
+        m->blocks[i] = m->blocks[j];
+        i = j;
+    }
+    m->blocks[i].ptr = 0;
+    m->num_blocks--;
+}
+
+// the heap as keyframe k had it: the damaged blocks skipped, or -1 if
+// out of memory
+static int64_t
+a2l_massif_seed(a2l_massif_t *m, uint32_t k) {
+    const a2l_keyframe_t *keyframe = a2l_read_keyframe(m->x->reader, k);
+    a2l_livesite_t *site = NULL;
+    a2l_liveiter_t it;
+    a2l_live_t l;
+    int64_t ret = 0;
+
+    m->start_ts = keyframe->first_ts;
+    m->copied_ts = keyframe->last_ts;
+    a2l_live_init(&it, m->x->reader, k);
+    while (a2l_live_next(&it, &l)) {
+        // only a2l_massif_site moves sites, and it hands back the new one
+        if (a2l_massif_block_add(m, l.ptr, l.bytes, l.stack_id) < 0 ||
+            (!(site && site->stack_id == l.stack_id) && !(site = a2l_massif_site(m, l.stack_id)))) {
+            ret = -1;
+            break;
+        }
+        site->live += (int64_t)l.bytes;
+        m->total += (int64_t)l.bytes;
+    }
+    if (ret == 0)
+        ret = (int64_t)it.bad_blocks;
+    a2l_live_free(&it);
+    return ret;
+}
+
+// event i against the seeded blocks, as a2lformat.h replays them: an
+// alloc replaces its ptr's block, a free removes it if it's there.
+// 1 if that's all it does, 0 if it counts as usual, -1 if out of memory.
+static int
+a2l_massif_replay(a2l_massif_t *m, const a2l_batch_t *b, uint32_t i) {
+    uint32_t slot = a2l_massif_block_slot(m, b->ptr[i]);
+    a2l_liveblock_t *l = &m->blocks[slot];
+    int freed = b->type[i] == A2L_REC_FREE;
+
+    if (l->ptr) {
+        a2l_livesite_t *site = a2l_massif_site(m, l->stack_id);
+        if (!site || (freed && a2l_massif_peak(m, b->ts[i]) < 0))
+            return -1;
+        site->live -= (int64_t)l->bytes;
+        m->total -= (int64_t)l->bytes;
+        a2l_massif_block_remove(m, slot);
+        if (freed)
+            return 1;
+    } else if (freed) {
+        // while the keyframe was copied, gone before it got there
+        return b->ts[i] <= m->copied_ts;
+    }
+    // the keyframe may have it too: its free has to find it here
+    if (b->ts[i] <= m->copied_ts && a2l_massif_block_add(m, b->ptr[i], b->bytes[i], b->stack_id[i]) < 0)
+        return -1;
+    return 0;
+}
+
+// the periodic snapshots due before ts
+static int
+a2l_massif_due(a2l_massif_t *m, uint64_t ts) {
+    while (m->next < m->periodic && ts > m->next_ts) {
+        int detailed = (m->next + 1) % m->detailed == 0 || m->next + 1 == m->periodic;
+        uint32_t num = 0;
+
+        if ((detailed && a2l_massif_live(m, &m->scratch, &num, &m->max_scratch) < 0) ||
+            a2l_massif_snapshot(m, m->next_ts, m->scratch, num, m->total, detailed ? "detailed" : "empty") < 0)
+            return -1;
+        m->next++;
+        m->next_ts = m->first_ts + (m->periodic > 1 ? m->span * m->next / (m->periodic - 1) : 0);
+    }
+    return 0;
+}
+
+static int
+a2l_massif_batch(a2l_massif_t *m, const a2l_batch_t *b) {
+    a2l_livesite_t *cached = NULL;
+
+    for (uint32_t i = 0; i < b->count; i++) {
+        // in the keyframe the heap was seeded from, or gone before it
+        if (b->ts[i] < m->start_ts)
+            continue;
+        if (a2l_massif_due(m, b->ts[i]) < 0)
+            return -1;
+        if (m->blocks && (m->num_blocks || b->ts[i] <= m->copied_ts)) {
+            int done = a2l_massif_replay(m, b, i);
+            if (done < 0)
+                return -1;
+            cached = NULL;
+            if (done)
+                continue;
+        }
+
+        uint32_t id = b->type[i] == A2L_REC_ALLOC ? b->stack_id[i] : b->alloc_stack_id[i];
+        if (b->type[i] == A2L_REC_FREE) {
+            if (!b->bytes[i]) {
+                m->untracked++;
+                continue;
+            }
+            // the heap shrinks: if it had peaked, keep it as it was
+            if (a2l_massif_peak(m, b->ts[i]) < 0)
+                return -1;
+        }
+        // only a2l_massif_site moves sites, and it hands back the new one
+        if (!cached || cached->stack_id != id) {
+            if (!(cached = a2l_massif_site(m, id)))
+                return -1;
+        }
+        int64_t delta = b->type[i] == A2L_REC_ALLOC ? (int64_t)b->bytes[i] : -(int64_t)b->bytes[i];
+        cached->live += delta;
+        m->total += delta;
+    }
+    return 0;
+}
+
+// periodic snapshots evenly over the trace, every detailed-th with its
+// heap tree, and the peak's, in one pass
+static int
+a2l_export_massif(a2l_export_t *x, const char *path, const char *trace, uint32_t periodic,
+                  uint32_t detailed, double threshold) {
+    const a2l_readinfo_t *info = a2l_read_info(x->reader);
+    a2l_merge_t *merge = NULL;
+    a2l_batch_t *b = NULL;
+    a2l_massif_t m;
+    uint64_t first_ts = info->first_ts;
+    int64_t seeded = 0;
+    int ret = -1, bad = 0;
+
+    memset(&m, 0, sizeof(m));
+    m.x = x;
+    m.threshold = threshold;
+    m.periodic = periodic;
+    m.detailed = detailed;
+
+    // the heap at the first event isn't empty if segments before it
+    // were compacted: start at the first whole keyframe after them
+    for (uint32_t i = 0; info->segments_compacted && i < a2l_read_num_keyframes(x->reader); i++) {
+        const a2l_keyframe_t *k = a2l_read_keyframe(x->reader, i);
+        if (k->complete) {
+            if (k->first_ts > first_ts && k->first_ts <= info->last_ts)
+                first_ts = k->first_ts;
+            break;
+        }
+    }
+    int64_t keyframe = a2l_read_keyframe_before(x->reader, first_ts);
+    if (info->segments_compacted && keyframe < 0)
+        fprintf(stderr, "a2l-export: %u segments compacted, and no whole keyframe left: the heap starts empty\n",
+                info->segments_compacted);
+
+    m.first_ts = m.next_ts = first_ts;
+    m.span = info->last_ts - first_ts;
+    if (!(b = a2l_batch_alloc(A2L_EXPORT_BATCH)) || !(merge = a2l_merge_open(&x->reader, 1)) ||
+        (keyframe >= 0 && (seeded = a2l_massif_seed(&m, (uint32_t)keyframe)) < 0))
+        bad = 1;
+    if (seeded > 0)
+        fprintf(stderr, "a2l-export: %" PRId64 " damaged keyframe blocks skipped\n", seeded);
+    while (!bad && a2l_merge_batch(merge, b))
+        bad = a2l_massif_batch(&m, b) < 0;
+    // the rest, and the peak if it was at the end
+    if (!bad && (a2l_massif_due(&m, UINT64_MAX) < 0 || a2l_massif_peak(&m, info->last_ts) < 0 ||
+                 (m.peak_total && a2l_massif_snapshot(&m, m.peak_ts, m.peak, m.num_peak, m.peak_total, "peak") < 0)))
+        bad = 1;
+    if (bad)
+        fprintf(stderr, "a2l-export: out of memory\n");
+    else if (a2l_merge_bad_blocks(merge))
+        fprintf(stderr, "a2l-export: %" PRIu64 " damaged blocks skipped\n", a2l_merge_bad_blocks(merge));
+
+    FILE *f = bad ? NULL : fopen(path, "w");
+    if (!bad && !f)
+        fprintf(stderr, "a2l-export: can't create %s: %s\n", path, strerror(errno));
+    if (f) {
+        // the peak, made last, goes in its place by time
+        uint32_t n = m.num_snapshots, last = m.peak_total ? n - 1 : n, at = 0;
+        while (at < last && m.snapshots[at].ts <= m.peak_ts)
+            at++;
+
+        fprintf(f, "desc: alloc2log trace %s, pid %u\ncmd: %s\ntime_unit: ms\n", trace, info->pid, trace);
+        for (uint32_t k = 0, i = 0; k < n; k++) {
+            const a2l_snapshot_t *s = last < n && k == at ? &m.snapshots[last] : &m.snapshots[i++];
+            fprintf(f, "#-----------\nsnapshot=%u\n#-----------\n", k);
+            fwrite(s->text, 1, s->len, f);
+        }
+        x->events = info->num_events;
+        x->slices = n;
+        x->bytes_written = (uint64_t)ftell(f);
+        int failed = ferror(f);
+        if (fclose(f) != 0 || failed)
+            fprintf(stderr, "a2l-export: can't write %s: %s\n", path, strerror(errno));
+        else
+            ret = 0;
+        if (m.untracked)
+            fprintf(stderr, "a2l-export: %" PRIu64 " frees don't say what they freed, left out\n", m.untracked);
+    }
+
+    for (uint32_t i = 0; i < m.num_snapshots; i++)
+        free(m.snapshots[i].text);
+    free(m.snapshots);
+    free(m.sites);
+    free(m.peak);
+    free(m.items);
+    free(m.scratch);
+    free(m.blocks);
+    a2l_merge_close(merge);
+    a2l_batch_free(b);
+    return ret;
+}
+
+int
+main(int argc, char **argv) {
+    const char *format = "columns", *dir = NULL;
+    char default_dir[A2L_EXPORT_PATH_MAX], error[256];
+    double slice_ms = 10;
+    long snapshots = 100, detailed = 10;
+    a2l_export_t x;
+    int opt;
+
+    memset(&x, 0, sizeof(x));
+
+    while ((opt = getopt(argc, argv, "f:o:uts:n:d:h")) != -1) {
+        switch (opt) {
+        case 'f': format = optarg; break;
+        case 'o': dir = optarg; break;
+        case 'u': x.raw = 1; break;
+        case 't': x.time_order = 1; break;
+        case 's': slice_ms = atof(optarg); break;
+        case 'n': snapshots = atol(optarg); break;
+        case 'd': detailed = atol(optarg); break;
+        default:
+            a2l_export_usage();
+            return 1;
+        }
+    }
+    int columns = !strcmp(format, "columns"), perfetto = !strcmp(format, "perfetto");
+    int massif = !strcmp(format, "massif");
+    if (optind != argc - 1 || !(slice_ms > 0) || snapshots < 1 || detailed < 1 ||
+        (!columns && !perfetto && !massif && strcmp(format, "chrome") != 0) ||
+        (!columns && (x.raw || x.time_order))) {
+        a2l_export_usage();
+        return 1;
+    }
+
+    const char *trace = argv[optind];
+    if (!dir) {
+        const char *ext = columns ? "columns" : perfetto ? "pftrace" : massif ? "massif" : "json";
+        if (snprintf(default_dir, sizeof(default_dir), "%s.%s", trace, ext) >= (int)sizeof(default_dir)) {
+            fprintf(stderr, "a2l-export: path too long: %s.%s\n", trace, ext);
+            return 1;
+        }
+        dir = default_dir;
+    }
+
+    if (!(x.reader = a2l_read_open(trace, error, sizeof(error)))) {
+        fprintf(stderr, "a2l-export: %s\n", error);
+        return 1;
+    }
+    if (massif) {
+        if (a2l_export_massif(&x, dir, trace, (uint32_t)snapshots, (uint32_t)detailed,
+                              A2L_EXPORT_MASSIF_THRESHOLD) < 0)
+            return 1;
+        printf("%" PRIu64 " events in %" PRIu64 " snapshots, %.1f MiB in %s\n",
+               x.events, x.slices, x.bytes_written / (1024.0 * 1024.0), dir);
+        a2l_read_close(x.reader);
+        return 0;
+    }
+    if (!columns) {
+        uint64_t slice_ns = (uint64_t)(slice_ms * 1e6);
+        if (a2l_export_slices(&x, dir, perfetto, slice_ns ? slice_ns : 1) < 0)
+            return 1;
+        printf("%" PRIu64 " events in %" PRIu64 " slices, %.1f MiB in %s\n",
+               x.events, x.slices, x.bytes_written / (1024.0 * 1024.0), dir);
+        a2l_read_close(x.reader);
+        return 0;
+    }
+    if (a2l_export_columns(&x, dir) < 0)
+        return 1;
+
+    const a2l_readinfo_t *info = a2l_read_info(x.reader);
+    printf("%" PRIu64 " events, %u stacks, %.1f MiB in %s\n",
+           x.columns[A2L_COL_TS].rows, a2l_read_num_stacks(x.reader),
+           x.bytes_written / (1024.0 * 1024.0), dir);
+    if (info->segments_compacted)
+        printf("%u compacted segments skipped\n", info->segments_compacted);
+    a2l_read_close(x.reader);
+    return 0;
+}
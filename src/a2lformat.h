@@ -0,0 +1,254 @@
+// a2lformat.h -- the binary trace format (A2L_FORMAT=binary).
+//
+// a trace is a file header, then blocks, then a block index:
+//
+//   a2l_fileheader_t
+//   a2l_blockheader_t, payload        one per capture buffer flush
+//   ...
+//   a2l_blockindex_t[num_blocks]      written at exit
+//   a2l_filetrailer_t                 last bytes of the file
+//
+// a block holds one thread's events in the order they happened, or
+// with A2L_BLOCK_DEFINITIONS, definitions only.  its payload is
+// compressed on its own (A2L_CODEC_LZ, see a2llz.h), so blocks decode
+// in any order, or several at once, from their header alone.  the
+// index lets a reader seek by time without touching the blocks.  a
+// trace cut short (crash, kill -9) has no index: walk the block
+// headers instead; the checksum catches a torn last block.
+//
+// payload records are a type byte, then varints:
+//
+//   A2L_REC_ALLOC   dt, ptr, bytes, stack_id
+//   A2L_REC_FREE    dt, ptr, stack_id, alloc_bytes, alloc_stack_id
+//   A2L_REC_STACK   stack_id, num_frames, then per frame:
+//                   zigzag(addr - previous addr), module_id, symbol_id
+//   A2L_REC_MODULE  module_id, base, path_len, path
+//   A2L_REC_SYMBOL  symbol_id, module_id, addr, name_len, name
+//   A2L_REC_SITE    bucket_ts, bucket_ns, stack_id, allocs, frees,
+//                   bytes_alloced, bytes_freed
+//   A2L_REC_LIVE    zigzag(ptr - previous ptr), bytes, stack_id
+//   A2L_REC_KEYFRAME num_blocks, num_live, live_bytes
+//
+// dt is nanoseconds since the block's previous event, or since
+// first_ts for its first.  timestamps are relative to the file
+// header's start_ns.  stack_id is the stack's hash_id, as in the text
+// log.  alloc_bytes and alloc_stack_id describe the block being freed;
+// both are 0 if it wasn't tracked.
+//
+// a definition is written as soon as it's made, so it comes before
+// every event that uses it, whichever thread logged that.  ids are
+// nonzero, 0 is unknown.  a definition can repeat after an eviction
+// under A2L_MEM_BUDGET.
+//
+// keyframes are the live heap, written now and then, so a reader can
+// rebuild the heap at time T from the last keyframe before T instead
+// of from the start.  a keyframe is the A2L_BLOCK_KEYFRAME blocks
+// sharing a first_ts, the moment it began.  each A2L_REC_LIVE is a
+// tracked block.  they come a live-map shard at a time, each shard's
+// sorted by address; each ptr is relative to the record before it in
+// the same block (the first to 0), so it steps back where a shard
+// starts, and a block can hold the end of one shard and the start of
+// the next: one address order needs a sort.  the keyframe's last
+// block ends with A2L_REC_KEYFRAME, counting its blocks; a keyframe
+// with blocks missing (cut short, or split by a roll) is ignored.
+//
+// the live heap isn't copied in one instant, so events close to
+// first_ts may or may not be in the keyframe.  to rebuild the heap at
+// T, start from the keyframe and replay every event from first_ts to
+// T in time order: an alloc sets its ptr's entry, a free removes it if
+// it's there.  that is exact: a block enters the live map before its
+// alloc event is stamped, and leaves it before its free event is.
+// blocks alloc2log didn't track (A2L_MEM_BUDGET) aren't in keyframes;
+// their frees have alloc_bytes 0.
+//
+// segmented traces (A2L_SEGMENT_SIZE) are a manifest at the trace
+// path, a2l_manifest_t then one a2l_manifest_segment_t per segment,
+// next to:
+//
+//   <path>.000000, <path>.000001 ..   segments, each a trace as above
+//   <path>.defs                       definitions for all segments,
+//                                     no index
+//
+// a segment's entry gives its time and event range, and defs_end: the
+// prefix of the definitions file that covers every event in it, so a
+// segment can be read alone, or all of them at once.  time ranges may
+// overlap a little: a buffer written after a roll carries events from
+// before it.  the last segment is A2L_SEGMENT_OPEN until the process
+// exits.
+//
+// with a retention policy, old segments are compacted: their events
+// summed per site into A2L_REC_SITE records, in A2L_BLOCK_SITES
+// blocks appended to
+//
+//   <path>.summary                    a trace of site blocks, each
+//                                     with its segment's time range
+//
+// then the segment file is deleted and its entry marked
+// A2L_SEGMENT_COMPACTED, with the summary bytes holding its sites.
+// a site record counts the site's allocations in [bucket_ts,
+// bucket_ts + bucket_ns), and frees of blocks it allocated; stack_id
+// 0 collects frees of blocks that weren't tracked.  a bucket that
+// spans two segments has a record in each: add them.
+//
+// a2l-convert writes text logs out as traces.  text logs have no
+// clock, so a converted trace has start_ns 0 and each event is
+// stamped with its record's byte offset in the log.  nor do they say
+// what a free released: every free has alloc_bytes and alloc_stack_id
+// 0, and readers pair it with its alloc by ptr.
+//
+// everything is little-endian.
+
+#ifndef A2L__FORMAT_H
+#define A2L__FORMAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define A2L_TRACE_MAGIC    0x544c3241  // 'A2LT'
+#define A2L_BLOCK_MAGIC    0x4b4c3241  // 'A2LK'
+#define A2L_TRAILER_MAGIC  0x584c3241  // 'A2LX'
+#define A2L_MANIFEST_MAGIC 0x4d4c3241  // 'A2LM'
+#define A2L_TRACE_VERSION  3
+
+#define A2L_SEGMENT_PATH_FMT "%s.%06u"
+#define A2L_DEFS_PATH_FMT    "%s.defs"
+#define A2L_SUMMARY_PATH_FMT "%s.summary"
+
+#define A2L_CODEC_NONE     0
+#define A2L_CODEC_LZ       1
+
+#define A2L_REC_ALLOC      1
+#define A2L_REC_FREE       2
+#define A2L_REC_STACK      3
+#define A2L_REC_MODULE     4
+#define A2L_REC_SYMBOL     5
+#define A2L_REC_SITE       6
+#define A2L_REC_LIVE       7
+#define A2L_REC_KEYFRAME   8
+
+#define A2L_BLOCK_DEFINITIONS 1        // block and index flags
+#define A2L_BLOCK_SITES       2
+#define A2L_BLOCK_KEYFRAME    4
+
+#define A2L_SEGMENT_OPEN      1        // manifest segment flags
+#define A2L_SEGMENT_COMPACTED 2
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_bytes;          // sizeof(a2l_fileheader_t)
+    uint32_t pid;
+    uint32_t segment;               // 0 if not segmented
+    uint64_t start_ns;              // CLOCK_MONOTONIC when tracing began
+    uint64_t start_realtime_ns;     // CLOCK_REALTIME at the same moment
+}a2l_fileheader_t;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t codec;
+    uint16_t header_bytes;          // sizeof(a2l_blockheader_t)
+    uint32_t raw_bytes;             // payload once decoded
+    uint32_t stored_bytes;          // payload as stored, after this header
+    uint32_t checksum;              // a2l_checksum() of the stored payload
+    uint32_t tid;
+    uint32_t num_events;            // alloc and free records
+    uint32_t flags;                 // A2L_BLOCK_*
+    uint64_t first_ts;
+    uint64_t last_ts;
+}a2l_blockheader_t;
+
+typedef struct {
+    uint64_t offset;                // of the block header
+    uint64_t first_ts;
+    uint64_t last_ts;
+    uint32_t tid;
+    uint32_t num_events;
+    uint32_t flags;
+    uint32_t _pad;
+}a2l_blockindex_t;
+
+typedef struct {
+    uint64_t index_offset;
+    uint32_t num_blocks;
+    uint32_t magic;
+}a2l_filetrailer_t;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_bytes;          // sizeof(a2l_manifest_t)
+    uint32_t pid;
+    uint32_t num_segments;
+    uint64_t start_ns;
+    uint64_t start_realtime_ns;
+    uint64_t segment_bytes;         // A2L_SEGMENT_SIZE
+}a2l_manifest_t;
+
+typedef struct {
+    uint32_t segment;
+    uint32_t flags;                 // A2L_SEGMENT_*
+    uint64_t first_ts;
+    uint64_t last_ts;
+    uint64_t first_event;           // events in all earlier segments
+    uint64_t num_events;
+    uint64_t bytes;                 // segment file size
+    uint64_t defs_end;              // definitions file bytes it needs
+    uint64_t summary_offset;        // if compacted, its site blocks
+    uint64_t summary_bytes;         // in the summary file
+}a2l_manifest_segment_t;
+
+static inline uint8_t *
+a2l_put_varint(uint8_t *p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+// NULL if the varint runs past end
+static inline const uint8_t *
+a2l_get_varint(const uint8_t *p, const uint8_t *end, uint64_t *v) {
+    uint64_t result = 0;
+
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        uint8_t b = *p++;
+        result |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *v = result;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static inline uint64_t
+a2l_zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t
+a2l_unzigzag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static inline uint32_t
+a2l_checksum(const void *data, size_t len) {
+    const uint8_t *p = data;
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ len;
+
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t w;
+        memcpy(&w, p, sizeof(w));
+        h = (h ^ w) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 29;
+    }
+    while (len--)
+        h = (h ^ *p++) * 0xff51afd7ed558ccdULL;
+
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+#endif
@@ -0,0 +1,162 @@
+// a2lgz.h -- small gzip writer, for exports read by tools that want .gz.
+//
+// one deflate block with the fixed huffman codes (rfc 1951, 3.2.6) in
+// a gzip member (rfc 1952); nothing here depends on zlib.  matching is
+// greedy and single-probe, as in a2llz.h: without code tables of its
+// own it comes out a little larger than zlib's, and much smaller than
+// stored blocks on the repetitive text and varints exports are made of.
+
+#ifndef A2L__GZ_H
+#define A2L__GZ_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define A2L_GZ_HASH_BITS 15
+#define A2L_GZ_TABLE_ENTRIES (1 << A2L_GZ_HASH_BITS)
+#define A2L_GZ_MIN_MATCH 4              // probed 4 bytes at a time; deflate allows 3
+#define A2L_GZ_MAX_MATCH 258
+#define A2L_GZ_MAX_OFFSET 32768
+
+// worst case: every byte a 9 bit literal, plus header and trailer
+#define A2L_GZ_BOUND(n) ((n) + (n)/8 + 32)
+
+typedef struct {
+    uint8_t *op;
+    uint64_t bits;
+    uint32_t num_bits;
+}a2l_gz__bits_t;
+
+static inline uint32_t
+a2l_gz__read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t
+a2l_gz__hash(uint32_t seq) {
+    return (seq * 2654435761u) >> (32 - A2L_GZ_HASH_BITS);
+}
+
+// n bits of value, least significant first
+static inline void
+a2l_gz__put(a2l_gz__bits_t *w, uint32_t value, uint32_t n) {
+    w->bits |= (uint64_t)value << w->num_bits;
+    w->num_bits += n;
+    while (w->num_bits >= 8) {
+        *w->op++ = (uint8_t)w->bits;
+        w->bits >>= 8;
+        w->num_bits -= 8;
+    }
+}
+
+// a huffman code goes most significant bit first
+static inline void
+a2l_gz__put_code(a2l_gz__bits_t *w, uint32_t code, uint32_t n) {
+    uint32_t reversed = 0;
+
+    for (uint32_t i = 0; i < n; i++)
+        reversed |= ((code >> i) & 1) << (n - 1 - i);
+    a2l_gz__put(w, reversed, n);
+}
+
+// a literal/length symbol, 0-285
+static inline void
+a2l_gz__put_symbol(a2l_gz__bits_t *w, uint32_t sym) {
+    if (sym < 144)
+        a2l_gz__put_code(w, 0x30 + sym, 8);
+    else if (sym < 256)
+        a2l_gz__put_code(w, 0x190 + sym - 144, 9);
+    else if (sym < 280)
+        a2l_gz__put_code(w, sym - 256, 7);
+    else
+        a2l_gz__put_code(w, 0xc0 + sym - 280, 8);
+}
+
+static inline void
+a2l_gz__put_match(a2l_gz__bits_t *w, uint32_t len, uint32_t offset) {
+    static const uint16_t len_base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                          35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static const uint8_t len_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                          3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    static const uint16_t offset_base[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                             257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                             8193, 12289, 16385, 24577};
+    static const uint8_t offset_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                             7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+    uint32_t i = 28;
+
+    while (len_base[i] > len)
+        i--;
+    a2l_gz__put_symbol(w, 257 + i);
+    a2l_gz__put(w, len - len_base[i], len_extra[i]);
+    for (i = 29; offset_base[i] > offset; i--)
+        ;
+    a2l_gz__put_code(w, i, 5);
+    a2l_gz__put(w, offset - offset_base[i], offset_extra[i]);
+}
+
+// crc-32 as gzip (and zip, and png) use it; crc is 0 to begin
+static inline uint32_t
+a2l_gz_crc32(const uint8_t *p, size_t len, uint32_t crc) {
+    crc = ~crc;
+    while (len--) {
+        crc ^= *p++;
+        for (int k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ (0xedb88320u & -(crc & 1));
+    }
+    return ~crc;
+}
+
+// src, under 4 GiB, as a gzip file into dst, which must hold
+// A2L_GZ_BOUND(src_len) bytes.  table is scratch of
+// A2L_GZ_TABLE_ENTRIES.  returns the compressed size.
+static inline size_t
+a2l_gz_compress(const uint8_t *src, size_t src_len, uint8_t *dst, uint32_t *table) {
+    // deflate, no name or time, from unix
+    static const uint8_t header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3};
+    const uint8_t *ip = src, *end = src + src_len;
+    a2l_gz__bits_t w = {dst + sizeof(header), 0, 0};
+
+    memcpy(dst, header, sizeof(header));
+    // positions are stored + 1; 0 is empty
+    memset(table, 0, sizeof(uint32_t) * A2L_GZ_TABLE_ENTRIES);
+
+    a2l_gz__put(&w, 1, 1);              // the last block
+    a2l_gz__put(&w, 1, 2);              // with the fixed codes
+    while (ip < end) {
+        if (end - ip >= A2L_GZ_MIN_MATCH) {
+            uint32_t seq = a2l_gz__read32(ip);
+            uint32_t h = a2l_gz__hash(seq);
+            size_t ref_pos = table[h];
+            table[h] = (uint32_t)(ip - src) + 1;
+
+            if (ref_pos && (size_t)(ip - src) + 1 - ref_pos <= A2L_GZ_MAX_OFFSET &&
+                a2l_gz__read32(src + ref_pos - 1) == seq) {
+                const uint8_t *ref = src + ref_pos - 1;
+                size_t len = A2L_GZ_MIN_MATCH;
+                while (len < A2L_GZ_MAX_MATCH && ip + len < end && ref[len] == ip[len])
+                    len++;
+                a2l_gz__put_match(&w, (uint32_t)len, (uint32_t)(ip - ref));
+                ip += len;
+                continue;
+            }
+        }
+        a2l_gz__put_symbol(&w, *ip++);
+    }
+    a2l_gz__put_symbol(&w, 256);        // end of block
+    if (w.num_bits)
+        a2l_gz__put(&w, 0, 8 - w.num_bits);
+
+    // crc and size, little-endian
+    uint32_t crc = a2l_gz_crc32(src, src_len, 0), size = (uint32_t)src_len;
+    for (int i = 0; i < 4; i++)
+        *w.op++ = (uint8_t)(crc >> (8 * i));
+    for (int i = 0; i < 4; i++)
+        *w.op++ = (uint8_t)(size >> (8 * i));
+    return w.op - dst;
+}
+
+#endif
@@ -0,0 +1,410 @@
+#define _GNU_SOURCE
+// a2lidx.c -- liba2lread's sidecar index; see a2lidx.h.
+//
+// building is one pass over the trace, a block at a time: each block
+// gets its bloom filter, and every event is summed into a (bucket,
+// site) table.  bucket refs come from the block headers' time ranges
+// alone, counted then filled per bucket.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "a2lidx.h"
+
+struct a2l_index {
+    const uint8_t *map;
+    size_t size;
+    const a2l_idxheader_t *header;
+    const a2l_idxblock_t *blocks;
+    const a2l_idxbucket_t *buckets;
+    const uint64_t *refs;
+    const a2l_idxsite_t *sites;
+};
+
+// a (bucket, site) sum while building
+typedef struct {
+    uint64_t key;                   // bucket << 32 | stack_id, + 1: 0 is empty
+    a2l_idxsite_t site;
+}a2l__idxsum_t;
+
+typedef struct {
+    a2l__idxsum_t *slots;
+    uint64_t mask, count;
+}a2l__idxsums_t;
+
+static int
+a2l__index_fail(char *error, size_t error_len, const char *fmt, ...) {
+    va_list args;
+
+    if (error && error_len) {
+        va_start(args, fmt);
+        vsnprintf(error, error_len, fmt, args);
+        va_end(args);
+    }
+    return -1;
+}
+
+static inline uint64_t
+a2l__index_hash(uint64_t key) {
+    uint64_t h = key * 0x9e3779b97f4a7c15ULL;
+    return h ^ (h >> 29);
+}
+
+static a2l_idxsite_t *
+a2l__index_sum(a2l__idxsums_t *m, uint32_t bucket, uint32_t stack_id) {
+    uint64_t key = ((uint64_t)bucket << 32 | stack_id) + 1;
+    uint64_t slot = a2l__index_hash(key) & m->mask;
+
+    while (m->slots[slot].key && m->slots[slot].key != key)
+        slot = (slot + 1) & m->mask;
+    if (m->slots[slot].key)
+        return &m->slots[slot].site;
+
+    if ((m->count + 1) * 2 > m->mask) {
+        a2l__idxsums_t grown;
+        grown.mask = m->mask * 2 + 1;
+        grown.count = m->count;
+        if (!(grown.slots = calloc(grown.mask + 1, sizeof(a2l__idxsum_t))))
+            return NULL;
+        for (uint64_t i = 0; i <= m->mask; i++) {
+            if (m->slots[i].key) {
+                uint64_t s = a2l__index_hash(m->slots[i].key) & grown.mask;
+                while (grown.slots[s].key)
+                    s = (s + 1) & grown.mask;
+                grown.slots[s] = m->slots[i];
+            }
+        }
+        free(m->slots);
+        *m = grown;
+        return a2l__index_sum(m, bucket, stack_id);
+    }
+
+    m->slots[slot].key = key;
+    m->slots[slot].site.stack_id = stack_id;
+    m->count++;
+    return &m->slots[slot].site;
+}
+
+static int
+a2l__index_cmp_sum(const void *pa, const void *pb) {
+    const a2l__idxsum_t *a = pa, *b = pb;
+    return a->key < b->key ? -1 : a->key > b->key;
+}
+
+static inline uint32_t
+a2l__index_bucket(const a2l_idxheader_t *h, uint64_t ts) {
+    if (ts <= h->first_ts)
+        return 0;
+    uint64_t b = (ts - h->first_ts) / h->bucket_ns;
+    return b < h->num_buckets ? (uint32_t)b : h->num_buckets - 1;
+}
+
+static int
+a2l__index_write(FILE *f, const void *data, size_t len) {
+    return len && fwrite(data, 1, len, f) != len ? -1 : 0;
+}
+
+int
+a2l_index_build(a2l_reader_t *r, const char *path, uint64_t bucket_ns, char *error, size_t error_len) {
+    const a2l_readinfo_t *info = a2l_read_info(r);
+    a2l_idxheader_t h;
+    a2l__idxsums_t sums = {0};
+    a2l_idxblock_t *blocks = NULL;
+    a2l_idxbucket_t *buckets = NULL;
+    uint64_t *refs = NULL;
+    a2l_idxsite_t *sites = NULL;
+    char tmp[4096];
+    FILE *f = NULL;
+    int ret = -1;
+
+    memset(&h, 0, sizeof(h));
+    h.magic = A2L_INDEX_MAGIC;
+    h.version = A2L_INDEX_VERSION;
+    h.header_bytes = sizeof(h);
+    h.pid = info->pid;
+    h.num_blocks = info->num_blocks;
+    h.num_events = info->num_events;
+    h.start_realtime_ns = info->start_realtime_ns;
+    h.first_ts = info->first_ts;
+    h.bucket_ns = bucket_ns ? bucket_ns : 1;
+    if (info->num_events) {
+        uint64_t n = (info->last_ts - info->first_ts) / h.bucket_ns + 1;
+        if (n > UINT32_MAX)
+            return a2l__index_fail(error, error_len, "buckets too small: %llu of them",
+                                   (unsigned long long)n);
+        h.num_buckets = (uint32_t)n;
+    }
+
+    blocks = calloc(info->num_blocks ? info->num_blocks : 1, sizeof(a2l_idxblock_t));
+    buckets = calloc(h.num_buckets ? h.num_buckets : 1, sizeof(a2l_idxbucket_t));
+    sums.mask = 1023;
+    sums.slots = calloc(sums.mask + 1, sizeof(a2l__idxsum_t));
+    if (!blocks || !buckets || !sums.slots) {
+        a2l__index_fail(error, error_len, "out of memory");
+        goto out;
+    }
+
+    // blocks: bloom filters and per-bucket site sums from their events,
+    // and a count of each bucket's refs from their time ranges
+    for (uint64_t i = 0; i < info->num_blocks; i++) {
+        const a2l_blockheader_t *bh = a2l_read_block(r, i);
+        a2l_idxblock_t *b = &blocks[i];
+        a2l_iter_t it;
+        a2l_event_t e;
+
+        b->first_ts = bh->first_ts;
+        b->last_ts = bh->last_ts;
+        b->tid = bh->tid;
+        b->num_events = bh->num_events;
+        if (!bh->num_events || !h.num_buckets)
+            continue;
+        for (uint32_t k = a2l__index_bucket(&h, bh->first_ts); k <= a2l__index_bucket(&h, bh->last_ts); k++)
+            buckets[k].num_refs++;
+
+        a2l_idxsite_t *site = NULL;
+        uint32_t site_bucket = 0;
+        a2l_iter_init(&it, r, i, i + 1);
+        while (a2l_iter_next(&it, &e)) {
+            uint32_t id = e.type == A2L_REC_ALLOC ? e.stack_id : e.alloc_stack_id;
+            uint32_t bucket = a2l__index_bucket(&h, e.ts);
+
+            a2l_index_bloom_add(b->bloom, e.stack_id);
+            if (e.alloc_stack_id != e.stack_id)
+                a2l_index_bloom_add(b->bloom, e.alloc_stack_id);
+
+            // runs of one site are common
+            if (!site || site->stack_id != id || site_bucket != bucket) {
+                if (!(site = a2l__index_sum(&sums, bucket, id))) {
+                    a2l_iter_free(&it);
+                    a2l__index_fail(error, error_len, "out of memory");
+                    goto out;
+                }
+                site_bucket = bucket;
+            }
+            if (e.type == A2L_REC_ALLOC) {
+                site->allocs++;
+                site->bytes_alloced += e.bytes;
+            } else {
+                site->frees++;
+                site->bytes_freed += e.bytes;
+            }
+        }
+        a2l_iter_free(&it);
+    }
+
+    // refs, bucket by bucket, blocks ascending in each
+    for (uint32_t k = 0; k < h.num_buckets; k++) {
+        buckets[k].first_ref = h.num_refs;
+        h.num_refs += buckets[k].num_refs;
+        buckets[k].num_refs = 0;
+    }
+    refs = malloc((h.num_refs ? h.num_refs : 1) * sizeof(uint64_t));
+    if (!refs) {
+        a2l__index_fail(error, error_len, "out of memory");
+        goto out;
+    }
+    for (uint64_t i = 0; i < info->num_blocks && h.num_buckets; i++) {
+        if (!blocks[i].num_events)
+            continue;
+        for (uint32_t k = a2l__index_bucket(&h, blocks[i].first_ts); k <= a2l__index_bucket(&h, blocks[i].last_ts); k++)
+            refs[buckets[k].first_ref + buckets[k].num_refs++] = i;
+    }
+
+    // sums, sorted into buckets, by stack id in each
+    uint64_t n = 0;
+    for (uint64_t i = 0; i <= sums.mask; i++)
+        if (sums.slots[i].key)
+            sums.slots[n++] = sums.slots[i];
+    qsort(sums.slots, n, sizeof(a2l__idxsum_t), a2l__index_cmp_sum);
+    sites = malloc((n ? n : 1) * sizeof(a2l_idxsite_t));
+    if (!sites) {
+        a2l__index_fail(error, error_len, "out of memory");
+        goto out;
+    }
+    for (uint64_t i = 0; i < n; i++) {
+        uint32_t k = (uint32_t)((sums.slots[i].key - 1) >> 32);
+        if (!buckets[k].num_sites)
+            buckets[k].first_site = i;
+        buckets[k].num_sites++;
+        sites[i] = sums.slots[i].site;
+    }
+    h.num_sites = n;
+
+    h.blocks_offset = sizeof(h);
+    h.buckets_offset = h.blocks_offset + info->num_blocks * sizeof(a2l_idxblock_t);
+    h.refs_offset = h.buckets_offset + (uint64_t)h.num_buckets * sizeof(a2l_idxbucket_t);
+    h.sites_offset = h.refs_offset + h.num_refs * sizeof(uint64_t);
+
+    // written aside, then renamed over: readers never see half an index
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if (!(f = fopen(tmp, "wb"))) {
+        a2l__index_fail(error, error_len, "can't create %s: %s", tmp, strerror(errno));
+        goto out;
+    }
+    if (a2l__index_write(f, &h, sizeof(h)) < 0 ||
+        a2l__index_write(f, blocks, info->num_blocks * sizeof(a2l_idxblock_t)) < 0 ||
+        a2l__index_write(f, buckets, (size_t)h.num_buckets * sizeof(a2l_idxbucket_t)) < 0 ||
+        a2l__index_write(f, refs, h.num_refs * sizeof(uint64_t)) < 0 ||
+        a2l__index_write(f, sites, h.num_sites * sizeof(a2l_idxsite_t)) < 0 ||
+        fclose(f) != 0) {
+        f = NULL;
+        unlink(tmp);
+        a2l__index_fail(error, error_len, "can't write %s: %s", tmp, strerror(errno));
+        goto out;
+    }
+    f = NULL;
+    if (rename(tmp, path) < 0) {
+        unlink(tmp);
+        a2l__index_fail(error, error_len, "can't rename %s: %s", tmp, strerror(errno));
+        goto out;
+    }
+    ret = 0;
+
+out:
+    if (f)
+        fclose(f);
+    free(blocks);
+    free(buckets);
+    free(refs);
+    free(sites);
+    free(sums.slots);
+    return ret;
+}
+
+a2l_index_t *
+a2l_index_open(const a2l_reader_t *r, const char *path, char *error, size_t error_len) {
+    const a2l_readinfo_t *info = a2l_read_info(r);
+    struct stat st;
+    a2l_index_t *ix;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        a2l__index_fail(error, error_len, "can't open %s: %s", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+    if ((size_t)st.st_size < sizeof(a2l_idxheader_t)) {
+        close(fd);
+        a2l__index_fail(error, error_len, "%s: not an index", path);
+        return NULL;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        a2l__index_fail(error, error_len, "can't map %s: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    const a2l_idxheader_t *h = map;
+    const char *problem = NULL;
+    if (h->magic != A2L_INDEX_MAGIC || h->header_bytes != sizeof(a2l_idxheader_t))
+        problem = "not an index";
+    else if (h->version != A2L_INDEX_VERSION)
+        problem = "unknown index version";
+    else if (h->sites_offset + h->num_sites * sizeof(a2l_idxsite_t) > (uint64_t)st.st_size ||
+             h->blocks_offset + h->num_blocks * sizeof(a2l_idxblock_t) > h->buckets_offset ||
+             h->refs_offset + h->num_refs * sizeof(uint64_t) > h->sites_offset)
+        problem = "index is truncated";
+    else if (h->num_blocks != info->num_blocks || h->num_events != info->num_events)
+        problem = "index is stale: the trace has changed since; rebuild it";
+    if (problem || !(ix = calloc(1, sizeof(a2l_index_t)))) {
+        munmap(map, st.st_size);
+        a2l__index_fail(error, error_len, "%s: %s", path, problem ? problem : "out of memory");
+        return NULL;
+    }
+
+    ix->map = map;
+    ix->size = st.st_size;
+    ix->header = h;
+    ix->blocks = (const a2l_idxblock_t *)(ix->map + h->blocks_offset);
+    ix->buckets = (const a2l_idxbucket_t *)(ix->map + h->buckets_offset);
+    ix->refs = (const uint64_t *)(ix->map + h->refs_offset);
+    ix->sites = (const a2l_idxsite_t *)(ix->map + h->sites_offset);
+    return ix;
+}
+
+void
+a2l_index_close(a2l_index_t *ix) {
+    if (!ix)
+        return;
+    munmap((void *)ix->map, ix->size);
+    free(ix);
+}
+
+const a2l_idxheader_t *
+a2l_index_header(const a2l_index_t *ix) {
+    return ix->header;
+}
+
+const a2l_idxblock_t *
+a2l_index_block(const a2l_index_t *ix, uint64_t i) {
+    return &ix->blocks[i];
+}
+
+const a2l_idxbucket_t *
+a2l_index_bucket(const a2l_index_t *ix, uint32_t i) {
+    return &ix->buckets[i];
+}
+
+const a2l_idxsite_t *
+a2l_index_sites(const a2l_index_t *ix, uint32_t i, uint32_t *num_sites) {
+    *num_sites = ix->buckets[i].num_sites;
+    return ix->sites + ix->buckets[i].first_site;
+}
+
+static int
+a2l__index_cmp_u64(const void *pa, const void *pb) {
+    uint64_t a = *(const uint64_t *)pa, b = *(const uint64_t *)pb;
+    return a < b ? -1 : a > b;
+}
+
+int64_t
+a2l_index_select(const a2l_index_t *ix, const a2l_idxquery_t *q, uint64_t **blocks) {
+    const a2l_idxheader_t *h = ix->header;
+    uint64_t n = 0, max = 0;
+
+    *blocks = NULL;
+    if (!h->num_buckets || q->to <= h->first_ts || q->from >= q->to)
+        return 0;
+
+    uint32_t first = a2l__index_bucket(h, q->from), last = a2l__index_bucket(h, q->to - 1);
+    for (uint32_t k = first; k <= last; k++) {
+        const a2l_idxbucket_t *bucket = &ix->buckets[k];
+
+        for (uint32_t j = 0; j < bucket->num_refs; j++) {
+            uint64_t i = ix->refs[bucket->first_ref + j];
+            const a2l_idxblock_t *b = &ix->blocks[i];
+
+            if (b->first_ts >= q->to || b->last_ts < q->from ||
+                (q->by_tid && b->tid != q->tid) ||
+                (q->by_stack && !a2l_index_bloom_test(b->bloom, q->stack_id)))
+                continue;
+            if (n == max) {
+                uint64_t *grown = realloc(*blocks, (max = max ? max * 2 : 256) * sizeof(uint64_t));
+                if (!grown) {
+                    free(*blocks);
+                    *blocks = NULL;
+                    return -1;
+                }
+                *blocks = grown;
+            }
+            (*blocks)[n++] = i;
+        }
+    }
+
+    // a block spanning buckets was listed in each
+    qsort(*blocks, n, sizeof(uint64_t), a2l__index_cmp_u64);
+    uint64_t unique = 0;
+    for (uint64_t i = 0; i < n; i++)
+        if (!unique || (*blocks)[unique - 1] != (*blocks)[i])
+            (*blocks)[unique++] = (*blocks)[i];
+    return (int64_t)unique;
+}
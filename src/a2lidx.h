@@ -0,0 +1,137 @@
+// a2lidx.h -- sidecar time index for binary traces, built by a2l-index.
+//
+// <trace>.idx lets a query on a time window, a thread or a stack
+// touch only the blocks that can hold its events.  it's one file:
+//
+//   a2l_idxheader_t
+//   a2l_idxblock_t  [num_blocks]   per trace block, in the reader's
+//                                  order: times, thread, and a bloom
+//                                  filter of the stack ids in it
+//   a2l_idxbucket_t [num_buckets]  per bucket_ns of time from first_ts
+//   uint64_t        [num_refs]     each bucket's blocks: those whose
+//                                  time range overlaps it
+//   a2l_idxsite_t   [num_sites]    each bucket's per-site sums, by
+//                                  stack id
+//
+// a bucket's site sums count the events stamped in it, by the site
+// that made the block (a free with no alloc info counts against 0), so
+// a window that covers whole buckets needs no blocks at all; only the
+// buckets at its edges, or a query on a thread, read blocks.
+//
+// an index is for the trace as it was: one whose block or event count
+// has changed since is stale and won't open.  rebuild it.
+//
+// the library half, in liba2lread: a2l_index_build writes one,
+// a2l_index_open maps one for a reader, a2l_index_select lists the
+// blocks a query needs.
+//
+// everything is little-endian.
+
+#ifndef A2L__IDX_H
+#define A2L__IDX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "a2lread.h"
+
+#define A2L_INDEX_MAGIC    0x494c3241  // 'A2LI'
+#define A2L_INDEX_VERSION  1
+#define A2L_INDEX_PATH_FMT "%s.idx"
+
+#define A2L_INDEX_BLOOM_WORDS 8        // 512 bits a block
+#define A2L_INDEX_BLOOM_BITS (A2L_INDEX_BLOOM_WORDS * 64)
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_bytes;          // sizeof(a2l_idxheader_t)
+    uint32_t pid;
+    uint32_t num_buckets;
+    uint64_t num_blocks;            // the trace's, to tell if it's stale
+    uint64_t num_events;
+    uint64_t start_realtime_ns;     // CLOCK_REALTIME at ts 0
+    uint64_t first_ts;              // bucket 0's start
+    uint64_t bucket_ns;
+    uint64_t blocks_offset;
+    uint64_t buckets_offset;
+    uint64_t refs_offset;
+    uint64_t num_refs;
+    uint64_t sites_offset;
+    uint64_t num_sites;
+}a2l_idxheader_t;
+
+typedef struct {
+    uint64_t first_ts, last_ts;
+    uint32_t tid;
+    uint32_t num_events;
+    uint64_t bloom[A2L_INDEX_BLOOM_WORDS];  // stack ids, alloc stack ids
+}a2l_idxblock_t;
+
+typedef struct {
+    uint64_t first_ref;
+    uint64_t first_site;
+    uint32_t num_refs;
+    uint32_t num_sites;
+}a2l_idxbucket_t;
+
+typedef struct {
+    uint32_t stack_id;
+    uint32_t _pad;
+    uint64_t allocs, frees;
+    uint64_t bytes_alloced, bytes_freed;
+}a2l_idxsite_t;
+
+// three bits of the bloom filter per stack id
+static inline uint64_t
+a2l_index_bloom_hash(uint32_t stack_id) {
+    uint64_t h = (stack_id + 1ULL) * 0x9e3779b97f4a7c15ULL;
+    return h ^ (h >> 31);
+}
+
+static inline void
+a2l_index_bloom_add(uint64_t *bloom, uint32_t stack_id) {
+    uint64_t h = a2l_index_bloom_hash(stack_id);
+
+    for (int i = 0; i < 3; i++, h >>= 9)
+        bloom[(h & (A2L_INDEX_BLOOM_BITS - 1)) / 64] |= 1ULL << (h & 63);
+}
+
+static inline int
+a2l_index_bloom_test(const uint64_t *bloom, uint32_t stack_id) {
+    uint64_t h = a2l_index_bloom_hash(stack_id);
+
+    for (int i = 0; i < 3; i++, h >>= 9)
+        if (!(bloom[(h & (A2L_INDEX_BLOOM_BITS - 1)) / 64] & (1ULL << (h & 63))))
+            return 0;
+    return 1;
+}
+
+typedef struct a2l_index a2l_index_t;
+
+// what a query wants: events in [from, to), of one thread and one
+// stack if by_tid and by_stack
+typedef struct {
+    uint64_t from, to;
+    int by_tid, by_stack;
+    uint32_t tid;
+    uint32_t stack_id;
+}a2l_idxquery_t;
+
+// -1 on failure, with the reason in error
+int a2l_index_build(a2l_reader_t *r, const char *path, uint64_t bucket_ns, char *error, size_t error_len);
+
+// NULL on failure, with the reason in error
+a2l_index_t *a2l_index_open(const a2l_reader_t *r, const char *path, char *error, size_t error_len);
+void a2l_index_close(a2l_index_t *ix);
+const a2l_idxheader_t *a2l_index_header(const a2l_index_t *ix);
+const a2l_idxblock_t *a2l_index_block(const a2l_index_t *ix, uint64_t i);
+const a2l_idxbucket_t *a2l_index_bucket(const a2l_index_t *ix, uint32_t i);
+// bucket i's site sums, by stack id
+const a2l_idxsite_t *a2l_index_sites(const a2l_index_t *ix, uint32_t i, uint32_t *num_sites);
+
+// the blocks that may hold q's events, ascending, into *blocks
+// (malloced, the caller frees).  the count, or -1 if out of memory.
+int64_t a2l_index_select(const a2l_index_t *ix, const a2l_idxquery_t *q, uint64_t **blocks);
+
+#endif
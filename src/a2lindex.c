@@ -0,0 +1,342 @@
+#define _GNU_SOURCE
+// a2l-index -- build a trace's sidecar index, or query through it
+//
+// usage: a2l-index [-b seconds] <trace>
+//        a2l-index -q [-f from] [-u until] [-t tid] [-s stack] [-n rows] [-d depth] <trace>
+//
+// the first writes <trace>.idx (a2lidx.h), with -b second buckets
+// (default 1).  the second sums what was allocated and freed in a
+// window, per site, reading only the blocks the index says can hold
+// it: from and until are HH:MM[:SS] wall clock, or seconds since the
+// trace began; -t picks a thread, -s a site's stack id (hex).  whole
+// buckets inside the window come from their sums, untouched, unless
+// -t is given.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "a2lread.h"
+#include "a2lidx.h"
+
+#define A2L_INDEX_PATH_MAX 4096
+
+typedef struct {
+    uint32_t stack_id;
+    uint64_t allocs, frees;
+    uint64_t bytes_alloced, bytes_freed;
+}a2l_qsite_t;
+
+typedef struct {
+    a2l_qsite_t *sites;
+    uint32_t num_sites, max_sites;
+}a2l_qsites_t;
+
+static void
+a2l_index_usage(void) {
+    fprintf(stderr, "usage: a2l-index [-b seconds] <trace>\n"
+                    "       a2l-index -q [-f from] [-u until] [-t tid] [-s stack] [-n rows] [-d depth] <trace>\n");
+}
+
+static double
+a2l_index_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// HH:MM[:SS] on the trace's first day (or the next, if that's well
+// before it began), or seconds since it began; -1 if neither
+static int
+a2l_index_parse_time(const char *str, const a2l_readinfo_t *info, uint64_t *ts) {
+    unsigned hour, minute;
+    double second = 0;
+    char *end;
+
+    if (!strchr(str, ':')) {
+        double seconds = strtod(str, &end);
+        if (end == str || *end || seconds < 0)
+            return -1;
+        *ts = (uint64_t)(seconds * 1e9);
+        return 0;
+    }
+
+    if (sscanf(str, "%u:%u:%lf", &hour, &minute, &second) < 2 || hour > 23 || minute > 59)
+        return -1;
+    if (!info->start_realtime_ns) {
+        fprintf(stderr, "a2l-index: the trace has no wall clock; give seconds\n");
+        return -1;
+    }
+
+    time_t start = (time_t)(info->start_realtime_ns / 1000000000ULL);
+    struct tm tm;
+    localtime_r(&start, &tm);
+    tm.tm_hour = (int)hour;
+    tm.tm_min = (int)minute;
+    tm.tm_sec = 0;
+    tm.tm_isdst = -1;
+    int64_t at_ns = (int64_t)mktime(&tm) * 1000000000LL + (int64_t)(second * 1e9);
+    if (at_ns + 3600LL * 1000000000LL < (int64_t)info->start_realtime_ns)
+        at_ns += 86400LL * 1000000000LL;
+
+    int64_t rel = at_ns - (int64_t)info->start_realtime_ns;
+    *ts = rel > 0 ? (uint64_t)rel : 0;
+    return 0;
+}
+
+static a2l_qsite_t *
+a2l_index_site(a2l_qsites_t *q, uint32_t stack_id) {
+    // few sites in a window, and mostly in runs: a sorted array
+    uint32_t lo = 0, hi = q->num_sites;
+
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (q->sites[mid].stack_id < stack_id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < q->num_sites && q->sites[lo].stack_id == stack_id)
+        return &q->sites[lo];
+
+    if (q->num_sites == q->max_sites) {
+        uint32_t max = q->max_sites ? q->max_sites * 2 : 256;
+        a2l_qsite_t *grown = realloc(q->sites, max * sizeof(a2l_qsite_t));
+        if (!grown)
+            return NULL;
+        q->sites = grown;
+        q->max_sites = max;
+    }
+    memmove(&q->sites[lo + 1], &q->sites[lo], (q->num_sites - lo) * sizeof(a2l_qsite_t));
+    memset(&q->sites[lo], 0, sizeof(a2l_qsite_t));
+    q->sites[lo].stack_id = stack_id;
+    q->num_sites++;
+    return &q->sites[lo];
+}
+
+// events of q's blocks, in [from, to)
+static int
+a2l_index_scan(const a2l_reader_t *r, const a2l_index_t *ix, const a2l_idxquery_t *q,
+               a2l_qsites_t *out, uint64_t *blocks_read, uint64_t *bad_blocks) {
+    uint64_t *blocks;
+    int64_t n = a2l_index_select(ix, q, &blocks);
+    a2l_qsite_t *site = NULL;
+
+    if (n < 0)
+        return -1;
+    for (int64_t i = 0; i < n; i++) {
+        a2l_iter_t it;
+        a2l_event_t e;
+
+        a2l_iter_init(&it, r, blocks[i], blocks[i] + 1);
+        while (a2l_iter_next(&it, &e)) {
+            uint32_t id = e.type == A2L_REC_ALLOC ? e.stack_id : e.alloc_stack_id;
+
+            if (e.ts < q->from || e.ts >= q->to || (q->by_stack && id != q->stack_id))
+                continue;
+            if (!site || site->stack_id != id) {
+                if (!(site = a2l_index_site(out, id))) {
+                    a2l_iter_free(&it);
+                    free(blocks);
+                    return -1;
+                }
+            }
+            if (e.type == A2L_REC_ALLOC) {
+                site->allocs++;
+                site->bytes_alloced += e.bytes;
+            } else {
+                site->frees++;
+                site->bytes_freed += e.bytes;
+            }
+        }
+        *bad_blocks += it.bad_blocks;
+        a2l_iter_free(&it);
+        // a site pointer doesn't survive the array growing
+        site = NULL;
+    }
+    *blocks_read += (uint64_t)n;
+    free(blocks);
+    return 0;
+}
+
+static int
+a2l_index_cmp_bytes(const void *pa, const void *pb) {
+    const a2l_qsite_t *a = pa, *b = pb;
+    return a->bytes_alloced < b->bytes_alloced ? 1 : a->bytes_alloced > b->bytes_alloced ? -1 : 0;
+}
+
+static int
+a2l_index_query(const a2l_reader_t *r, const a2l_index_t *ix, a2l_idxquery_t *q, int rows, int depth) {
+    const a2l_idxheader_t *h = a2l_index_header(ix);
+    a2l_qsites_t out = {0};
+    uint64_t blocks_read = 0, bad_blocks = 0;
+    uint32_t summed = 0;
+
+    // whole buckets in the window, from their sums: unless by thread,
+    // they need no blocks, and only the edges are scanned
+    uint64_t cover_from = q->to, cover_to = q->to;
+    if (!q->by_tid && h->num_buckets && q->from < q->to) {
+        uint64_t first = q->from <= h->first_ts ? 0 : (q->from - h->first_ts + h->bucket_ns - 1) / h->bucket_ns;
+        uint64_t end = q->to <= h->first_ts ? 0 : (q->to - h->first_ts) / h->bucket_ns;
+        // the last bucket holds everything to the end
+        if (q->to > h->first_ts + (uint64_t)h->num_buckets * h->bucket_ns)
+            end = h->num_buckets;
+        if (end > h->num_buckets)
+            end = h->num_buckets;
+
+        if (first < end) {
+            cover_from = h->first_ts + first * h->bucket_ns;
+            cover_to = end == h->num_buckets ? q->to : h->first_ts + end * h->bucket_ns;
+            for (uint64_t k = first; k < end; k++) {
+                uint32_t num_sites;
+                const a2l_idxsite_t *s = a2l_index_sites(ix, (uint32_t)k, &num_sites);
+
+                for (uint32_t j = 0; j < num_sites; j++) {
+                    if (q->by_stack && s[j].stack_id != q->stack_id)
+                        continue;
+                    a2l_qsite_t *site = a2l_index_site(&out, s[j].stack_id);
+                    if (!site)
+                        return -1;
+                    site->allocs += s[j].allocs;
+                    site->frees += s[j].frees;
+                    site->bytes_alloced += s[j].bytes_alloced;
+                    site->bytes_freed += s[j].bytes_freed;
+                }
+                summed++;
+            }
+        }
+    }
+
+    a2l_idxquery_t edge = *q;
+    if (cover_from < cover_to) {
+        edge.to = cover_from;
+        if (edge.from < edge.to && a2l_index_scan(r, ix, &edge, &out, &blocks_read, &bad_blocks) < 0)
+            return -1;
+        edge.from = cover_to;
+        edge.to = q->to;
+    }
+    if (edge.from < edge.to && a2l_index_scan(r, ix, &edge, &out, &blocks_read, &bad_blocks) < 0)
+        return -1;
+
+    uint64_t allocs = 0, frees = 0, bytes_alloced = 0, bytes_freed = 0;
+    for (uint32_t i = 0; i < out.num_sites; i++) {
+        allocs += out.sites[i].allocs;
+        frees += out.sites[i].frees;
+        bytes_alloced += out.sites[i].bytes_alloced;
+        bytes_freed += out.sites[i].bytes_freed;
+    }
+    printf("%.3f s to %.3f s: %" PRIu64 " allocs of %" PRIu64 " bytes, %" PRIu64 " frees of %" PRIu64 " bytes\n",
+           q->from / 1e9, q->to / 1e9, allocs, bytes_alloced, frees, bytes_freed);
+    printf("read %" PRIu64 " of %" PRIu64 " blocks, %u buckets from sums\n",
+           blocks_read, h->num_blocks, summed);
+    if (bad_blocks)
+        printf("%" PRIu64 " damaged blocks skipped\n", bad_blocks);
+
+    qsort(out.sites, out.num_sites, sizeof(a2l_qsite_t), a2l_index_cmp_bytes);
+    printf("\n%14s %10s %14s %10s  site\n", "bytes", "allocs", "freed", "frees");
+    for (uint32_t i = 0; i < out.num_sites && (int)i < rows; i++) {
+        const a2l_qsite_t *s = &out.sites[i];
+        const a2l_stack_t *stack = a2l_read_stack(r, s->stack_id);
+        char frame[512];
+
+        printf("%14" PRIu64 " %10" PRIu64 " %14" PRIu64 " %10" PRIu64 "  ",
+               s->bytes_alloced, s->allocs, s->bytes_freed, s->frees);
+        if (!s->stack_id) {
+            printf("(unknown)\n");
+            continue;
+        }
+        printf("%08x", s->stack_id);
+        for (uint32_t j = 0; stack && j < stack->num_frames && (int)j < depth; j++) {
+            a2l_read_frame_name(r, &stack->frames[j], frame, sizeof(frame));
+            printf(j ? " < %s" : "  %s", frame);
+        }
+        printf("\n");
+    }
+    free(out.sites);
+    return 0;
+}
+
+int
+main(int argc, char **argv) {
+    const char *from_str = NULL, *until_str = NULL;
+    char index_path[A2L_INDEX_PATH_MAX], error[256];
+    double bucket_seconds = 1.0;
+    int query = 0, rows = 10, depth = 4, opt;
+    a2l_idxquery_t q;
+
+    memset(&q, 0, sizeof(q));
+
+    while ((opt = getopt(argc, argv, "b:qf:u:t:s:n:d:h")) != -1) {
+        switch (opt) {
+        case 'b': bucket_seconds = atof(optarg); break;
+        case 'q': query = 1; break;
+        case 'f': from_str = optarg; break;
+        case 'u': until_str = optarg; break;
+        case 't': q.by_tid = 1; q.tid = (uint32_t)strtoul(optarg, NULL, 10); break;
+        case 's': q.by_stack = 1; q.stack_id = (uint32_t)strtoul(optarg, NULL, 16); break;
+        case 'n': rows = atoi(optarg); break;
+        case 'd': depth = atoi(optarg); break;
+        default:
+            a2l_index_usage();
+            return 1;
+        }
+    }
+    if (optind != argc - 1 || bucket_seconds <= 0) {
+        a2l_index_usage();
+        return 1;
+    }
+
+    const char *trace = argv[optind];
+    snprintf(index_path, sizeof(index_path), A2L_INDEX_PATH_FMT, trace);
+    double start = a2l_index_now();
+    a2l_reader_t *r = a2l_read_open(trace, error, sizeof(error));
+    if (!r) {
+        fprintf(stderr, "a2l-index: %s\n", error);
+        return 1;
+    }
+    const a2l_readinfo_t *info = a2l_read_info(r);
+
+    if (!query) {
+        uint64_t bucket_ns = (uint64_t)(bucket_seconds * 1e9);
+        if (a2l_index_build(r, index_path, bucket_ns ? bucket_ns : 1, error, sizeof(error)) < 0) {
+            fprintf(stderr, "a2l-index: %s\n", error);
+            return 1;
+        }
+        a2l_index_t *ix = a2l_index_open(r, index_path, error, sizeof(error));
+        if (!ix) {
+            fprintf(stderr, "a2l-index: %s\n", error);
+            return 1;
+        }
+        const a2l_idxheader_t *h = a2l_index_header(ix);
+        printf("%s: %" PRIu64 " blocks, %u buckets of %.3f s, %" PRIu64 " bucket sites, in %.2f s\n",
+               index_path, h->num_blocks, h->num_buckets, h->bucket_ns / 1e9, h->num_sites,
+               a2l_index_now() - start);
+        a2l_index_close(ix);
+        a2l_read_close(r);
+        return 0;
+    }
+
+    a2l_index_t *ix = a2l_index_open(r, index_path, error, sizeof(error));
+    if (!ix) {
+        fprintf(stderr, "a2l-index: %s\n", error);
+        return 1;
+    }
+    q.from = 0;
+    q.to = info->last_ts + 1;
+    if ((from_str && a2l_index_parse_time(from_str, info, &q.from) < 0) ||
+        (until_str && a2l_index_parse_time(until_str, info, &q.to) < 0)) {
+        fprintf(stderr, "a2l-index: times are HH:MM[:SS] or seconds\n");
+        return 1;
+    }
+    if (a2l_index_query(r, ix, &q, rows, depth) < 0) {
+        fprintf(stderr, "a2l-index: out of memory\n");
+        return 1;
+    }
+    a2l_index_close(ix);
+    a2l_read_close(r);
+    return 0;
+}
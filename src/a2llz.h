@@ -0,0 +1,188 @@
+// a2llz.h -- small LZ77 block codec for trace blocks.
+//
+// the compressed form is the LZ4 block format, so any LZ4 block
+// decoder reads it too; nothing here depends on liblz4.  blocks are
+// compressed independently, with no dictionary carried between them,
+// so each one decodes on its own.
+//
+// greedy single-probe matching: fast rather than dense, since it runs
+// on the hook's flush path.
+
+#ifndef A2L__LZ_H
+#define A2L__LZ_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define A2L_LZ_HASH_BITS 14
+#define A2L_LZ_TABLE_ENTRIES (1 << A2L_LZ_HASH_BITS)
+#define A2L_LZ_MIN_MATCH 4
+#define A2L_LZ_MAX_OFFSET 65535
+
+// format limits: a match can't start in the last 12 bytes, and the
+// last 5 bytes are always literals
+#define A2L_LZ_MFLIMIT 12
+#define A2L_LZ_LASTLITERALS 5
+
+// worst case compressed size
+#define A2L_LZ_BOUND(n) ((n) + (n)/255 + 16)
+
+static inline uint32_t
+a2l_lz__read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t
+a2l_lz__hash(uint32_t seq) {
+    return (seq * 2654435761u) >> (32 - A2L_LZ_HASH_BITS);
+}
+
+static inline uint8_t *
+a2l_lz__put_length(uint8_t *op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+// emits one sequence: literals, then a match unless match_len is 0
+static inline uint8_t *
+a2l_lz__put_sequence(uint8_t *op, const uint8_t *literals, size_t lit_len,
+                     size_t offset, size_t match_len) {
+    uint8_t *token = op++;
+    size_t ml = match_len ? match_len - A2L_LZ_MIN_MATCH : 0;
+
+    *token = (uint8_t)((lit_len >= 15 ? 15 : lit_len) << 4);
+    if (lit_len >= 15)
+        op = a2l_lz__put_length(op, lit_len - 15);
+    memcpy(op, literals, lit_len);
+    op += lit_len;
+
+    if (match_len) {
+        *op++ = (uint8_t)(offset & 0xff);
+        *op++ = (uint8_t)(offset >> 8);
+        *token |= (uint8_t)(ml >= 15 ? 15 : ml);
+        if (ml >= 15)
+            op = a2l_lz__put_length(op, ml - 15);
+    }
+    return op;
+}
+
+// compress src into dst, which must hold A2L_LZ_BOUND(src_len)
+// bytes.  table is scratch of A2L_LZ_TABLE_ENTRIES.  returns the
+// compressed size.
+static inline size_t
+a2l_lz_compress(const uint8_t *src, size_t src_len, uint8_t *dst, uint32_t *table) {
+    const uint8_t *ip = src, *anchor = src;
+    const uint8_t *end = src + src_len;
+    uint8_t *op = dst;
+
+    if (src_len > A2L_LZ_MFLIMIT) {
+        const uint8_t *mflimit = end - A2L_LZ_MFLIMIT;
+        const uint8_t *match_limit = end - A2L_LZ_LASTLITERALS;
+
+        // positions are stored + 1; 0 is empty
+        memset(table, 0, sizeof(uint32_t) * A2L_LZ_TABLE_ENTRIES);
+
+        while (ip < mflimit) {
+            uint32_t seq = a2l_lz__read32(ip);
+            uint32_t h = a2l_lz__hash(seq);
+            size_t ref_pos = table[h];
+            table[h] = (uint32_t)(ip - src) + 1;
+
+            if (ref_pos == 0 || (size_t)(ip - src) + 1 - ref_pos > A2L_LZ_MAX_OFFSET ||
+                a2l_lz__read32(src + ref_pos - 1) != seq) {
+                // skip faster through incompressible runs
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+
+            const uint8_t *ref = src + ref_pos - 1;
+            size_t len = A2L_LZ_MIN_MATCH;
+            while (ip + len < match_limit && ref[len] == ip[len])
+                len++;
+
+            op = a2l_lz__put_sequence(op, anchor, ip - anchor, ip - ref, len);
+            ip += len;
+            anchor = ip;
+
+            if (ip < mflimit)
+                table[a2l_lz__hash(a2l_lz__read32(ip - 2))] = (uint32_t)(ip - 2 - src) + 1;
+        }
+    }
+
+    op = a2l_lz__put_sequence(op, anchor, end - anchor, 0, 0);
+    return op - dst;
+}
+
+// decompress src into dst of exactly dst_len bytes.  returns the
+// decompressed size, or -1 if src is malformed.
+static inline long
+a2l_lz_decompress(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_len) {
+    const uint8_t *ip = src, *ip_end = src + src_len;
+    uint8_t *op = dst, *op_end = dst + dst_len;
+
+    while (ip < ip_end) {
+        uint8_t token = *ip++;
+        size_t len = token >> 4;
+
+        if (len == 15) {
+            uint8_t b;
+            do {
+                if (ip >= ip_end)
+                    return -1;
+                b = *ip++;
+                len += b;
+            } while (b == 255);
+        }
+        if ((size_t)(ip_end - ip) < len || (size_t)(op_end - op) < len)
+            return -1;
+        memcpy(op, ip, len);
+        ip += len;
+        op += len;
+
+        // the last sequence has literals only
+        if (ip == ip_end)
+            break;
+
+        if (ip_end - ip < 2)
+            return -1;
+        size_t offset = ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst))
+            return -1;
+
+        len = token & 15;
+        if (len == 15) {
+            uint8_t b;
+            do {
+                if (ip >= ip_end)
+                    return -1;
+                b = *ip++;
+                len += b;
+            } while (b == 255);
+        }
+        len += A2L_LZ_MIN_MATCH;
+        if ((size_t)(op_end - op) < len)
+            return -1;
+
+        // byte at a time: matches may overlap their own output
+        const uint8_t *ref = op - offset;
+        if (offset >= len) {
+            memcpy(op, ref, len);
+            op += len;
+        } else {
+            while (len--)
+                *op++ = *ref++;
+        }
+    }
+
+    return op - dst;
+}
+
+#endif
@@ -0,0 +1,249 @@
+#define _GNU_SOURCE
+// a2lmerge.c -- liba2lread's k-way merge; see a2lread.h.
+//
+// a trace's blocks are each one thread's events in time order, and a
+// thread's blocks follow each other in the trace, so every (reader,
+// thread) is a sorted stream.  a stream decodes one block at a time,
+// through an iterator over just that block; the streams' heads are
+// merged with a loser tree: the root holds the winner, each inner node
+// the loser of the match played there, so taking the winner and
+// replaying its leaf's path is log2(k) comparisons, against one
+// node each.
+//
+// events sort by time, then by sequence: reader, then the event's
+// place in its trace (block, then position).  equal times come out in
+// trace order, the same from run to run.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "a2lread.h"
+
+typedef struct {
+    const a2l_reader_t *reader;
+    uint32_t source;
+    uint32_t tid;
+    uint64_t shift;                 // reader's start_ns less the earliest
+    uint64_t *blocks;               // its blocks, in trace order
+    uint64_t num_blocks, next;
+    a2l_iter_t it;
+    a2l_event_t head;               // next event out, if not done
+    uint64_t seq;                   // block << 32 | position
+    int done;
+}a2l__stream_t;
+
+// a block, while streams are found
+typedef struct {
+    uint32_t source;
+    uint32_t tid;
+    uint64_t block;
+}a2l__mergestub_t;
+
+struct a2l_merge {
+    a2l__stream_t *streams;
+    uint32_t num_streams;
+    uint32_t *tree;                 // [0] the winner, [1, k) losers
+    uint64_t *block_lists;
+};
+
+// s before t
+static inline int
+a2l__merge_before(const a2l__stream_t *s, const a2l__stream_t *t) {
+    if (s->done != t->done)
+        return t->done;
+    if (s->head.ts != t->head.ts)
+        return s->head.ts < t->head.ts;
+    if (s->source != t->source)
+        return s->source < t->source;
+    return s->seq < t->seq;
+}
+
+// s's next event into head, or done
+static void
+a2l__merge_advance(a2l__stream_t *s) {
+    for (;;) {
+        if (a2l_iter_next(&s->it, &s->head)) {
+            s->head.ts += s->shift;
+            s->seq++;
+            return;
+        }
+        if (s->next == s->num_blocks) {
+            s->done = 1;
+            return;
+        }
+
+        // the next block: the iterator keeps its buffer
+        uint64_t block = s->blocks[s->next++];
+        s->it.block = block;
+        s->it.end_block = block + 1;
+        s->seq = block << 32;
+    }
+}
+
+static inline int
+a2l__merge_same_stream(const a2l__mergestub_t *a, const a2l__mergestub_t *b) {
+    return a->source == b->source && a->tid == b->tid;
+}
+
+static int
+a2l__merge_cmp_stub(const void *pa, const void *pb) {
+    const a2l__mergestub_t *a = pa, *b = pb;
+    if (a->source != b->source)
+        return a->source < b->source ? -1 : 1;
+    if (a->tid != b->tid)
+        return a->tid < b->tid ? -1 : 1;
+    return a->block < b->block ? -1 : a->block > b->block;
+}
+
+a2l_merge_t *
+a2l_merge_open(a2l_reader_t *const *readers, uint32_t num_readers) {
+    a2l_merge_t *m = calloc(1, sizeof(a2l_merge_t));
+    uint64_t total_blocks = 0, earliest = UINT64_MAX;
+    uint32_t max_streams = 0;
+
+    if (!m)
+        return NULL;
+    for (uint32_t i = 0; i < num_readers; i++) {
+        const a2l_readinfo_t *info = a2l_read_info(readers[i]);
+        total_blocks += info->num_blocks;
+        if (info->start_ns < earliest)
+            earliest = info->start_ns;
+    }
+
+    // a stream per (reader, tid), found by sorting a stub per block
+    a2l__mergestub_t *stubs = malloc((total_blocks ? total_blocks : 1) * sizeof(a2l__mergestub_t));
+    m->block_lists = malloc((total_blocks ? total_blocks : 1) * sizeof(uint64_t));
+    if (!stubs || !m->block_lists) {
+        free(stubs);
+        a2l_merge_close(m);
+        return NULL;
+    }
+    uint64_t n = 0;
+    for (uint32_t i = 0; i < num_readers; i++) {
+        const a2l_readinfo_t *info = a2l_read_info(readers[i]);
+        for (uint64_t b = 0; b < info->num_blocks; b++) {
+            stubs[n].source = i;
+            stubs[n].tid = a2l_read_block(readers[i], b)->tid;
+            stubs[n].block = b;
+            n++;
+        }
+    }
+    qsort(stubs, n, sizeof(a2l__mergestub_t), a2l__merge_cmp_stub);
+    for (uint64_t i = 0; i < n; i++)
+        if (!i || !a2l__merge_same_stream(&stubs[i - 1], &stubs[i]))
+            max_streams++;
+
+    m->streams = calloc(max_streams ? max_streams : 1, sizeof(a2l__stream_t));
+    m->tree = calloc(max_streams ? max_streams : 1, sizeof(uint32_t));
+    if (!m->streams || !m->tree) {
+        free(stubs);
+        a2l_merge_close(m);
+        return NULL;
+    }
+    for (uint64_t i = 0; i < n;) {
+        a2l__stream_t *s = &m->streams[m->num_streams++];
+
+        s->reader = readers[stubs[i].source];
+        s->source = stubs[i].source;
+        s->tid = stubs[i].tid;
+        s->shift = a2l_read_info(s->reader)->start_ns - earliest;
+        s->blocks = m->block_lists + i;
+        for (uint64_t j = i; j < n && a2l__merge_same_stream(&stubs[i], &stubs[j]); j++)
+            s->blocks[s->num_blocks++] = stubs[j].block;
+        i += s->num_blocks;
+
+        a2l_iter_init(&s->it, s->reader, 0, 0);
+        a2l__merge_advance(s);
+    }
+    free(stubs);
+
+    // the first tournament, bottom up: leaves are k..2k-1, inner
+    // nodes 1..k-1, each node's winner goes up and its loser stays
+    uint32_t k = m->num_streams;
+    if (k) {
+        uint32_t *winners = malloc(2 * k * sizeof(uint32_t));
+        if (!winners) {
+            a2l_merge_close(m);
+            return NULL;
+        }
+        for (uint32_t i = 0; i < k; i++)
+            winners[k + i] = i;
+        for (uint32_t node = k - 1; node >= 1; node--) {
+            uint32_t a = winners[2 * node], b = winners[2 * node + 1];
+            int a_wins = a2l__merge_before(&m->streams[a], &m->streams[b]);
+            winners[node] = a_wins ? a : b;
+            m->tree[node] = a_wins ? b : a;
+        }
+        m->tree[0] = k > 1 ? winners[1] : 0;
+        free(winners);
+    }
+    return m;
+}
+
+void
+a2l_merge_close(a2l_merge_t *m) {
+    if (!m)
+        return;
+    for (uint32_t i = 0; i < m->num_streams; i++)
+        a2l_iter_free(&m->streams[i].it);
+    free(m->streams);
+    free(m->tree);
+    free(m->block_lists);
+    free(m);
+}
+
+int
+a2l_merge_next(a2l_merge_t *m, a2l_event_t *e, uint32_t *source) {
+    uint32_t k = m->num_streams;
+
+    if (!k)
+        return 0;
+
+    uint32_t winner = m->tree[0];
+    a2l__stream_t *s = &m->streams[winner];
+    if (s->done)
+        return 0;
+    *e = s->head;
+    if (source)
+        *source = s->source;
+    a2l__merge_advance(s);
+
+    // replay the winner's path to the root
+    for (uint32_t node = (winner + k) / 2; node >= 1; node /= 2) {
+        if (a2l__merge_before(&m->streams[m->tree[node]], &m->streams[winner])) {
+            uint32_t t = m->tree[node];
+            m->tree[node] = winner;
+            winner = t;
+        }
+    }
+    m->tree[0] = winner;
+    return 1;
+}
+
+uint32_t
+a2l_merge_batch(a2l_merge_t *m, a2l_batch_t *b) {
+    a2l_event_t e;
+    uint32_t n = 0;
+
+    while (n < b->capacity && a2l_merge_next(m, &e, NULL)) {
+        b->ts[n] = e.ts;
+        b->ptr[n] = e.ptr;
+        b->bytes[n] = e.bytes;
+        b->stack_id[n] = e.stack_id;
+        b->alloc_stack_id[n] = e.alloc_stack_id;
+        b->tid[n] = e.tid;
+        b->type[n] = e.type;
+        n++;
+    }
+    b->count = n;
+    return n;
+}
+
+uint64_t
+a2l_merge_bad_blocks(const a2l_merge_t *m) {
+    uint64_t bad = 0;
+
+    for (uint32_t i = 0; i < m->num_streams; i++)
+        bad += m->streams[i].it.bad_blocks;
+    return bad;
+}
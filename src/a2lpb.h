@@ -0,0 +1,95 @@
+// a2lpb.h -- small protobuf encoder, for exports in protobuf formats.
+//
+// a message is built in a growing buffer.  one nested in another is
+// built in a buffer of its own and added whole: its length goes
+// first, so it can't be written in place.  the first allocation that
+// fails marks the buffer failed, and later calls do nothing; the
+// failure carries up into any message it's added to, so the caller
+// checks once, at the end.
+
+#ifndef A2L__PB_H
+#define A2L__PB_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    uint8_t *p;
+    size_t len, max;
+    int failed;
+}a2l_pb_t;
+
+static inline int
+a2l_pb_reserve(a2l_pb_t *b, size_t n) {
+    if (b->failed)
+        return -1;
+    if (b->len + n > b->max) {
+        size_t max = b->max ? b->max : 256;
+        while (b->len + n > max)
+            max *= 2;
+        uint8_t *grown = realloc(b->p, max);
+        if (!grown) {
+            b->failed = 1;
+            return -1;
+        }
+        b->p = grown;
+        b->max = max;
+    }
+    return 0;
+}
+
+static inline void
+a2l_pb_varint(a2l_pb_t *b, uint64_t v) {
+    if (a2l_pb_reserve(b, 10) < 0)
+        return;
+    while (v >= 0x80) {
+        b->p[b->len++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    b->p[b->len++] = (uint8_t)v;
+}
+
+// a varint field; negative int64s take ten bytes, as protobuf has it
+static inline void
+a2l_pb_int(a2l_pb_t *b, uint32_t field, uint64_t v) {
+    a2l_pb_varint(b, (uint64_t)field << 3);
+    a2l_pb_varint(b, v);
+}
+
+// a length-delimited field: a string, a message or packed varints
+static inline void
+a2l_pb_bytes(a2l_pb_t *b, uint32_t field, const void *data, size_t len) {
+    a2l_pb_varint(b, (uint64_t)field << 3 | 2);
+    a2l_pb_varint(b, len);
+    if (a2l_pb_reserve(b, len) < 0)
+        return;
+    memcpy(b->p + b->len, data, len);
+    b->len += len;
+}
+
+static inline void
+a2l_pb_string(a2l_pb_t *b, uint32_t field, const char *s) {
+    a2l_pb_bytes(b, field, s, strlen(s));
+}
+
+static inline void
+a2l_pb_message(a2l_pb_t *b, uint32_t field, const a2l_pb_t *msg) {
+    if (msg->failed)
+        b->failed = 1;
+    a2l_pb_bytes(b, field, msg->p, msg->len);
+}
+
+// fields already encoded, as they are
+static inline void
+a2l_pb_append(a2l_pb_t *b, const a2l_pb_t *from) {
+    if (from->failed)
+        b->failed = 1;
+    if (a2l_pb_reserve(b, from->len) < 0)
+        return;
+    memcpy(b->p + b->len, from->p, from->len);
+    b->len += from->len;
+}
+
+#endif
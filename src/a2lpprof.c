@@ -0,0 +1,358 @@
+#define _GNU_SOURCE
+// a2lpprof.c -- heap profiles in pprof's format; see a2lpprof.h.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "a2lpprof.h"
+#include "a2lgz.h"
+#include "a2lpb.h"
+
+#define A2L_PPROF_PAGE 4096
+
+// profile.proto's field numbers
+#define A2L_PB_PROFILE_SAMPLE_TYPE    1
+#define A2L_PB_PROFILE_SAMPLE         2
+#define A2L_PB_PROFILE_MAPPING        3
+#define A2L_PB_PROFILE_LOCATION       4
+#define A2L_PB_PROFILE_FUNCTION       5
+#define A2L_PB_PROFILE_STRING_TABLE   6
+#define A2L_PB_PROFILE_TIME_NANOS     9
+#define A2L_PB_PROFILE_DURATION_NANOS 10
+#define A2L_PB_PROFILE_PERIOD_TYPE    11
+#define A2L_PB_PROFILE_PERIOD         12
+#define A2L_PB_PROFILE_DEFAULT_TYPE   14
+#define A2L_PB_VALUETYPE_TYPE         1
+#define A2L_PB_VALUETYPE_UNIT         2
+#define A2L_PB_SAMPLE_LOCATION_ID     1
+#define A2L_PB_SAMPLE_VALUE           2
+#define A2L_PB_MAPPING_ID             1
+#define A2L_PB_MAPPING_MEMORY_START   2
+#define A2L_PB_MAPPING_MEMORY_LIMIT   3
+#define A2L_PB_MAPPING_FILENAME       5
+#define A2L_PB_MAPPING_HAS_FUNCTIONS  7
+#define A2L_PB_LOCATION_ID            1
+#define A2L_PB_LOCATION_MAPPING_ID    2
+#define A2L_PB_LOCATION_ADDRESS       3
+#define A2L_PB_LOCATION_LINE          4
+#define A2L_PB_LINE_FUNCTION_ID       1
+#define A2L_PB_FUNCTION_ID            1
+#define A2L_PB_FUNCTION_NAME          2
+#define A2L_PB_FUNCTION_SYSTEM_NAME   3
+
+// ids from 1 up by key: addresses, symbol and module ids
+typedef struct {
+    uint64_t *keys;
+    uint32_t *ids;                  // 0 if empty
+    uint32_t mask, count;
+}a2l__pprof_map_t;
+
+typedef struct {
+    uint64_t start, limit;
+    uint32_t filename;              // in the string table
+    int has_functions;              // every frame in it symbolized
+}a2l__pprof_mapping_t;
+
+typedef struct {
+    const a2l_reader_t *r;
+    a2l_pb_t samples, mappings, locations, functions;
+    a2l_pb_t msg, line, ids, values;   // scratch
+    a2l__pprof_map_t location_ids, function_ids, mapping_ids;
+    a2l__pprof_mapping_t *mapping;  // by id - 1
+    const char **strings;
+    uint32_t num_strings, max_strings;
+    uint32_t *string_slots;         // index + 1, by hash
+    uint32_t string_mask;
+    int failed;
+}a2l__pprof_t;
+
+//
+// tables
+//
+
+static int
+a2l__pprof_map_grow(a2l__pprof_map_t *m) {
+    a2l__pprof_map_t grown = {0};
+
+    grown.mask = m->mask ? m->mask * 2 + 1 : 1023;
+    grown.count = m->count;
+    if (!(grown.keys = malloc((grown.mask + 1) * sizeof(uint64_t))) ||
+        !(grown.ids = calloc(grown.mask + 1, sizeof(uint32_t)))) {
+        free(grown.keys);
+        return -1;
+    }
+    for (uint32_t i = 0; m->ids && i <= m->mask; i++) {
+        if (!m->ids[i])
+            continue;
+        uint32_t j = (uint32_t)((m->keys[i] * 0x9e3779b97f4a7c15ULL) >> 32) & grown.mask;
+        while (grown.ids[j])
+            j = (j + 1) & grown.mask;
+        grown.keys[j] = m->keys[i];
+        grown.ids[j] = m->ids[i];
+    }
+    free(m->keys);
+    free(m->ids);
+    *m = grown;
+    return 0;
+}
+
+// key's id, a new one if it had none (and *added set); 0 if out of memory
+static uint32_t
+a2l__pprof_map_id(a2l__pprof_map_t *m, uint64_t key, int *added) {
+    *added = 0;
+    if (2 * (m->count + 1) > m->mask + 1 && a2l__pprof_map_grow(m) < 0)
+        return 0;
+    uint32_t i = (uint32_t)((key * 0x9e3779b97f4a7c15ULL) >> 32) & m->mask;
+    while (m->ids[i] && m->keys[i] != key)
+        i = (i + 1) & m->mask;
+    if (!m->ids[i]) {
+        m->keys[i] = key;
+        m->ids[i] = ++m->count;
+        *added = 1;
+    }
+    return m->ids[i];
+}
+
+static void
+a2l__pprof_map_free(a2l__pprof_map_t *m) {
+    free(m->keys);
+    free(m->ids);
+}
+
+// s's index in the string table, which keeps the pointer
+static uint32_t
+a2l__pprof_string(a2l__pprof_t *p, const char *s) {
+    if (2 * (p->num_strings + 1) > p->string_mask + 1) {
+        uint32_t mask = p->string_mask ? p->string_mask * 2 + 1 : 1023;
+        uint32_t *slots = calloc(mask + 1, sizeof(uint32_t));
+        const char **strings = realloc(p->strings, (mask + 1) / 2 * sizeof(const char *));
+        if (!slots || !strings) {
+            free(slots);
+            if (strings)
+                p->strings = strings;
+            p->failed = 1;
+            return 0;
+        }
+        p->strings = strings;
+        p->max_strings = (mask + 1) / 2;
+        free(p->string_slots);
+        p->string_slots = slots;
+        p->string_mask = mask;
+        for (uint32_t i = 0; i < p->num_strings; i++) {
+            uint64_t h = 0xcbf29ce484222325ULL;
+            for (const char *c = p->strings[i]; *c; c++)
+                h = (h ^ (uint8_t)*c) * 0x100000001b3ULL;
+            uint32_t j = (uint32_t)h & mask;
+            while (slots[j])
+                j = (j + 1) & mask;
+            slots[j] = i + 1;
+        }
+    }
+
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (const char *c = s; *c; c++)
+        h = (h ^ (uint8_t)*c) * 0x100000001b3ULL;
+    uint32_t j = (uint32_t)h & p->string_mask;
+    while (p->string_slots[j] && strcmp(p->strings[p->string_slots[j] - 1], s))
+        j = (j + 1) & p->string_mask;
+    if (!p->string_slots[j]) {
+        p->strings[p->num_strings++] = s;
+        p->string_slots[j] = p->num_strings;
+    }
+    return p->string_slots[j] - 1;
+}
+
+//
+// the profile
+//
+
+// the mapping id of frame's module, stretched to take it in; 0 if none
+static uint32_t
+a2l__pprof_mapping(a2l__pprof_t *p, const a2l_frame_t *frame, int symbolized) {
+    const a2l_module_t *module = a2l_read_module(p->r, frame->module_id);
+    int added;
+
+    if (!module)
+        return 0;
+    uint32_t id = a2l__pprof_map_id(&p->mapping_ids, frame->module_id, &added);
+    if (!id) {
+        p->failed = 1;
+        return 0;
+    }
+    if (added) {
+        a2l__pprof_mapping_t *grown = realloc(p->mapping, id * sizeof(a2l__pprof_mapping_t));
+        if (!grown) {
+            p->failed = 1;
+            return 0;
+        }
+        p->mapping = grown;
+        p->mapping[id - 1].start = module->base;
+        p->mapping[id - 1].limit = module->base;
+        p->mapping[id - 1].filename = a2l__pprof_string(p, module->path);
+        p->mapping[id - 1].has_functions = 1;
+    }
+    a2l__pprof_mapping_t *m = &p->mapping[id - 1];
+    if (frame->addr >= m->limit)
+        m->limit = frame->addr + 1;
+    if (!symbolized)
+        m->has_functions = 0;
+    return id;
+}
+
+static uint32_t
+a2l__pprof_function(a2l__pprof_t *p, const a2l_symbol_t *symbol) {
+    int added;
+    uint32_t id = a2l__pprof_map_id(&p->function_ids, symbol->id, &added);
+
+    if (!id)
+        p->failed = 1;
+    else if (added) {
+        uint32_t name = a2l__pprof_string(p, symbol->name);
+        p->msg.len = 0;
+        a2l_pb_int(&p->msg, A2L_PB_FUNCTION_ID, id);
+        a2l_pb_int(&p->msg, A2L_PB_FUNCTION_NAME, name);
+        a2l_pb_int(&p->msg, A2L_PB_FUNCTION_SYSTEM_NAME, name);
+        a2l_pb_message(&p->functions, A2L_PB_PROFILE_FUNCTION, &p->msg);
+    }
+    return id;
+}
+
+// a frame's location id, one per address
+static uint32_t
+a2l__pprof_location(a2l__pprof_t *p, const a2l_frame_t *frame) {
+    int added;
+    uint32_t id = a2l__pprof_map_id(&p->location_ids, frame->addr, &added);
+
+    if (!id) {
+        p->failed = 1;
+        return 0;
+    }
+    if (!added)
+        return id;
+
+    const a2l_symbol_t *symbol = a2l_read_symbol(p->r, frame->symbol_id);
+    uint32_t mapping = a2l__pprof_mapping(p, frame, symbol != NULL);
+    uint32_t function = symbol ? a2l__pprof_function(p, symbol) : 0;
+
+    p->msg.len = 0;
+    a2l_pb_int(&p->msg, A2L_PB_LOCATION_ID, id);
+    if (mapping)
+        a2l_pb_int(&p->msg, A2L_PB_LOCATION_MAPPING_ID, mapping);
+    a2l_pb_int(&p->msg, A2L_PB_LOCATION_ADDRESS, frame->addr);
+    if (function) {
+        p->line.len = 0;
+        a2l_pb_int(&p->line, A2L_PB_LINE_FUNCTION_ID, function);
+        a2l_pb_message(&p->msg, A2L_PB_LOCATION_LINE, &p->line);
+    }
+    a2l_pb_message(&p->locations, A2L_PB_PROFILE_LOCATION, &p->msg);
+    return id;
+}
+
+static void
+a2l__pprof_sample(a2l__pprof_t *p, const a2l_pprofsite_t *site) {
+    const a2l_stack_t *stack = site->stack_id ? a2l_read_stack(p->r, site->stack_id) : NULL;
+
+    // frames innermost first, as pprof has them
+    p->ids.len = 0;
+    for (uint32_t i = 0; stack && i < stack->num_frames; i++)
+        a2l_pb_varint(&p->ids, a2l__pprof_location(p, &stack->frames[i]));
+
+    p->values.len = 0;
+    a2l_pb_varint(&p->values, (uint64_t)site->alloc_objects);
+    a2l_pb_varint(&p->values, (uint64_t)site->alloc_space);
+    a2l_pb_varint(&p->values, (uint64_t)site->inuse_objects);
+    a2l_pb_varint(&p->values, (uint64_t)site->inuse_space);
+
+    p->msg.len = 0;
+    a2l_pb_message(&p->msg, A2L_PB_SAMPLE_LOCATION_ID, &p->ids);
+    a2l_pb_message(&p->msg, A2L_PB_SAMPLE_VALUE, &p->values);
+    a2l_pb_message(&p->samples, A2L_PB_PROFILE_SAMPLE, &p->msg);
+}
+
+static void
+a2l__pprof_value_type(a2l__pprof_t *p, a2l_pb_t *b, uint32_t field, const char *type, const char *unit) {
+    uint32_t type_index = a2l__pprof_string(p, type), unit_index = a2l__pprof_string(p, unit);
+
+    p->msg.len = 0;
+    a2l_pb_int(&p->msg, A2L_PB_VALUETYPE_TYPE, type_index);
+    a2l_pb_int(&p->msg, A2L_PB_VALUETYPE_UNIT, unit_index);
+    a2l_pb_message(b, field, &p->msg);
+}
+
+int
+a2l_pprof_write(const a2l_reader_t *r, const a2l_pprofsite_t *sites, uint64_t num_sites, FILE *f) {
+    const a2l_readinfo_t *info = a2l_read_info(r);
+    static const char *types[4][2] = {
+        {"alloc_objects", "count"}, {"alloc_space", "bytes"},
+        {"inuse_objects", "count"}, {"inuse_space", "bytes"}
+    };
+    a2l__pprof_t p;
+    a2l_pb_t out = {0};
+    int ret = -1;
+
+    memset(&p, 0, sizeof(p));
+    p.r = r;
+    a2l__pprof_string(&p, "");      // index 0 is always ""
+
+    for (int i = 0; i < 4; i++)
+        a2l__pprof_value_type(&p, &out, A2L_PB_PROFILE_SAMPLE_TYPE, types[i][0], types[i][1]);
+    for (uint64_t i = 0; i < num_sites && !p.failed; i++)
+        if (sites[i].alloc_objects || sites[i].inuse_objects)
+            a2l__pprof_sample(&p, &sites[i]);
+
+    for (uint32_t i = 0; i < p.mapping_ids.count; i++) {
+        const a2l__pprof_mapping_t *m = &p.mapping[i];
+        p.msg.len = 0;
+        a2l_pb_int(&p.msg, A2L_PB_MAPPING_ID, i + 1);
+        a2l_pb_int(&p.msg, A2L_PB_MAPPING_MEMORY_START, m->start);
+        a2l_pb_int(&p.msg, A2L_PB_MAPPING_MEMORY_LIMIT, (m->limit + A2L_PPROF_PAGE - 1) & ~(uint64_t)(A2L_PPROF_PAGE - 1));
+        a2l_pb_int(&p.msg, A2L_PB_MAPPING_FILENAME, m->filename);
+        a2l_pb_int(&p.msg, A2L_PB_MAPPING_HAS_FUNCTIONS, m->has_functions);
+        a2l_pb_message(&p.mappings, A2L_PB_PROFILE_MAPPING, &p.msg);
+    }
+
+    a2l_pb_append(&out, &p.samples);
+    a2l_pb_append(&out, &p.mappings);
+    a2l_pb_append(&out, &p.locations);
+    a2l_pb_append(&out, &p.functions);
+    a2l_pb_int(&out, A2L_PB_PROFILE_TIME_NANOS, info->start_realtime_ns);
+    a2l_pb_int(&out, A2L_PB_PROFILE_DURATION_NANOS, info->last_ts);
+    a2l__pprof_value_type(&p, &out, A2L_PB_PROFILE_PERIOD_TYPE, "space", "bytes");
+    a2l_pb_int(&out, A2L_PB_PROFILE_PERIOD, 1);
+    a2l_pb_int(&out, A2L_PB_PROFILE_DEFAULT_TYPE, a2l__pprof_string(&p, "inuse_space"));
+    // the table last, with every string in it
+    for (uint32_t i = 0; i < p.num_strings; i++)
+        a2l_pb_string(&out, A2L_PB_PROFILE_STRING_TABLE, p.strings[i]);
+
+    if (!p.failed && !out.failed && !p.msg.failed && !p.line.failed && !p.ids.failed && !p.values.failed) {
+        uint8_t *gz = malloc(A2L_GZ_BOUND(out.len));
+        uint32_t *table = malloc(A2L_GZ_TABLE_ENTRIES * sizeof(uint32_t));
+        if (gz && table) {
+            size_t len = a2l_gz_compress(out.p, out.len, gz, table);
+            ret = fwrite(gz, 1, len, f) == len ? 0 : -1;
+        } else
+            errno = ENOMEM;
+        free(gz);
+        free(table);
+    } else
+        errno = ENOMEM;
+
+    free(out.p);
+    free(p.samples.p);
+    free(p.mappings.p);
+    free(p.locations.p);
+    free(p.functions.p);
+    free(p.msg.p);
+    free(p.line.p);
+    free(p.ids.p);
+    free(p.values.p);
+    a2l__pprof_map_free(&p.location_ids);
+    a2l__pprof_map_free(&p.function_ids);
+    a2l__pprof_map_free(&p.mapping_ids);
+    free(p.mapping);
+    free(p.strings);
+    free(p.string_slots);
+    return ret;
+}
@@ -0,0 +1,32 @@
+// a2lpprof.h -- heap profiles in pprof's format, for a2l-analyze -F pprof.
+//
+// a profile.proto (github.com/google/pprof, proto/profile.proto),
+// gzipped as pprof writes them, encoded by hand.  each site is a
+// sample with four values: alloc_objects, alloc_space, inuse_objects
+// and inuse_space, the last the default view.  its stack's frames are
+// locations, innermost first, one per address; a symbol is a function;
+// a module is a mapping, from its base to the page past the highest
+// address seen in it, marked as having functions when all its frames
+// were symbolized, so pprof leaves it alone, else left for pprof to
+// symbolize from the binary.  the period is 1: every allocation is in
+// the trace.
+
+#ifndef A2L__PPROF_H
+#define A2L__PPROF_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "a2lread.h"
+
+typedef struct {
+    uint32_t stack_id;
+    uint32_t _pad;
+    int64_t alloc_objects, alloc_space;
+    int64_t inuse_objects, inuse_space;
+}a2l_pprofsite_t;
+
+// sites of r's trace as a profile into f; -1 with errno on failure
+int a2l_pprof_write(const a2l_reader_t *r, const a2l_pprofsite_t *sites, uint64_t num_sites, FILE *f);
+
+#endif
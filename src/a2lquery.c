@@ -0,0 +1,748 @@
+#define _GNU_SOURCE
+// a2lquery.c -- a2l-analyze's query language; see a2lquery.h.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "a2lquery.h"
+
+enum {
+    A2L__QT_END,
+    A2L__QT_WORD,                   // names, numbers, times: [A-Za-z0-9_.:]+
+    A2L__QT_STRING,                 // '...' or "..."
+    A2L__QT_PUNCT                   // = != < <= > >= ~ ( )
+};
+
+typedef struct {
+    const char *p;
+    int kind;
+    char tok[256];
+    a2l_query_t *q;
+    const a2l_readinfo_t *info;
+    char *error;
+    size_t error_len;
+    int failed;
+}a2l__qparser_t;
+
+static void
+a2l__query_fail(a2l__qparser_t *p, const char *what) {
+    if (p->failed)
+        return;
+    p->failed = 1;
+    if (p->kind == A2L__QT_END)
+        snprintf(p->error, p->error_len, "%s at the end of the query", what);
+    else
+        snprintf(p->error, p->error_len, "%s at '%s'", what, p->tok);
+}
+
+static void
+a2l__query_next(a2l__qparser_t *p) {
+    size_t n = 0;
+
+    while (isspace((unsigned char)*p->p))
+        p->p++;
+    if (!*p->p) {
+        p->kind = A2L__QT_END;
+        p->tok[0] = 0;
+        return;
+    }
+
+    char c = *p->p;
+    if (c == '\'' || c == '"') {
+        const char *end = strchr(p->p + 1, c);
+        if (!end) {
+            snprintf(p->tok, sizeof(p->tok), "%s", p->p);
+            p->kind = A2L__QT_STRING;
+            a2l__query_fail(p, "unterminated string");
+            p->p += strlen(p->p);
+            return;
+        }
+        n = (size_t)(end - p->p - 1);
+        if (n >= sizeof(p->tok))
+            n = sizeof(p->tok) - 1;
+        memcpy(p->tok, p->p + 1, n);
+        p->tok[n] = 0;
+        p->kind = A2L__QT_STRING;
+        p->p = end + 1;
+        return;
+    }
+    if (isalnum((unsigned char)c) || c == '_' || c == '.' || c == ':') {
+        while ((isalnum((unsigned char)*p->p) || *p->p == '_' || *p->p == '.' || *p->p == ':') &&
+               n < sizeof(p->tok) - 1)
+            p->tok[n++] = *p->p++;
+        p->tok[n] = 0;
+        p->kind = A2L__QT_WORD;
+        return;
+    }
+
+    p->tok[n++] = *p->p++;
+    if ((c == '!' || c == '<' || c == '>') && *p->p == '=')
+        p->tok[n++] = *p->p++;
+    p->tok[n] = 0;
+    p->kind = A2L__QT_PUNCT;
+}
+
+// the current token is the keyword or punctuation: take it
+static int
+a2l__query_accept(a2l__qparser_t *p, const char *tok) {
+    if (p->kind == A2L__QT_END || p->kind == A2L__QT_STRING || strcasecmp(p->tok, tok))
+        return 0;
+    a2l__query_next(p);
+    return 1;
+}
+
+static int
+a2l__query_expect(a2l__qparser_t *p, const char *tok) {
+    char what[64];
+
+    if (a2l__query_accept(p, tok))
+        return 1;
+    snprintf(what, sizeof(what), "expected '%s'", tok);
+    a2l__query_fail(p, what);
+    return 0;
+}
+
+// seconds since the trace began, or HH:MM[:SS] wall clock
+static int
+a2l__query_time(const char *str, const a2l_readinfo_t *info, uint64_t *ts) {
+    unsigned hour, minute;
+    double second = 0;
+    char *end;
+
+    if (!strchr(str, ':')) {
+        double seconds = strtod(str, &end);
+        if (end == str || *end || seconds < 0)
+            return -1;
+        *ts = (uint64_t)(seconds * 1e9);
+        return 0;
+    }
+
+    if (sscanf(str, "%u:%u:%lf", &hour, &minute, &second) < 2 || hour > 23 || minute > 59 ||
+        !info->start_realtime_ns)
+        return -1;
+
+    time_t start = (time_t)(info->start_realtime_ns / 1000000000ULL);
+    struct tm tm;
+    localtime_r(&start, &tm);
+    tm.tm_hour = (int)hour;
+    tm.tm_min = (int)minute;
+    tm.tm_sec = 0;
+    tm.tm_isdst = -1;
+    int64_t at_ns = (int64_t)mktime(&tm) * 1000000000LL + (int64_t)(second * 1e9);
+    if (at_ns + 3600LL * 1000000000LL < (int64_t)info->start_realtime_ns)
+        at_ns += 86400LL * 1000000000LL;
+
+    int64_t rel = at_ns - (int64_t)info->start_realtime_ns;
+    *ts = rel > 0 ? (uint64_t)rel : 0;
+    return 0;
+}
+
+// bytes, K/M/G suffixes ok
+static int
+a2l__query_bytes(const char *str, uint64_t *bytes) {
+    char *end;
+
+    if (!isdigit((unsigned char)*str))
+        return -1;
+    *bytes = strtoull(str, &end, 10);
+    switch (*end) {
+    case 'g': case 'G': *bytes <<= 10; // fallthrough
+    case 'm': case 'M': *bytes <<= 10; // fallthrough
+    case 'k': case 'K': *bytes <<= 10; end++;
+    }
+    return *end ? -1 : 0;
+}
+
+static int
+a2l__query_number(const char *str, int base, uint64_t *value) {
+    char *end;
+
+    if (!isxdigit((unsigned char)*str))
+        return -1;
+    *value = strtoull(str, &end, base);
+    return *end ? -1 : 0;
+}
+
+static a2l_qnode_t *
+a2l__query_node(a2l__qparser_t *p, int kind) {
+    a2l_qnode_t *n = calloc(1, sizeof(a2l_qnode_t));
+
+    if (!n) {
+        a2l__query_fail(p, "out of memory");
+        return NULL;
+    }
+    n->kind = kind;
+    n->index = (int)p->q->num_nodes++;
+    return n;
+}
+
+static void
+a2l__query_free_node(a2l_qnode_t *n) {
+    if (!n)
+        return;
+    a2l__query_free_node(n->left);
+    a2l__query_free_node(n->right);
+    free(n->text);
+    free(n->matches);
+    free(n);
+}
+
+static a2l_qnode_t *a2l__query_or(a2l__qparser_t *p);
+
+static a2l_qnode_t *
+a2l__query_leaf(a2l__qparser_t *p) {
+    static const struct { const char *name; int field; } fields[] = {
+        {"size", A2L_QF_SIZE}, {"time", A2L_QF_TIME}, {"thread", A2L_QF_THREAD},
+        {"type", A2L_QF_TYPE}, {"site", A2L_QF_SITE}, {"ptr", A2L_QF_PTR},
+        {"stack", A2L_QF_STACK}, {"module", A2L_QF_MODULE}
+    };
+    static const char *ops[] = {"=", "!=", "<", "<=", ">", ">="};
+    int field = -1, op = -1;
+
+    for (size_t i = 0; p->kind == A2L__QT_WORD && i < sizeof(fields) / sizeof(fields[0]); i++)
+        if (!strcasecmp(p->tok, fields[i].name))
+            field = fields[i].field;
+    if (field < 0) {
+        a2l__query_fail(p, "expected a field");
+        return NULL;
+    }
+    a2l__query_next(p);
+
+    if (field == A2L_QF_STACK || field == A2L_QF_MODULE) {
+        if (!a2l__query_expect(p, "~"))
+            return NULL;
+        if (p->kind != A2L__QT_STRING && p->kind != A2L__QT_WORD) {
+            a2l__query_fail(p, "expected text to match");
+            return NULL;
+        }
+        a2l_qnode_t *n = a2l__query_node(p, A2L_QN_MATCH);
+        if (n && !(n->text = strdup(p->tok))) {
+            a2l__query_fail(p, "out of memory");
+            a2l__query_free_node(n);
+            return NULL;
+        }
+        if (n) {
+            n->field = field;
+            a2l__query_next(p);
+        }
+        return n;
+    }
+
+    for (int i = 0; p->kind == A2L__QT_PUNCT && i < 6; i++)
+        if (!strcmp(p->tok, ops[i]))
+            op = i;
+    if (op < 0 || (field == A2L_QF_TYPE && op != A2L_QO_EQ && op != A2L_QO_NE)) {
+        a2l__query_fail(p, field == A2L_QF_TYPE ? "expected = or !=" : "expected a comparison");
+        return NULL;
+    }
+    a2l__query_next(p);
+
+    uint64_t value = 0;
+    int bad = p->kind != A2L__QT_WORD;
+    if (!bad) {
+        switch (field) {
+        case A2L_QF_SIZE:   bad = a2l__query_bytes(p->tok, &value) < 0; break;
+        case A2L_QF_TIME:   bad = a2l__query_time(p->tok, p->info, &value) < 0; break;
+        case A2L_QF_THREAD: bad = a2l__query_number(p->tok, 10, &value) < 0; break;
+        case A2L_QF_SITE:
+        case A2L_QF_PTR:    bad = a2l__query_number(p->tok, 16, &value) < 0; break;
+        case A2L_QF_TYPE:
+            if (!strcasecmp(p->tok, "alloc"))
+                value = A2L_REC_ALLOC;
+            else if (!strcasecmp(p->tok, "free"))
+                value = A2L_REC_FREE;
+            else
+                bad = 1;
+        }
+    }
+    if (bad) {
+        static const char *expected[] = {
+            "expected a size", "expected seconds, or HH:MM[:SS] on a trace with a wall clock",
+            "expected a thread id", "expected alloc or free", "expected a stack id in hex",
+            "expected a pointer in hex"
+        };
+        a2l__query_fail(p, expected[field]);
+        return NULL;
+    }
+
+    a2l_qnode_t *n = a2l__query_node(p, A2L_QN_CMP);
+    if (n) {
+        n->field = field;
+        n->op = op;
+        n->value = value;
+        a2l__query_next(p);
+    }
+    return n;
+}
+
+static a2l_qnode_t *
+a2l__query_unary(a2l__qparser_t *p) {
+    if (a2l__query_accept(p, "not")) {
+        a2l_qnode_t *n = a2l__query_node(p, A2L_QN_NOT);
+        if (n && !(n->left = a2l__query_unary(p))) {
+            a2l__query_free_node(n);
+            return NULL;
+        }
+        return n;
+    }
+    if (a2l__query_accept(p, "(")) {
+        a2l_qnode_t *n = a2l__query_or(p);
+        if (n && !a2l__query_expect(p, ")")) {
+            a2l__query_free_node(n);
+            return NULL;
+        }
+        return n;
+    }
+    return a2l__query_leaf(p);
+}
+
+// left-leaning chains of kind, between operands parsed by operand
+static a2l_qnode_t *
+a2l__query_chain(a2l__qparser_t *p, const char *word, int kind, a2l_qnode_t *(*operand)(a2l__qparser_t *)) {
+    a2l_qnode_t *left = operand(p);
+
+    while (left && a2l__query_accept(p, word)) {
+        a2l_qnode_t *n = a2l__query_node(p, kind);
+        if (!n || !(n->right = operand(p))) {
+            a2l__query_free_node(n);
+            a2l__query_free_node(left);
+            return NULL;
+        }
+        n->left = left;
+        left = n;
+    }
+    return left;
+}
+
+static a2l_qnode_t *
+a2l__query_and(a2l__qparser_t *p) {
+    return a2l__query_chain(p, "and", A2L_QN_AND, a2l__query_unary);
+}
+
+static a2l_qnode_t *
+a2l__query_or(a2l__qparser_t *p) {
+    return a2l__query_chain(p, "or", A2L_QN_OR, a2l__query_and);
+}
+
+int
+a2l_query_parse(a2l_query_t *q, const char *text, const a2l_readinfo_t *info,
+                char *error, size_t error_len) {
+    static const char *groups[] = {"site", "thread", "module", "type", "size", "time"};
+    static const char *columns[] = {"bytes", "allocs", "frees", "freed", "live", "events", "key"};
+    a2l__qparser_t p;
+
+    memset(q, 0, sizeof(*q));
+    q->group = A2L_QG_SITE;
+    q->order = A2L_QC_BYTES;
+    q->descending = 1;
+
+    memset(&p, 0, sizeof(p));
+    p.p = text;
+    p.q = q;
+    p.info = info;
+    p.error = error;
+    p.error_len = error_len;
+    a2l__query_next(&p);
+
+    if (a2l__query_accept(&p, "where"))
+        q->where = a2l__query_or(&p);
+
+    if (!p.failed && a2l__query_accept(&p, "group") && a2l__query_expect(&p, "by")) {
+        int group = -1;
+        for (int i = 0; p.kind == A2L__QT_WORD && i < 6; i++)
+            if (!strcasecmp(p.tok, groups[i]))
+                group = i;
+        if (group < 0)
+            a2l__query_fail(&p, "expected site, thread, module, type, size or time");
+        else {
+            q->group = group;
+            a2l__query_next(&p);
+            // time runs in order unless asked otherwise
+            if (group == A2L_QG_TIME) {
+                q->order = A2L_QC_KEY;
+                q->descending = 0;
+            }
+        }
+        if (!p.failed && group == A2L_QG_TIME) {
+            char *end;
+            double seconds = p.kind == A2L__QT_WORD ? strtod(p.tok, &end) : 0;
+            if (seconds <= 0 || *end)
+                a2l__query_fail(&p, "expected the buckets' width in seconds");
+            else {
+                q->bucket_ns = (uint64_t)(seconds * 1e9);
+                q->bucket_ns += !q->bucket_ns;
+                a2l__query_next(&p);
+            }
+        }
+    }
+
+    if (!p.failed && a2l__query_accept(&p, "order") && a2l__query_expect(&p, "by")) {
+        int order = -1;
+        for (int i = 0; p.kind == A2L__QT_WORD && i < 7; i++)
+            if (!strcasecmp(p.tok, columns[i]))
+                order = i;
+        if (order < 0)
+            a2l__query_fail(&p, "expected bytes, allocs, frees, freed, live, events or key");
+        else {
+            q->order = order;
+            q->descending = order != A2L_QC_KEY;
+            a2l__query_next(&p);
+            if (a2l__query_accept(&p, "asc"))
+                q->descending = 0;
+            else if (a2l__query_accept(&p, "desc"))
+                q->descending = 1;
+        }
+    }
+
+    if (!p.failed && a2l__query_accept(&p, "limit")) {
+        uint64_t limit;
+        if (p.kind != A2L__QT_WORD || a2l__query_number(p.tok, 10, &limit) < 0 || !limit ||
+            limit > UINT32_MAX)
+            a2l__query_fail(&p, "expected a row count");
+        else {
+            q->limit = (uint32_t)limit;
+            a2l__query_next(&p);
+        }
+    }
+
+    if (!p.failed && p.kind != A2L__QT_END)
+        a2l__query_fail(&p, "expected where, group by, order by or limit");
+    if (p.failed) {
+        a2l_query_free(q);
+        return -1;
+    }
+    return 0;
+}
+
+void
+a2l_query_free(a2l_query_t *q) {
+    a2l__query_free_node(q->where);
+    q->where = NULL;
+}
+
+// snprintf at buf + *len, counting what doesn't fit
+static void
+a2l__query_put(char *buf, size_t size, size_t *len, const char *fmt, ...) {
+    size_t at = *len < size ? *len : size;
+    va_list args;
+
+    va_start(args, fmt);
+    *len += (size_t)vsnprintf(buf + at, size - at, fmt, args);
+    va_end(args);
+}
+
+static void
+a2l__query_key_node(const a2l_qnode_t *n, char *buf, size_t size, size_t *len) {
+    static const char *kinds[] = {"cmp", "match", "and", "or", "not"};
+
+    a2l__query_put(buf, size, len, "%s(%d,%d,%llx,'%s'", kinds[n->kind], n->field, n->op,
+                   (unsigned long long)n->value, n->text ? n->text : "");
+    for (const a2l_qnode_t *child = n->left; child; child = child == n->left ? n->right : NULL) {
+        a2l__query_put(buf, size, len, ",");
+        a2l__query_key_node(child, buf, size, len);
+    }
+    a2l__query_put(buf, size, len, ")");
+}
+
+size_t
+a2l_query_key(const a2l_query_t *q, char *buf, size_t size) {
+    size_t len = 0;
+
+    if (size)
+        buf[0] = 0;
+    if (q->where)
+        a2l__query_key_node(q->where, buf, size, &len);
+    a2l__query_put(buf, size, &len, " group %d %llu", q->group, (unsigned long long)q->bucket_ns);
+    return len;
+}
+
+//
+// binding
+//
+
+static int
+a2l__query_stack_matches(const a2l_reader_t *r, const a2l_qnode_t *n, const a2l_stack_t *stack) {
+    char name[512];
+
+    for (uint32_t i = 0; i < stack->num_frames; i++) {
+        const a2l_frame_t *frame = &stack->frames[i];
+        if (n->field == A2L_QF_MODULE) {
+            const a2l_module_t *module = a2l_read_module(r, frame->module_id);
+            if (module && module->path && strstr(module->path, n->text))
+                return 1;
+        } else {
+            a2l_read_frame_name(r, frame, name, sizeof(name));
+            if (strstr(name, n->text))
+                return 1;
+        }
+    }
+    return 0;
+}
+
+static int
+a2l__query_bind_node(a2l_qnode_t *n, const a2l_reader_t *r) {
+    if (!n)
+        return 0;
+    if (n->kind != A2L_QN_MATCH)
+        return a2l__query_bind_node(n->left, r) < 0 ? -1 : a2l__query_bind_node(n->right, r);
+
+    uint32_t num_stacks = a2l_read_num_stacks(r), size = 16;
+    uint32_t *ids = malloc((num_stacks ? num_stacks : 1) * sizeof(uint32_t));
+    if (!ids)
+        return -1;
+    for (uint32_t i = 0; i < num_stacks; i++) {
+        const a2l_stack_t *stack = a2l_read_stack_at(r, i);
+        if (stack->id && a2l__query_stack_matches(r, n, stack))
+            ids[n->num_matches++] = stack->id;
+    }
+
+    // at most half full
+    while (size < n->num_matches * 2 + 2)
+        size *= 2;
+    free(n->matches);
+    if (!(n->matches = calloc(size, sizeof(uint32_t)))) {
+        free(ids);
+        return -1;
+    }
+    n->match_mask = size - 1;
+    for (uint32_t i = 0; i < n->num_matches; i++) {
+        uint32_t slot = (ids[i] * 2654435761u) & n->match_mask;
+        while (n->matches[slot] && n->matches[slot] != ids[i] + 1)
+            slot = (slot + 1) & n->match_mask;
+        n->matches[slot] = ids[i] + 1;
+    }
+    free(ids);
+    return 0;
+}
+
+int
+a2l_query_bind(a2l_query_t *q, const a2l_reader_t *r) {
+    return a2l__query_bind_node(q->where, r);
+}
+
+int
+a2l_query_matches(const a2l_qnode_t *n, uint32_t stack_id) {
+    uint32_t slot = (stack_id * 2654435761u) & n->match_mask;
+
+    while (n->matches[slot]) {
+        if (n->matches[slot] == stack_id + 1)
+            return 1;
+        slot = (slot + 1) & n->match_mask;
+    }
+    return 0;
+}
+
+//
+// pushdown
+//
+
+static void
+a2l__query_bounds_node(const a2l_qnode_t *n, a2l_qbounds_t *b) {
+    if (n->kind == A2L_QN_AND) {
+        a2l__query_bounds_node(n->left, b);
+        a2l__query_bounds_node(n->right, b);
+        return;
+    }
+    if (n->kind == A2L_QN_MATCH) {
+        if (!b->sites || n->num_matches < b->sites->num_matches)
+            b->sites = n;
+        return;
+    }
+    if (n->kind != A2L_QN_CMP)
+        return;
+
+    uint64_t v = n->value;
+    switch (n->field) {
+    case A2L_QF_TIME:
+        if (n->op == A2L_QO_EQ || n->op == A2L_QO_GE || n->op == A2L_QO_GT) {
+            uint64_t from = n->op == A2L_QO_GT ? v + 1 : v;
+            if (from > b->from)
+                b->from = from;
+        }
+        if (n->op == A2L_QO_EQ || n->op == A2L_QO_LE || n->op == A2L_QO_LT) {
+            uint64_t to = n->op == A2L_QO_LT ? v : v + 1;
+            if (to < b->to)
+                b->to = to;
+        }
+        break;
+    case A2L_QF_THREAD:
+        if (n->op == A2L_QO_EQ && v <= UINT32_MAX) {
+            b->by_tid = 1;
+            b->tid = (uint32_t)v;
+        }
+        break;
+    case A2L_QF_SITE:
+        if (n->op == A2L_QO_EQ && v <= UINT32_MAX) {
+            b->by_site = 1;
+            b->site = (uint32_t)v;
+        }
+        break;
+    }
+}
+
+void
+a2l_query_bounds(const a2l_query_t *q, a2l_qbounds_t *b) {
+    memset(b, 0, sizeof(*b));
+    b->to = UINT64_MAX;
+    if (q->where)
+        a2l__query_bounds_node(q->where, b);
+}
+
+static int
+a2l__query_by_site_node(const a2l_qnode_t *n) {
+    if (!n || n->kind == A2L_QN_MATCH)
+        return 1;
+    if (n->kind == A2L_QN_CMP)
+        return n->field == A2L_QF_SITE;
+    return a2l__query_by_site_node(n->left) && a2l__query_by_site_node(n->right);
+}
+
+int
+a2l_query_by_site(const a2l_query_t *q) {
+    return (q->group == A2L_QG_SITE || q->group == A2L_QG_MODULE) && a2l__query_by_site_node(q->where);
+}
+
+//
+// evaluation
+//
+
+int
+a2l_qeval_init(a2l_qeval_t *ev, const a2l_query_t *q, uint32_t capacity) {
+    uint32_t nodes = q->num_nodes;
+
+    ev->capacity = capacity;
+    ev->masks = malloc((size_t)(nodes ? nodes : 1) * capacity);
+    ev->site = malloc(capacity * sizeof(uint32_t));
+    if (!ev->masks || !ev->site) {
+        a2l_qeval_free(ev);
+        return -1;
+    }
+    return 0;
+}
+
+void
+a2l_qeval_free(a2l_qeval_t *ev) {
+    free(ev->masks);
+    free(ev->site);
+    ev->masks = NULL;
+    ev->site = NULL;
+}
+
+// one loop per column and operator, simple enough to vectorize
+#define A2L__QUERY_CMP(col, v, m, count, op) do { \
+        switch (op) { \
+        case A2L_QO_EQ: for (uint32_t i = 0; i < (count); i++) (m)[i] = (col)[i] == (v); break; \
+        case A2L_QO_NE: for (uint32_t i = 0; i < (count); i++) (m)[i] = (col)[i] != (v); break; \
+        case A2L_QO_LT: for (uint32_t i = 0; i < (count); i++) (m)[i] = (col)[i] < (v); break; \
+        case A2L_QO_LE: for (uint32_t i = 0; i < (count); i++) (m)[i] = (col)[i] <= (v); break; \
+        case A2L_QO_GT: for (uint32_t i = 0; i < (count); i++) (m)[i] = (col)[i] > (v); break; \
+        case A2L_QO_GE: for (uint32_t i = 0; i < (count); i++) (m)[i] = (col)[i] >= (v); break; \
+        } \
+    } while (0)
+
+static void
+a2l__query_cmp(const a2l_qnode_t *n, const a2l_qeval_t *ev, const a2l_batch_t *b, uint8_t *m) {
+    uint32_t count = b->count;
+    uint64_t v = n->value;
+
+    // 32-bit columns against a value that doesn't fit: every row is below it
+    if ((n->field == A2L_QF_THREAD || n->field == A2L_QF_SITE) && v > UINT32_MAX) {
+        int below = n->op == A2L_QO_NE || n->op == A2L_QO_LT || n->op == A2L_QO_LE;
+        memset(m, below, count);
+        return;
+    }
+
+    switch (n->field) {
+    case A2L_QF_SIZE:   A2L__QUERY_CMP(b->bytes, v, m, count, n->op); break;
+    case A2L_QF_TIME:   A2L__QUERY_CMP(b->ts, v, m, count, n->op); break;
+    case A2L_QF_PTR:    A2L__QUERY_CMP(b->ptr, v, m, count, n->op); break;
+    case A2L_QF_THREAD: A2L__QUERY_CMP(b->tid, (uint32_t)v, m, count, n->op); break;
+    case A2L_QF_SITE:   A2L__QUERY_CMP(ev->site, (uint32_t)v, m, count, n->op); break;
+    case A2L_QF_TYPE:   A2L__QUERY_CMP(b->type, (uint8_t)v, m, count, n->op); break;
+    }
+}
+
+static int
+a2l__query_any(const uint8_t *m, uint32_t count) {
+    uint8_t any = 0;
+
+    for (uint32_t i = 0; i < count; i++)
+        any |= m[i];
+    return any;
+}
+
+// n's mask of b's rows
+static uint8_t *
+a2l__query_eval(const a2l_qnode_t *n, const a2l_qeval_t *ev, const a2l_batch_t *b) {
+    uint8_t *m = ev->masks + (size_t)n->index * ev->capacity;
+    uint32_t count = b->count;
+
+    switch (n->kind) {
+    case A2L_QN_CMP:
+        a2l__query_cmp(n, ev, b, m);
+        break;
+    case A2L_QN_MATCH: {
+        // runs of one site are common
+        uint32_t last = 0;
+        uint8_t hit = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            if (!i || ev->site[i] != last) {
+                last = ev->site[i];
+                hit = (uint8_t)a2l_query_matches(n, last);
+            }
+            m[i] = hit;
+        }
+        break;
+    }
+    case A2L_QN_NOT: {
+        const uint8_t *l = a2l__query_eval(n->left, ev, b);
+        for (uint32_t i = 0; i < count; i++)
+            m[i] = l[i] ^ 1;
+        break;
+    }
+    case A2L_QN_AND:
+    case A2L_QN_OR: {
+        // the right side only runs if it can change the answer
+        const uint8_t *l = a2l__query_eval(n->left, ev, b);
+        int any = a2l__query_any(l, count);
+        if (n->kind == A2L_QN_AND ? !any : (any && !memchr(l, 0, count))) {
+            memcpy(m, l, count);
+            break;
+        }
+        const uint8_t *r = a2l__query_eval(n->right, ev, b);
+        if (n->kind == A2L_QN_AND)
+            for (uint32_t i = 0; i < count; i++)
+                m[i] = l[i] & r[i];
+        else
+            for (uint32_t i = 0; i < count; i++)
+                m[i] = l[i] | r[i];
+        break;
+    }
+    }
+    return m;
+}
+
+uint32_t
+a2l_query_filter(const a2l_query_t *q, a2l_qeval_t *ev, const a2l_batch_t *b, uint32_t *sel) {
+    uint32_t count = b->count, n = 0;
+
+    for (uint32_t i = 0; i < count; i++)
+        ev->site[i] = b->type[i] == A2L_REC_ALLOC ? b->stack_id[i] : b->alloc_stack_id[i];
+
+    if (!q->where) {
+        for (uint32_t i = 0; i < count; i++)
+            sel[i] = i;
+        return count;
+    }
+
+    const uint8_t *m = a2l__query_eval(q->where, ev, b);
+    for (uint32_t i = 0; i < count; i++) {
+        sel[n] = i;
+        n += m[i];
+    }
+    return n;
+}
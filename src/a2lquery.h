@@ -0,0 +1,143 @@
+// a2lquery.h -- a2l-analyze's query language.
+//
+//   [where <expr>] [group by <key>] [order by <column> [asc|desc]] [limit <n>]
+//
+//   expr    <field> <op> <value>, stack ~ 'text', module ~ 'text',
+//           expr and expr, expr or expr, not expr, ( expr )
+//   field   size (K/M/G ok), time (seconds into the trace, or HH:MM[:SS]
+//           wall clock), thread, type (alloc or free), site (stack id,
+//           hex), ptr (hex)
+//   op      = != < <= > >=
+//   key     site (default), thread, module, type, size (power of two
+//           classes), time <seconds>
+//   column  allocs, bytes, frees, freed, live, events, key
+//
+// an event's site is the stack that allocated its block: its own for
+// an alloc, its alloc_stack_id for a free.  stack ~ matches a site
+// with a frame named like the text (module!symbol+0x..), module ~ one
+// with a frame in a module whose path contains it.
+//
+// a query runs a batch of events at a time: each leaf of the where
+// clause is a loop over one column, into a byte mask; and, or and not
+// combine masks; the rows left are grouped.  a2l_query_bounds pulls
+// the time range, thread and sites that every match must have out of
+// the top-level ands, so whole blocks can be skipped before decoding.
+
+#ifndef A2L__QUERY_H
+#define A2L__QUERY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "a2lread.h"
+
+enum {
+    A2L_QN_CMP,
+    A2L_QN_MATCH,
+    A2L_QN_AND,
+    A2L_QN_OR,
+    A2L_QN_NOT
+};
+
+enum {
+    A2L_QF_SIZE,
+    A2L_QF_TIME,
+    A2L_QF_THREAD,
+    A2L_QF_TYPE,
+    A2L_QF_SITE,
+    A2L_QF_PTR,
+    A2L_QF_STACK,                   // ~ only
+    A2L_QF_MODULE                   // ~ only
+};
+
+enum {
+    A2L_QO_EQ,
+    A2L_QO_NE,
+    A2L_QO_LT,
+    A2L_QO_LE,
+    A2L_QO_GT,
+    A2L_QO_GE
+};
+
+enum {
+    A2L_QG_SITE,
+    A2L_QG_THREAD,
+    A2L_QG_MODULE,
+    A2L_QG_TYPE,
+    A2L_QG_SIZE,
+    A2L_QG_TIME
+};
+
+enum {
+    A2L_QC_BYTES,
+    A2L_QC_ALLOCS,
+    A2L_QC_FREES,
+    A2L_QC_FREED,
+    A2L_QC_LIVE,
+    A2L_QC_EVENTS,
+    A2L_QC_KEY
+};
+
+typedef struct a2l_qnode {
+    int kind;                       // A2L_QN_*
+    int field;                      // A2L_QF_*
+    int op;                         // A2L_QO_*
+    uint64_t value;
+    char *text;                     // ~'s
+    uint32_t *matches;              // ~: site ids that match, open addressing on id + 1
+    uint32_t match_mask, num_matches;
+    int index;                      // its mask, in a2l_qeval_t
+    struct a2l_qnode *left, *right;
+}a2l_qnode_t;
+
+typedef struct {
+    a2l_qnode_t *where;             // NULL: every event
+    uint32_t num_nodes;
+    int group;                      // A2L_QG_*
+    uint64_t bucket_ns;             // group by time
+    int order;                      // A2L_QC_*
+    int descending;
+    uint32_t limit;                 // 0: the caller's default
+}a2l_query_t;
+
+// what every matching event has: blocks without it can be skipped
+typedef struct {
+    uint64_t from, to;              // time, [from, to)
+    int by_tid;
+    uint32_t tid;
+    const a2l_qnode_t *sites;       // a node whose matches every event's site is among
+    int by_site;
+    uint32_t site;
+}a2l_qbounds_t;
+
+// a thread's scratch for evaluating batches
+typedef struct {
+    uint8_t *masks;                 // a batch's worth per node
+    uint32_t *site;
+    uint32_t capacity;
+}a2l_qeval_t;
+
+// -1 on failure, with the reason in error
+int a2l_query_parse(a2l_query_t *q, const char *text, const a2l_readinfo_t *info,
+                    char *error, size_t error_len);
+// resolve stack ~ and module ~ against r's stacks
+int a2l_query_bind(a2l_query_t *q, const a2l_reader_t *r);
+void a2l_query_free(a2l_query_t *q);
+// what the rows depend on (where and group by, not order or limit) as
+// text, into buf as snprintf would; returns the full length
+size_t a2l_query_key(const a2l_query_t *q, char *buf, size_t size);
+
+void a2l_query_bounds(const a2l_query_t *q, a2l_qbounds_t *bounds);
+// 1 if the rows an event counts in depend on its site alone: the where
+// clause tests only sites, and rows are sites or modules
+int a2l_query_by_site(const a2l_query_t *q);
+// 1 if stack_id is among the node's matches
+int a2l_query_matches(const a2l_qnode_t *node, uint32_t stack_id);
+
+int a2l_qeval_init(a2l_qeval_t *ev, const a2l_query_t *q, uint32_t capacity);
+void a2l_qeval_free(a2l_qeval_t *ev);
+// the rows of b that pass, into sel; their count.  ev->site is filled
+// with each row's site.
+uint32_t a2l_query_filter(const a2l_query_t *q, a2l_qeval_t *ev, const a2l_batch_t *b, uint32_t *sel);
+
+#endif
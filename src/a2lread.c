@@ -0,0 +1,1126 @@
+#define _GNU_SOURCE
+// a2lread.c -- liba2lread; see a2lread.h.
+//
+// a2l_read_open maps every file of the trace and makes one pass over
+// the block headers: through the block index where there is one,
+// walking header to header where there isn't.  definitions blocks are
+// decoded there and then; event blocks are only listed, and decoded by
+// iterators, which check their checksums as they go.  keyframe blocks
+// are listed by keyframe, and each keyframe's last one decoded to see
+// whether it's whole.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "a2lread.h"
+#include "a2llz.h"
+
+typedef struct {
+    const uint8_t *map;
+    size_t size;
+    uint64_t first_block;           // its first event block's number
+    uint32_t segment;               // from its header
+    uint32_t _pad;
+}a2l__readfile_t;
+
+struct a2l_reader {
+    a2l_readinfo_t info;
+
+    a2l__readfile_t *files;
+    uint32_t num_files, max_files;
+    const a2l_blockheader_t **blocks;
+    uint64_t max_blocks;
+
+    // keyframes, and their blocks in trace order
+    a2l_keyframe_t *keyframes;
+    uint64_t *keyframe_first;       // each one's first in keyframe_blocks
+    uint32_t num_keyframes, max_keyframes;
+    const a2l_blockheader_t **keyframe_blocks;
+    uint64_t num_keyframe_blocks, max_keyframe_blocks;
+
+    // definitions
+    a2l_stack_t *stacks;
+    uint64_t *stack_first_frame;    // while loading; frames moves as it grows
+    uint32_t num_stacks, max_stacks;
+    uint32_t *stack_slots;          // open addressing on id: stacks index + 1
+    uint32_t stack_mask;
+    a2l_frame_t *frames;
+    uint64_t num_frames, max_frames;
+    a2l_module_t *modules;          // by id; path NULL if not defined
+    uint32_t max_modules;
+    a2l_symbol_t *symbols;          // by id; name NULL if not defined
+    uint32_t max_symbols;
+
+    // while opening
+    uint8_t *scratch;
+    size_t scratch_size;
+    char *error;
+    size_t error_len;
+};
+
+static int
+a2l__read_fail(a2l_reader_t *r, const char *fmt, ...) {
+    va_list args;
+
+    if (r->error && r->error_len) {
+        va_start(args, fmt);
+        vsnprintf(r->error, r->error_len, fmt, args);
+        va_end(args);
+    }
+    return -1;
+}
+
+// grow array to hold needed elements, zeroing the new ones
+static int
+a2l__read_grow(void **array, uint64_t *capacity, uint64_t needed, size_t size) {
+    if (needed <= *capacity)
+        return 0;
+
+    uint64_t n = *capacity ? *capacity : 64;
+    while (n < needed)
+        n *= 2;
+    void *grown = realloc(*array, n * size);
+    if (!grown)
+        return -1;
+    memset((char *)grown + *capacity * size, 0, (n - *capacity) * size);
+    *array = grown;
+    *capacity = n;
+    return 0;
+}
+
+static int
+a2l__read_grow32(void **array, uint32_t *capacity, uint64_t needed, size_t size) {
+    uint64_t cap = *capacity;
+
+    if (needed >= UINT32_MAX || a2l__read_grow(array, &cap, needed, size) < 0)
+        return -1;
+    *capacity = (uint32_t)cap;
+    return 0;
+}
+
+//
+// definitions
+//
+
+static uint32_t
+a2l__read_slot(const a2l_reader_t *r, uint32_t id) {
+    uint32_t slot = (id * 2654435761u) & r->stack_mask;
+
+    while (r->stack_slots[slot] && r->stacks[r->stack_slots[slot] - 1].id != id)
+        slot = (slot + 1) & r->stack_mask;
+    return slot;
+}
+
+static int
+a2l__read_rehash(a2l_reader_t *r) {
+    uint32_t size = r->stack_mask ? (r->stack_mask + 1) * 2 : 1024;
+    uint32_t *slots = calloc(size, sizeof(uint32_t));
+
+    if (!slots)
+        return -1;
+    free(r->stack_slots);
+    r->stack_slots = slots;
+    r->stack_mask = size - 1;
+    for (uint32_t i = 0; i < r->num_stacks; i++)
+        r->stack_slots[a2l__read_slot(r, r->stacks[i].id)] = i + 1;
+    return 0;
+}
+
+// NULL if malformed or out of memory
+static const uint8_t *
+a2l__read_stack_def(a2l_reader_t *r, const uint8_t *p, const uint8_t *end) {
+    uint64_t id, num_frames, addr = 0;
+
+    if (!(p = a2l_get_varint(p, end, &id)) || !(p = a2l_get_varint(p, end, &num_frames)) ||
+        num_frames > (uint64_t)(end - p))
+        return NULL;
+
+    if ((r->num_stacks + 1) * 2 > r->stack_mask && a2l__read_rehash(r) < 0)
+        return NULL;
+
+    // repeats after an eviction are the same stack
+    uint32_t slot = a2l__read_slot(r, (uint32_t)id);
+    int known = r->stack_slots[slot] != 0;
+    if (!known) {
+        uint32_t max_first = r->max_stacks;
+        if (a2l__read_grow32((void **)&r->stacks, &r->max_stacks, r->num_stacks + 1, sizeof(a2l_stack_t)) < 0 ||
+            a2l__read_grow32((void **)&r->stack_first_frame, &max_first, r->num_stacks + 1, sizeof(uint64_t)) < 0 ||
+            a2l__read_grow((void **)&r->frames, &r->max_frames, r->num_frames + num_frames, sizeof(a2l_frame_t)) < 0)
+            return NULL;
+        r->stacks[r->num_stacks].id = (uint32_t)id;
+        r->stacks[r->num_stacks].num_frames = (uint32_t)num_frames;
+        r->stack_first_frame[r->num_stacks] = r->num_frames;
+        r->stack_slots[slot] = ++r->num_stacks;
+    }
+
+    for (uint64_t i = 0; i < num_frames; i++) {
+        uint64_t delta, module_id, symbol_id;
+
+        if (!(p = a2l_get_varint(p, end, &delta)) ||
+            !(p = a2l_get_varint(p, end, &module_id)) ||
+            !(p = a2l_get_varint(p, end, &symbol_id)))
+            return NULL;
+        addr += (uint64_t)a2l_unzigzag(delta);
+        if (!known) {
+            a2l_frame_t *f = &r->frames[r->num_frames++];
+            f->addr = addr;
+            f->module_id = (uint32_t)module_id;
+            f->symbol_id = (uint32_t)symbol_id;
+        }
+    }
+    return p;
+}
+
+static const uint8_t *
+a2l__read_module_def(a2l_reader_t *r, const uint8_t *p, const uint8_t *end) {
+    uint64_t id, base, len;
+
+    if (!(p = a2l_get_varint(p, end, &id)) || !(p = a2l_get_varint(p, end, &base)) ||
+        !(p = a2l_get_varint(p, end, &len)) || (uint64_t)(end - p) < len ||
+        a2l__read_grow32((void **)&r->modules, &r->max_modules, id + 1, sizeof(a2l_module_t)) < 0)
+        return NULL;
+
+    a2l_module_t *m = &r->modules[id];
+    if (!m->path) {
+        if (!(m->path = strndup((const char *)p, len)))
+            return NULL;
+        m->id = (uint32_t)id;
+        m->base = base;
+    }
+    return p + len;
+}
+
+static const uint8_t *
+a2l__read_symbol_def(a2l_reader_t *r, const uint8_t *p, const uint8_t *end) {
+    uint64_t id, module_id, addr, len;
+
+    if (!(p = a2l_get_varint(p, end, &id)) || !(p = a2l_get_varint(p, end, &module_id)) ||
+        !(p = a2l_get_varint(p, end, &addr)) || !(p = a2l_get_varint(p, end, &len)) ||
+        (uint64_t)(end - p) < len ||
+        a2l__read_grow32((void **)&r->symbols, &r->max_symbols, id + 1, sizeof(a2l_symbol_t)) < 0)
+        return NULL;
+
+    a2l_symbol_t *s = &r->symbols[id];
+    if (!s->name) {
+        if (!(s->name = strndup((const char *)p, len)))
+            return NULL;
+        s->id = (uint32_t)id;
+        s->module_id = (uint32_t)module_id;
+        s->addr = addr;
+    }
+    return p + len;
+}
+
+// a definitions block.  -1 if it's malformed.
+static int
+a2l__read_defs(a2l_reader_t *r, const char *path, const a2l_blockheader_t *bh) {
+    const uint8_t *p = (const uint8_t *)bh + bh->header_bytes;
+
+    if (a2l_checksum(p, bh->stored_bytes) != bh->checksum)
+        return a2l__read_fail(r, "%s: bad definitions block", path);
+
+    if (bh->codec == A2L_CODEC_LZ) {
+        if (bh->raw_bytes > r->scratch_size) {
+            free(r->scratch);
+            r->scratch_size = bh->raw_bytes;
+            if (!(r->scratch = malloc(r->scratch_size)))
+                return a2l__read_fail(r, "out of memory");
+        }
+        if (a2l_lz_decompress(p, bh->stored_bytes, r->scratch, bh->raw_bytes) != bh->raw_bytes)
+            return a2l__read_fail(r, "%s: bad definitions block", path);
+        p = r->scratch;
+    }
+
+    const uint8_t *end = p + bh->raw_bytes;
+    while (p && p < end) {
+        switch (*p++) {
+        case A2L_REC_STACK:  p = a2l__read_stack_def(r, p, end); break;
+        case A2L_REC_MODULE: p = a2l__read_module_def(r, p, end); break;
+        case A2L_REC_SYMBOL: p = a2l__read_symbol_def(r, p, end); break;
+        default:             p = NULL; break;
+        }
+    }
+    if (!p)
+        return a2l__read_fail(r, "%s: bad definitions block", path);
+    return 0;
+}
+
+// bh's payload, checked, and decompressed into *buffer if it was
+// stored so.  NULL if it's damaged or out of memory.
+static const uint8_t *
+a2l__read_payload(const a2l_blockheader_t *bh, uint8_t **buffer, size_t *buffer_size) {
+    const uint8_t *payload = (const uint8_t *)bh + bh->header_bytes;
+
+    if (a2l_checksum(payload, bh->stored_bytes) != bh->checksum)
+        return NULL;
+
+    if (bh->codec == A2L_CODEC_LZ) {
+        if (bh->raw_bytes > *buffer_size) {
+            uint8_t *grown = realloc(*buffer, bh->raw_bytes);
+            if (!grown)
+                return NULL;
+            *buffer = grown;
+            *buffer_size = bh->raw_bytes;
+        }
+        if (a2l_lz_decompress(payload, bh->stored_bytes, *buffer, bh->raw_bytes) != bh->raw_bytes)
+            return NULL;
+        return *buffer;
+    }
+    return bh->stored_bytes == bh->raw_bytes ? payload : NULL;
+}
+
+//
+// keyframes
+//
+
+// a keyframe block: one more of the keyframe it began, or a new one
+static int
+a2l__read_add_keyframe(a2l_reader_t *r, const a2l_blockheader_t *bh) {
+    a2l_keyframe_t *k = r->num_keyframes ? &r->keyframes[r->num_keyframes - 1] : NULL;
+
+    if (a2l__read_grow((void **)&r->keyframe_blocks, &r->max_keyframe_blocks, r->num_keyframe_blocks + 1,
+                       sizeof(const a2l_blockheader_t *)) < 0)
+        return a2l__read_fail(r, "out of memory");
+
+    // one thread writes them, one at a time, so a keyframe's blocks
+    // come together
+    if (!k || k->first_ts != bh->first_ts) {
+        uint32_t max_first = r->max_keyframes;
+        if (a2l__read_grow32((void **)&r->keyframes, &r->max_keyframes, r->num_keyframes + 1,
+                             sizeof(a2l_keyframe_t)) < 0 ||
+            a2l__read_grow32((void **)&r->keyframe_first, &max_first, r->num_keyframes + 1,
+                             sizeof(uint64_t)) < 0)
+            return a2l__read_fail(r, "out of memory");
+        r->keyframe_first[r->num_keyframes] = r->num_keyframe_blocks;
+        k = &r->keyframes[r->num_keyframes++];
+        k->first_ts = bh->first_ts;
+    }
+    k->num_blocks++;
+    if (bh->last_ts > k->last_ts)
+        k->last_ts = bh->last_ts;
+    r->keyframe_blocks[r->num_keyframe_blocks++] = bh;
+    return 0;
+}
+
+// whole if its last block ends with the end record, and that counts
+// the blocks there are
+static void
+a2l__read_keyframe_end(a2l_reader_t *r, uint32_t i) {
+    a2l_keyframe_t *k = &r->keyframes[i];
+    const a2l_blockheader_t *bh = r->keyframe_blocks[r->keyframe_first[i] + k->num_blocks - 1];
+    const uint8_t *p = a2l__read_payload(bh, &r->scratch, &r->scratch_size);
+    const uint8_t *end = p ? p + bh->raw_bytes : NULL;
+    uint64_t f[3];
+
+    while (p && p < end) {
+        int type = *p++;
+        if (type != A2L_REC_LIVE && type != A2L_REC_KEYFRAME)
+            return;
+        for (int j = 0; j < 3; j++)
+            if (!(p = a2l_get_varint(p, end, &f[j])))
+                return;
+        if (type == A2L_REC_KEYFRAME && p == end && f[0] == k->num_blocks) {
+            k->complete = 1;
+            k->num_live = f[1];
+            k->live_bytes = f[2];
+        }
+    }
+}
+
+//
+// files
+//
+
+static int
+a2l__read_map(a2l_reader_t *r, const char *path, a2l__readfile_t **file) {
+    struct stat st;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        a2l__read_fail(r, "can't open %s: %s", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof(a2l_fileheader_t)) {
+        close(fd);
+        return a2l__read_fail(r, "%s is not a binary trace", path);
+    }
+
+    const uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return a2l__read_fail(r, "can't map %s: %s", path, strerror(errno));
+
+    const a2l_fileheader_t *fh = (const a2l_fileheader_t *)map;
+    if (fh->magic != A2L_TRACE_MAGIC || fh->version != A2L_TRACE_VERSION ||
+        fh->header_bytes < sizeof(a2l_fileheader_t) || fh->header_bytes > (size_t)st.st_size) {
+        munmap((void *)map, st.st_size);
+        return a2l__read_fail(r, "%s is not a version %d binary trace", path, A2L_TRACE_VERSION);
+    }
+
+    if (a2l__read_grow32((void **)&r->files, &r->max_files, r->num_files + 1, sizeof(a2l__readfile_t)) < 0) {
+        munmap((void *)map, st.st_size);
+        return a2l__read_fail(r, "out of memory");
+    }
+    *file = &r->files[r->num_files++];
+    (*file)->map = map;
+    (*file)->size = st.st_size;
+    (*file)->first_block = r->info.num_blocks;
+    (*file)->segment = fh->segment;
+    return 0;
+}
+
+// the block at offset, if it's whole and ends by end
+static const a2l_blockheader_t *
+a2l__read_block_at(const a2l__readfile_t *file, uint64_t offset, uint64_t end) {
+    if (offset + sizeof(a2l_blockheader_t) > end)
+        return NULL;
+
+    const a2l_blockheader_t *bh = (const a2l_blockheader_t *)(file->map + offset);
+    if (bh->magic != A2L_BLOCK_MAGIC || bh->header_bytes < sizeof(a2l_blockheader_t) ||
+        offset + bh->header_bytes + bh->stored_bytes > end)
+        return NULL;
+    return bh;
+}
+
+static int
+a2l__read_add_block(a2l_reader_t *r, const char *path, const a2l_blockheader_t *bh) {
+    a2l_readinfo_t *info = &r->info;
+
+    if (bh->flags & A2L_BLOCK_DEFINITIONS)
+        return a2l__read_defs(r, path, bh);
+    if (bh->flags & A2L_BLOCK_KEYFRAME)
+        return a2l__read_add_keyframe(r, bh);
+    // per-site sums: no events of their own
+    if (bh->flags & A2L_BLOCK_SITES)
+        return 0;
+
+    if (a2l__read_grow((void **)&r->blocks, &r->max_blocks, info->num_blocks + 1,
+                       sizeof(const a2l_blockheader_t *)) < 0)
+        return a2l__read_fail(r, "out of memory");
+    r->blocks[info->num_blocks++] = bh;
+
+    if (bh->num_events) {
+        if (!info->num_events || bh->first_ts < info->first_ts)
+            info->first_ts = bh->first_ts;
+        if (bh->last_ts > info->last_ts)
+            info->last_ts = bh->last_ts;
+        info->num_events += bh->num_events;
+    }
+    return 0;
+}
+
+// list one file's blocks, loading its definitions
+static int
+a2l__read_file(a2l_reader_t *r, const char *path) {
+    a2l__readfile_t *file = NULL;
+
+    if (a2l__read_map(r, path, &file) < 0)
+        return -1;
+
+    const a2l_fileheader_t *fh = (const a2l_fileheader_t *)file->map;
+    if (!r->info.start_ns) {
+        r->info.pid = fh->pid;
+        r->info.start_ns = fh->start_ns;
+        r->info.start_realtime_ns = fh->start_realtime_ns;
+    }
+
+    const a2l_filetrailer_t *trailer =
+        (const a2l_filetrailer_t *)(file->map + file->size - sizeof(a2l_filetrailer_t));
+    uint64_t index_end = trailer->index_offset +
+        (uint64_t)trailer->num_blocks * sizeof(a2l_blockindex_t);
+
+    if (file->size >= fh->header_bytes + sizeof(*trailer) && trailer->magic == A2L_TRAILER_MAGIC &&
+        trailer->index_offset >= fh->header_bytes && index_end <= file->size - sizeof(*trailer)) {
+        const a2l_blockindex_t *index = (const a2l_blockindex_t *)(file->map + trailer->index_offset);
+
+        for (uint32_t i = 0; i < trailer->num_blocks; i++) {
+            const a2l_blockheader_t *bh = a2l__read_block_at(file, index[i].offset, trailer->index_offset);
+            if (!bh)
+                return a2l__read_fail(r, "%s: bad block index", path);
+            if (a2l__read_add_block(r, path, bh) < 0)
+                return -1;
+        }
+        return 0;
+    }
+
+    // no index: cut short, or still being written.  up to the first
+    // block that isn't whole.
+    const a2l_blockheader_t *bh;
+    for (uint64_t off = fh->header_bytes; (bh = a2l__read_block_at(file, off, file->size));
+         off += bh->header_bytes + bh->stored_bytes) {
+        if (a2l__read_add_block(r, path, bh) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+// a segmented trace: definitions, then each segment
+static int
+a2l__read_manifest(a2l_reader_t *r, const char *path, int fd) {
+    char file_path[4096];
+    a2l_manifest_t manifest;
+
+    if (pread(fd, &manifest, sizeof(manifest), 0) != sizeof(manifest) ||
+        manifest.magic != A2L_MANIFEST_MAGIC || manifest.version != A2L_TRACE_VERSION)
+        return a2l__read_fail(r, "%s is not a version %d manifest", path, A2L_TRACE_VERSION);
+
+    r->info.pid = manifest.pid;
+    r->info.start_ns = manifest.start_ns;
+    r->info.start_realtime_ns = manifest.start_realtime_ns;
+    r->info.num_segments = manifest.num_segments;
+
+    snprintf(file_path, sizeof(file_path), A2L_DEFS_PATH_FMT, path);
+    if (a2l__read_file(r, file_path) < 0)
+        return -1;
+
+    for (uint32_t i = 0; i < manifest.num_segments; i++) {
+        a2l_manifest_segment_t seg;
+
+        if (pread(fd, &seg, sizeof(seg), manifest.header_bytes + (off_t)i * sizeof(seg)) != sizeof(seg))
+            return a2l__read_fail(r, "%s: manifest cut short", path);
+        if (seg.flags & A2L_SEGMENT_COMPACTED) {
+            r->info.segments_compacted++;
+            continue;
+        }
+        snprintf(file_path, sizeof(file_path), A2L_SEGMENT_PATH_FMT, path, seg.segment);
+        if (a2l__read_file(r, file_path) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+a2l_reader_t *
+a2l_read_open(const char *path, char *error, size_t error_len) {
+    uint32_t magic = 0;
+    int result;
+
+    a2l_reader_t *r = calloc(1, sizeof(a2l_reader_t));
+    if (!r) {
+        snprintf(error, error_len, "out of memory");
+        return NULL;
+    }
+    r->error = error;
+    r->error_len = error_len;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || pread(fd, &magic, sizeof(magic), 0) != sizeof(magic)) {
+        result = a2l__read_fail(r, "can't read %s: %s", path, fd < 0 ? strerror(errno) : "too short");
+    } else if (magic == A2L_MANIFEST_MAGIC) {
+        result = a2l__read_manifest(r, path, fd);
+    } else {
+        result = a2l__read_file(r, path);
+    }
+    if (fd >= 0)
+        close(fd);
+
+    if (result == 0 && !r->stack_mask && a2l__read_rehash(r) < 0)
+        result = a2l__read_fail(r, "out of memory");
+    for (uint32_t i = 0; result == 0 && i < r->num_keyframes; i++)
+        a2l__read_keyframe_end(r, i);
+    if (result < 0) {
+        a2l_read_close(r);
+        return NULL;
+    }
+
+    // frames has stopped moving
+    for (uint32_t i = 0; i < r->num_stacks; i++)
+        r->stacks[i].frames = r->frames + r->stack_first_frame[i];
+    free(r->stack_first_frame);
+    r->stack_first_frame = NULL;
+    free(r->scratch);
+    r->scratch = NULL;
+    r->scratch_size = 0;
+    r->error = NULL;
+    return r;
+}
+
+void
+a2l_read_close(a2l_reader_t *r) {
+    if (!r)
+        return;
+
+    for (uint32_t i = 0; i < r->num_files; i++)
+        munmap((void *)r->files[i].map, r->files[i].size);
+    for (uint32_t i = 0; i < r->max_modules; i++)
+        free((void *)r->modules[i].path);
+    for (uint32_t i = 0; i < r->max_symbols; i++)
+        free((void *)r->symbols[i].name);
+    free(r->files);
+    free(r->blocks);
+    free(r->keyframes);
+    free(r->keyframe_first);
+    free(r->keyframe_blocks);
+    free(r->stacks);
+    free(r->stack_first_frame);
+    free(r->stack_slots);
+    free(r->frames);
+    free(r->modules);
+    free(r->symbols);
+    free(r->scratch);
+    free(r);
+}
+
+const a2l_readinfo_t *
+a2l_read_info(const a2l_reader_t *r) {
+    return &r->info;
+}
+
+const a2l_blockheader_t *
+a2l_read_block(const a2l_reader_t *r, uint64_t i) {
+    return i < r->info.num_blocks ? r->blocks[i] : NULL;
+}
+
+const a2l_stack_t *
+a2l_read_stack(const a2l_reader_t *r, uint32_t id) {
+    uint32_t index = r->stack_slots[a2l__read_slot(r, id)];
+    return index ? &r->stacks[index - 1] : NULL;
+}
+
+const a2l_module_t *
+a2l_read_module(const a2l_reader_t *r, uint32_t id) {
+    return id < r->max_modules && r->modules[id].path ? &r->modules[id] : NULL;
+}
+
+const a2l_symbol_t *
+a2l_read_symbol(const a2l_reader_t *r, uint32_t id) {
+    return id < r->max_symbols && r->symbols[id].name ? &r->symbols[id] : NULL;
+}
+
+uint32_t
+a2l_read_block_segment(const a2l_reader_t *r, uint64_t i) {
+    uint32_t lo = 0, hi = r->num_files;
+
+    // the last file starting at or before block i
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (r->files[mid].first_block <= i)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return r->num_files ? r->files[lo].segment : 0;
+}
+
+uint32_t
+a2l_read_num_stacks(const a2l_reader_t *r) {
+    return r->num_stacks;
+}
+
+const a2l_stack_t *
+a2l_read_stack_at(const a2l_reader_t *r, uint32_t i) {
+    return i < r->num_stacks ? &r->stacks[i] : NULL;
+}
+
+int
+a2l_read_frame_name(const a2l_reader_t *r, const a2l_frame_t *frame, char *buf, size_t len) {
+    const a2l_module_t *m = a2l_read_module(r, frame->module_id);
+    const a2l_symbol_t *s = a2l_read_symbol(r, frame->symbol_id);
+    const char *module = "?";
+
+    if (m) {
+        const char *slash = strrchr(m->path, '/');
+        module = slash ? slash + 1 : m->path;
+    }
+
+    if (s)
+        return snprintf(buf, len, "%s!%s+0x%llx", module, s->name,
+                        (unsigned long long)(frame->addr - s->addr));
+    if (m)
+        return snprintf(buf, len, "%s!+0x%llx", module, (unsigned long long)(frame->addr - m->base));
+    return snprintf(buf, len, "0x%llx", (unsigned long long)frame->addr);
+}
+
+uint32_t
+a2l_read_num_keyframes(const a2l_reader_t *r) {
+    return r->num_keyframes;
+}
+
+const a2l_keyframe_t *
+a2l_read_keyframe(const a2l_reader_t *r, uint32_t i) {
+    return i < r->num_keyframes ? &r->keyframes[i] : NULL;
+}
+
+int64_t
+a2l_read_keyframe_before(const a2l_reader_t *r, uint64_t ts) {
+    for (int64_t i = (int64_t)r->num_keyframes - 1; i >= 0; i--)
+        if (r->keyframes[i].complete && r->keyframes[i].first_ts <= ts)
+            return i;
+    return -1;
+}
+
+void
+a2l_live_init(a2l_liveiter_t *it, const a2l_reader_t *r, uint32_t keyframe) {
+    memset(it, 0, sizeof(*it));
+    it->reader = r;
+    if (keyframe < r->num_keyframes) {
+        it->block = r->keyframe_first[keyframe];
+        it->end_block = it->block + r->keyframes[keyframe].num_blocks;
+    }
+}
+
+void
+a2l_live_free(a2l_liveiter_t *it) {
+    free(it->buffer);
+    it->buffer = NULL;
+    it->buffer_size = 0;
+}
+
+int
+a2l_live_next(a2l_liveiter_t *it, a2l_live_t *l) {
+    for (;;) {
+        while (it->p < it->end) {
+            const uint8_t *p = it->p;
+            uint64_t f[3];
+            int type = *p++;
+
+            for (int i = 0; p && i < 3; i++)
+                p = a2l_get_varint(p, it->end, &f[i]);
+            if (!p || (type != A2L_REC_LIVE && type != A2L_REC_KEYFRAME)) {
+                // the rest of a malformed block is lost
+                it->bad_blocks++;
+                it->p = it->end;
+                break;
+            }
+            it->p = p;
+            if (type == A2L_REC_KEYFRAME)
+                continue;
+            it->ptr += (uint64_t)a2l_unzigzag(f[0]);
+            l->ptr = it->ptr;
+            l->bytes = f[1];
+            l->stack_id = (uint32_t)f[2];
+            return 1;
+        }
+
+        if (it->block >= it->end_block)
+            return 0;
+        const a2l_blockheader_t *bh = it->reader->keyframe_blocks[it->block++];
+        if (!(it->p = a2l__read_payload(bh, &it->buffer, &it->buffer_size))) {
+            it->bad_blocks++;
+            it->end = NULL;
+            continue;
+        }
+        it->end = it->p + bh->raw_bytes;
+        it->ptr = 0;
+    }
+}
+
+//
+// the heap when the events left begin
+//
+
+// an event while the keyframe was copied, to replay in time order
+typedef struct {
+    uint64_t ts;
+    uint64_t seq;                   // ties in trace order
+    uint64_t ptr, bytes;
+    uint32_t stack_id;
+    uint32_t type;
+}a2l__read_copied_t;
+
+typedef struct {
+    uint32_t stack_id;
+    uint32_t used;
+    int64_t bytes, blocks;
+}a2l__read_site_t;
+
+typedef struct {
+    a2l_live_t *blocks;             // the heap, by ptr; ptr 0 if the slot is empty
+    uint64_t block_mask, num_blocks;
+    a2l__read_site_t *sites;        // by stack id
+    uint32_t site_mask, num_sites;
+    a2l__read_copied_t *copied;
+    uint64_t num_copied, max_copied;
+}a2l__read_heap_t;
+
+static uint64_t
+a2l__read_block_slot(const a2l__read_heap_t *h, uint64_t ptr) {
+    uint64_t i = ((ptr >> 4) * 2654435761u) & h->block_mask;
+
+    while (h->blocks[i].ptr && h->blocks[i].ptr != ptr)
+        i = (i + 1) & h->block_mask;
+    return i;
+}
+
+static int
+a2l__read_block_add(a2l__read_heap_t *h, uint64_t ptr, uint64_t bytes, uint32_t stack_id) {
+    if (!h->blocks || 2 * (h->num_blocks + 1) > h->block_mask + 1) {
+        uint64_t old_mask = h->block_mask;
+        a2l_live_t *old = h->blocks;
+        uint64_t mask = old ? old_mask * 2 + 1 : 4095;
+
+        if (!(h->blocks = calloc(mask + 1, sizeof(a2l_live_t)))) {
+            h->blocks = old;
+            return -1;
+        }
+        h->block_mask = mask;
+        for (uint64_t i = 0; old && i <= old_mask; i++)
+            if (old[i].ptr)
+                h->blocks[a2l__read_block_slot(h, old[i].ptr)] = old[i];
+        free(old);
+    }
+    a2l_live_t *l = &h->blocks[a2l__read_block_slot(h, ptr)];
+    h->num_blocks += !l->ptr;
+    l->ptr = ptr;
+    l->bytes = bytes;
+    l->stack_id = stack_id;
+    return 0;
+}
+
+// empty slot i, moving back the blocks that probed past it
+static void
+a2l__read_block_remove(a2l__read_heap_t *h, uint64_t i) {
+    uint64_t j = i;
+
+    for (;;) {
+        j = (j + 1) & h->block_mask;
+        if (!h->blocks[j].ptr)
+            break;
+        uint64_t home = ((h->blocks[j].ptr >> 4) * 2654435761u) & h->block_mask;
+        // j stays if its home is cyclically in (i, j]
+        if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+            continue;
+        h->blocks[i] = h->blocks[j];
+        i = j;
+    }
+    h->blocks[i].ptr = 0;
+    h->num_blocks--;
+}
+
+static int
+a2l__read_site_add(a2l__read_heap_t *h, uint32_t stack_id, int64_t bytes, int64_t blocks) {
+    if (!h->sites || 2 * (h->num_sites + 1) > h->site_mask + 1) {
+        uint32_t old_mask = h->site_mask;
+        a2l__read_site_t *old = h->sites;
+        uint32_t mask = old ? old_mask * 2 + 1 : 1023;
+
+        if (mask == old_mask || !(h->sites = calloc((size_t)mask + 1, sizeof(a2l__read_site_t)))) {
+            h->sites = old;
+            return -1;
+        }
+        h->site_mask = mask;
+        for (uint32_t i = 0; old && i <= old_mask; i++) {
+            if (!old[i].used)
+                continue;
+            uint32_t j = (old[i].stack_id * 2654435761u) & mask;
+            while (h->sites[j].used)
+                j = (j + 1) & mask;
+            h->sites[j] = old[i];
+        }
+        free(old);
+    }
+    uint32_t i = (stack_id * 2654435761u) & h->site_mask;
+    while (h->sites[i].used && h->sites[i].stack_id != stack_id)
+        i = (i + 1) & h->site_mask;
+    a2l__read_site_t *s = &h->sites[i];
+    if (!s->used) {
+        s->used = 1;
+        s->stack_id = stack_id;
+        h->num_sites++;
+    }
+    s->bytes += bytes;
+    s->blocks += blocks;
+    return 0;
+}
+
+static int
+a2l__read_cmp_copied(const void *pa, const void *pb) {
+    const a2l__read_copied_t *a = pa, *b = pb;
+    if (a->ts != b->ts)
+        return a->ts < b->ts ? -1 : 1;
+    return a->seq < b->seq ? -1 : a->seq > b->seq;
+}
+
+static int
+a2l__read_cmp_sitelive(const void *pa, const void *pb) {
+    const a2l_sitelive_t *a = pa, *b = pb;
+    return a->stack_id < b->stack_id ? -1 : a->stack_id > b->stack_id;
+}
+
+// keyframe k's blocks, then the events until it ended: every one is
+// taken off its site, and those while it was copied are replayed on
+// the blocks as a2lformat.h says
+static int
+a2l__read_start_heap(const a2l_reader_t *r, uint32_t k, a2l__read_heap_t *h, uint64_t *bad_blocks) {
+    const a2l_keyframe_t *keyframe = &r->keyframes[k];
+    a2l_liveiter_t live;
+    a2l_live_t l;
+    a2l_iter_t it;
+    a2l_event_t e;
+    int ret = 0;
+
+    a2l_live_init(&live, r, k);
+    while (ret == 0 && a2l_live_next(&live, &l))
+        ret = a2l__read_block_add(h, l.ptr, l.bytes, l.stack_id);
+    *bad_blocks += live.bad_blocks;
+    a2l_live_free(&live);
+
+    // the iterator keeps its buffer from block to block
+    a2l_iter_init(&it, r, 0, 0);
+    for (uint64_t i = 0; ret == 0 && i < r->info.num_blocks; i++) {
+        if (r->blocks[i]->first_ts > keyframe->last_ts)
+            continue;
+        it.block = i;
+        it.end_block = i + 1;
+        while (ret == 0 && a2l_iter_next(&it, &e) && e.ts <= keyframe->last_ts) {
+            // a block alloc2log didn't track: no site, no size
+            if (e.type == A2L_REC_FREE && !e.bytes && !e.alloc_stack_id)
+                continue;
+            int alloc = e.type == A2L_REC_ALLOC;
+            ret = a2l__read_site_add(h, e.alloc_stack_id, alloc ? -(int64_t)e.bytes : (int64_t)e.bytes,
+                                     alloc ? -1 : 1);
+            if (ret == 0 && e.ts >= keyframe->first_ts) {
+                if ((ret = a2l__read_grow((void **)&h->copied, &h->max_copied, h->num_copied + 1,
+                                          sizeof(a2l__read_copied_t))) < 0)
+                    break;
+                a2l__read_copied_t *c = &h->copied[h->num_copied];
+                c->ts = e.ts;
+                c->seq = h->num_copied++;
+                c->ptr = e.ptr;
+                c->bytes = e.bytes;
+                c->stack_id = e.alloc_stack_id;
+                c->type = e.type;
+            }
+        }
+        // the rest of the block is after the keyframe
+        it.p = it.end = NULL;
+    }
+    *bad_blocks += it.bad_blocks;
+    a2l_iter_free(&it);
+
+    // an alloc sets its ptr's block, a free removes it if it's there
+    qsort(h->copied, h->num_copied, sizeof(a2l__read_copied_t), a2l__read_cmp_copied);
+    for (uint64_t i = 0; ret == 0 && i < h->num_copied; i++) {
+        const a2l__read_copied_t *c = &h->copied[i];
+        uint64_t slot = a2l__read_block_slot(h, c->ptr);
+        if (c->type == A2L_REC_ALLOC)
+            ret = a2l__read_block_add(h, c->ptr, c->bytes, c->stack_id);
+        else if (h->blocks[slot].ptr)
+            a2l__read_block_remove(h, slot);
+    }
+
+    for (uint64_t i = 0; ret == 0 && i <= h->block_mask; i++)
+        if (h->blocks[i].ptr)
+            ret = a2l__read_site_add(h, h->blocks[i].stack_id, (int64_t)h->blocks[i].bytes, 1);
+    return ret;
+}
+
+int
+a2l_read_start_heap(const a2l_reader_t *r, a2l_startheap_t *sh) {
+    uint64_t first_ts = r->info.first_ts;
+    a2l__read_heap_t h;
+    int ret;
+
+    memset(sh, 0, sizeof(*sh));
+    sh->keyframe = -1;
+    if (!r->info.segments_compacted)
+        return 0;
+    // the first whole keyframe after the compacted segments
+    for (uint32_t i = 0; i < r->num_keyframes; i++) {
+        if (r->keyframes[i].complete) {
+            if (r->keyframes[i].first_ts > first_ts && r->keyframes[i].first_ts <= r->info.last_ts)
+                first_ts = r->keyframes[i].first_ts;
+            break;
+        }
+    }
+    if ((sh->keyframe = a2l_read_keyframe_before(r, first_ts)) < 0)
+        return 0;
+
+    memset(&h, 0, sizeof(h));
+    ret = a2l__read_start_heap(r, (uint32_t)sh->keyframe, &h, &sh->bad_blocks);
+    if (ret == 0 && !(sh->sites = malloc((h.num_sites ? h.num_sites : 1) * sizeof(a2l_sitelive_t))))
+        ret = -1;
+    for (uint32_t i = 0; ret == 0 && i <= h.site_mask; i++) {
+        const a2l__read_site_t *s = &h.sites[i];
+        if (!s->used || (!s->bytes && !s->blocks))
+            continue;
+        a2l_sitelive_t *out = &sh->sites[sh->num_sites++];
+        out->stack_id = s->stack_id;
+        out->_pad = 0;
+        out->bytes = s->bytes;
+        out->blocks = s->blocks;
+        sh->bytes += s->bytes;
+        sh->blocks += s->blocks;
+    }
+    if (ret == 0)
+        qsort(sh->sites, sh->num_sites, sizeof(a2l_sitelive_t), a2l__read_cmp_sitelive);
+    else
+        a2l_start_heap_free(sh);
+    free(h.blocks);
+    free(h.sites);
+    free(h.copied);
+    return ret;
+}
+
+void
+a2l_start_heap_free(a2l_startheap_t *sh) {
+    free(sh->sites);
+    sh->sites = NULL;
+    sh->num_sites = 0;
+}
+
+//
+// iteration
+//
+
+void
+a2l_iter_init(a2l_iter_t *it, const a2l_reader_t *r, uint64_t first_block, uint64_t end_block) {
+    memset(it, 0, sizeof(*it));
+    it->reader = r;
+    it->end_block = end_block < r->info.num_blocks ? end_block : r->info.num_blocks;
+    it->block = first_block < it->end_block ? first_block : it->end_block;
+}
+
+void
+a2l_iter_free(a2l_iter_t *it) {
+    free(it->buffer);
+    it->buffer = NULL;
+    it->buffer_size = 0;
+}
+
+// on to the next block that checks out; 0 at the range's end
+static int
+a2l__iter_block(a2l_iter_t *it) {
+    while (it->block < it->end_block) {
+        const a2l_blockheader_t *bh = it->reader->blocks[it->block++];
+        const uint8_t *payload = a2l__read_payload(bh, &it->buffer, &it->buffer_size);
+
+        if (!payload) {
+            it->bad_blocks++;
+            continue;
+        }
+
+        it->header = bh;
+        it->p = payload;
+        it->end = payload + bh->raw_bytes;
+        it->ts = bh->first_ts;
+        return 1;
+    }
+
+    it->header = NULL;
+    it->p = it->end = NULL;
+    return 0;
+}
+
+// the event at *pp.  0 if it's malformed.
+static inline int
+a2l__iter_decode(const uint8_t **pp, const uint8_t *end, uint64_t *ts, uint32_t tid, a2l_event_t *e) {
+    const uint8_t *p = *pp;
+    uint64_t f[5];
+    int type = *p++;
+
+    if (type == A2L_REC_ALLOC) {
+        // dt, ptr, bytes, stack_id
+        for (int i = 0; i < 4; i++)
+            if (!(p = a2l_get_varint(p, end, &f[i])))
+                return 0;
+        e->bytes = f[2];
+        e->stack_id = e->alloc_stack_id = (uint32_t)f[3];
+    } else if (type == A2L_REC_FREE) {
+        // dt, ptr, stack_id, alloc_bytes, alloc_stack_id
+        for (int i = 0; i < 5; i++)
+            if (!(p = a2l_get_varint(p, end, &f[i])))
+                return 0;
+        e->stack_id = (uint32_t)f[2];
+        e->bytes = f[3];
+        e->alloc_stack_id = (uint32_t)f[4];
+    } else {
+        return 0;
+    }
+
+    *ts += f[0];
+    e->ts = *ts;
+    e->ptr = f[1];
+    e->tid = tid;
+    e->type = (uint8_t)type;
+    *pp = p;
+    return 1;
+}
+
+int
+a2l_iter_next(a2l_iter_t *it, a2l_event_t *e) {
+    for (;;) {
+        if (it->p < it->end) {
+            if (a2l__iter_decode(&it->p, it->end, &it->ts, it->header->tid, e))
+                return 1;
+            // the rest of a malformed block is lost
+            it->bad_blocks++;
+            it->p = it->end;
+        }
+        if (!a2l__iter_block(it))
+            return 0;
+    }
+}
+
+uint32_t
+a2l_iter_batch(a2l_iter_t *it, a2l_batch_t *b) {
+    uint32_t n = 0;
+
+    while (n < b->capacity) {
+        if (it->p >= it->end) {
+            if (!a2l__iter_block(it))
+                break;
+            continue;
+        }
+
+        const uint8_t *p = it->p, *end = it->end;
+        uint64_t ts = it->ts;
+        uint32_t tid = it->header->tid;
+        a2l_event_t e;
+
+        for (; n < b->capacity && p < end; n++) {
+            if (!a2l__iter_decode(&p, end, &ts, tid, &e)) {
+                it->bad_blocks++;
+                p = end;
+                break;
+            }
+            b->ts[n] = e.ts;
+            b->ptr[n] = e.ptr;
+            b->bytes[n] = e.bytes;
+            b->stack_id[n] = e.stack_id;
+            b->alloc_stack_id[n] = e.alloc_stack_id;
+            b->tid[n] = e.tid;
+            b->type[n] = e.type;
+        }
+        it->p = p;
+        it->ts = ts;
+    }
+
+    b->count = n;
+    return n;
+}
+
+a2l_batch_t *
+a2l_batch_alloc(uint32_t capacity) {
+    // one allocation, widest arrays first so each stays aligned
+    size_t per_event = 3 * sizeof(uint64_t) + 3 * sizeof(uint32_t) + sizeof(uint8_t);
+    a2l_batch_t *b = malloc(sizeof(a2l_batch_t) + (size_t)capacity * per_event);
+
+    if (!b)
+        return NULL;
+
+    uint8_t *p = (uint8_t *)(b + 1);
+    b->count = 0;
+    b->capacity = capacity;
+    b->ts = (uint64_t *)p;              p += capacity * sizeof(uint64_t);
+    b->ptr = (uint64_t *)p;             p += capacity * sizeof(uint64_t);
+    b->bytes = (uint64_t *)p;           p += capacity * sizeof(uint64_t);
+    b->stack_id = (uint32_t *)p;        p += capacity * sizeof(uint32_t);
+    b->alloc_stack_id = (uint32_t *)p;  p += capacity * sizeof(uint32_t);
+    b->tid = (uint32_t *)p;             p += capacity * sizeof(uint32_t);
+    b->type = p;
+    return b;
+}
+
+void
+a2l_batch_free(a2l_batch_t *b) {
+    free(b);
+}
@@ -0,0 +1,253 @@
+// a2lread.h -- liba2lread, for reading alloc2log's binary traces.
+//
+// open a trace, or a segmented trace's manifest, then iterate its
+// events, one at a time or in batches of arrays:
+//
+//   char error[256];
+//   a2l_reader_t *r = a2l_read_open("a2l-1234.a2l", error, sizeof(error));
+//   a2l_iter_t it;
+//   a2l_event_t e;
+//
+//   a2l_iter_init(&it, r, 0, a2l_read_info(r)->num_blocks);
+//   while (a2l_iter_next(&it, &e))
+//       ...
+//   a2l_iter_free(&it);
+//   a2l_read_close(r);
+//
+// files are mmapped.  a block stored uncompressed is decoded straight
+// from the map, a compressed one into a buffer the iterator reuses;
+// nothing is allocated per event.  every stack, module and symbol
+// definition is loaded by a2l_read_open, so lookups work before, and
+// during, iteration.
+//
+// events come a block at a time, in trace order: each block is one
+// thread's events in time order.  a reader doesn't change once open,
+// so threads can each iterate their own range of blocks at once.
+// blocks that fail their checksum (a torn last block, after a crash)
+// are skipped and counted in bad_blocks.  compacted segments have no
+// events left and are skipped.
+//
+// for one global order instead, across threads and across traces of
+// several processes, merge them:
+//
+//   a2l_merge_t *m = a2l_merge_open(readers, num_readers);
+//   uint32_t source;
+//   while (a2l_merge_next(m, &e, &source))
+//       ...                        // e from readers[source]
+//   a2l_merge_close(m);
+//
+// events come out by time, ties in trace order.  a merge streams: it
+// holds one decoded block per (trace, thread), never a whole trace.
+//
+// to see the heap at time T without replaying the whole trace, start
+// from the last whole keyframe at or before T, then replay the events
+// from its first_ts on, as a2lformat.h says:
+//
+//   int64_t k = a2l_read_keyframe_before(r, T);
+//   a2l_liveiter_t live;
+//   a2l_live_t l;
+//
+//   a2l_live_init(&live, r, (uint32_t)k);
+//   while (a2l_live_next(&live, &l))
+//       ...                        // l.ptr was live, l.bytes from l.stack_id
+//   a2l_live_free(&live);
+//
+// build: bin/linux/liba2lread.a
+
+#ifndef A2L__READ_H
+#define A2L__READ_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "a2lformat.h"
+
+typedef struct a2l_reader a2l_reader_t;
+
+typedef struct {
+    uint32_t pid;
+    uint32_t num_segments;          // 0 if not segmented
+    uint32_t segments_compacted;
+    uint32_t _pad;
+    uint64_t start_ns;              // CLOCK_MONOTONIC when tracing began
+    uint64_t start_realtime_ns;     // CLOCK_REALTIME at the same moment
+    uint64_t num_blocks;            // event blocks
+    uint64_t num_events;
+    uint64_t first_ts, last_ts;     // of all events
+}a2l_readinfo_t;
+
+typedef struct {
+    uint64_t ts;                    // nanoseconds since start_ns
+    uint64_t ptr;
+    uint64_t bytes;                 // allocated, or freed (0 if not tracked)
+    uint32_t stack_id;              // of the call
+    uint32_t alloc_stack_id;        // of the allocation: for frees, 0 if not tracked
+    uint32_t tid;
+    uint8_t type;                   // A2L_REC_ALLOC or A2L_REC_FREE
+}a2l_event_t;
+
+// the same, as arrays: a2l_event_t i is field[i] of each
+typedef struct {
+    uint32_t count, capacity;
+    uint64_t *ts;
+    uint64_t *ptr;
+    uint64_t *bytes;
+    uint32_t *stack_id;
+    uint32_t *alloc_stack_id;
+    uint32_t *tid;
+    uint8_t *type;
+}a2l_batch_t;
+
+typedef struct {
+    uint64_t addr;
+    uint32_t module_id;             // 0 if unknown
+    uint32_t symbol_id;             // 0 if unknown
+}a2l_frame_t;
+
+typedef struct {
+    uint32_t id;
+    uint32_t num_frames;
+    const a2l_frame_t *frames;      // innermost first
+}a2l_stack_t;
+
+typedef struct {
+    uint32_t id;
+    uint64_t base;
+    const char *path;
+}a2l_module_t;
+
+typedef struct {
+    uint32_t id;
+    uint32_t module_id;
+    uint64_t addr;
+    const char *name;
+}a2l_symbol_t;
+
+// a heap keyframe: its blocks share first_ts
+typedef struct {
+    uint64_t first_ts;              // when it began, as events' ts
+    uint64_t last_ts;               // when its last block was written
+    uint64_t num_live, live_bytes;  // from its end record; 0 unless complete
+    uint32_t num_blocks;            // found
+    uint32_t complete;              // 1 if none are missing
+}a2l_keyframe_t;
+
+// a block live in a keyframe
+typedef struct {
+    uint64_t ptr;
+    uint64_t bytes;
+    uint32_t stack_id;
+}a2l_live_t;
+
+// a site's part of the heap
+typedef struct {
+    uint32_t stack_id;
+    uint32_t _pad;
+    int64_t bytes, blocks;
+}a2l_sitelive_t;
+
+// the heap as the events left begin
+typedef struct {
+    a2l_sitelive_t *sites;          // by stack id
+    uint32_t num_sites;
+    uint32_t _pad;
+    int64_t bytes, blocks;          // the sites', summed
+    int64_t keyframe;               // rebuilt from; -1 if none
+    uint64_t bad_blocks;            // the keyframe's and events' skipped
+}a2l_startheap_t;
+
+typedef struct {
+    const a2l_reader_t *reader;
+    uint64_t block, end_block;      // next of the keyframe's blocks, and its end
+    const uint8_t *p, *end;
+    uint64_t ptr;                   // previous record's
+    uint8_t *buffer;                // decompressed payload
+    size_t buffer_size;
+    uint64_t bad_blocks;
+}a2l_liveiter_t;
+
+typedef struct {
+    const a2l_reader_t *reader;
+    uint64_t block, end_block;      // next block, and the range's end
+    const a2l_blockheader_t *header; // block being decoded
+    const uint8_t *p, *end;
+    uint64_t ts;
+    uint8_t *buffer;                // decompressed payload
+    size_t buffer_size;
+    uint64_t bad_blocks;
+}a2l_iter_t;
+
+// NULL on failure, with the reason in error
+a2l_reader_t *a2l_read_open(const char *path, char *error, size_t error_len);
+void a2l_read_close(a2l_reader_t *r);
+const a2l_readinfo_t *a2l_read_info(const a2l_reader_t *r);
+
+// event block i, 0 <= i < num_blocks: tid, time range, event count
+const a2l_blockheader_t *a2l_read_block(const a2l_reader_t *r, uint64_t i);
+// the segment block i is in, as its file's header has it; 0 if not segmented
+uint32_t a2l_read_block_segment(const a2l_reader_t *r, uint64_t i);
+
+// NULL if not defined
+const a2l_stack_t *a2l_read_stack(const a2l_reader_t *r, uint32_t id);
+const a2l_module_t *a2l_read_module(const a2l_reader_t *r, uint32_t id);
+const a2l_symbol_t *a2l_read_symbol(const a2l_reader_t *r, uint32_t id);
+
+// every stack, 0 <= i < a2l_read_num_stacks(), in definition order
+uint32_t a2l_read_num_stacks(const a2l_reader_t *r);
+const a2l_stack_t *a2l_read_stack_at(const a2l_reader_t *r, uint32_t i);
+
+// module!symbol+0x1a, module!+0x1234 (offset in module) or 0x7f..,
+// into buf as snprintf would; returns the full length
+int a2l_read_frame_name(const a2l_reader_t *r, const a2l_frame_t *frame, char *buf, size_t len);
+
+// every keyframe, 0 <= i < a2l_read_num_keyframes(), whole or not,
+// in trace order, which is first_ts order
+uint32_t a2l_read_num_keyframes(const a2l_reader_t *r);
+const a2l_keyframe_t *a2l_read_keyframe(const a2l_reader_t *r, uint32_t i);
+// the last complete keyframe with first_ts <= ts; -1 if there's none
+int64_t a2l_read_keyframe_before(const a2l_reader_t *r, uint64_t ts);
+
+// the live blocks of keyframe i, a live-map shard at a time, each
+// shard's by address.  a damaged block's are skipped and counted in
+// bad_blocks.
+void a2l_live_init(a2l_liveiter_t *it, const a2l_reader_t *r, uint32_t keyframe);
+void a2l_live_free(a2l_liveiter_t *it);
+// 1 with the next block in l, 0 at the end
+int a2l_live_next(a2l_liveiter_t *it, a2l_live_t *l);
+
+// a trace whose first segments were compacted has lost the blocks
+// allocated in them, and a sum of the events left counts their frees
+// but not their allocs.  this is what was live at the first event
+// left, per site: from the first whole keyframe after them, replayed
+// to its end, less the events until then.  add it to such sums and
+// live bytes and blocks are right throughout.  empty, with keyframe
+// -1, if nothing was compacted or no whole keyframe is left.  0, or
+// -1 if out of memory.
+int a2l_read_start_heap(const a2l_reader_t *r, a2l_startheap_t *h);
+void a2l_start_heap_free(a2l_startheap_t *h);
+
+// events of blocks [first_block, end_block)
+void a2l_iter_init(a2l_iter_t *it, const a2l_reader_t *r, uint64_t first_block, uint64_t end_block);
+void a2l_iter_free(a2l_iter_t *it);
+// 1 with the next event in e, 0 at the end
+int a2l_iter_next(a2l_iter_t *it, a2l_event_t *e);
+// up to b->capacity events into b; b->count, 0 at the end
+uint32_t a2l_iter_batch(a2l_iter_t *it, a2l_batch_t *b);
+
+// every event of the readers in time order; times are from the
+// earliest reader's start_ns.  NULL if out of memory.  the readers
+// must stay open until a2l_merge_close.
+typedef struct a2l_merge a2l_merge_t;
+a2l_merge_t *a2l_merge_open(a2l_reader_t *const *readers, uint32_t num_readers);
+void a2l_merge_close(a2l_merge_t *m);
+// 1 with the next event in e, and its reader's index in source if not NULL; 0 at the end
+int a2l_merge_next(a2l_merge_t *m, a2l_event_t *e, uint32_t *source);
+// up to b->capacity events into b; b->count, 0 at the end
+uint32_t a2l_merge_batch(a2l_merge_t *m, a2l_batch_t *b);
+uint64_t a2l_merge_bad_blocks(const a2l_merge_t *m);
+
+// NULL if out of memory
+a2l_batch_t *a2l_batch_alloc(uint32_t capacity);
+void a2l_batch_free(a2l_batch_t *b);
+
+#endif
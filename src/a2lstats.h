@@ -0,0 +1,153 @@
+// a2lstats.h -- layout of the live statistics region.
+//
+// alloc2log.so creates a POSIX shared memory object named
+// /a2l-<pid> (visible as /dev/shm/a2l-<pid>) and keeps these
+// counters current from inside the hooks.  a2l-top maps the same
+// object read-only, so watching a process costs no file io and no
+// log parsing.
+//
+// All counters are monotonic and updated with relaxed atomics.
+// Readers take rates by differencing two snapshots.
+//
+// Each thread slot also carries alloc2log's own cost, split by hook
+// stage, in cycles (rdtsc; nanoseconds where there is no tsc).
+//
+// mem accounts for every byte alloc2log maps for itself, and how far
+// it has degraded to stay inside A2L_MEM_BUDGET.  thread counters
+// count every call whatever the degrade level; once it samples, sites
+// and live bytes count only the sampled allocations.
+
+#ifndef A2L__STATS_H
+#define A2L__STATS_H
+
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#  include <x86intrin.h>
+#endif
+
+#define A2L_STATS_MAGIC        0x534c3241  // 'A2LS'
+#define A2L_STATS_VERSION      3
+#define A2L_STATS_SHM_NAME_FMT "/a2l-%d"
+
+// a thread's slot is freed when it exits and reused.  the last slot is
+// shared, by threads past the others at once.
+#define A2L_STATS_MAX_THREADS  256
+#define A2L_STATS_SHARED_SLOT  (A2L_STATS_MAX_THREADS - 1)
+
+// site table is open addressed on hash_id; must be a power of two
+#define A2L_STATS_MAX_SITES    4096
+#define A2L_STATS_MAX_PROBE    32
+#define A2L_STATS_LABEL_LEN    96
+
+// hook stages timed by selfprof.c.  wrapper is the whole hook minus
+// the real allocator call; the others are parts of it.
+#define A2L_STAGE_WRAPPER      0
+#define A2L_STAGE_UNWIND       1
+#define A2L_STAGE_HASH         2
+#define A2L_STAGE_SYMBOLIZE    3
+#define A2L_STAGE_FORMAT       4
+#define A2L_STAGE_WRITE        5
+#define A2L_STAGE_TRACK        6   // live map and these counters
+#define A2L_STAGE_COUNT        7
+
+#define A2L_STAGE_NAMES \
+    {"wrapper", "unwind", "hash", "symbolize", "format", "write", "track"}
+
+// hist[i] counts samples of [2^i, 2^(i+1)) cycles
+#define A2L_STAGE_HIST_BUCKETS 32
+
+typedef struct {
+    uint64_t count;
+    uint64_t cycles;
+    uint64_t max_cycles;
+    uint64_t hist[A2L_STAGE_HIST_BUCKETS];
+}a2l_stats_stage_t;
+
+// categories of alloc2log's own memory, see memaccount.c
+#define A2L_MEM_STATS          0   // this region
+#define A2L_MEM_LIVEMAP        1   // trackallocs.c
+#define A2L_MEM_STACKS         2   // stacktable.c index
+#define A2L_MEM_SYMBOLS        3   // stacktable.c frames and symbolized text
+#define A2L_MEM_BUFFERS        4   // capture buffers
+#define A2L_MEM_COUNT          5
+
+#define A2L_MEM_NAMES \
+    {"stats", "livemap", "stacks", "symbols", "buffers"}
+
+typedef struct {
+    uint64_t bytes[A2L_MEM_COUNT];
+    uint64_t total;
+    uint64_t peak;
+    uint64_t budget;               // 0 if unlimited
+    uint64_t denied;               // mappings refused to stay in budget
+    uint32_t degrade_level;
+    uint32_t sample_shift;         // 1 in 2^sample_shift new allocs is logged
+    uint32_t max_frames;
+    uint32_t _pad;
+    uint64_t stack_evictions;
+    uint64_t events_sampled_out;
+    uint64_t allocs_untracked;     // live map was full and at budget
+}a2l_stats_mem_t;
+
+typedef struct {
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t bytes_alloced;
+    uint64_t bytes_freed;
+}a2l_stats_counters_t;
+
+typedef struct {
+    uint32_t tid;             // kernel thread id, 0 if slot unused
+    uint32_t free;            // its thread exited: up for reuse
+    a2l_stats_counters_t counters;
+    a2l_stats_stage_t stages[A2L_STAGE_COUNT];   // written by the owning thread only
+}a2l_stats_thread_t;
+
+typedef struct {
+    uint32_t hash_id;         // stack hash of the allocating site, 0 if unused
+    uint32_t label_ready;     // label is complete and safe to read
+    a2l_stats_counters_t counters;
+    char label[A2L_STATS_LABEL_LEN];
+}a2l_stats_site_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t pid;
+    uint32_t num_threads;     // thread slots handed out, max if the shared one is in use
+    uint32_t max_threads;
+    uint32_t max_sites;
+    uint64_t sites_dropped;   // allocs whose site didn't fit in the table
+    uint64_t live_bytes;
+    uint64_t peak_live_bytes;
+
+    // a2l_cycles() and CLOCK_MONOTONIC ns at init, to convert cycles
+    uint64_t start_cycles;
+    uint64_t start_ns;
+
+    a2l_stats_mem_t mem;
+
+    a2l_stats_thread_t threads[A2L_STATS_MAX_THREADS];    // the last shared
+    a2l_stats_site_t sites[A2L_STATS_MAX_SITES];
+}a2l_stats_t;
+
+
+static inline uint64_t
+a2l_clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t
+a2l_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return a2l_clock_ns();
+#endif
+}
+
+#endif
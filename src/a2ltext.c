@@ -0,0 +1,284 @@
+#define _GNU_SOURCE
+// a2ltext.c -- liba2lread's text log parser; see a2ltext.h.
+//
+// the parser walks a range line by line.  a scanner hands it the
+// range's delimiters in order, newlines and quotes, from a bitmap of
+// 64 bytes at a time: four SSE2 compares per character, a movemask
+// each, then a count-trailing-zeros per delimiter.  everything between
+// delimiters is read once, by the field it belongs to.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "a2ltext.h"
+
+#define A2L_TEXT_LINE_QUOTES 8          // a stack frame line has the most
+
+int
+a2l_text_open(a2l_textlog_t *log, const char *path, char *error, size_t error_len) {
+    struct stat st;
+
+    memset(log, 0, sizeof(*log));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        snprintf(error, error_len, "can't open %s: %s", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        snprintf(error, error_len, "can't map %s: %s", path, strerror(errno));
+        return -1;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    log->map = map;
+    log->size = st.st_size;
+    return 0;
+}
+
+void
+a2l_text_close(a2l_textlog_t *log) {
+    if (log->map)
+        munmap((void *)log->map, log->size);
+    log->map = NULL;
+    log->size = 0;
+}
+
+void
+a2l_text_split(const a2l_textlog_t *log, uint32_t n, uint64_t *bounds) {
+    static const char start[] = "\n  {\n";
+
+    bounds[0] = 0;
+    for (uint32_t i = 1; i < n; i++) {
+        uint64_t target = (uint64_t)log->size * i / n;
+        const char *found;
+
+        if (target < bounds[i - 1])
+            target = bounds[i - 1];
+        found = memmem(log->map + target, log->size - target, start, sizeof(start) - 1);
+        bounds[i] = found ? (uint64_t)(found - log->map) + 1 : log->size;
+    }
+    bounds[n] = log->size;
+}
+
+//
+// scanning
+//
+
+// bit i set if p[i] is a newline or a quote.  p has 64 bytes.
+static inline uint64_t
+a2l__text_mask(const char *p) {
+#if defined(__SSE2__)
+    const __m128i newline = _mm_set1_epi8('\n'), quote = _mm_set1_epi8('\'');
+    uint64_t mask = 0;
+
+    for (int i = 0; i < 4; i++) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + 16 * i));
+        __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(v, newline), _mm_cmpeq_epi8(v, quote));
+        mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(hits) << (16 * i);
+    }
+    return mask;
+#else
+    uint64_t mask = 0;
+
+    for (int i = 0; i < 64; i++)
+        if (p[i] == '\n' || p[i] == '\'')
+            mask |= 1ULL << i;
+    return mask;
+#endif
+}
+
+// the window at p, clipped to the range's end
+static inline void
+a2l__text_window(a2l_textparser_t *tp, const char *p) {
+    tp->window = p;
+    if (tp->end - p >= 64) {
+        tp->bits = a2l__text_mask(p);
+    } else {
+        char tail[64];
+        memset(tail, 0, sizeof(tail));
+        memcpy(tail, p, tp->end - p);
+        tp->bits = a2l__text_mask(tail);
+    }
+}
+
+// the next newline or quote, or NULL at the range's end
+static inline const char *
+a2l__text_delim(a2l_textparser_t *tp) {
+    while (!tp->bits) {
+        if (tp->end - tp->window <= 64)
+            return NULL;
+        a2l__text_window(tp, tp->window + 64);
+    }
+
+    const char *d = tp->window + __builtin_ctzll(tp->bits);
+    tp->bits &= tp->bits - 1;
+    return d;
+}
+
+// the next line, and where its quotes are.  0 at the range's end.
+static int
+a2l__text_line(a2l_textparser_t *tp, const char **line, size_t *len,
+               const char **quotes, int *num_quotes) {
+    const char *d;
+
+    if (tp->line >= tp->end)
+        return 0;
+
+    *line = tp->line;
+    *num_quotes = 0;
+    while ((d = a2l__text_delim(tp)) && *d != '\n') {
+        if (*num_quotes < A2L_TEXT_LINE_QUOTES)
+            quotes[*num_quotes] = d;
+        (*num_quotes)++;
+    }
+
+    // the last line may have no newline
+    const char *line_end = d ? d : tp->end;
+    *len = line_end - *line;
+    tp->line = d ? d + 1 : tp->end;
+    return 1;
+}
+
+//
+// fields
+//
+
+static inline uint64_t
+a2l__text_hex(const char *p, const char *end) {
+    uint64_t v = 0;
+
+    if (end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+        p += 2;
+    for (; p < end; p++) {
+        char c = *p;
+        if (c >= '0' && c <= '9')      v = v << 4 | (uint64_t)(c - '0');
+        else if (c >= 'a' && c <= 'f') v = v << 4 | (uint64_t)(c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F') v = v << 4 | (uint64_t)(c - 'A' + 10);
+        else break;
+    }
+    return v;
+}
+
+static inline int64_t
+a2l__text_dec(const char *p, const char *end) {
+    int negative = p < end && *p == '-';
+    uint64_t v = 0;
+
+    for (p += negative; p < end && *p >= '0' && *p <= '9'; p++)
+        v = v * 10 + (uint64_t)(*p - '0');
+    return negative ? -(int64_t)v : (int64_t)v;
+}
+
+#define A2L__TEXT_KEY(content, len, key) \
+    ((len) >= sizeof(key) - 1 && memcmp((content), (key), sizeof(key) - 1) == 0)
+
+void
+a2l_text_init(a2l_textparser_t *tp, const a2l_textlog_t *log, uint64_t begin, uint64_t end) {
+    memset(tp, 0, sizeof(*tp));
+    tp->map = log->map;
+    tp->begin = log->map + begin;
+    tp->end = log->map + (end < log->size ? end : log->size);
+    tp->line = tp->begin;
+    if (tp->begin < tp->end)
+        a2l__text_window(tp, tp->begin);
+}
+
+int
+a2l_text_next(a2l_textparser_t *tp, a2l_textrecord_t *rec) {
+    const char *line, *quotes[A2L_TEXT_LINE_QUOTES];
+    size_t len;
+    int num_quotes;
+
+    // to the next record's opening brace
+    for (;;) {
+        if (!a2l__text_line(tp, &line, &len, quotes, &num_quotes))
+            return 0;
+        if (len == 3 && memcmp(line, "  {", 3) == 0)
+            break;
+    }
+
+restart:
+    memset(rec, 0, offsetof(a2l_textrecord_t, frames));
+    rec->offset = (uint64_t)(line - tp->map);
+
+    while (a2l__text_line(tp, &line, &len, quotes, &num_quotes)) {
+        size_t indent = 0;
+        while (indent < len && line[indent] == ' ')
+            indent++;
+        const char *content = line + indent;
+        size_t clen = len - indent;
+
+        if (indent == 2) {
+            if (clen >= 1 && content[0] == '}') {
+                tp->records++;
+                return 1;
+            }
+            // a record cut short, then another
+            if (clen == 1 && content[0] == '{') {
+                tp->malformed++;
+                goto restart;
+            }
+            continue;
+        }
+
+        switch (clen ? content[0] : 0) {
+        case 'c':
+            if (A2L__TEXT_KEY(content, clen, "call:") && num_quotes >= 2) {
+                rec->call = quotes[0] + 1;
+                rec->call_len = (uint32_t)(quotes[1] - quotes[0] - 1);
+            }
+            break;
+        case 'b':
+            if (A2L__TEXT_KEY(content, clen, "bytes: "))
+                rec->bytes = a2l__text_dec(content + 7, content + clen);
+            break;
+        case 'h':
+            if (A2L__TEXT_KEY(content, clen, "hash_id: "))
+                rec->hash_id = (uint32_t)a2l__text_dec(content + 9, content + clen);
+            break;
+        case 't':
+            if (A2L__TEXT_KEY(content, clen, "thread_id: "))
+                rec->thread_id = (uint64_t)a2l__text_dec(content + 11, content + clen);
+            break;
+        case 'p':
+            if (A2L__TEXT_KEY(content, clen, "ptr:") && num_quotes >= 2)
+                rec->ptr = a2l__text_hex(quotes[0] + 1, quotes[1]);
+            break;
+        case '{':
+            // func, bin, addr, offset: a quoted value each
+            if (num_quotes == 8 && rec->num_frames < A2L_TEXT_MAX_FRAMES) {
+                a2l_textframe_t *f = &rec->frames[rec->num_frames++];
+                f->func = quotes[0] + 1;
+                f->func_len = (uint32_t)(quotes[1] - quotes[0] - 1);
+                f->bin = quotes[2] + 1;
+                f->bin_len = (uint32_t)(quotes[3] - quotes[2] - 1);
+                f->addr = a2l__text_hex(quotes[4] + 1, quotes[5]);
+                f->offset = a2l__text_hex(quotes[6] + 1, quotes[7]);
+            }
+            break;
+        }
+    }
+
+    // the range ended inside the record
+    tp->malformed++;
+    return 0;
+}
@@ -0,0 +1,78 @@
+// a2ltext.h -- liba2lread's parser for alloc2log's text log format.
+//
+// a log is a run of records, as A2L_SPRINTF writes them:
+//
+//     {
+//       call: 'malloc',
+//       bytes: 64,
+//       hash_id: 1025720105,
+//       thread_id: 7926,
+//       ptr: '0x55df600c82a0'          (none if NULL)
+//       stack: [
+//         {    func: 'puts',    bin: '/lib/libc.so.6',    addr: '0x7fc5..',    offset: '0xc8'       },
+//         ...
+//       ],
+//     },
+//
+// the log is mmapped and parsed in place: a record's strings point
+// into the mapping.  newlines and quotes, the only delimiters the
+// parser needs, are found 64 bytes at a time with SSE2.
+//
+// a2l_text_split cuts a log into ranges that each start at a record,
+// so threads can parse one range each.  a malformed record (a log cut
+// short, say) is skipped and counted.
+
+#ifndef A2L__TEXT_H
+#define A2L__TEXT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define A2L_TEXT_MAX_FRAMES 64
+
+typedef struct {
+    const char *func;               // not NUL terminated; func_len 0 if unknown
+    const char *bin;
+    uint32_t func_len, bin_len;
+    uint64_t addr;
+    uint64_t offset;                // from func's start, or bin's base if no func
+}a2l_textframe_t;
+
+typedef struct {
+    uint64_t offset;                // of the record in the log
+    const char *call;               // 'malloc', 'free', ..
+    uint32_t call_len;
+    uint32_t hash_id;
+    int64_t bytes;                  // 0 for frees
+    uint64_t thread_id;
+    uint64_t ptr;                   // 0 if none
+    uint32_t num_frames;
+    a2l_textframe_t frames[A2L_TEXT_MAX_FRAMES];
+}a2l_textrecord_t;
+
+typedef struct {
+    const char *map;
+    size_t size;
+}a2l_textlog_t;
+
+typedef struct {
+    const char *map;
+    const char *begin, *end;        // range being parsed
+    const char *line;               // start of the next line
+    const char *window;             // 64 bytes that bits describe
+    uint64_t bits;                  // delimiters in window not yet consumed
+    uint64_t records, malformed;
+}a2l_textparser_t;
+
+// -1 on failure, with the reason in error
+int a2l_text_open(a2l_textlog_t *log, const char *path, char *error, size_t error_len);
+void a2l_text_close(a2l_textlog_t *log);
+
+// n ranges [bounds[i], bounds[i+1]), each starting at a record
+void a2l_text_split(const a2l_textlog_t *log, uint32_t n, uint64_t *bounds);
+
+void a2l_text_init(a2l_textparser_t *tp, const a2l_textlog_t *log, uint64_t begin, uint64_t end);
+// 1 with the next record in rec, 0 at the range's end
+int a2l_text_next(a2l_textparser_t *tp, a2l_textrecord_t *rec);
+
+#endif
@@ -0,0 +1,235 @@
+#define _GNU_SOURCE
+// a2l-timeline -- build a trace's timeline pyramid, or view a stretch of it
+//
+// usage: a2l-timeline [-r ms] [-s sites] <trace>
+//        a2l-timeline -q [-f from] [-u until] [-w points] [-n sites] [-d depth] <trace>
+//
+// the first writes <trace>.tl (a2ltl.h): buckets of -r milliseconds
+// (default 1), then 10 times wider at each level up, keeping -s top
+// sites per bucket (default 8).  the second prints [from, until) at the
+// finest level that fits it in -w rows (default 100): live bytes at
+// each bucket's end with the low and peak during it, alloc rates, and
+// its top -n sites.  from and until are HH:MM[:SS] wall clock, or
+// seconds since the trace began.  buckets with no events are left out.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "a2lread.h"
+#include "a2ltl.h"
+
+#define A2L_TIMELINE_PATH_MAX 4096
+#define A2L_TIMELINE_MAX_SHOWN 64       // sites described below the rows
+
+static void
+a2l_timeline_usage(void) {
+    fprintf(stderr, "usage: a2l-timeline [-r ms] [-s sites] <trace>\n"
+                    "       a2l-timeline -q [-f from] [-u until] [-w points] [-n sites] [-d depth] <trace>\n");
+}
+
+static double
+a2l_timeline_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// human readable byte count into buf
+static const char *
+a2l_timeline_bytes(char *buf, size_t len, double bytes) {
+    const char *units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    int unit = 0;
+
+    while ((bytes >= 1024.0 || bytes <= -1024.0) && unit < 4) {
+        bytes /= 1024.0;
+        unit++;
+    }
+    snprintf(buf, len, unit ? "%.1f %s" : "%.0f %s", bytes, units[unit]);
+    return buf;
+}
+
+// HH:MM[:SS] on the trace's first day (or the next, if that's well
+// before it began), or seconds since it began; -1 if neither
+static int
+a2l_timeline_parse_time(const char *str, const a2l_readinfo_t *info, uint64_t *ts) {
+    unsigned hour, minute;
+    double second = 0;
+    char *end;
+
+    if (!strchr(str, ':')) {
+        double seconds = strtod(str, &end);
+        if (end == str || *end || seconds < 0)
+            return -1;
+        *ts = (uint64_t)(seconds * 1e9);
+        return 0;
+    }
+
+    if (sscanf(str, "%u:%u:%lf", &hour, &minute, &second) < 2 || hour > 23 || minute > 59)
+        return -1;
+    if (!info->start_realtime_ns) {
+        fprintf(stderr, "a2l-timeline: the trace has no wall clock; give seconds\n");
+        return -1;
+    }
+
+    time_t start = (time_t)(info->start_realtime_ns / 1000000000ULL);
+    struct tm tm;
+    localtime_r(&start, &tm);
+    tm.tm_hour = (int)hour;
+    tm.tm_min = (int)minute;
+    tm.tm_sec = 0;
+    tm.tm_isdst = -1;
+    int64_t at_ns = (int64_t)mktime(&tm) * 1000000000LL + (int64_t)(second * 1e9);
+    if (at_ns + 3600LL * 1000000000LL < (int64_t)info->start_realtime_ns)
+        at_ns += 86400LL * 1000000000LL;
+
+    int64_t rel = at_ns - (int64_t)info->start_realtime_ns;
+    *ts = rel > 0 ? (uint64_t)rel : 0;
+    return 0;
+}
+
+static void
+a2l_timeline_query(const a2l_reader_t *r, const a2l_timeline_t *tl, uint64_t from, uint64_t to,
+                   uint64_t points, int num_sites, int depth) {
+    const a2l_tlheader_t *h = a2l_timeline_header(tl);
+    uint32_t shown[A2L_TIMELINE_MAX_SHOWN], num_shown = 0;
+    char b0[32], b1[32], b2[32], b3[32];
+    double start = a2l_timeline_now();
+    uint64_t count;
+
+    uint32_t k = a2l_timeline_zoom(tl, from, to, points);
+    const a2l_tllevel_t *l = a2l_timeline_level(tl, k);
+    const a2l_tlbucket_t *b = a2l_timeline_buckets(tl, k, from, to, &count);
+    double seconds = l->bucket_ns / 1e9;
+
+    printf("%.3f s to %.3f s: %" PRIu64 " buckets of %g s (level %u of %u), found in %.3f ms\n",
+           from / 1e9, to / 1e9, count, seconds, k + 1, h->num_levels, (a2l_timeline_now() - start) * 1e3);
+    if (a2l_read_info(r)->segments_compacted && h->start_keyframe >= 0)
+        printf("%u compacted segments: live counts from the %s they left, rebuilt from keyframe %" PRId64 "\n",
+               a2l_read_info(r)->segments_compacted, a2l_timeline_bytes(b0, sizeof(b0), (double)h->start_live),
+               h->start_keyframe);
+    else if (a2l_read_info(r)->segments_compacted)
+        printf("%u compacted segments, and no whole keyframe left: live counts only the events kept\n",
+               a2l_read_info(r)->segments_compacted);
+    printf("\n%12s %12s %12s %12s %12s %12s  top sites\n",
+           "time", "live", "low", "peak", "allocs/s", "bytes/s");
+    for (uint64_t i = 0; i < count; i++) {
+        const a2l_tlsite_t *s = a2l_timeline_sites(tl, k, &b[i]);
+
+        printf("%10.3f s %12s %12s %12s %12.0f %10s/s ",
+               b[i].index * seconds, a2l_timeline_bytes(b0, sizeof(b0), (double)b[i].live),
+               a2l_timeline_bytes(b1, sizeof(b1), (double)b[i].live_min),
+               a2l_timeline_bytes(b2, sizeof(b2), (double)b[i].live_max), b[i].allocs / seconds,
+               a2l_timeline_bytes(b3, sizeof(b3), b[i].bytes_alloced / seconds));
+        for (uint32_t j = 0; j < b[i].num_sites && (int)j < num_sites; j++) {
+            printf(" %08x %s", s[j].stack_id, a2l_timeline_bytes(b0, sizeof(b0), (double)s[j].bytes_alloced));
+            uint32_t seen = 0;
+            while (seen < num_shown && shown[seen] != s[j].stack_id)
+                seen++;
+            if (seen == num_shown && num_shown < A2L_TIMELINE_MAX_SHOWN)
+                shown[num_shown++] = s[j].stack_id;
+        }
+        printf("\n");
+    }
+    if (!count)
+        printf("  none\n");
+
+    // the sites above, once each
+    if (num_shown)
+        printf("\n");
+    for (uint32_t i = 0; i < num_shown; i++) {
+        const a2l_stack_t *stack = a2l_read_stack(r, shown[i]);
+        char frame[512];
+
+        printf("%08x", shown[i]);
+        if (!shown[i])
+            printf("  (unknown)");
+        for (uint32_t j = 0; shown[i] && stack && j < stack->num_frames && (int)j < depth; j++) {
+            a2l_read_frame_name(r, &stack->frames[j], frame, sizeof(frame));
+            printf(j ? " < %s" : "  %s", frame);
+        }
+        printf("\n");
+    }
+}
+
+int
+main(int argc, char **argv) {
+    const char *from_str = NULL, *until_str = NULL;
+    char path[A2L_TIMELINE_PATH_MAX], error[256];
+    double base_ms = 1.0;
+    int query = 0, top_sites = 8, num_sites = 3, depth = 4, opt;
+    long points = 100;
+
+    while ((opt = getopt(argc, argv, "r:s:qf:u:w:n:d:h")) != -1) {
+        switch (opt) {
+        case 'r': base_ms = atof(optarg); break;
+        case 's': top_sites = atoi(optarg); break;
+        case 'q': query = 1; break;
+        case 'f': from_str = optarg; break;
+        case 'u': until_str = optarg; break;
+        case 'w': points = atol(optarg); break;
+        case 'n': num_sites = atoi(optarg); break;
+        case 'd': depth = atoi(optarg); break;
+        default:
+            a2l_timeline_usage();
+            return 1;
+        }
+    }
+    if (optind != argc - 1 || base_ms <= 0 || top_sites < 0 || points < 1) {
+        a2l_timeline_usage();
+        return 1;
+    }
+
+    const char *trace = argv[optind];
+    snprintf(path, sizeof(path), A2L_TIMELINE_PATH_FMT, trace);
+    double start = a2l_timeline_now();
+    a2l_reader_t *r = a2l_read_open(trace, error, sizeof(error));
+    if (!r) {
+        fprintf(stderr, "a2l-timeline: %s\n", error);
+        return 1;
+    }
+    const a2l_readinfo_t *info = a2l_read_info(r);
+
+    if (!query) {
+        uint64_t base_ns = (uint64_t)(base_ms * 1e6);
+        if (a2l_timeline_build(r, path, base_ns ? base_ns : 1, (uint32_t)top_sites, error, sizeof(error)) < 0) {
+            fprintf(stderr, "a2l-timeline: %s\n", error);
+            return 1;
+        }
+        a2l_timeline_t *tl = a2l_timeline_open(r, path, error, sizeof(error));
+        if (!tl) {
+            fprintf(stderr, "a2l-timeline: %s\n", error);
+            return 1;
+        }
+        const a2l_tlheader_t *h = a2l_timeline_header(tl);
+        printf("%s: %u levels, in %.2f s\n", path, h->num_levels, a2l_timeline_now() - start);
+        for (uint32_t k = 0; k < h->num_levels; k++) {
+            const a2l_tllevel_t *l = a2l_timeline_level(tl, k);
+            printf("  %12g s buckets: %10" PRIu64 " with events, %10" PRIu64 " top sites\n",
+                   l->bucket_ns / 1e9, l->num_buckets, l->num_sites);
+        }
+        a2l_timeline_close(tl);
+        a2l_read_close(r);
+        return 0;
+    }
+
+    a2l_timeline_t *tl = a2l_timeline_open(r, path, error, sizeof(error));
+    if (!tl) {
+        fprintf(stderr, "a2l-timeline: %s\n", error);
+        return 1;
+    }
+    uint64_t from = info->first_ts, to = info->last_ts + 1;
+    if ((from_str && a2l_timeline_parse_time(from_str, info, &from) < 0) ||
+        (until_str && a2l_timeline_parse_time(until_str, info, &to) < 0)) {
+        fprintf(stderr, "a2l-timeline: times are HH:MM[:SS] or seconds\n");
+        return 1;
+    }
+    a2l_timeline_query(r, tl, from, to, (uint64_t)points, num_sites, depth);
+    a2l_timeline_close(tl);
+    a2l_read_close(r);
+    return 0;
+}
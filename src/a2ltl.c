@@ -0,0 +1,503 @@
+#define _GNU_SOURCE
+// a2ltl.c -- liba2lread's multi-resolution timeline; see a2ltl.h.
+//
+// building is one pass over the trace in time order, through a merge.
+// only level 0 sees events; when its bucket ends, its sums are added
+// into the open bucket of level 1, and so on up, so every level costs
+// a bucket's worth of memory however long the trace.  finished buckets
+// and their top sites go to a scratch file per level, unlinked, and
+// are copied into place at the end.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "a2ltl.h"
+
+#define A2L__TIMELINE_BATCH 4096
+
+struct a2l_timeline {
+    const uint8_t *map;
+    size_t size;
+    const a2l_tlheader_t *header;
+    const a2l_tllevel_t *levels;
+};
+
+// a site's sums in an open bucket
+typedef struct {
+    uint64_t key;                   // stack_id + 1: 0 is empty
+    a2l_tlsite_t site;
+}a2l__tlsum_t;
+
+// a level's open bucket while building
+typedef struct {
+    uint64_t bucket_ns;
+    int open;
+    a2l_tlbucket_t b;
+    a2l__tlsum_t *slots;
+    uint32_t *used;                 // slots in use, to walk and clear
+    uint32_t mask, count;
+    FILE *buckets, *sites;
+    uint64_t num_buckets, num_sites;
+}a2l__tlbuild_t;
+
+static int
+a2l__timeline_fail(char *error, size_t error_len, const char *fmt, ...) {
+    va_list args;
+
+    if (error && error_len) {
+        va_start(args, fmt);
+        vsnprintf(error, error_len, fmt, args);
+        va_end(args);
+    }
+    return -1;
+}
+
+static int
+a2l__timeline_init(a2l__tlbuild_t *l, uint32_t size) {
+    l->slots = calloc(size, sizeof(a2l__tlsum_t));
+    l->used = malloc(size * sizeof(uint32_t));
+    l->mask = size - 1;
+    l->count = 0;
+    return l->slots && l->used ? 0 : -1;
+}
+
+static a2l_tlsite_t *
+a2l__timeline_sum(a2l__tlbuild_t *l, uint32_t stack_id) {
+    uint64_t key = stack_id + 1ULL;
+    uint32_t slot = (stack_id * 2654435761u) & l->mask;
+
+    while (l->slots[slot].key && l->slots[slot].key != key)
+        slot = (slot + 1) & l->mask;
+    if (l->slots[slot].key)
+        return &l->slots[slot].site;
+
+    // half full: double, then look again
+    if ((l->count + 1) * 2 > l->mask) {
+        a2l__tlbuild_t grown;
+        if (a2l__timeline_init(&grown, (l->mask + 1) * 2) < 0) {
+            free(grown.slots);
+            free(grown.used);
+            return NULL;
+        }
+        for (uint32_t i = 0; i < l->count; i++) {
+            const a2l__tlsum_t *s = &l->slots[l->used[i]];
+            uint32_t g = (s->site.stack_id * 2654435761u) & grown.mask;
+            while (grown.slots[g].key)
+                g = (g + 1) & grown.mask;
+            grown.slots[g] = *s;
+            grown.used[grown.count++] = g;
+        }
+        free(l->slots);
+        free(l->used);
+        l->slots = grown.slots;
+        l->used = grown.used;
+        l->mask = grown.mask;
+        return a2l__timeline_sum(l, stack_id);
+    }
+
+    l->slots[slot].key = key;
+    l->slots[slot].site.stack_id = stack_id;
+    l->used[l->count++] = slot;
+    return &l->slots[slot].site;
+}
+
+static int
+a2l__timeline_cmp_site(const void *pa, const void *pb) {
+    const a2l_tlsite_t *a = pa, *b = pb;
+
+    if (a->bytes_alloced != b->bytes_alloced)
+        return a->bytes_alloced < b->bytes_alloced ? 1 : -1;
+    if (a->allocs != b->allocs)
+        return a->allocs < b->allocs ? 1 : -1;
+    return a->stack_id < b->stack_id ? -1 : a->stack_id > b->stack_id;
+}
+
+// level k's open bucket out to its file, and into level k + 1's
+static int
+a2l__timeline_flush(a2l__tlbuild_t *levels, uint32_t k, uint32_t num_levels, uint32_t top_sites,
+                    a2l_tlsite_t **scratch, uint32_t *scratch_size) {
+    a2l__tlbuild_t *l = &levels[k];
+
+    if (*scratch_size < l->count) {
+        a2l_tlsite_t *grown = realloc(*scratch, l->count * sizeof(a2l_tlsite_t));
+        if (!grown)
+            return -1;
+        *scratch = grown;
+        *scratch_size = l->count;
+    }
+    for (uint32_t i = 0; i < l->count; i++)
+        (*scratch)[i] = l->slots[l->used[i]].site;
+    qsort(*scratch, l->count, sizeof(a2l_tlsite_t), a2l__timeline_cmp_site);
+
+    l->b.first_site = l->num_sites;
+    // sites that only freed aren't top of anything
+    l->b.num_sites = 0;
+    while (l->b.num_sites < l->count && l->b.num_sites < top_sites && (*scratch)[l->b.num_sites].allocs)
+        l->b.num_sites++;
+    if ((l->b.num_sites && fwrite(*scratch, sizeof(a2l_tlsite_t), l->b.num_sites, l->sites) != l->b.num_sites) ||
+        fwrite(&l->b, sizeof(a2l_tlbucket_t), 1, l->buckets) != 1)
+        return -1;
+    l->num_sites += l->b.num_sites;
+    l->num_buckets++;
+
+    if (k + 1 < num_levels) {
+        a2l__tlbuild_t *up = &levels[k + 1];
+        uint64_t index = l->b.index / A2L_TIMELINE_FANOUT;
+
+        if (up->open && up->b.index != index &&
+            a2l__timeline_flush(levels, k + 1, num_levels, top_sites, scratch, scratch_size) < 0)
+            return -1;
+        if (!up->open) {
+            memset(&up->b, 0, sizeof(up->b));
+            up->b.index = index;
+            up->b.live_min = l->b.live_min;
+            up->b.live_max = l->b.live_max;
+            up->open = 1;
+        }
+        up->b.allocs += l->b.allocs;
+        up->b.frees += l->b.frees;
+        up->b.bytes_alloced += l->b.bytes_alloced;
+        up->b.bytes_freed += l->b.bytes_freed;
+        up->b.live = l->b.live;
+        if (l->b.live_min < up->b.live_min)
+            up->b.live_min = l->b.live_min;
+        if (l->b.live_max > up->b.live_max)
+            up->b.live_max = l->b.live_max;
+        for (uint32_t i = 0; i < l->count; i++) {
+            const a2l_tlsite_t *s = &l->slots[l->used[i]].site;
+            a2l_tlsite_t *u = a2l__timeline_sum(up, s->stack_id);
+            if (!u)
+                return -1;
+            u->allocs += s->allocs;
+            u->bytes_alloced += s->bytes_alloced;
+            u->bytes_freed += s->bytes_freed;
+        }
+    }
+
+    for (uint32_t i = 0; i < l->count; i++)
+        memset(&l->slots[l->used[i]], 0, sizeof(a2l__tlsum_t));
+    l->count = 0;
+    l->open = 0;
+    return 0;
+}
+
+static int
+a2l__timeline_copy(FILE *to, FILE *from) {
+    char buf[65536];
+    size_t n;
+
+    if (fflush(from) != 0 || fseek(from, 0, SEEK_SET) != 0)
+        return -1;
+    while ((n = fread(buf, 1, sizeof(buf), from)) > 0)
+        if (fwrite(buf, 1, n, to) != n)
+            return -1;
+    return ferror(from) ? -1 : 0;
+}
+
+int
+a2l_timeline_build(a2l_reader_t *r, const char *path, uint64_t base_ns, uint32_t top_sites,
+                   char *error, size_t error_len) {
+    const a2l_readinfo_t *info = a2l_read_info(r);
+    a2l__tlbuild_t levels[A2L_TIMELINE_MAX_LEVELS];
+    a2l_tllevel_t out[A2L_TIMELINE_MAX_LEVELS];
+    a2l_tlsite_t *scratch = NULL;
+    uint32_t scratch_size = 0;
+    a2l_tlheader_t h;
+    a2l_startheap_t heap;
+    a2l_merge_t *m = NULL;
+    a2l_batch_t *b = NULL;
+    char tmp[4096 + 8];
+    FILE *f = NULL;
+    int ret = -1;
+
+    memset(&heap, 0, sizeof(heap));
+    memset(&h, 0, sizeof(h));
+    h.magic = A2L_TIMELINE_MAGIC;
+    h.version = A2L_TIMELINE_VERSION;
+    h.header_bytes = sizeof(h);
+    h.pid = info->pid;
+    h.num_blocks = info->num_blocks;
+    h.num_events = info->num_events;
+    h.start_realtime_ns = info->start_realtime_ns;
+    h.first_ts = info->first_ts;
+    h.last_ts = info->last_ts;
+    h.base_ns = base_ns ? base_ns : 1;
+    h.top_sites = top_sites;
+    h.levels_offset = sizeof(h);
+
+    // wider by the fanout each, until one bucket holds it all
+    memset(levels, 0, sizeof(levels));
+    for (uint64_t ns = h.base_ns; h.num_levels < A2L_TIMELINE_MAX_LEVELS; ns *= A2L_TIMELINE_FANOUT) {
+        levels[h.num_levels++].bucket_ns = ns;
+        if (info->first_ts / ns == info->last_ts / ns || ns > UINT64_MAX / A2L_TIMELINE_FANOUT)
+            break;
+    }
+
+    for (uint32_t k = 0; k < h.num_levels; k++) {
+        char scratch_path[4096 + 16];
+
+        if (a2l__timeline_init(&levels[k], 256) < 0) {
+            a2l__timeline_fail(error, error_len, "out of memory");
+            goto out;
+        }
+        // next to the timeline, gone once closed
+        snprintf(scratch_path, sizeof(scratch_path), "%s.%ub.tmp", path, k);
+        levels[k].buckets = fopen(scratch_path, "w+b");
+        unlink(scratch_path);
+        snprintf(scratch_path, sizeof(scratch_path), "%s.%us.tmp", path, k);
+        levels[k].sites = fopen(scratch_path, "w+b");
+        unlink(scratch_path);
+        if (!levels[k].buckets || !levels[k].sites) {
+            a2l__timeline_fail(error, error_len, "can't create %s: %s", scratch_path, strerror(errno));
+            goto out;
+        }
+    }
+
+    if (!(m = a2l_merge_open(&r, 1)) || !(b = a2l_batch_alloc(A2L__TIMELINE_BATCH)) ||
+        a2l_read_start_heap(r, &heap) < 0) {
+        a2l__timeline_fail(error, error_len, "out of memory");
+        goto out;
+    }
+    // compacted segments left a heap the events kept don't know of
+    h.start_live = heap.bytes;
+    h.start_keyframe = heap.keyframe;
+    a2l_start_heap_free(&heap);
+
+    a2l__tlbuild_t *l0 = &levels[0];
+    int64_t live = heap.bytes;
+    while (a2l_merge_batch(m, b)) {
+        a2l_tlsite_t *site = NULL;
+
+        for (uint32_t i = 0; i < b->count; i++) {
+            uint64_t index = b->ts[i] / h.base_ns;
+
+            if (!l0->open || l0->b.index != index) {
+                if (l0->open &&
+                    a2l__timeline_flush(levels, 0, h.num_levels, top_sites, &scratch, &scratch_size) < 0)
+                    goto failed;
+                memset(&l0->b, 0, sizeof(l0->b));
+                l0->b.index = index;
+                l0->b.live_min = l0->b.live_max = live;
+                l0->open = 1;
+                site = NULL;
+            }
+
+            uint32_t id = b->type[i] == A2L_REC_ALLOC ? b->stack_id[i] : b->alloc_stack_id[i];
+            // runs of one site are common
+            if (!site || site->stack_id != id) {
+                if (!(site = a2l__timeline_sum(l0, id)))
+                    goto failed;
+            }
+            if (b->type[i] == A2L_REC_ALLOC) {
+                l0->b.allocs++;
+                l0->b.bytes_alloced += b->bytes[i];
+                site->allocs++;
+                site->bytes_alloced += b->bytes[i];
+                live += (int64_t)b->bytes[i];
+            } else {
+                l0->b.frees++;
+                l0->b.bytes_freed += b->bytes[i];
+                site->bytes_freed += b->bytes[i];
+                live -= (int64_t)b->bytes[i];
+            }
+            l0->b.live = live;
+            if (live < l0->b.live_min)
+                l0->b.live_min = live;
+            if (live > l0->b.live_max)
+                l0->b.live_max = live;
+        }
+    }
+    for (uint32_t k = 0; k < h.num_levels; k++) {
+        if (levels[k].open &&
+            a2l__timeline_flush(levels, k, h.num_levels, top_sites, &scratch, &scratch_size) < 0)
+            goto failed;
+    }
+
+    uint64_t offset = h.levels_offset + h.num_levels * sizeof(a2l_tllevel_t);
+    for (uint32_t k = 0; k < h.num_levels; k++) {
+        memset(&out[k], 0, sizeof(out[k]));
+        out[k].bucket_ns = levels[k].bucket_ns;
+        out[k].num_buckets = levels[k].num_buckets;
+        out[k].buckets_offset = offset;
+        offset += levels[k].num_buckets * sizeof(a2l_tlbucket_t);
+    }
+    for (uint32_t k = 0; k < h.num_levels; k++) {
+        out[k].num_sites = levels[k].num_sites;
+        out[k].sites_offset = offset;
+        offset += levels[k].num_sites * sizeof(a2l_tlsite_t);
+    }
+
+    // written aside, then renamed over, as indexes are
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if (!(f = fopen(tmp, "wb"))) {
+        a2l__timeline_fail(error, error_len, "can't create %s: %s", tmp, strerror(errno));
+        goto out;
+    }
+    int bad = fwrite(&h, sizeof(h), 1, f) != 1 ||
+              fwrite(out, sizeof(a2l_tllevel_t), h.num_levels, f) != h.num_levels;
+    for (uint32_t k = 0; !bad && k < h.num_levels; k++)
+        bad = a2l__timeline_copy(f, levels[k].buckets) < 0;
+    for (uint32_t k = 0; !bad && k < h.num_levels; k++)
+        bad = a2l__timeline_copy(f, levels[k].sites) < 0;
+    if (fclose(f) != 0 || bad) {
+        f = NULL;
+        unlink(tmp);
+        a2l__timeline_fail(error, error_len, "can't write %s: %s", tmp, strerror(errno));
+        goto out;
+    }
+    f = NULL;
+    if (rename(tmp, path) < 0) {
+        unlink(tmp);
+        a2l__timeline_fail(error, error_len, "can't rename %s: %s", tmp, strerror(errno));
+        goto out;
+    }
+    ret = 0;
+    goto out;
+
+failed:
+    a2l__timeline_fail(error, error_len, "out of memory, or can't write scratch files: %s", strerror(errno));
+out:
+    if (f)
+        fclose(f);
+    for (uint32_t k = 0; k < h.num_levels; k++) {
+        free(levels[k].slots);
+        free(levels[k].used);
+        if (levels[k].buckets)
+            fclose(levels[k].buckets);
+        if (levels[k].sites)
+            fclose(levels[k].sites);
+    }
+    a2l_start_heap_free(&heap);
+    a2l_batch_free(b);
+    if (m)
+        a2l_merge_close(m);
+    free(scratch);
+    return ret;
+}
+
+a2l_timeline_t *
+a2l_timeline_open(const a2l_reader_t *r, const char *path, char *error, size_t error_len) {
+    const a2l_readinfo_t *info = a2l_read_info(r);
+    struct stat st;
+    a2l_timeline_t *tl;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        a2l__timeline_fail(error, error_len, "can't open %s: %s", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+    if ((size_t)st.st_size < sizeof(a2l_tlheader_t)) {
+        close(fd);
+        a2l__timeline_fail(error, error_len, "%s: not a timeline", path);
+        return NULL;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        a2l__timeline_fail(error, error_len, "can't map %s: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    const a2l_tlheader_t *h = map;
+    const char *problem = NULL;
+    // the version first: an older one's header may be another size
+    if (h->magic != A2L_TIMELINE_MAGIC)
+        problem = "not a timeline";
+    else if (h->version != A2L_TIMELINE_VERSION)
+        problem = "timeline is from another version; rebuild it";
+    else if (h->header_bytes != sizeof(a2l_tlheader_t))
+        problem = "not a timeline";
+    else if (!h->num_levels || h->num_levels > A2L_TIMELINE_MAX_LEVELS ||
+             h->levels_offset + h->num_levels * sizeof(a2l_tllevel_t) > (uint64_t)st.st_size)
+        problem = "timeline is truncated";
+    else if (h->num_blocks != info->num_blocks || h->num_events != info->num_events)
+        problem = "timeline is stale: the trace has changed since; rebuild it";
+    for (uint32_t k = 0; !problem && k < h->num_levels; k++) {
+        const a2l_tllevel_t *l = (const a2l_tllevel_t *)((const uint8_t *)map + h->levels_offset) + k;
+        if (l->buckets_offset + l->num_buckets * sizeof(a2l_tlbucket_t) > (uint64_t)st.st_size ||
+            l->sites_offset + l->num_sites * sizeof(a2l_tlsite_t) > (uint64_t)st.st_size || !l->bucket_ns)
+            problem = "timeline is truncated";
+    }
+    if (problem || !(tl = calloc(1, sizeof(a2l_timeline_t)))) {
+        munmap(map, st.st_size);
+        a2l__timeline_fail(error, error_len, "%s: %s", path, problem ? problem : "out of memory");
+        return NULL;
+    }
+
+    tl->map = map;
+    tl->size = st.st_size;
+    tl->header = h;
+    tl->levels = (const a2l_tllevel_t *)(tl->map + h->levels_offset);
+    return tl;
+}
+
+void
+a2l_timeline_close(a2l_timeline_t *tl) {
+    if (!tl)
+        return;
+    munmap((void *)tl->map, tl->size);
+    free(tl);
+}
+
+const a2l_tlheader_t *
+a2l_timeline_header(const a2l_timeline_t *tl) {
+    return tl->header;
+}
+
+const a2l_tllevel_t *
+a2l_timeline_level(const a2l_timeline_t *tl, uint32_t level) {
+    return &tl->levels[level];
+}
+
+uint32_t
+a2l_timeline_zoom(const a2l_timeline_t *tl, uint64_t from, uint64_t to, uint64_t points) {
+    uint32_t k = 0;
+
+    if (to <= from)
+        to = from + 1;
+    // bucket widths, not stored buckets: a sparse stretch keeps its scale
+    while (k + 1 < tl->header->num_levels &&
+           (to - 1) / tl->levels[k].bucket_ns - from / tl->levels[k].bucket_ns + 1 > points)
+        k++;
+    return k;
+}
+
+// the first of n buckets at or after index
+static uint64_t
+a2l__timeline_find(const a2l_tlbucket_t *buckets, uint64_t n, uint64_t index) {
+    uint64_t lo = 0, hi = n;
+
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (buckets[mid].index < index)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+const a2l_tlbucket_t *
+a2l_timeline_buckets(const a2l_timeline_t *tl, uint32_t level, uint64_t from, uint64_t to, uint64_t *count) {
+    const a2l_tllevel_t *l = &tl->levels[level];
+    const a2l_tlbucket_t *buckets = (const a2l_tlbucket_t *)(tl->map + l->buckets_offset);
+    uint64_t first = a2l__timeline_find(buckets, l->num_buckets, from / l->bucket_ns);
+    uint64_t end = to > from ? a2l__timeline_find(buckets, l->num_buckets, (to - 1) / l->bucket_ns + 1) : first;
+
+    *count = end - first;
+    return buckets + first;
+}
+
+const a2l_tlsite_t *
+a2l_timeline_sites(const a2l_timeline_t *tl, uint32_t level, const a2l_tlbucket_t *b) {
+    return (const a2l_tlsite_t *)(tl->map + tl->levels[level].sites_offset) + b->first_site;
+}
@@ -0,0 +1,111 @@
+// a2ltl.h -- multi-resolution timeline of a binary trace, built
+// by a2l-timeline.
+//
+// <trace>.tl sums the trace into time buckets at several widths, so a
+// view of any stretch of it, at any zoom, reads a few hundred buckets
+// instead of the events.  level 0's buckets are base_ns wide (1 ms by
+// default), and each level's are A2L_TIMELINE_FANOUT times wider than
+// the one below, up to one that holds the whole trace.  buckets count
+// from ts 0, so each one nests exactly in one of the level above.
+//
+//   a2l_tlheader_t
+//   a2l_tllevel_t  [num_levels]
+//   per level:  a2l_tlbucket_t [num_buckets]   by index, empty ones left out
+//   per level:  a2l_tlsite_t   [num_sites]     each bucket's top sites
+//
+// a bucket has its allocs and frees, the live bytes when it ends and
+// the least and most there were during it, and its top_sites sites by
+// bytes allocated in it.  live bytes are what the trace's own events
+// add up to, in time order across threads: allocs less tracked frees,
+// from the heap there was at the first event.  that's none, unless
+// segments were compacted: then it's the heap they left, rebuilt from
+// the first whole keyframe kept (a2l_read_start_heap), and start_live
+// says how much.  a free counts against the site that made its block.
+//
+// like an index, a timeline is for the trace as it was: one whose
+// block or event count has changed since won't open.
+//
+// everything is little-endian.
+
+#ifndef A2L__TL_H
+#define A2L__TL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "a2lread.h"
+
+#define A2L_TIMELINE_MAGIC     0x544c3241  // 'A2LT'
+#define A2L_TIMELINE_VERSION   2
+#define A2L_TIMELINE_PATH_FMT  "%s.tl"
+#define A2L_TIMELINE_FANOUT    10
+#define A2L_TIMELINE_MAX_LEVELS 24
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_bytes;          // sizeof(a2l_tlheader_t)
+    uint32_t pid;
+    uint32_t num_levels;
+    uint64_t num_blocks;            // the trace's, to tell if it's stale
+    uint64_t num_events;
+    uint64_t start_realtime_ns;     // CLOCK_REALTIME at ts 0
+    uint64_t first_ts, last_ts;
+    int64_t start_live;             // at first_ts: the heap compaction left
+    int64_t start_keyframe;         // it was rebuilt from; -1 if none
+    uint64_t base_ns;               // level 0's bucket width
+    uint32_t top_sites;             // kept per bucket, at most
+    uint32_t _pad;
+    uint64_t levels_offset;
+}a2l_tlheader_t;
+
+typedef struct {
+    uint64_t bucket_ns;
+    uint64_t num_buckets;
+    uint64_t buckets_offset;
+    uint64_t num_sites;
+    uint64_t sites_offset;
+}a2l_tllevel_t;
+
+typedef struct {
+    uint64_t index;                 // ts / bucket_ns
+    uint64_t allocs, frees;
+    uint64_t bytes_alloced, bytes_freed;
+    int64_t live;                   // at its end
+    int64_t live_min, live_max;     // during it, its start included
+    uint64_t first_site;            // in its level's sites
+    uint32_t num_sites;
+    uint32_t _pad;
+}a2l_tlbucket_t;
+
+typedef struct {
+    uint32_t stack_id;
+    uint32_t _pad;
+    uint64_t allocs;
+    uint64_t bytes_alloced, bytes_freed;
+}a2l_tlsite_t;
+
+typedef struct a2l_timeline a2l_timeline_t;
+
+// one pass over r in time order, into path.  -1 on failure, with the
+// reason in error.
+int a2l_timeline_build(a2l_reader_t *r, const char *path, uint64_t base_ns, uint32_t top_sites,
+                       char *error, size_t error_len);
+
+// NULL on failure, with the reason in error
+a2l_timeline_t *a2l_timeline_open(const a2l_reader_t *r, const char *path, char *error, size_t error_len);
+void a2l_timeline_close(a2l_timeline_t *tl);
+const a2l_tlheader_t *a2l_timeline_header(const a2l_timeline_t *tl);
+const a2l_tllevel_t *a2l_timeline_level(const a2l_timeline_t *tl, uint32_t level);
+
+// the finest level that covers [from, to) in at most points buckets,
+// else the coarsest
+uint32_t a2l_timeline_zoom(const a2l_timeline_t *tl, uint64_t from, uint64_t to, uint64_t points);
+// the level's buckets that overlap [from, to): the first, and how many
+// in *count
+const a2l_tlbucket_t *a2l_timeline_buckets(const a2l_timeline_t *tl, uint32_t level,
+                                           uint64_t from, uint64_t to, uint64_t *count);
+// a bucket's top sites, by bytes allocated
+const a2l_tlsite_t *a2l_timeline_sites(const a2l_timeline_t *tl, uint32_t level, const a2l_tlbucket_t *b);
+
+#endif
@@ -0,0 +1,308 @@
+#define _GNU_SOURCE
+// a2l-top -- live view of a process running under alloc2log.so
+//
+// usage: a2l-top [-d seconds] [-n iterations] [-s sites] <pid>
+//
+// maps the process' /a2l-<pid> shared memory statistics region and
+// redraws rates from successive snapshots.  no log file is read.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+
+#include "a2lstats.h"
+
+#define A2L_TOP_MAX_THREAD_ROWS 8
+
+typedef struct {
+    int index;
+    double rate;
+}a2l_toprow_t;
+
+static volatile sig_atomic_t a2l__top_quit = 0;
+
+static void
+a2l_top_on_signal(int sig) {
+    (void)sig;
+    a2l__top_quit = 1;
+}
+
+static double
+a2l_top_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// human readable byte count into buf
+static const char *
+a2l_top_bytes(char *buf, size_t len, double bytes) {
+    const char *units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    int unit = 0;
+
+    while ((bytes >= 1024.0 || bytes <= -1024.0) && unit < 4) {
+        bytes /= 1024.0;
+        unit++;
+    }
+    snprintf(buf, len, unit ? "%.1f %s" : "%.0f %s", bytes, units[unit]);
+    return buf;
+}
+
+static int
+a2l_top_cmp_rows(const void *a, const void *b) {
+    const a2l_toprow_t *ra = a, *rb = b;
+    if (ra->rate < rb->rate) return 1;
+    if (ra->rate > rb->rate) return -1;
+    return ra->index - rb->index;
+}
+
+static void
+a2l_top_usage(void) {
+    fprintf(stderr, "usage: a2l-top [-d seconds] [-n iterations] [-s sites] <pid>\n");
+}
+
+static void
+a2l_top_draw(const a2l_stats_t *cur, const a2l_stats_t *prev, double dt,
+             int max_sites, a2l_toprow_t *rows) {
+    char b0[32], b1[32], b2[32];
+    a2l_stats_counters_t total = {0}, total_prev = {0};
+    uint32_t num_threads = cur->num_threads < A2L_STATS_MAX_THREADS ?
+        cur->num_threads : A2L_STATS_MAX_THREADS;
+
+    for (uint32_t i = 0; i < num_threads; i++) {
+        const a2l_stats_counters_t *c = &cur->threads[i].counters;
+        const a2l_stats_counters_t *p = &prev->threads[i].counters;
+        total.allocs += c->allocs;        total_prev.allocs += p->allocs;
+        total.frees += c->frees;          total_prev.frees += p->frees;
+        total.bytes_alloced += c->bytes_alloced;
+        total_prev.bytes_alloced += p->bytes_alloced;
+    }
+
+    // home, clear
+    printf("\033[H\033[2J");
+    printf("a2l-top  pid %u  threads %u  sites dropped %" PRIu64 "\n\n",
+           cur->pid, cur->num_threads, cur->sites_dropped);
+    printf("live %s   peak %s\n",
+           a2l_top_bytes(b0, sizeof(b0), (double)cur->live_bytes),
+           a2l_top_bytes(b1, sizeof(b1), (double)cur->peak_live_bytes));
+    printf("allocs/s %.0f   frees/s %.0f   bytes/s %s\n",
+           (total.allocs - total_prev.allocs) / dt,
+           (total.frees - total_prev.frees) / dt,
+           a2l_top_bytes(b2, sizeof(b2), (total.bytes_alloced - total_prev.bytes_alloced) / dt));
+    printf("total allocs %" PRIu64 "   frees %" PRIu64 "\n",
+           total.allocs, total.frees);
+
+    // alloc2log's own cost over the interval, mean cycles per call
+    static const char *stage_names[] = A2L_STAGE_NAMES;
+    uint64_t stage_count[A2L_STAGE_COUNT] = {0}, stage_cycles[A2L_STAGE_COUNT] = {0};
+    for (uint32_t i = 0; i < num_threads; i++) {
+        for (int s = 0; s < A2L_STAGE_COUNT; s++) {
+            stage_count[s] += cur->threads[i].stages[s].count - prev->threads[i].stages[s].count;
+            stage_cycles[s] += cur->threads[i].stages[s].cycles - prev->threads[i].stages[s].cycles;
+        }
+    }
+
+    uint64_t elapsed_cycles = a2l_cycles() - cur->start_cycles;
+    double ns_per_cycle = elapsed_cycles ?
+        (double)(a2l_clock_ns() - cur->start_ns) / (double)elapsed_cycles : 1.0;
+    printf("hook cost %.1f%% of a core, cycles/call:",
+           100.0 * (double)stage_cycles[A2L_STAGE_WRAPPER] * ns_per_cycle / (dt * 1e9));
+    for (int s = 0; s < A2L_STAGE_COUNT; s++)
+        printf(" %s %.0f", stage_names[s],
+               stage_count[s] ? (double)stage_cycles[s] / (double)stage_count[s] : 0.0);
+    printf("\n");
+
+    // alloc2log's own memory
+    static const char *mem_names[] = A2L_MEM_NAMES;
+    const a2l_stats_mem_t *mem = &cur->mem;
+    printf("a2l mem %s", a2l_top_bytes(b0, sizeof(b0), (double)mem->total));
+    if (mem->budget)
+        printf(" of %s", a2l_top_bytes(b1, sizeof(b1), (double)mem->budget));
+    printf(" (");
+    for (int m = 0; m < A2L_MEM_COUNT; m++)
+        printf("%s%s %s", m ? ", " : "", mem_names[m],
+               a2l_top_bytes(b0, sizeof(b0), (double)mem->bytes[m]));
+    printf(")\n");
+    if (mem->degrade_level)
+        printf("degraded: level %u, sampling 1/%u, depth %u, "
+               "%" PRIu64 " evictions, %" PRIu64 " untracked\n",
+               mem->degrade_level, 1u << mem->sample_shift, mem->max_frames,
+               mem->stack_evictions, mem->allocs_untracked);
+    printf("\n");
+
+    // threads, busiest first
+    int num_rows = 0;
+    for (uint32_t i = 0; i < num_threads; i++) {
+        rows[num_rows].index = (int)i;
+        rows[num_rows].rate = (cur->threads[i].counters.allocs -
+                               prev->threads[i].counters.allocs) / dt;
+        num_rows++;
+    }
+    qsort(rows, num_rows, sizeof(a2l_toprow_t), a2l_top_cmp_rows);
+
+    printf("%8s %12s %12s %12s\n", "TID", "ALLOCS/S", "BYTES/S", "NET");
+    for (int r = 0; r < num_rows && r < A2L_TOP_MAX_THREAD_ROWS; r++) {
+        const a2l_stats_thread_t *t = &cur->threads[rows[r].index];
+        const a2l_stats_thread_t *tp = &prev->threads[rows[r].index];
+        int is_overflow = rows[r].index == A2L_STATS_SHARED_SLOT &&
+            cur->num_threads >= A2L_STATS_MAX_THREADS;
+
+        if (is_overflow)
+            printf("%8s ", "other");
+        else
+            printf("%8u ", t->tid);
+        printf("%12.0f %12s %12s\n", rows[r].rate,
+               a2l_top_bytes(b0, sizeof(b0),
+                             (t->counters.bytes_alloced - tp->counters.bytes_alloced) / dt),
+               a2l_top_bytes(b1, sizeof(b1),
+                             (double)t->counters.bytes_alloced - (double)t->counters.bytes_freed));
+    }
+    printf("\n");
+
+    // sites, by bytes/sec, then by live bytes
+    num_rows = 0;
+    for (int i = 0; i < A2L_STATS_MAX_SITES; i++) {
+        const a2l_stats_site_t *s = &cur->sites[i];
+        if (s->hash_id == 0)
+            continue;
+        double rate = (s->counters.bytes_alloced - prev->sites[i].counters.bytes_alloced) / dt;
+        double live = (double)s->counters.bytes_alloced - (double)s->counters.bytes_freed;
+
+        rows[num_rows].index = i;
+        // idle sites sort after active ones, by live bytes
+        rows[num_rows].rate = rate > 0 ? rate + 1e18 : live;
+        num_rows++;
+    }
+    qsort(rows, num_rows, sizeof(a2l_toprow_t), a2l_top_cmp_rows);
+
+    printf("%10s %10s %12s %12s  %s\n", "HASH_ID", "ALLOCS/S", "BYTES/S", "LIVE", "SITE");
+    for (int r = 0; r < num_rows && r < max_sites; r++) {
+        const a2l_stats_site_t *s = &cur->sites[rows[r].index];
+        const a2l_stats_site_t *sp = &prev->sites[rows[r].index];
+
+        printf("%10u %10.0f %12s %12s  %s\n", s->hash_id,
+               (s->counters.allocs - sp->counters.allocs) / dt,
+               a2l_top_bytes(b0, sizeof(b0),
+                             (s->counters.bytes_alloced - sp->counters.bytes_alloced) / dt),
+               a2l_top_bytes(b1, sizeof(b1),
+                             (double)s->counters.bytes_alloced - (double)s->counters.bytes_freed),
+               s->label_ready == 1 ? s->label : "?");
+    }
+
+    fflush(stdout);
+}
+
+int
+main(int argc, char **argv) {
+    double delay = 1.0;
+    long iterations = -1;
+    int max_sites = -1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:n:s:h")) != -1) {
+        switch (opt) {
+        case 'd': delay = atof(optarg); break;
+        case 'n': iterations = atol(optarg); break;
+        case 's': max_sites = atoi(optarg); break;
+        default:
+            a2l_top_usage();
+            return 1;
+        }
+    }
+
+    if (optind >= argc || delay <= 0.0) {
+        a2l_top_usage();
+        return 1;
+    }
+
+    int pid = atoi(argv[optind]);
+    char shm_name[32];
+    snprintf(shm_name, sizeof(shm_name), A2L_STATS_SHM_NAME_FMT, pid);
+
+    int fd = shm_open(shm_name, O_RDONLY, 0);
+    if (fd == -1) {
+        fprintf(stderr, "a2l-top: can't open %s: %s\n"
+                "is pid %d running with LD_PRELOAD=alloc2log.so?\n",
+                shm_name, strerror(errno), pid);
+        return 1;
+    }
+
+    const a2l_stats_t *live = mmap(NULL, sizeof(a2l_stats_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (live == MAP_FAILED) {
+        fprintf(stderr, "a2l-top: can't map %s: %s\n", shm_name, strerror(errno));
+        return 1;
+    }
+
+    if (live->magic != A2L_STATS_MAGIC || live->version != A2L_STATS_VERSION) {
+        fprintf(stderr, "a2l-top: %s is not a version %d stats region\n",
+                shm_name, A2L_STATS_VERSION);
+        return 1;
+    }
+
+    if (max_sites < 0) {
+        struct winsize ws;
+        int rows = 40;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0)
+            rows = ws.ws_row;
+        max_sites = rows - 13 - A2L_TOP_MAX_THREAD_ROWS;
+        if (max_sites < 5)
+            max_sites = 5;
+    }
+
+    a2l_stats_t *cur = malloc(sizeof(a2l_stats_t));
+    a2l_stats_t *prev = malloc(sizeof(a2l_stats_t));
+    a2l_toprow_t *rows = malloc(sizeof(a2l_toprow_t) * A2L_STATS_MAX_SITES);
+    if (!cur || !prev || !rows) {
+        fprintf(stderr, "a2l-top: out of memory\n");
+        return 1;
+    }
+
+    signal(SIGINT, a2l_top_on_signal);
+    signal(SIGTERM, a2l_top_on_signal);
+
+    memcpy(prev, live, sizeof(a2l_stats_t));
+    double prev_time = a2l_top_now();
+
+    while (!a2l__top_quit && iterations != 0) {
+        struct timespec ts;
+        ts.tv_sec = (time_t)delay;
+        ts.tv_nsec = (long)((delay - (double)ts.tv_sec) * 1e9);
+        nanosleep(&ts, NULL);
+        if (a2l__top_quit)
+            break;
+
+        // the process unlinks its region at exit, but our mapping
+        // stays valid; stop once it's gone
+        if (kill(pid, 0) == -1 && errno == ESRCH) {
+            printf("\na2l-top: pid %d exited\n", pid);
+            break;
+        }
+
+        memcpy(cur, live, sizeof(a2l_stats_t));
+        double now = a2l_top_now();
+
+        a2l_top_draw(cur, prev, now - prev_time, max_sites, rows);
+
+        a2l_stats_t *tmp = prev;
+        prev = cur;
+        cur = tmp;
+        prev_time = now;
+
+        if (iterations > 0)
+            iterations--;
+    }
+
+    free(cur);
+    free(prev);
+    free(rows);
+    return 0;
+}
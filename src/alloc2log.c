@@ -12,6 +12,8 @@
 #include <fcntl.h>
 #include <inttypes.h>
 #include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 
 #define FTG_IMPLEMENT_CORE
 #include "3rdparty/ftg_core.h"
@@ -19,12 +21,37 @@
 #define FTG_IMPLEMENT_CONTAINERS
 #include "3rdparty/ftg_containers.h"
 
-#define A2L_TRACK_ALLOCS 0
+#include "a2lstats.h"
+#include "a2lformat.h"
+#include "a2llz.h"
+
+#define A2L_TRACK_ALLOCS 1
 
 #define MAX_FRAMES 32
 
+// frames 0 and 1 are a2l_log_frames and the wrapper itself
+#define A2L_SKIP_FRAMES 2
+
+#if defined(__x86_64__) || defined(__i386__)
+#  define A2L_CPU_RELAX() __builtin_ia32_pause()
+#else
+#  define A2L_CPU_RELAX()
+#endif
+
+#define A2L_ATOMIC_ADD(p, v) __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+#define A2L_ATOMIC_SUB(p, v) __atomic_fetch_sub((p), (v), __ATOMIC_RELAXED)
+
 // unity build -- dlsym calls malloc if .so is not compiled and linked in one stage
+#include "memaccount.c"
 #include "trackallocs.c"
+#include "shmstats.c"
+#include "selfprof.c"
+#include "stacktable.c"
+#include "capbuf.c"
+#include "binlog.c"
+#include "background.c"
+#include "keyframe.c"
+#include "retention.c"
 
 
 typedef struct{
@@ -58,13 +85,16 @@ a2l_real_t a2l_real;
 #define TAB4 TAB TAB TAB TAB
 
 static int a2l__initialized = 0;
+static int a2l__initializing = 0;
+static int a2l__init_steps = 0;     // of a2l_initialize's, finished
 static int a2l__fd = -1;
 #define A2L_ENSURE_INITIALIZED \
-    if (!a2l__initialized) { a2l_initialize(); }
+    if (!__atomic_load_n(&a2l__initialized, __ATOMIC_ACQUIRE)) { a2l_initialize(); }
 
-// toggle malloc logging.
-// fixme: create a mutex for this
-int a2l__malloc_logging = 1;
+// toggle malloc logging.  per thread: a2l's own allocations are
+// skipped without hiding other threads' calls made meanwhile.
+__thread int a2l__malloc_logging
+    __attribute__((tls_model("initial-exec"))) = 1;
 void a2l__enable_malloc_logging(void) {
     a2l__malloc_logging = 1;
 }
@@ -88,13 +118,40 @@ void a2l_logstr(const char *msg) {
     FTG_UNUSED(len);
 }
 
+// A2L_FORMAT=binary writes the block format in a2lformat.h
+static int a2l__binary = 0;
+
+// a fork child of a process part way through a2l_initialize has lost
+// the thread doing it.  let the next hook call go on from the last
+// step that thread finished.
+static void
+a2l__initialize_atfork_child(void) {
+    if (!__atomic_load_n(&a2l__initialized, __ATOMIC_ACQUIRE))
+        __atomic_store_n(&a2l__initializing, 0, __ATOMIC_RELEASE);
+}
+
 static void
 a2l_initialize(void) {
+    static __thread int initializing_here __attribute__((tls_model("initial-exec")));
     char *logfile = getenv("A2L_LOGFILE");
+    char *format = getenv("A2L_FORMAT");
     char default_logfile[256];
 
+    // the first thread in initializes, any others wait for it.  the
+    // initializing thread itself comes back here through free().
+    if (initializing_here)
+        return;
+    if (__atomic_exchange_n(&a2l__initializing, 1, __ATOMIC_ACQUIRE)) {
+        while (!__atomic_load_n(&a2l__initialized, __ATOMIC_ACQUIRE))
+            A2L_CPU_RELAX();
+        return;
+    }
+    initializing_here = 1;
+
+    a2l__binary = format && strcmp(format, "binary") == 0;
+
     if (logfile == NULL) {
-        sprintf(default_logfile, "a2l-%d.log", getpid());
+        sprintf(default_logfile, a2l__binary ? "a2l-%d.a2l" : "a2l-%d.log", getpid());
         logfile = default_logfile;
     }
 
@@ -113,40 +170,119 @@ a2l_initialize(void) {
     A2L_LOG('i');
 
 #undef A2L_MAPSYM
-#if A2L_TRACK_ALLOCS
+    // each step once, even across a fork.  only a fork before the
+    // handler is in, while the symbols are looked up, still loses init.
     a2l__disable_malloc_logging();
-    a2l_track_allocs_init();
-    a2l__enable_malloc_logging();
+    if (a2l__init_steps < 1) {
+        pthread_atfork(NULL, NULL, a2l__initialize_atfork_child);
+        a2l_mem_init();
+        a2l__init_steps = 1;
+    }
+    if (a2l__init_steps < 2) {
+        a2l_stats_init();
+        a2l__init_steps = 2;
+    }
+    if (a2l__init_steps < 3) {
+#if A2L_TRACK_ALLOCS
+        a2l_track_allocs_init();
 #endif
+        a2l_stacktable_init();
+        a2l_selfprof_init();
+        a2l__init_steps = 3;
+    }
+    a2l__enable_malloc_logging();
 
     A2L_LOG('i');
 
-    a2l__initialized = 1;
-    a2l__fd = open(default_logfile, O_CREAT|O_WRONLY, S_IRUSR|S_IWUSR);
+    a2l__disable_malloc_logging();
+    if (a2l__init_steps < 4) {
+        if (a2l__binary)
+            a2l_binlog_init(logfile, logfile != default_logfile);
+        else
+            a2l__fd = open(logfile, O_CREAT|O_TRUNC|O_WRONLY, S_IRUSR|S_IWUSR);
+        a2l__init_steps = 4;
+    }
+    if (a2l__init_steps < 5) {
+        a2l_capbuf_init(a2l__fd, a2l__binary);
+        a2l__init_steps = 5;
+    }
+    a2l__enable_malloc_logging();
+
+    __atomic_store_n(&a2l__initialized, 1, __ATOMIC_RELEASE);
+    initializing_here = 0;
 
     A2L_LOG('i');
 }
 
-void
-a2l_log_frames(const char *calling_func, ssize_t alloc_bytes, const void *ptr) {
+__attribute__((destructor)) static void
+a2l_shutdown(void) {
+    a2l_capbuf_shutdown();
+    a2l_binlog_shutdown();
+    a2l_selfprof_report();
+    a2l_stats_shutdown();
+}
+
+// log the call and its stack, and count and track a new block.
+// returns the stack hash_id, which identifies the calling site.  for
+// a free, freed is the block's record if it was tracked, and ts when
+// it left the live map, or 0.
+uint32_t
+a2l_log_frames(const char *calling_func, ssize_t alloc_bytes, const void *ptr,
+               const a2l_allocrecord_t *freed, uint64_t ts) {
     void *bt_buf[MAX_FRAMES];
+    a2l_stagelaps_t laps;
+
+    // safe point for degrading under the memory budget: no locks held
+    a2l_mem_relieve();
+
+    a2l_stagelaps_start(&laps);
 
     A2L_LOG('l');
     a2l__disable_malloc_logging();
-    int trace_frames = backtrace(bt_buf, MAX_FRAMES);
-    char **trace_frames_desc = backtrace_symbols(bt_buf, trace_frames);
+    int trace_frames = backtrace(bt_buf, a2l__mem->max_frames);
     a2l__enable_malloc_logging();
+    a2l_stagelaps_lap(&laps, A2L_STAGE_UNWIND);
+
+    void **caller_frames = &bt_buf[A2L_SKIP_FRAMES];
+    int num_caller_frames = trace_frames > A2L_SKIP_FRAMES ? trace_frames - A2L_SKIP_FRAMES : 0;
+
+    // derive hash from the caller's return addresses, so the same
+    // call site always gets the same hash_id
+    uint32_t hash_id = 0;
+    if (num_caller_frames)
+        hash_id = ftg_hash_fast(caller_frames, num_caller_frames * sizeof(void*));
+    a2l_stagelaps_lap(&laps, A2L_STAGE_HASH);
+
+    // a binary event is stamped under the live map's lock, so
+    // keyframes know which side of their copy it fell on
+    if (strcmp(calling_func, "free") != 0) {
+        a2l_stats_alloc(hash_id, alloc_bytes);
+#if A2L_TRACK_ALLOCS
+        a2l_track_alloc((void *)ptr, alloc_bytes, hash_id, a2l__binary ? &ts : NULL);
+#endif
+        a2l_stagelaps_lap(&laps, A2L_STAGE_TRACK);
+    }
 
     A2L_LOG('l');
 
+    if (a2l__binary) {
+        a2l_binlog_event(strcmp(calling_func, "free") != 0, ptr, alloc_bytes, hash_id,
+                         caller_frames, num_caller_frames, freed, ts, &laps);
+        a2l_stagelaps_commit(&laps);
+        return hash_id;
+    }
+
 
 #define BUF_MAXLEN 8192
-    char buf[BUF_MAXLEN];
+    char stack_buf[BUF_MAXLEN];
+
+    // since our .so can't use buffered io, records are formatted
+    // into the thread's capture buffer, or stack space without one.
+    a2l_capbuf_t *capbuf = a2l_capbuf_acquire(BUF_MAXLEN);
+    char *buf = capbuf ? capbuf->base + capbuf->used : stack_buf;
     char *p_end = &buf[BUF_MAXLEN-1];
     char *p_buf = &buf[0];
-
-    // since our .so can't use buffered io, this function uses
-    // stack space to buffer the structured log.
+    a2l_stagelaps_lap(&laps, A2L_STAGE_WRITE);
 
 #if 0
 #define A2L_SPRINTF(MSG, ...)                       \
@@ -164,13 +300,7 @@ a2l_log_frames(const char *calling_func, ssize_t alloc_bytes, const void *ptr) {
 
     A2L_LOG('a');
 
-    // derive hash from trace frames
-    void *hash_beg = &trace_frames_desc[0];
-    void *hash_end = &trace_frames_desc[trace_frames-1];
-    uint32_t hash_id = ftg_hash_fast(hash_beg, hash_end - hash_beg);
-
-    //pthread_t thread_id = pthread_self();
-    pthread_t thread_id = 0;
+    size_t thread_id = a2l_gettid();
 
     A2L_SPRINTF(TAB  "{\n" TAB2 "call: '%s',\n", calling_func);
     A2L_SPRINTF(TAB2 "bytes: %" FTG_SPEC_SSIZE_T ",\n", alloc_bytes);
@@ -184,56 +314,91 @@ a2l_log_frames(const char *calling_func, ssize_t alloc_bytes, const void *ptr) {
         A2L_LOG('c');
     }
     A2L_SPRINTF(TAB2 "stack: [\n");
-
-    for (int i = 2; i < trace_frames; i++) {
-        // format:
-        ///home/mlabbe/dev/alloc2log/bin/linux/alloc2log.so(malloc+0x4d) [0x7f8eef1c8ba8]
-
-        a2l_parsedframe_t sf;
-        char *p = trace_frames_desc[i];
-
-        //int result = write(1, trace_frames_desc[i], strlen(trace_frames_desc[i]));
-        //FTG_UNUSED(result);
-
-        sf.bin = p;
-        while (*p != '(') p++;
-        sf.bin_end = p;
-
-        sf.func = p+1;
-        while (*p != '+' && *p != ')') p++;
-        sf.func_end = p;
-
-        sf.offset = p+1;
-        while (*p != ')') p++;
-        sf.offset_end = p;
-
-        while (*p != '[') p++;
-        sf.addr = p+1;
-        while (*p != ']') p++;
-        sf.addr_end = p;
-
-        A2L_SPRINTF(TAB3 "{");
-        A2L_SPRINTF_STACKFRAME(func, ',');
-        A2L_SPRINTF_STACKFRAME(bin, ',');
-        A2L_SPRINTF_STACKFRAME(addr, ',');
-        A2L_SPRINTF_STACKFRAME(offset, ' ');
-        A2L_SPRINTF(TAB3 "}%c\n", i==trace_frames-1?' ':',');
-
-        A2L_LOG('.');
+    a2l_stagelaps_lap(&laps, A2L_STAGE_FORMAT);
+
+    // the formatted frames come from the stack table when this stack
+    // has been seen before
+    char *stack_text = p_buf;
+    int stack_len = a2l_stacktable_get(hash_id, caller_frames, num_caller_frames,
+                                       p_buf, p_end - p_buf);
+    if (stack_len >= 0) {
+        p_buf += stack_len;
+        a2l_stagelaps_lap(&laps, A2L_STAGE_SYMBOLIZE);
+    } else {
+        a2l__disable_malloc_logging();
+        char **trace_frames_desc = backtrace_symbols(bt_buf, trace_frames);
+        a2l__enable_malloc_logging();
+
+        if (num_caller_frames && strcmp(calling_func, "free") != 0)
+            a2l_stats_label_site(hash_id, trace_frames_desc[A2L_SKIP_FRAMES]);
+        a2l_stagelaps_lap(&laps, A2L_STAGE_SYMBOLIZE);
+
+        for (int i = A2L_SKIP_FRAMES; i < trace_frames; i++) {
+            // format:
+            ///home/mlabbe/dev/alloc2log/bin/linux/alloc2log.so(malloc+0x4d) [0x7f8eef1c8ba8]
+
+            a2l_parsedframe_t sf;
+            char *p = trace_frames_desc[i];
+
+            //int result = write(1, trace_frames_desc[i], strlen(trace_frames_desc[i]));
+            //FTG_UNUSED(result);
+
+            sf.bin = p;
+            while (*p != '(') p++;
+            sf.bin_end = p;
+
+            sf.func = p+1;
+            while (*p != '+' && *p != ')') p++;
+            sf.func_end = p;
+
+            sf.offset = p+1;
+            while (*p != ')') p++;
+            sf.offset_end = p;
+
+            while (*p != '[') p++;
+            sf.addr = p+1;
+            while (*p != ']') p++;
+            sf.addr_end = p;
+
+            A2L_SPRINTF(TAB3 "{");
+            A2L_SPRINTF_STACKFRAME(func, ',');
+            A2L_SPRINTF_STACKFRAME(bin, ',');
+            A2L_SPRINTF_STACKFRAME(addr, ',');
+            A2L_SPRINTF_STACKFRAME(offset, ' ');
+            A2L_SPRINTF(TAB3 "}%c\n", i==trace_frames-1?' ':',');
+
+            A2L_LOG('.');
+        }
+        a2l_stagelaps_lap(&laps, A2L_STAGE_FORMAT);
+
+        a2l_stacktable_put(hash_id, caller_frames, num_caller_frames,
+                           stack_text, p_buf - stack_text);
+
+        a2l__disable_malloc_logging();
+        free(trace_frames_desc);
+        a2l__enable_malloc_logging();
+        a2l_stagelaps_lap(&laps, A2L_STAGE_SYMBOLIZE);
     }
 
     A2L_LOG('d');
 
     A2L_SPRINTF(TAB2 "],\n");
     A2L_SPRINTF(TAB  "},\n");
+    a2l_stagelaps_lap(&laps, A2L_STAGE_FORMAT);
 
-    a2l_logstr(buf);
+    if (capbuf) {
+        a2l_capbuf_commit(capbuf, p_buf - buf);
+    } else {
+        *p_buf = '\0';
+        a2l_logstr(buf);
+    }
+    a2l_stagelaps_lap(&laps, A2L_STAGE_WRITE);
 
-    a2l__disable_malloc_logging();
-    free(trace_frames_desc);
-    a2l__enable_malloc_logging();
+    a2l_stagelaps_commit(&laps);
 
     A2L_LOG('x');
+
+    return hash_id;
 }
 
 
@@ -254,17 +419,23 @@ malloc(size_t size) {
 
     A2L_LOG('m');
 
+    uint64_t hook_start = a2l_cycles();
     void *ptr = a2l_real.malloc(size);
+    uint64_t real_cycles = a2l_cycles() - hook_start;
 
     A2L_LOG('m');
 
-    a2l_log_frames("malloc", size, ptr);
+    // under memory pressure only a sample of new blocks is followed,
+    // though a2l-top's rates still count them all
+    if (a2l_mem_sampled_out()) {
+        a2l_stats_alloc_sampled(size);
+        return ptr;
+    }
 
+    // counts and tracks the block too
+    a2l_log_frames("malloc", size, ptr, NULL, 0);
 
-    //todo: just log, don't do this
-#if A2L_TRACK_ALLOCS
-    a2l_track_alloc(ptr);
-#endif
+    a2l_stage_add(A2L_STAGE_WRAPPER, a2l_cycles() - hook_start - real_cycles);
 
     return ptr;
 }
@@ -290,7 +461,32 @@ void free(void *ptr) {
         return a2l_real.free(ptr);
     }
 
-    a2l_log_frames("free", 0, ptr);
+    uint64_t hook_start = a2l_cycles();
+    uint64_t lap = hook_start;
+
+    // untrack before the real free, or another thread could get ptr
+    // back from malloc while it is still in the map
+    a2l_allocrecord_t record;
+    int tracked = 0;
+    uint64_t ts = 0;
+#if A2L_TRACK_ALLOCS
+    tracked = a2l_track_free(ptr, &record, a2l__binary ? &ts : NULL);
+#endif
+
+    // while sampling, an unknown ptr is most likely a block that was
+    // sampled out; keep the log's malloc/free pairs consistent
+    if (!tracked && a2l__mem->sample_shift) {
+        a2l_stats_free(NULL);
+        a2l_real.free(ptr);
+        return;
+    }
+
+    a2l_stats_free(tracked ? &record : NULL);
+    a2l_stage_lap(A2L_STAGE_TRACK, &lap);
+
+    a2l_log_frames("free", 0, ptr, tracked ? &record : NULL, ts);
+
+    a2l_stage_add(A2L_STAGE_WRAPPER, a2l_cycles() - hook_start);
 
     a2l_real.free(ptr);
 }
@@ -0,0 +1,122 @@
+
+// alloc2log's background thread, for trace work too slow for a hook:
+// heap keyframes (keyframe.c) and segment compaction (retention.c).
+//
+// it starts the first time there's work, in each process, and sleeps
+// on a futex in between; a2l__background_kick() wakes it, and it
+// wakes by itself every A2L_BACKGROUND_POLL_MS for work that comes due
+// with time.  it never logs its own calls, and maps memory only
+// through memaccount.c.
+
+#define A2L_BACKGROUND_POLL_MS 1000
+#define A2L_NS_PER_SEC 1000000000ULL
+
+// linux futex ops, without <linux/futex.h>
+#define A2L_FUTEX_WAIT 0
+#define A2L_FUTEX_WAKE 1
+
+extern __thread int a2l__malloc_logging
+    __attribute__((tls_model("initial-exec")));
+
+static int a2l__background_wanted = 0;          // some job is configured
+static pid_t a2l__background_pid = 0;           // process it runs in
+static int a2l__background_stop = 0;
+static int a2l__background_busy = 0;
+static int a2l__background_wake = 0;            // futex: bumped per kick
+static __thread int a2l__background_on_thread
+    __attribute__((tls_model("initial-exec")));
+
+static void a2l__keyframe_pass(void);
+static void a2l__retention_pass(void);
+
+// 30s, 10m, 2h, 7d; plain numbers are seconds
+static uint64_t
+a2l__parse_seconds(const char *str) {
+    char *end;
+    uint64_t seconds = strtoull(str, &end, 10);
+
+    switch (*end) {
+    case 'd': case 'D': seconds *= 24; // fallthrough
+    case 'h': case 'H': seconds *= 60; // fallthrough
+    case 'm': case 'M': seconds *= 60;
+    }
+    return seconds;
+}
+
+// binlog.c: a trace was opened, in this process or a forked child,
+// which has no thread yet
+static void
+a2l__background_reset(void) {
+    a2l__background_stop = 0;
+    a2l__background_busy = 0;
+}
+
+// 1 if a job running on the thread should give up: it's stopping
+static inline int
+a2l__background_stopping(void) {
+    return a2l__background_on_thread &&
+           __atomic_load_n(&a2l__background_stop, __ATOMIC_ACQUIRE);
+}
+
+static void *
+a2l__background_main(void *arg) {
+    struct timespec poll = {A2L_BACKGROUND_POLL_MS / 1000,
+                            (A2L_BACKGROUND_POLL_MS % 1000) * 1000000L};
+
+    FTG_UNUSED(arg);
+    a2l__malloc_logging = 0;
+    a2l__background_on_thread = 1;
+
+    for (;;) {
+        // busy before stop, against a2l_background_shutdown()'s order
+        __atomic_store_n(&a2l__background_busy, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&a2l__background_stop, __ATOMIC_SEQ_CST))
+            break;
+        int wake = __atomic_load_n(&a2l__background_wake, __ATOMIC_ACQUIRE);
+        a2l__keyframe_pass();
+        a2l__retention_pass();
+        __atomic_store_n(&a2l__background_busy, 0, __ATOMIC_SEQ_CST);
+
+        syscall(SYS_futex, &a2l__background_wake, A2L_FUTEX_WAIT, wake, &poll, NULL, 0);
+    }
+
+    __atomic_store_n(&a2l__background_busy, 0, __ATOMIC_SEQ_CST);
+    return NULL;
+}
+
+// there's work: wake the thread, or start it in this process if it
+// isn't running.  no alloc2log locks held.
+static void
+a2l__background_kick(void) {
+    pid_t pid = getpid();
+    pthread_t thread;
+
+    if (!a2l__background_wanted)
+        return;
+
+    A2L_ATOMIC_ADD(&a2l__background_wake, 1);
+    if (__atomic_load_n(&a2l__background_pid, __ATOMIC_RELAXED) == pid ||
+        __atomic_exchange_n(&a2l__background_pid, pid, __ATOMIC_ACQ_REL) == pid) {
+        syscall(SYS_futex, &a2l__background_wake, A2L_FUTEX_WAKE, 1, NULL, NULL, 0);
+        return;
+    }
+
+    // pthread_create allocates; that's not the program's doing
+    int logging = a2l__malloc_logging;
+    a2l__malloc_logging = 0;
+    if (pthread_create(&thread, NULL, a2l__background_main, NULL) == 0)
+        pthread_detach(thread);
+    a2l__malloc_logging = logging;
+}
+
+// at exit: stop the thread between blocks.  a job it was part way
+// through is dropped.
+static void
+a2l_background_shutdown(void) {
+    struct timespec wait = {0, 1000000};
+
+    __atomic_store_n(&a2l__background_stop, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&a2l__background_pid, __ATOMIC_RELAXED) == getpid())
+        while (__atomic_load_n(&a2l__background_busy, __ATOMIC_SEQ_CST))
+            nanosleep(&wait, NULL);
+}
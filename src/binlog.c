@@ -0,0 +1,716 @@
+
+// binary trace writer (A2L_FORMAT=binary).  see a2lformat.h for the
+// layout.
+//
+// events are encoded into the thread's capture buffer, as text
+// records are.  a flush compresses the buffer into one block, which
+// is written at an offset reserved under the file lock, so blocks
+// never interleave and the index knows where each one went.  a thread
+// without a buffer writes each event as its own small raw block.
+//
+// stacks, modules and symbols are defined once, by the first thread
+// to meet them, and written out right away as a definitions block:
+// every event that uses a definition is written after it.  dladdr()
+// names each frame in place of backtrace_symbols(): same information,
+// no heap, and each symbol's name is written once rather than in
+// every stack that uses it.
+//
+// with A2L_SEGMENT_SIZE (bytes, K/M/G ok) the trace rolls over into
+// segments of about that size, listed in a manifest, and definitions
+// go to a file of their own.  segments are complete traces; the
+// manifest says how much of the definitions file each one needs.
+//
+// keyframe.c adds live heap keyframes to the trace; retention.c
+// compacts old segments.  both run on background.c's thread.
+
+#define A2L_BINLOG_MAX_MODULES 256
+#define A2L_BINLOG_INITIAL_SYMBOLS 1024       // power of two
+#define A2L_BINLOG_INITIAL_INDEX 1024
+#define A2L_BINLOG_NAME_MAX 512               // longer names are cut
+#define A2L_BINLOG_RECORD_MAX 1024            // largest single record
+#define A2L_BINLOG_CHUNK (4*A2L_BINLOG_RECORD_MAX)
+#define A2L_BINLOG_EVENT_MAX 64
+#define A2L_BINLOG_MIN_SEGMENT (1024*1024)
+
+// a file blocks are written to: the trace, the open segment, or the
+// definitions file
+typedef struct {
+    int lock;
+    int fd;
+    uint64_t offset;                // where the next block goes
+    a2l_blockindex_t *index;
+    uint32_t index_count, index_capacity;
+    int index_lost;                 // couldn't grow; no index is written
+
+    // for the manifest
+    uint32_t segment;
+    uint64_t first_ts, last_ts;
+    uint64_t first_event, num_events;
+}a2l__binfile_t;
+
+static a2l__binfile_t a2l__binlog_trace = {.fd = -1};
+static a2l__binfile_t a2l__binlog_defs = {.fd = -1};
+static int a2l__binlog_closed = 0;      // once the index is written
+static uint64_t a2l__binlog_start_ns, a2l__binlog_start_realtime_ns;
+
+static char a2l__binlog_path[256];      // trace, or manifest if segmented
+static int a2l__binlog_path_explicit;   // from A2L_LOGFILE
+static uint64_t a2l__binlog_segment_size = 0;
+static int a2l__binlog_manifest_fd = -1;
+
+// writers that reserved room in a segment and haven't finished writing
+// it, by segment mod this.  retention.c doesn't compact a segment
+// until its count is back to 0; segments that share a count only wait
+// for each other.
+#define A2L_BINLOG_WRITER_SLOTS 64
+static uint32_t a2l__binlog_writers[A2L_BINLOG_WRITER_SLOTS];
+
+// module id is index + 1
+static int a2l__binlog_module_lock = 0;
+static uintptr_t a2l__binlog_modules[A2L_BINLOG_MAX_MODULES];
+static uint32_t a2l__binlog_num_modules = 0;
+
+typedef struct {
+    uintptr_t addr;
+    uint32_t id;                    // 0 marks an empty slot
+}a2l__binsym_t;
+
+static int a2l__binlog_symbol_lock = 0;
+static a2l__binsym_t *a2l__binlog_symbols = NULL;
+static uint32_t a2l__binlog_symbol_mask = 0;
+static uint32_t a2l__binlog_symbol_count = 0;
+static uint32_t a2l__binlog_next_symbol = 1;
+
+static void a2l__background_reset(void);
+static void a2l__background_kick(void);
+static void a2l_background_shutdown(void);
+static void a2l_keyframe_init(void);
+static void a2l__keyframe_reset(void);
+static void a2l__keyframe_request(void);
+static inline void a2l_keyframe_check(uint64_t ts);
+static void a2l_retention_init(void);
+static void a2l__retention_open(void);
+static void a2l_retention_shutdown(void);
+
+static inline uint32_t
+a2l__binlog_symbol_hash(uintptr_t addr) {
+    return (uint32_t)(((uint64_t)addr * 0x9e3779b97f4a7c15ULL) >> 32);
+}
+
+static void
+a2l__binlog_pwrite(int fd, const void *data, size_t bytes, uint64_t offset) {
+    size_t done = 0;
+
+    while (done < bytes) {
+        ssize_t n = pwrite(fd, (const char *)data + done, bytes - done, offset + done);
+        if (n <= 0)
+            break;
+        done += (size_t)n;
+    }
+}
+
+//
+// files
+//
+
+static void
+a2l__binlog_open(a2l__binfile_t *f, const char *path, uint32_t segment) {
+    a2l_fileheader_t header;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = A2L_TRACE_MAGIC;
+    header.version = A2L_TRACE_VERSION;
+    header.header_bytes = sizeof(header);
+    header.pid = (uint32_t)getpid();
+    header.segment = segment;
+    header.start_ns = a2l__binlog_start_ns;
+    header.start_realtime_ns = a2l__binlog_start_realtime_ns;
+
+    f->fd = open(path, O_CREAT|O_TRUNC|O_WRONLY, S_IRUSR|S_IWUSR);
+    a2l__binlog_pwrite(f->fd, &header, sizeof(header), 0);
+    f->offset = sizeof(header);
+    f->index_count = 0;
+    f->segment = segment;
+    f->first_ts = f->last_ts = 0;
+    f->num_events = 0;
+}
+
+// append the index and trailer, and close.  the file stays open for
+// writers still holding a dup of fd.
+static void
+a2l__binlog_close(a2l__binfile_t *f) {
+    a2l_filetrailer_t trailer;
+
+    if (f->fd == -1)
+        return;
+
+    if (!f->index_lost) {
+        uint64_t bytes = f->index_count * sizeof(a2l_blockindex_t);
+        trailer.index_offset = f->offset;
+        trailer.num_blocks = f->index_count;
+        trailer.magic = A2L_TRAILER_MAGIC;
+
+        a2l__binlog_pwrite(f->fd, f->index, bytes, trailer.index_offset);
+        a2l__binlog_pwrite(f->fd, &trailer, sizeof(trailer), trailer.index_offset + bytes);
+        f->offset += bytes + sizeof(trailer);
+    }
+    close(f->fd);
+    f->fd = -1;
+}
+
+static void
+a2l__binlog_segment_path(char *path, size_t len, uint32_t segment) {
+    snprintf(path, len, A2L_SEGMENT_PATH_FMT, a2l__binlog_path, segment);
+}
+
+// write the manifest entry for the trace's current segment
+static void
+a2l__binlog_manifest_update(int open) {
+    a2l__binfile_t *f = &a2l__binlog_trace;
+    a2l_manifest_segment_t entry;
+    a2l_manifest_t manifest;
+
+    memset(&entry, 0, sizeof(entry));
+    entry.segment = f->segment;
+    entry.flags = open ? A2L_SEGMENT_OPEN : 0;
+    entry.first_ts = f->first_ts;
+    entry.last_ts = f->last_ts;
+    entry.first_event = f->first_event;
+    entry.num_events = f->num_events;
+    entry.bytes = f->offset;
+    entry.defs_end = __atomic_load_n(&a2l__binlog_defs.offset, __ATOMIC_RELAXED);
+
+    memset(&manifest, 0, sizeof(manifest));
+    manifest.magic = A2L_MANIFEST_MAGIC;
+    manifest.version = A2L_TRACE_VERSION;
+    manifest.header_bytes = sizeof(manifest);
+    manifest.pid = (uint32_t)getpid();
+    manifest.num_segments = f->segment + 1;
+    manifest.start_ns = a2l__binlog_start_ns;
+    manifest.start_realtime_ns = a2l__binlog_start_realtime_ns;
+    manifest.segment_bytes = a2l__binlog_segment_size;
+
+    // entry first: a reader never sees a count past what's written
+    a2l__binlog_pwrite(a2l__binlog_manifest_fd, &entry, sizeof(entry),
+                       sizeof(manifest) + f->segment * sizeof(entry));
+    a2l__binlog_pwrite(a2l__binlog_manifest_fd, &manifest, sizeof(manifest), 0);
+}
+
+// close the full segment and open the next.  trace lock held.
+static void
+a2l__binlog_roll(void) {
+    a2l__binfile_t *f = &a2l__binlog_trace;
+    char path[300];
+
+    a2l__binlog_close(f);
+    a2l__binlog_manifest_update(0);
+
+    uint64_t next_event = f->first_event + f->num_events;
+    a2l__binlog_segment_path(path, sizeof(path), f->segment + 1);
+    a2l__binlog_open(f, path, f->segment + 1);
+    f->first_event = next_event;
+    a2l__binlog_manifest_update(1);
+}
+
+static void a2l__binlog_atfork_child(void);
+
+// open the trace (or manifest, first segment and definitions file)
+static void
+a2l__binlog_start(void) {
+    struct timespec ts;
+    char path[300];
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    a2l__binlog_start_ns = a2l_clock_ns();
+    a2l__binlog_start_realtime_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    a2l__binlog_trace.first_event = 0;
+    a2l__background_reset();
+    a2l__keyframe_reset();
+
+    if (!a2l__binlog_segment_size) {
+        a2l__binlog_open(&a2l__binlog_trace, a2l__binlog_path, 0);
+        return;
+    }
+
+    // read back by retention.c
+    a2l__binlog_manifest_fd = open(a2l__binlog_path, O_CREAT|O_TRUNC|O_RDWR, S_IRUSR|S_IWUSR);
+    snprintf(path, sizeof(path), A2L_DEFS_PATH_FMT, a2l__binlog_path);
+    a2l__binlog_open(&a2l__binlog_defs, path, 0);
+    a2l__binlog_segment_path(path, sizeof(path), 0);
+    a2l__binlog_open(&a2l__binlog_trace, path, 0);
+    a2l__binlog_manifest_update(1);
+    a2l__retention_open();
+}
+
+static void
+a2l_binlog_init(const char *path, int path_explicit) {
+    const char *segment = getenv("A2L_SEGMENT_SIZE");
+
+    snprintf(a2l__binlog_path, sizeof(a2l__binlog_path), "%s", path);
+    a2l__binlog_path_explicit = path_explicit;
+
+    if (segment) {
+        a2l__binlog_segment_size = a2l__parse_bytes(segment);
+        if (a2l__binlog_segment_size && a2l__binlog_segment_size < A2L_BINLOG_MIN_SEGMENT)
+            a2l__binlog_segment_size = A2L_BINLOG_MIN_SEGMENT;
+    }
+    a2l_keyframe_init();
+    a2l_retention_init();
+
+    a2l__binlog_start();
+    pthread_atfork(NULL, NULL, a2l__binlog_atfork_child);
+}
+
+// reserve room at the end of the file for the block described by
+// header, and index it.  returns the fd to write it to, to be passed
+// to a2l__binlog_release() with *writers, or -1 once the trace is
+// closed.
+static int
+a2l__binlog_reserve(a2l__binfile_t *f, const a2l_blockheader_t *header, uint64_t *offset,
+                    uint32_t **writers) {
+    uint64_t bytes = sizeof(*header) + header->stored_bytes;
+    int rolled = 0;
+    int fd;
+
+    a2l__spin_lock(&f->lock);
+    if (a2l__binlog_closed || f->fd == -1) {
+        a2l__spin_unlock(&f->lock);
+        return -1;
+    }
+
+    if (f == &a2l__binlog_trace && a2l__binlog_segment_size &&
+        f->offset + bytes > a2l__binlog_segment_size && f->index_count) {
+        a2l__binlog_roll();
+        rolled = 1;
+    }
+
+    *offset = f->offset;
+    f->offset += bytes;
+
+    if (f->index_count == f->index_capacity && !f->index_lost) {
+        uint32_t capacity = f->index_capacity ? f->index_capacity * 2 : A2L_BINLOG_INITIAL_INDEX;
+        a2l_blockindex_t *index = a2l_mem_map(A2L_MEM_BUFFERS, capacity * sizeof(a2l_blockindex_t));
+
+        // without an index readers walk the blocks, so carry on
+        if (!index) {
+            f->index_lost = 1;
+        } else {
+            if (f->index) {
+                memcpy(index, f->index, f->index_count * sizeof(a2l_blockindex_t));
+                a2l_mem_unmap(A2L_MEM_BUFFERS, f->index, f->index_capacity * sizeof(a2l_blockindex_t));
+            }
+            f->index = index;
+            f->index_capacity = capacity;
+        }
+    }
+
+    if (!f->index_lost) {
+        a2l_blockindex_t *entry = &f->index[f->index_count++];
+        memset(entry, 0, sizeof(*entry));
+        entry->offset = *offset;
+        entry->first_ts = header->first_ts;
+        entry->last_ts = header->last_ts;
+        entry->tid = header->tid;
+        entry->num_events = header->num_events;
+        entry->flags = header->flags;
+    }
+
+    if (header->num_events) {
+        if (!f->num_events || header->first_ts < f->first_ts)
+            f->first_ts = header->first_ts;
+        if (header->last_ts > f->last_ts)
+            f->last_ts = header->last_ts;
+        f->num_events += header->num_events;
+    }
+
+    // a roll can close fd while this block is being written, and
+    // the segment mustn't be compacted until it has been
+    fd = a2l__binlog_segment_size ? dup(f->fd) : f->fd;
+    *writers = NULL;
+    if (f == &a2l__binlog_trace && a2l__binlog_segment_size) {
+        *writers = &a2l__binlog_writers[f->segment % A2L_BINLOG_WRITER_SLOTS];
+        A2L_ATOMIC_ADD(*writers, 1);
+    }
+
+    a2l__spin_unlock(&f->lock);
+
+    // a keyframe for the new segment, compaction for the old
+    if (rolled) {
+        a2l__keyframe_request();
+        a2l__background_kick();
+    }
+    return fd;
+}
+
+static void
+a2l__binlog_release(a2l__binfile_t *f, int fd, uint32_t *writers) {
+    if (fd != f->fd)
+        close(fd);
+    if (writers)
+        __atomic_sub_fetch(writers, 1, __ATOMIC_RELEASE);
+}
+
+// write raw as one block, compressed if lz_table is given and it helps
+static void
+a2l__binlog_write_block(a2l__binfile_t *f, uint32_t flags, uint32_t tid,
+                        const uint8_t *raw, size_t raw_bytes,
+                        uint32_t num_events, uint64_t first_ts, uint64_t last_ts,
+                        uint32_t *lz_table, uint8_t *lz_out) {
+    a2l_blockheader_t header;
+    const uint8_t *payload = raw;
+    uint64_t offset;
+    uint32_t *writers;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = A2L_BLOCK_MAGIC;
+    header.codec = A2L_CODEC_NONE;
+    header.header_bytes = sizeof(header);
+    header.raw_bytes = (uint32_t)raw_bytes;
+    header.stored_bytes = (uint32_t)raw_bytes;
+    header.tid = tid;
+    header.num_events = num_events;
+    header.flags = flags;
+    header.first_ts = first_ts;
+    header.last_ts = last_ts;
+
+    if (lz_table) {
+        size_t stored = a2l_lz_compress(raw, raw_bytes, lz_out, lz_table);
+        if (stored < raw_bytes) {
+            header.codec = A2L_CODEC_LZ;
+            header.stored_bytes = (uint32_t)stored;
+            payload = lz_out;
+        }
+    }
+    header.checksum = a2l_checksum(payload, header.stored_bytes);
+
+    int fd = a2l__binlog_reserve(f, &header, &offset, &writers);
+    if (fd == -1)
+        return;
+    a2l__binlog_pwrite(fd, &header, sizeof(header), offset);
+    a2l__binlog_pwrite(fd, payload, header.stored_bytes, offset + sizeof(header));
+    a2l__binlog_release(f, fd, writers);
+}
+
+// capbuf.c: cb is locked and about to be emptied
+static void
+a2l__binlog_flush(a2l_capbuf_t *cb) {
+    a2l__binlog_write_block(&a2l__binlog_trace, 0, cb->tid, (const uint8_t *)cb->base, cb->used,
+                            cb->num_events, cb->first_ts, cb->last_ts,
+                            cb->lz_table, cb->lz_out);
+    cb->num_events = 0;
+}
+
+// write the index and close the trace.  called after the capture
+// buffers are flushed.
+static void
+a2l_binlog_shutdown(void) {
+    a2l__binfile_t *f = &a2l__binlog_trace;
+
+    if (f->fd == -1)
+        return;
+
+    a2l_background_shutdown();
+    a2l_retention_shutdown();
+
+    a2l__spin_lock(&f->lock);
+    a2l__spin_lock(&a2l__binlog_defs.lock);
+    a2l__binlog_closed = 1;
+    a2l__spin_unlock(&a2l__binlog_defs.lock);
+
+    a2l__binlog_close(f);
+    if (a2l__binlog_segment_size) {
+        close(a2l__binlog_defs.fd);
+        a2l__binlog_defs.fd = -1;
+        a2l__binlog_manifest_update(0);
+        close(a2l__binlog_manifest_fd);
+    }
+    a2l__spin_unlock(&f->lock);
+}
+
+// a budget eviction: symbols are defined again on next use
+static void
+a2l_binlog_evict(void) {
+    a2l__spin_lock(&a2l__binlog_symbol_lock);
+    a2l_mem_unmap(A2L_MEM_SYMBOLS, a2l__binlog_symbols,
+                  a2l__binlog_symbols ? (a2l__binlog_symbol_mask + 1) * sizeof(a2l__binsym_t) : 0);
+    a2l__binlog_symbols = NULL;
+    a2l__binlog_symbol_mask = 0;
+    a2l__binlog_symbol_count = 0;
+    a2l__spin_unlock(&a2l__binlog_symbol_lock);
+}
+
+// the child gets its own trace, a2l-<pid>.a2l or A2L_LOGFILE.<pid>.
+// nothing defined in the parent's trace is known to be in it.
+static void
+a2l__binlog_atfork_child(void) {
+    char path[300];
+
+    if (a2l__binlog_path_explicit)
+        snprintf(path, sizeof(path), "%s.%d", a2l__binlog_path, getpid());
+    else
+        snprintf(path, sizeof(path), "a2l-%d.a2l", getpid());
+    memcpy(a2l__binlog_path, path, sizeof(a2l__binlog_path) - 1);
+
+    a2l__binlog_trace.lock = 0;
+    a2l__binlog_defs.lock = 0;
+    a2l__binlog_module_lock = 0;
+    a2l__binlog_symbol_lock = 0;
+
+    a2l__binlog_num_modules = 0;
+    memset(a2l__binlog_writers, 0, sizeof(a2l__binlog_writers));
+    a2l_binlog_evict();
+
+    // the parent's files stay the parent's
+    if (a2l__binlog_trace.fd != -1)
+        close(a2l__binlog_trace.fd);
+    if (a2l__binlog_defs.fd != -1)
+        close(a2l__binlog_defs.fd);
+    if (a2l__binlog_manifest_fd != -1)
+        close(a2l__binlog_manifest_fd);
+    a2l__binlog_start();
+}
+
+//
+// definitions
+//
+
+// definitions for one new stack, collected and written as one block
+typedef struct {
+    uint8_t *p;
+    uint32_t tid;
+    uint8_t buf[A2L_BINLOG_CHUNK];
+}a2l__bindefs_t;
+
+static void
+a2l__bindefs_write(a2l__bindefs_t *d) {
+    a2l__binfile_t *f = a2l__binlog_segment_size ? &a2l__binlog_defs : &a2l__binlog_trace;
+
+    if (d->p > d->buf)
+        a2l__binlog_write_block(f, A2L_BLOCK_DEFINITIONS, d->tid, d->buf, d->p - d->buf,
+                                0, 0, 0, NULL, NULL);
+    d->p = d->buf;
+}
+
+// make room for one more record
+static void
+a2l__bindefs_room(a2l__bindefs_t *d) {
+    if (d->buf + sizeof(d->buf) - d->p < A2L_BINLOG_RECORD_MAX)
+        a2l__bindefs_write(d);
+}
+
+static uint8_t *
+a2l__binlog_put_string(uint8_t *p, const char *str) {
+    size_t len = str ? strnlen(str, A2L_BINLOG_NAME_MAX) : 0;
+
+    p = a2l_put_varint(p, len);
+    if (len)
+        memcpy(p, str, len);
+    return p + len;
+}
+
+// module id for base, defining it if it is new
+static uint32_t
+a2l__binlog_module(uintptr_t base, const char *path, a2l__bindefs_t *d) {
+    uint32_t id = 0;
+
+    a2l__spin_lock(&a2l__binlog_module_lock);
+    for (uint32_t i = 0; i < a2l__binlog_num_modules; i++) {
+        if (a2l__binlog_modules[i] == base) {
+            id = i + 1;
+            break;
+        }
+    }
+    if (!id && a2l__binlog_num_modules < A2L_BINLOG_MAX_MODULES) {
+        a2l__binlog_modules[a2l__binlog_num_modules++] = base;
+        id = a2l__binlog_num_modules;
+
+        a2l__bindefs_room(d);
+        *d->p++ = A2L_REC_MODULE;
+        d->p = a2l_put_varint(d->p, id);
+        d->p = a2l_put_varint(d->p, base);
+        d->p = a2l__binlog_put_string(d->p, path);
+    }
+    a2l__spin_unlock(&a2l__binlog_module_lock);
+
+    return id;
+}
+
+static int
+a2l__binlog_grow_symbols(void) {
+    uint32_t old_capacity = a2l__binlog_symbols ? a2l__binlog_symbol_mask + 1 : 0;
+    uint32_t new_capacity = old_capacity ? old_capacity * 2 : A2L_BINLOG_INITIAL_SYMBOLS;
+    a2l__binsym_t *symbols = a2l_mem_map(A2L_MEM_SYMBOLS, new_capacity * sizeof(a2l__binsym_t));
+
+    if (!symbols)
+        return 0;
+
+    for (uint32_t i = 0; i < old_capacity; i++) {
+        if (!a2l__binlog_symbols[i].id)
+            continue;
+        uint32_t j = a2l__binlog_symbol_hash(a2l__binlog_symbols[i].addr) & (new_capacity - 1);
+        while (symbols[j].id)
+            j = (j + 1) & (new_capacity - 1);
+        symbols[j] = a2l__binlog_symbols[i];
+    }
+
+    a2l_mem_unmap(A2L_MEM_SYMBOLS, a2l__binlog_symbols, old_capacity * sizeof(a2l__binsym_t));
+    a2l__binlog_symbols = symbols;
+    a2l__binlog_symbol_mask = new_capacity - 1;
+    return 1;
+}
+
+// symbol id for addr, defining it if it is new.  0 if the table is
+// full and can't grow.
+static uint32_t
+a2l__binlog_symbol(uintptr_t addr, uint32_t module_id, const char *name, a2l__bindefs_t *d) {
+    uint32_t id = 0;
+
+    a2l__spin_lock(&a2l__binlog_symbol_lock);
+
+    if (!a2l__binlog_symbols ||
+        (a2l__binlog_symbol_count + 1) * 4 > (a2l__binlog_symbol_mask + 1) * 3)
+        if (!a2l__binlog_grow_symbols() && !a2l__binlog_symbols)
+            goto done;
+
+    uint32_t i = a2l__binlog_symbol_hash(addr) & a2l__binlog_symbol_mask;
+    for (; a2l__binlog_symbols[i].id; i = (i + 1) & a2l__binlog_symbol_mask) {
+        if (a2l__binlog_symbols[i].addr == addr) {
+            id = a2l__binlog_symbols[i].id;
+            goto done;
+        }
+    }
+
+    if ((a2l__binlog_symbol_count + 1) * 16 > (a2l__binlog_symbol_mask + 1) * 15)
+        goto done;
+
+    id = a2l__binlog_next_symbol++;
+    a2l__binlog_symbols[i].addr = addr;
+    a2l__binlog_symbols[i].id = id;
+    a2l__binlog_symbol_count++;
+
+    a2l__bindefs_room(d);
+    *d->p++ = A2L_REC_SYMBOL;
+    d->p = a2l_put_varint(d->p, id);
+    d->p = a2l_put_varint(d->p, module_id);
+    d->p = a2l_put_varint(d->p, addr);
+    d->p = a2l__binlog_put_string(d->p, name);
+
+done:
+    a2l__spin_unlock(&a2l__binlog_symbol_lock);
+    return id;
+}
+
+// name each frame and define the stack
+static void
+a2l__binlog_define_stack(uint32_t hash_id, void * const *frames, int num_frames, int label) {
+    uint32_t module_ids[MAX_FRAMES], symbol_ids[MAX_FRAMES];
+    a2l__bindefs_t defs;
+
+    defs.p = defs.buf;
+    defs.tid = a2l_gettid();
+
+    for (int i = 0; i < num_frames; i++) {
+        Dl_info info;
+
+        module_ids[i] = symbol_ids[i] = 0;
+
+        // dladdr takes the loader lock but doesn't allocate
+        if (!dladdr(frames[i], &info))
+            continue;
+
+        module_ids[i] = a2l__binlog_module((uintptr_t)info.dli_fbase, info.dli_fname, &defs);
+        if (info.dli_saddr)
+            symbol_ids[i] = a2l__binlog_symbol((uintptr_t)info.dli_saddr, module_ids[i],
+                                               info.dli_sname, &defs);
+
+        if (label && i == 0) {
+            char desc[A2L_STATS_LABEL_LEN];
+            snprintf(desc, sizeof(desc), "%s(%s+0x%lx) [%p]",
+                     info.dli_fname ? info.dli_fname : "",
+                     info.dli_sname ? info.dli_sname : "",
+                     (unsigned long)((uintptr_t)frames[i] - (uintptr_t)info.dli_saddr),
+                     frames[i]);
+            a2l_stats_label_site(hash_id, desc);
+        }
+    }
+
+    a2l__bindefs_room(&defs);
+    uint8_t *p = defs.p;
+    uintptr_t prev = 0;
+
+    *p++ = A2L_REC_STACK;
+    p = a2l_put_varint(p, hash_id);
+    p = a2l_put_varint(p, num_frames);
+    for (int i = 0; i < num_frames; i++) {
+        p = a2l_put_varint(p, a2l_zigzag((int64_t)((uintptr_t)frames[i] - prev)));
+        p = a2l_put_varint(p, module_ids[i]);
+        p = a2l_put_varint(p, symbol_ids[i]);
+        prev = (uintptr_t)frames[i];
+    }
+    defs.p = p;
+
+    a2l__bindefs_write(&defs);
+}
+
+//
+// events
+//
+
+// log one alloc or free.  for a free, freed is the block's record if
+// it was tracked.  now is the event's a2l_clock_ns() time if the live
+// map took it, or 0.
+static void
+a2l_binlog_event(int is_alloc, const void *ptr, size_t bytes, uint32_t hash_id,
+                 void * const *frames, int num_frames,
+                 const a2l_allocrecord_t *freed, uint64_t now, a2l_stagelaps_t *laps) {
+    uint8_t local[A2L_BINLOG_EVENT_MAX];
+    char unused;
+
+    if (__atomic_load_n(&a2l__binlog_closed, __ATOMIC_RELAXED))
+        return;
+
+    // a stack table entry, with no text, marks a stack as defined
+    if (a2l_stacktable_get(hash_id, frames, num_frames, &unused, 0) < 0) {
+        a2l__binlog_define_stack(hash_id, frames, num_frames, is_alloc);
+        a2l_stacktable_put(hash_id, frames, num_frames, "", 0);
+        a2l_stagelaps_lap(laps, A2L_STAGE_SYMBOLIZE);
+    }
+
+    a2l_capbuf_t *cb = a2l_capbuf_acquire(A2L_BINLOG_EVENT_MAX);
+    uint8_t *start = cb ? (uint8_t *)cb->base + cb->used : local;
+    a2l_stagelaps_lap(laps, A2L_STAGE_WRITE);
+
+    uint64_t ts = (now ? now : a2l_clock_ns()) - a2l__binlog_start_ns;
+    uint64_t prev_ts = ts;
+    if (cb) {
+        if (cb->num_events == 0)
+            cb->first_ts = ts;
+        else
+            prev_ts = cb->last_ts;
+        cb->last_ts = ts;
+        cb->num_events++;
+    }
+
+    uint8_t *p = start;
+    *p++ = is_alloc ? A2L_REC_ALLOC : A2L_REC_FREE;
+    p = a2l_put_varint(p, ts - prev_ts);
+    p = a2l_put_varint(p, (uintptr_t)ptr);
+    if (is_alloc) {
+        p = a2l_put_varint(p, bytes);
+        p = a2l_put_varint(p, hash_id);
+    } else {
+        p = a2l_put_varint(p, hash_id);
+        p = a2l_put_varint(p, freed ? freed->bytes : 0);
+        p = a2l_put_varint(p, freed ? freed->stack_hash_id : 0);
+    }
+    a2l_stagelaps_lap(laps, A2L_STAGE_FORMAT);
+
+    if (cb)
+        a2l_capbuf_commit(cb, p - start);
+    else
+        a2l__binlog_write_block(&a2l__binlog_trace, 0, a2l_gettid(), start, p - start,
+                                1, ts, ts, NULL, NULL);
+    a2l_stagelaps_lap(laps, A2L_STAGE_WRITE);
+
+    a2l_keyframe_check(ts);
+}
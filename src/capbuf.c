@@ -0,0 +1,326 @@
+
+// per-thread capture buffers.
+//
+// records are formatted straight into the calling thread's buffer
+// and written out a buffer at a time, not one write() per event.  so
+// an _exit() or crash loses what's still buffered, and a text log is
+// only in order per thread (binary records carry timestamps).
+//
+// a thread registers on its first logged call.  its buffer is mapped
+// then and bound to the numa node the thread is running on (not
+// wherever the first toucher happened to be).  it's backed by huge
+// pages where possible and prefaulted before use, so the hook doesn't
+// take page faults in steady state.
+//
+//   A2L_BUFFER_SIZE  bytes per thread, K/M/G ok (default 2M)
+//   A2L_HUGEPAGES    "explicit" tries MAP_HUGETLB first, "0" disables
+//                    transparent huge pages too (default: thp)
+//
+// without a buffer (over budget, or during shutdown) records are
+// written directly, as before.
+//
+// in binary mode the back of the mapping is scratch for compressing
+// the front, and a flush hands the buffer to binlog.c to be written
+// as one block.
+
+#define A2L_CAPBUF_DEFAULT_SIZE (2*1024*1024)
+#define A2L_CAPBUF_MIN_SIZE (64*1024)
+#define A2L_CAPBUF_MIN_BINARY_SIZE (256*1024)
+#define A2L_HUGEPAGE_SIZE (2*1024*1024)
+
+// linux mempolicy, without a libnuma dependency
+#define A2L_MPOL_PREFERRED 1
+
+typedef struct a2l_capbuf_s {
+    int lock;
+    int node;                       // numa node, -1 if unknown
+    char *base;
+    size_t size;                    // usable bytes
+    size_t map_size;                // bytes mapped, for unmap
+    size_t used;
+    struct a2l_capbuf_s *prev, *next;
+
+    // binary mode: the block being filled
+    uint32_t tid;
+    uint32_t num_events;
+    uint64_t first_ts, last_ts;
+    uint32_t *lz_table;             // A2L_LZ_TABLE_ENTRIES
+    uint8_t *lz_out;                // A2L_LZ_BOUND(size)
+}a2l_capbuf_t;
+
+static int a2l__capbuf_fd = -1;
+static size_t a2l__capbuf_size = A2L_CAPBUF_DEFAULT_SIZE;
+static int a2l__capbuf_hugepages = 1;   // 0 off, 1 thp, 2 explicit
+static int a2l__capbuf_direct = 0;      // set at shutdown
+static int a2l__capbuf_binary = 0;
+static pthread_key_t a2l__capbuf_key;
+
+// registry of live buffers, for the flush at exit
+static int a2l__capbuf_list_lock = 0;
+static a2l_capbuf_t *a2l__capbuf_list = NULL;
+
+static __thread a2l_capbuf_t *a2l__capbuf
+    __attribute__((tls_model("initial-exec"))) = NULL;
+static __thread int a2l__capbuf_failed
+    __attribute__((tls_model("initial-exec"))) = 0;
+
+static inline void
+a2l__spin_lock(int *lock) {
+    while (__atomic_test_and_set(lock, __ATOMIC_ACQUIRE))
+        while (__atomic_load_n(lock, __ATOMIC_RELAXED))
+            A2L_CPU_RELAX();
+}
+
+static inline void
+a2l__spin_unlock(int *lock) {
+    __atomic_clear(lock, __ATOMIC_RELEASE);
+}
+
+static void a2l__binlog_flush(a2l_capbuf_t *cb);
+
+static void
+a2l__capbuf_flush_locked(a2l_capbuf_t *cb) {
+    size_t done = 0;
+
+    if (a2l__capbuf_binary) {
+        if (cb->used)
+            a2l__binlog_flush(cb);
+        cb->used = 0;
+        return;
+    }
+
+    while (done < cb->used) {
+        ssize_t n = write(a2l__capbuf_fd, cb->base + done, cb->used - done);
+        if (n <= 0)
+            break;
+        done += (size_t)n;
+    }
+    cb->used = 0;
+}
+
+static int
+a2l__current_node(void) {
+    unsigned cpu, node;
+
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0)
+        return -1;
+    return (int)node;
+}
+
+// map size bytes on the calling thread's node, huge-page backed if
+// allowed, and prefaulted
+static char *
+a2l__capbuf_map(size_t size, size_t *map_size, int *node) {
+    char *p = MAP_FAILED;
+
+    *map_size = size;
+    *node = a2l__current_node();
+
+#ifdef MAP_HUGETLB
+    if (a2l__capbuf_hugepages == 2 && size % A2L_HUGEPAGE_SIZE == 0)
+        p = mmap(NULL, size, PROT_READ|PROT_WRITE,
+                 MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+#endif
+
+    if (p == MAP_FAILED && a2l__capbuf_hugepages && size >= A2L_HUGEPAGE_SIZE) {
+        // over-map so a huge page aligned run of size bytes fits, then trim
+        size_t slop = A2L_HUGEPAGE_SIZE;
+        char *raw = mmap(NULL, size + slop, PROT_READ|PROT_WRITE,
+                         MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (raw != MAP_FAILED) {
+            char *aligned = (char *)(((uintptr_t)raw + slop - 1) & ~(uintptr_t)(slop - 1));
+            if (aligned > raw)
+                munmap(raw, aligned - raw);
+            if (raw + size + slop > aligned + size)
+                munmap(aligned + size, (raw + size + slop) - (aligned + size));
+            p = aligned;
+#ifdef MADV_HUGEPAGE
+            madvise(p, size, MADV_HUGEPAGE);
+#endif
+        }
+    }
+
+    if (p == MAP_FAILED)
+        p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+
+    // bind before the first touch, so pages are allocated on node
+    if (*node >= 0 && *node < (int)(sizeof(unsigned long) * 8)) {
+        unsigned long nodemask = 1UL << *node;
+        syscall(SYS_mbind, p, size, A2L_MPOL_PREFERRED, &nodemask,
+                sizeof(nodemask) * 8, 0);
+    }
+
+    // prefault now rather than inside a later malloc
+    int populated = 0;
+#ifdef MADV_POPULATE_WRITE
+    populated = madvise(p, size, MADV_POPULATE_WRITE) == 0;
+#endif
+    if (!populated) {
+        long page = sysconf(_SC_PAGESIZE);
+        for (size_t off = 0; off < size; off += page)
+            ((volatile char *)p)[off] = 0;
+    }
+
+    return p;
+}
+
+static void
+a2l__capbuf_release(a2l_capbuf_t *cb) {
+    a2l__spin_lock(&a2l__capbuf_list_lock);
+    if (cb->prev)
+        cb->prev->next = cb->next;
+    else
+        a2l__capbuf_list = cb->next;
+    if (cb->next)
+        cb->next->prev = cb->prev;
+    a2l__spin_unlock(&a2l__capbuf_list_lock);
+
+    a2l__spin_lock(&cb->lock);
+    a2l__capbuf_flush_locked(cb);
+    a2l__spin_unlock(&cb->lock);
+
+    // the header is at the front of the mapping it describes
+    a2l_mem_unmap(A2L_MEM_BUFFERS, cb, cb->map_size);
+}
+
+// pthread key destructor: the thread is exiting
+static void
+a2l__capbuf_thread_exit(void *arg) {
+    a2l_capbuf_t *cb = arg;
+
+    a2l__capbuf = NULL;
+    a2l__capbuf_failed = 1;
+    a2l__capbuf_release(cb);
+}
+
+// in a fork child only the forking thread survives.  drop what the
+// other threads' buffers held; the parent writes those.
+static void
+a2l__capbuf_atfork_child(void) {
+    a2l_capbuf_t *cb = a2l__capbuf_list;
+
+    a2l__capbuf_list_lock = 0;
+    while (cb) {
+        a2l_capbuf_t *next = cb->next;
+        cb->lock = 0;
+        cb->used = 0;
+        cb->num_events = 0;
+        cb = next;
+    }
+}
+
+static void
+a2l_capbuf_init(int fd, int binary) {
+    const char *size = getenv("A2L_BUFFER_SIZE");
+    const char *huge = getenv("A2L_HUGEPAGES");
+    size_t min_size = binary ? A2L_CAPBUF_MIN_BINARY_SIZE : A2L_CAPBUF_MIN_SIZE;
+
+    if (size)
+        a2l__capbuf_size = a2l__parse_bytes(size);
+    if (a2l__capbuf_size < min_size)
+        a2l__capbuf_size = min_size;
+    a2l__capbuf_fd = fd;
+    a2l__capbuf_binary = binary;
+    if (huge)
+        a2l__capbuf_hugepages = strcmp(huge, "explicit") == 0 ? 2 : huge[0] != '0';
+
+    pthread_key_create(&a2l__capbuf_key, a2l__capbuf_thread_exit);
+    pthread_atfork(NULL, NULL, a2l__capbuf_atfork_child);
+}
+
+// register the calling thread: stats slot and capture buffer
+static a2l_capbuf_t *
+a2l__capbuf_register(void) {
+    size_t map_size;
+    int node;
+
+    // once per thread, whether it worked or not
+    a2l__capbuf_failed = 1;
+
+    if (a2l__stats)
+        a2l__stats_thread();
+
+    size_t size = a2l__capbuf_size;
+    if (!a2l__mem_reserve(A2L_MEM_BUFFERS, size))
+        return NULL;
+
+    char *p = a2l__capbuf_map(size, &map_size, &node);
+    if (!p) {
+        a2l__mem_add(A2L_MEM_BUFFERS, -(int64_t)size);
+        return NULL;
+    }
+
+    // the buffer's header lives at the front of its own mapping
+    a2l_capbuf_t *cb = (a2l_capbuf_t *)p;
+    memset(cb, 0, sizeof(*cb));
+    cb->node = node;
+    cb->base = p + sizeof(a2l_capbuf_t);
+    cb->size = size - sizeof(a2l_capbuf_t);
+    cb->map_size = map_size;
+    cb->tid = a2l_gettid();
+
+    if (a2l__capbuf_binary) {
+        // records, then the hash table and output of the compressor
+        size_t table_bytes = sizeof(uint32_t) * A2L_LZ_TABLE_ENTRIES;
+        size_t avail = cb->size - table_bytes - 64;
+        cb->size = (avail - 16) / 2 - (avail - 16) / 512;
+        cb->lz_table = (uint32_t *)(((uintptr_t)cb->base + cb->size + 7) & ~(uintptr_t)7);
+        cb->lz_out = (uint8_t *)(cb->lz_table + A2L_LZ_TABLE_ENTRIES);
+    }
+
+    a2l__spin_lock(&a2l__capbuf_list_lock);
+    cb->next = a2l__capbuf_list;
+    if (cb->next)
+        cb->next->prev = cb;
+    a2l__capbuf_list = cb;
+    a2l__spin_unlock(&a2l__capbuf_list_lock);
+
+    pthread_setspecific(a2l__capbuf_key, cb);
+    a2l__capbuf = cb;
+    return cb;
+}
+
+// lock the calling thread's buffer with at least record_max bytes
+// free, flushing if needed.  NULL if the thread has no buffer; write
+// directly then.
+static a2l_capbuf_t *
+a2l_capbuf_acquire(size_t record_max) {
+    a2l_capbuf_t *cb = a2l__capbuf;
+
+    if (__atomic_load_n(&a2l__capbuf_direct, __ATOMIC_RELAXED))
+        return NULL;
+    if (!cb) {
+        if (a2l__capbuf_failed)
+            return NULL;
+        cb = a2l__capbuf_register();
+        if (!cb)
+            return NULL;
+    }
+
+    a2l__spin_lock(&cb->lock);
+    if (cb->size - cb->used < record_max)
+        a2l__capbuf_flush_locked(cb);
+    return cb;
+}
+
+static void
+a2l_capbuf_commit(a2l_capbuf_t *cb, size_t bytes) {
+    cb->used += bytes;
+    a2l__spin_unlock(&cb->lock);
+}
+
+// at exit: flush every buffer and write directly from here on
+static void
+a2l_capbuf_shutdown(void) {
+    __atomic_store_n(&a2l__capbuf_direct, 1, __ATOMIC_RELAXED);
+
+    a2l__spin_lock(&a2l__capbuf_list_lock);
+    for (a2l_capbuf_t *cb = a2l__capbuf_list; cb; cb = cb->next) {
+        a2l__spin_lock(&cb->lock);
+        a2l__capbuf_flush_locked(cb);
+        a2l__spin_unlock(&cb->lock);
+    }
+    a2l__spin_unlock(&a2l__capbuf_list_lock);
+}
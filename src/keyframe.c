@@ -0,0 +1,211 @@
+
+// heap keyframes: the live heap, written into the trace now and then
+// so a reader can rebuild the heap at any time from the keyframe
+// before it, replaying only the tail.  see a2lformat.h.
+//
+// A2L_KEYFRAME_INTERVAL spaces them out (30s, 10m; plain numbers are
+// seconds; 0 for none; default 60s).  a segmented trace also gets one
+// just after each roll, so each segment can be read alone.
+//
+// the first event to find one due asks the background thread for it.
+// the thread copies the live map a shard at a time, under that
+// shard's lock only, then sorts each copy by address and writes it out
+// delta-encoded.
+
+#define A2L_KEYFRAME_DEFAULT_INTERVAL 60      // seconds
+#define A2L_KEYFRAME_CHUNK (64*1024)          // keyframe block payload
+#define A2L_KEYFRAME_RECORD_MAX 40
+
+static uint64_t a2l__keyframe_interval_ns = A2L_KEYFRAME_DEFAULT_INTERVAL * A2L_NS_PER_SEC;
+static uint64_t a2l__keyframe_next = 0;         // when the next is due
+static int a2l__keyframe_pending = 0;
+
+// binlog.c, before the trace is opened
+static void
+a2l_keyframe_init(void) {
+    const char *interval = getenv("A2L_KEYFRAME_INTERVAL");
+
+    if (interval)
+        a2l__keyframe_interval_ns = a2l__parse_seconds(interval) * A2L_NS_PER_SEC;
+#if !A2L_TRACK_ALLOCS
+    // no live map to take them from
+    a2l__keyframe_interval_ns = 0;
+#endif
+    if (a2l__keyframe_interval_ns)
+        a2l__background_wanted = 1;
+}
+
+// binlog.c: a trace was opened
+static void
+a2l__keyframe_reset(void) {
+    a2l__keyframe_next = a2l__keyframe_interval_ns;
+    a2l__keyframe_pending = 0;
+}
+
+// ask the background thread for one.  no alloc2log locks held.
+static void
+a2l__keyframe_request(void) {
+    // not for a roll the thread's own keyframe caused
+    if (!a2l__keyframe_interval_ns || a2l__background_on_thread)
+        return;
+
+    __atomic_store_n(&a2l__keyframe_pending, 1, __ATOMIC_RELEASE);
+    a2l__background_kick();
+}
+
+// binlog.c, per event: one thread a period finds a keyframe due
+static inline void
+a2l_keyframe_check(uint64_t ts) {
+    uint64_t next = __atomic_load_n(&a2l__keyframe_next, __ATOMIC_RELAXED);
+
+    if (!a2l__keyframe_interval_ns || ts < next ||
+        !__atomic_compare_exchange_n(&a2l__keyframe_next, &next, ts + a2l__keyframe_interval_ns,
+                                     0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        return;
+    a2l__keyframe_request();
+}
+
+#if A2L_TRACK_ALLOCS
+
+// a keyframe being written
+typedef struct {
+    uint8_t *chunk, *p;
+    uint32_t *lz_table;
+    uint8_t *lz_out;
+    uintptr_t prev;                 // previous ptr in this block
+    uint64_t first_ts;
+    uint32_t num_blocks;
+}a2l__keyframe_t;
+
+#define A2L_KEYFRAME_SCRATCH_BYTES \
+    (A2L_KEYFRAME_CHUNK + A2L_LZ_TABLE_ENTRIES*sizeof(uint32_t) + A2L_LZ_BOUND(A2L_KEYFRAME_CHUNK))
+
+static void
+a2l__keyframe_sift(a2l_allocrecord_t *r, uint32_t root, uint32_t n) {
+    for (;;) {
+        uint32_t child = 2 * root + 1;
+        if (child >= n)
+            return;
+        if (child + 1 < n && (uintptr_t)r[child + 1].heap_ptr > (uintptr_t)r[child].heap_ptr)
+            child++;
+        if ((uintptr_t)r[root].heap_ptr >= (uintptr_t)r[child].heap_ptr)
+            return;
+
+        a2l_allocrecord_t swap = r[root];
+        r[root] = r[child];
+        r[child] = swap;
+        root = child;
+    }
+}
+
+// heapsort by address: in place, and qsort may allocate
+static void
+a2l__keyframe_sort(a2l_allocrecord_t *r, uint32_t n) {
+    for (uint32_t i = n / 2; i-- > 0;)
+        a2l__keyframe_sift(r, i, n);
+
+    for (uint32_t end = n; end-- > 1;) {
+        a2l_allocrecord_t swap = r[0];
+        r[0] = r[end];
+        r[end] = swap;
+        a2l__keyframe_sift(r, 0, end);
+    }
+}
+
+static void
+a2l__keyframe_flush(a2l__keyframe_t *k) {
+    if (k->p == k->chunk)
+        return;
+
+    a2l__binlog_write_block(&a2l__binlog_trace, A2L_BLOCK_KEYFRAME, 0, k->chunk, k->p - k->chunk,
+                            0, k->first_ts, a2l_clock_ns() - a2l__binlog_start_ns,
+                            k->lz_table, k->lz_out);
+    k->num_blocks++;
+    k->p = k->chunk;
+    k->prev = 0;
+}
+
+// make room for one more record
+static void
+a2l__keyframe_room(a2l__keyframe_t *k) {
+    if (k->chunk + A2L_KEYFRAME_CHUNK - k->p < A2L_KEYFRAME_RECORD_MAX)
+        a2l__keyframe_flush(k);
+}
+
+static void
+a2l__keyframe_write(void) {
+    a2l_allocrecord_t *records = NULL;
+    uint32_t capacity = 0;
+    uint64_t num_live = 0, live_bytes = 0;
+    a2l__keyframe_t k;
+
+    uint8_t *scratch = a2l_mem_map(A2L_MEM_BUFFERS, A2L_KEYFRAME_SCRATCH_BYTES);
+    if (!scratch)
+        return;
+
+    k.chunk = k.p = scratch;
+    k.lz_table = (uint32_t *)(scratch + A2L_KEYFRAME_CHUNK);
+    k.lz_out = (uint8_t *)(k.lz_table + A2L_LZ_TABLE_ENTRIES);
+    k.prev = 0;
+    k.num_blocks = 0;
+    k.first_ts = a2l_clock_ns() - a2l__binlog_start_ns;
+
+    for (int s = 0; s < A2L_TRACK_SHARDS; s++) {
+        uint32_t n;
+
+        // the shard can grow while the copy is being resized
+        while ((n = a2l_track_snapshot(s, records, capacity)) > capacity) {
+            a2l_mem_unmap(A2L_MEM_BUFFERS, records, capacity * sizeof(a2l_allocrecord_t));
+            capacity = n + n / 2;
+            records = a2l_mem_map(A2L_MEM_BUFFERS, capacity * sizeof(a2l_allocrecord_t));
+            if (!records) {
+                capacity = 0;
+                goto done;
+            }
+        }
+        if (a2l__background_stopping())
+            goto done;
+
+        a2l__keyframe_sort(records, n);
+
+        for (uint32_t i = 0; i < n; i++) {
+            uintptr_t ptr = (uintptr_t)records[i].heap_ptr;
+
+            a2l__keyframe_room(&k);
+            *k.p++ = A2L_REC_LIVE;
+            k.p = a2l_put_varint(k.p, a2l_zigzag((int64_t)(ptr - k.prev)));
+            k.p = a2l_put_varint(k.p, records[i].bytes);
+            k.p = a2l_put_varint(k.p, records[i].stack_hash_id);
+            k.prev = ptr;
+
+            num_live++;
+            live_bytes += records[i].bytes;
+        }
+    }
+
+    // the end record says the keyframe is whole
+    a2l__keyframe_room(&k);
+    *k.p++ = A2L_REC_KEYFRAME;
+    k.p = a2l_put_varint(k.p, k.num_blocks + 1);
+    k.p = a2l_put_varint(k.p, num_live);
+    k.p = a2l_put_varint(k.p, live_bytes);
+    a2l__keyframe_flush(&k);
+
+done:
+    a2l_mem_unmap(A2L_MEM_BUFFERS, records, capacity * sizeof(a2l_allocrecord_t));
+    a2l_mem_unmap(A2L_MEM_BUFFERS, scratch, A2L_KEYFRAME_SCRATCH_BYTES);
+}
+
+#else
+
+static void
+a2l__keyframe_write(void) {
+}
+
+#endif
+
+static void
+a2l__keyframe_pass(void) {
+    if (__atomic_exchange_n(&a2l__keyframe_pending, 0, __ATOMIC_ACQ_REL))
+        a2l__keyframe_write();
+}
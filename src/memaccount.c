@@ -0,0 +1,166 @@
+
+// accounting for alloc2log's own memory, and the budget that bounds it.
+//
+// everything alloc2log keeps for itself is mapped through
+// a2l_mem_map() and charged to a category.  with A2L_MEM_BUDGET set
+// (bytes, K/M/G suffixes ok), a mapping that would cross the budget
+// is refused and flags pressure.  the next hook, holding no locks,
+// calls a2l_mem_relieve(), which degrades one level:
+//
+//   1.   evict stack definitions (cached stacks and symbols)
+//   2-7. also log only 1 in 2, 4 .. 64 new allocations
+//   8.   also unwind at most A2L_DEGRADED_FRAMES frames
+//
+// the live map can't be evicted; when it can't grow, new blocks go
+// untracked instead.  so memory never goes past the budget, except
+// for the fixed stats region if the budget is smaller than it.
+
+#define A2L_MAX_SAMPLE_SHIFT 6
+#define A2L_DEGRADED_FRAMES (A2L_SKIP_FRAMES + 8)
+#define A2L_MAX_DEGRADE_LEVEL (A2L_MAX_SAMPLE_SHIFT + 2)
+
+// counters live here until the stats region exists, then move into it
+static a2l_stats_mem_t a2l__mem_early;
+static a2l_stats_mem_t *a2l__mem = &a2l__mem_early;
+static int a2l__mem_pressure = 0;
+
+static void a2l_stacktable_evict(void);
+static void a2l_binlog_evict(void);
+
+static uint64_t
+a2l__parse_bytes(const char *str) {
+    char *end;
+    uint64_t bytes = strtoull(str, &end, 10);
+
+    switch (*end) {
+    case 'g': case 'G': bytes <<= 10; // fallthrough
+    case 'm': case 'M': bytes <<= 10; // fallthrough
+    case 'k': case 'K': bytes <<= 10;
+    }
+    return bytes;
+}
+
+static void
+a2l_mem_init(void) {
+    const char *budget = getenv("A2L_MEM_BUDGET");
+
+    a2l__mem->max_frames = MAX_FRAMES;
+    if (budget)
+        a2l__mem->budget = a2l__parse_bytes(budget);
+}
+
+// move the counters into the shared stats region
+static void
+a2l_mem_publish(a2l_stats_mem_t *shared) {
+    *shared = *a2l__mem;
+    __atomic_store_n(&a2l__mem, shared, __ATOMIC_RELEASE);
+}
+
+static void
+a2l__mem_peak(uint64_t total) {
+    uint64_t peak = __atomic_load_n(&a2l__mem->peak, __ATOMIC_RELAXED);
+    while (total > peak &&
+           !__atomic_compare_exchange_n(&a2l__mem->peak, &peak, total, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static void
+a2l__mem_add(int category, int64_t bytes) {
+    A2L_ATOMIC_ADD(&a2l__mem->bytes[category], bytes);
+    a2l__mem_peak(A2L_ATOMIC_ADD(&a2l__mem->total, bytes) + bytes);
+}
+
+// charge memory that alloc2log can't run without, budget or not
+static void
+a2l_mem_charge(int category, size_t bytes) {
+    a2l__mem_add(category, (int64_t)bytes);
+}
+
+// 1 if bytes more fit in the budget, and charges them
+static int
+a2l__mem_reserve(int category, size_t bytes) {
+    uint64_t budget = a2l__mem->budget;
+
+    if (!budget) {
+        a2l__mem_add(category, (int64_t)bytes);
+        return 1;
+    }
+
+    uint64_t total = __atomic_load_n(&a2l__mem->total, __ATOMIC_RELAXED);
+    do {
+        if (total + bytes > budget) {
+            A2L_ATOMIC_ADD(&a2l__mem->denied, 1);
+            __atomic_store_n(&a2l__mem_pressure, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+    } while (!__atomic_compare_exchange_n(&a2l__mem->total, &total, total + bytes, 1,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    A2L_ATOMIC_ADD(&a2l__mem->bytes[category], bytes);
+    a2l__mem_peak(total + bytes);
+    return 1;
+}
+
+// anonymous, budget-checked, prefaulted mapping.  NULL if over
+// budget or out of memory.
+static void *
+a2l_mem_map(int category, size_t bytes) {
+    if (!a2l__mem_reserve(category, bytes))
+        return NULL;
+
+    void *p = mmap(NULL, bytes, PROT_READ|PROT_WRITE,
+                   MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE, -1, 0);
+    if (p == MAP_FAILED) {
+        a2l__mem_add(category, -(int64_t)bytes);
+        return NULL;
+    }
+    return p;
+}
+
+static void
+a2l_mem_unmap(int category, void *p, size_t bytes) {
+    if (!p)
+        return;
+    munmap(p, bytes);
+    a2l__mem_add(category, -(int64_t)bytes);
+}
+
+// degrade one level if a mapping was refused since the last call.
+// must be called with no alloc2log locks held.
+static void
+a2l_mem_relieve(void) {
+    if (!__atomic_load_n(&a2l__mem_pressure, __ATOMIC_RELAXED))
+        return;
+    if (!__atomic_exchange_n(&a2l__mem_pressure, 0, __ATOMIC_ACQ_REL))
+        return;
+
+    // past the last level, pressure only evicts
+    uint32_t level = a2l__mem->degrade_level;
+    if (level < A2L_MAX_DEGRADE_LEVEL)
+        __atomic_store_n(&a2l__mem->degrade_level, ++level, __ATOMIC_RELAXED);
+
+    a2l_stacktable_evict();
+    a2l_binlog_evict();
+    A2L_ATOMIC_ADD(&a2l__mem->stack_evictions, 1);
+
+    if (level >= 2) {
+        if (a2l__mem->sample_shift < A2L_MAX_SAMPLE_SHIFT)
+            A2L_ATOMIC_ADD(&a2l__mem->sample_shift, 1);
+        else
+            __atomic_store_n(&a2l__mem->max_frames, A2L_DEGRADED_FRAMES, __ATOMIC_RELAXED);
+    }
+}
+
+// 1 if this thread's next new allocation should be skipped
+static inline int
+a2l_mem_sampled_out(void) {
+    static __thread uint32_t tick __attribute__((tls_model("initial-exec")));
+    uint32_t shift = __atomic_load_n(&a2l__mem->sample_shift, __ATOMIC_RELAXED);
+
+    if (shift == 0 || (tick++ & ((1u << shift) - 1)) == 0)
+        return 0;
+
+    A2L_ATOMIC_ADD(&a2l__mem->events_sampled_out, 1);
+    return 1;
+}
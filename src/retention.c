@@ -0,0 +1,396 @@
+
+// retention for long captures: keep recent events, and per-site
+// trends for the rest, in bounded disk.
+//
+// the background thread compacts closed segments oldest first: once
+// they are A2L_RETAIN_AGE old (30s, 10m, 2h, 7d; plain numbers are
+// seconds), or sooner while the trace's files would take more than
+// A2L_DISK_CAP bytes (K/M/G ok).  compacting sums a segment's events
+// per allocation site over A2L_RETAIN_BUCKET wide buckets (default
+// 60s), appends the sums to <path>.summary, marks the segment
+// compacted in the manifest, and deletes it.  see a2lformat.h.
+//
+// summaries and definitions grow with sites and time, not with
+// events, so the cap holds while it leaves room for a few segments.
+// setting either limit turns segments on; without A2L_SEGMENT_SIZE
+// they are an eighth of the cap, up to 64M.
+
+#define A2L_RETAIN_MAX_SEGMENT (64*1024*1024)
+#define A2L_RETAIN_DEFAULT_BUCKET 60          // seconds
+#define A2L_RETAIN_INITIAL_SITES 4096         // power of two
+#define A2L_RETAIN_CHUNK (64*1024)            // site block payload
+#define A2L_RETAIN_RECORD_MAX 80
+
+// one site's counts in one bucket
+typedef struct {
+    uint64_t bucket_ts;
+    uint32_t stack_id;
+    uint32_t used;
+    uint64_t allocs, frees;
+    uint64_t bytes_alloced, bytes_freed;
+}a2l__retainsite_t;
+
+static uint64_t a2l__retain_age_ns = 0;
+static uint64_t a2l__retain_disk_cap = 0;
+static uint64_t a2l__retain_bucket_ns = A2L_RETAIN_DEFAULT_BUCKET * A2L_NS_PER_SEC;
+
+static a2l__binfile_t a2l__retain_summary = {.fd = -1};
+static uint32_t a2l__retain_next = 0;           // oldest raw segment
+
+// the thread's scratch, mapped for one compaction at a time
+static a2l__retainsite_t *a2l__retain_sites = NULL;
+static uint32_t a2l__retain_site_mask = 0, a2l__retain_site_count = 0;
+static uint8_t *a2l__retain_block = NULL;       // stored, then raw payload
+static size_t a2l__retain_block_bytes = 0;
+static uint8_t *a2l__retain_chunk = NULL;       // chunk, lz table, lz output
+#define A2L_RETAIN_CHUNK_BYTES \
+    (A2L_RETAIN_CHUNK + A2L_LZ_TABLE_ENTRIES*sizeof(uint32_t) + A2L_LZ_BOUND(A2L_RETAIN_CHUNK))
+
+// binlog.c, before the trace is opened
+static void
+a2l_retention_init(void) {
+    const char *age = getenv("A2L_RETAIN_AGE");
+    const char *cap = getenv("A2L_DISK_CAP");
+    const char *bucket = getenv("A2L_RETAIN_BUCKET");
+
+    if (age)
+        a2l__retain_age_ns = a2l__parse_seconds(age) * A2L_NS_PER_SEC;
+    if (cap)
+        a2l__retain_disk_cap = a2l__parse_bytes(cap);
+    if (bucket && a2l__parse_seconds(bucket))
+        a2l__retain_bucket_ns = a2l__parse_seconds(bucket) * A2L_NS_PER_SEC;
+
+    if (!a2l__retain_age_ns && !a2l__retain_disk_cap)
+        return;
+    a2l__background_wanted = 1;
+    if (a2l__binlog_segment_size)
+        return;
+
+    a2l__binlog_segment_size = A2L_RETAIN_MAX_SEGMENT;
+    if (a2l__retain_disk_cap && a2l__retain_disk_cap / 8 < a2l__binlog_segment_size)
+        a2l__binlog_segment_size = a2l__retain_disk_cap / 8;
+    if (a2l__binlog_segment_size < A2L_BINLOG_MIN_SEGMENT)
+        a2l__binlog_segment_size = A2L_BINLOG_MIN_SEGMENT;
+}
+
+// binlog.c: a segmented trace was opened, in this process or a
+// forked child
+static void
+a2l__retention_open(void) {
+    char path[300];
+
+    if (!a2l__retain_age_ns && !a2l__retain_disk_cap)
+        return;
+
+    // a child starts over
+    if (a2l__retain_summary.fd != -1)
+        close(a2l__retain_summary.fd);
+    a2l__retain_summary.lock = 0;
+    a2l__retain_next = 0;
+
+    snprintf(path, sizeof(path), A2L_SUMMARY_PATH_FMT, a2l__binlog_path);
+    a2l__binlog_open(&a2l__retain_summary, path, 0);
+}
+
+//
+// compaction
+//
+
+static void
+a2l__retention_release(void) {
+    a2l_mem_unmap(A2L_MEM_BUFFERS, a2l__retain_sites,
+                  a2l__retain_sites ? (a2l__retain_site_mask + 1) * sizeof(a2l__retainsite_t) : 0);
+    a2l_mem_unmap(A2L_MEM_BUFFERS, a2l__retain_block, a2l__retain_block_bytes);
+    a2l_mem_unmap(A2L_MEM_BUFFERS, a2l__retain_chunk,
+                  a2l__retain_chunk ? A2L_RETAIN_CHUNK_BYTES : 0);
+    a2l__retain_sites = NULL;
+    a2l__retain_site_mask = a2l__retain_site_count = 0;
+    a2l__retain_block = NULL;
+    a2l__retain_block_bytes = 0;
+    a2l__retain_chunk = NULL;
+}
+
+static inline uint32_t
+a2l__retention_site_hash(uint64_t bucket_ts, uint32_t stack_id) {
+    return (uint32_t)(((bucket_ts ^ ((uint64_t)stack_id << 32)) * 0x9e3779b97f4a7c15ULL) >> 32);
+}
+
+static int
+a2l__retention_grow_sites(void) {
+    uint32_t old_capacity = a2l__retain_sites ? a2l__retain_site_mask + 1 : 0;
+    uint32_t new_capacity = old_capacity ? old_capacity * 2 : A2L_RETAIN_INITIAL_SITES;
+    a2l__retainsite_t *sites = a2l_mem_map(A2L_MEM_BUFFERS, new_capacity * sizeof(a2l__retainsite_t));
+
+    if (!sites)
+        return 0;
+
+    for (uint32_t i = 0; i < old_capacity; i++) {
+        a2l__retainsite_t *site = &a2l__retain_sites[i];
+        if (!site->used)
+            continue;
+        uint32_t j = a2l__retention_site_hash(site->bucket_ts, site->stack_id) & (new_capacity - 1);
+        while (sites[j].used)
+            j = (j + 1) & (new_capacity - 1);
+        sites[j] = *site;
+    }
+
+    a2l_mem_unmap(A2L_MEM_BUFFERS, a2l__retain_sites, old_capacity * sizeof(a2l__retainsite_t));
+    a2l__retain_sites = sites;
+    a2l__retain_site_mask = new_capacity - 1;
+    return 1;
+}
+
+// the counts for stack_id in the bucket holding ts.  NULL if the
+// table can't grow.
+static a2l__retainsite_t *
+a2l__retention_site(uint64_t ts, uint32_t stack_id) {
+    uint64_t bucket_ts = ts - ts % a2l__retain_bucket_ns;
+
+    if ((a2l__retain_site_count + 1) * 4 > (a2l__retain_site_mask + 1) * 3 || !a2l__retain_sites)
+        if (!a2l__retention_grow_sites())
+            return NULL;
+
+    uint32_t i = a2l__retention_site_hash(bucket_ts, stack_id) & a2l__retain_site_mask;
+    for (; a2l__retain_sites[i].used; i = (i + 1) & a2l__retain_site_mask) {
+        a2l__retainsite_t *site = &a2l__retain_sites[i];
+        if (site->bucket_ts == bucket_ts && site->stack_id == stack_id)
+            return site;
+    }
+
+    a2l__retainsite_t *site = &a2l__retain_sites[i];
+    site->bucket_ts = bucket_ts;
+    site->stack_id = stack_id;
+    site->used = 1;
+    a2l__retain_site_count++;
+    return site;
+}
+
+// count one decoded block's events.  0 if out of memory.
+static int
+a2l__retention_count(const a2l_blockheader_t *header, const uint8_t *p, const uint8_t *end) {
+    uint64_t ts = header->first_ts;
+
+    while (p < end) {
+        uint8_t type = *p++;
+        uint64_t dt, ptr, a, b, alloc_stack_id = 0;
+
+        // alloc: bytes, stack_id.  free: stack_id, alloc_bytes, alloc_stack_id
+        if (type != A2L_REC_ALLOC && type != A2L_REC_FREE)
+            break;
+        if (!(p = a2l_get_varint(p, end, &dt)) || !(p = a2l_get_varint(p, end, &ptr)) ||
+            !(p = a2l_get_varint(p, end, &a)) || !(p = a2l_get_varint(p, end, &b)))
+            break;
+        if (type == A2L_REC_FREE && !(p = a2l_get_varint(p, end, &alloc_stack_id)))
+            break;
+        ts += dt;
+
+        // a free counts against the site that allocated the block
+        a2l__retainsite_t *site = a2l__retention_site(ts, type == A2L_REC_ALLOC ? (uint32_t)b : (uint32_t)alloc_stack_id);
+        if (!site)
+            return 0;
+        if (type == A2L_REC_ALLOC) {
+            site->allocs++;
+            site->bytes_alloced += a;
+        } else {
+            site->frees++;
+            site->bytes_freed += b;
+        }
+    }
+    return 1;
+}
+
+// count every event in the segment.  0 if it must wait: out of
+// memory, or the thread is stopping.
+static int
+a2l__retention_read(const a2l_manifest_segment_t *entry) {
+    a2l_filetrailer_t trailer;
+    a2l_blockheader_t header;
+    char path[300];
+
+    a2l__binlog_segment_path(path, sizeof(path), entry->segment);
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return 1;       // removed already: nothing to keep
+
+    uint64_t end = entry->bytes;
+    if (end >= sizeof(a2l_fileheader_t) + sizeof(trailer) &&
+        pread(fd, &trailer, sizeof(trailer), end - sizeof(trailer)) == sizeof(trailer) &&
+        trailer.magic == A2L_TRAILER_MAGIC && trailer.index_offset < end)
+        end = trailer.index_offset;
+
+    // a torn or bad block ends the walk, as for any reader
+    uint64_t offset = sizeof(a2l_fileheader_t);
+    while (offset + sizeof(header) <= end) {
+        if (a2l__background_stopping()) {
+            close(fd);
+            return 0;
+        }
+        if (pread(fd, &header, sizeof(header), offset) != sizeof(header) ||
+            header.magic != A2L_BLOCK_MAGIC || header.header_bytes < sizeof(header))
+            break;
+        offset += header.header_bytes;
+
+        size_t need = (size_t)header.stored_bytes + header.raw_bytes;
+        if (need > a2l__retain_block_bytes) {
+            a2l_mem_unmap(A2L_MEM_BUFFERS, a2l__retain_block, a2l__retain_block_bytes);
+            a2l__retain_block_bytes = 0;
+            if (!(a2l__retain_block = a2l_mem_map(A2L_MEM_BUFFERS, need))) {
+                close(fd);
+                return 0;
+            }
+            a2l__retain_block_bytes = need;
+        }
+
+        uint8_t *stored = a2l__retain_block, *raw = stored + header.stored_bytes;
+        if (pread(fd, stored, header.stored_bytes, offset) != (ssize_t)header.stored_bytes ||
+            a2l_checksum(stored, header.stored_bytes) != header.checksum)
+            break;
+        offset += header.stored_bytes;
+
+        if (header.flags & (A2L_BLOCK_DEFINITIONS|A2L_BLOCK_KEYFRAME))
+            continue;
+        if (header.codec == A2L_CODEC_LZ) {
+            if (a2l_lz_decompress(stored, header.stored_bytes, raw, header.raw_bytes) != header.raw_bytes)
+                break;
+        } else {
+            raw = stored;
+        }
+
+        if (!a2l__retention_count(&header, raw, raw + header.raw_bytes)) {
+            close(fd);
+            return 0;
+        }
+    }
+
+    close(fd);
+    return 1;
+}
+
+// append the counted sites to the summary as site blocks
+static void
+a2l__retention_write(const a2l_manifest_segment_t *entry) {
+    uint8_t *chunk = a2l__retain_chunk;
+    uint32_t *lz_table = (uint32_t *)(chunk + A2L_RETAIN_CHUNK);
+    uint8_t *lz_out = (uint8_t *)(lz_table + A2L_LZ_TABLE_ENTRIES);
+    uint8_t *p = chunk;
+
+    for (uint32_t i = 0; a2l__retain_sites && i <= a2l__retain_site_mask; i++) {
+        const a2l__retainsite_t *site = &a2l__retain_sites[i];
+        if (!site->used)
+            continue;
+
+        if (chunk + A2L_RETAIN_CHUNK - p < A2L_RETAIN_RECORD_MAX) {
+            a2l__binlog_write_block(&a2l__retain_summary, A2L_BLOCK_SITES, 0, chunk, p - chunk,
+                                    0, entry->first_ts, entry->last_ts, lz_table, lz_out);
+            p = chunk;
+        }
+        *p++ = A2L_REC_SITE;
+        p = a2l_put_varint(p, site->bucket_ts);
+        p = a2l_put_varint(p, a2l__retain_bucket_ns);
+        p = a2l_put_varint(p, site->stack_id);
+        p = a2l_put_varint(p, site->allocs);
+        p = a2l_put_varint(p, site->frees);
+        p = a2l_put_varint(p, site->bytes_alloced);
+        p = a2l_put_varint(p, site->bytes_freed);
+    }
+
+    if (p > chunk)
+        a2l__binlog_write_block(&a2l__retain_summary, A2L_BLOCK_SITES, 0, chunk, p - chunk,
+                                0, entry->first_ts, entry->last_ts, lz_table, lz_out);
+}
+
+// replace a closed segment with its site counts.  0 if it must wait.
+static int
+a2l__retention_compact(a2l_manifest_segment_t *entry) {
+    char path[300];
+
+    // blocks reserved in it before the roll may not be written yet: a
+    // hole would fail its checksum and end the walk, losing the rest
+    if (__atomic_load_n(&a2l__binlog_writers[entry->segment % A2L_BINLOG_WRITER_SLOTS], __ATOMIC_ACQUIRE))
+        return 0;
+
+    if (!a2l__retain_chunk &&
+        !(a2l__retain_chunk = a2l_mem_map(A2L_MEM_BUFFERS, A2L_RETAIN_CHUNK_BYTES)))
+        return 0;
+
+    if (!a2l__retention_read(entry)) {
+        a2l__retention_release();
+        return 0;
+    }
+
+    // the summary has one writer: this thread
+    uint64_t summary_offset = a2l__retain_summary.offset;
+    a2l__retention_write(entry);
+    a2l__retention_release();
+
+    // summary, then manifest, then delete: an exit part way leaves
+    // the segment listed and readable
+    entry->flags |= A2L_SEGMENT_COMPACTED;
+    entry->summary_offset = summary_offset;
+    entry->summary_bytes = a2l__retain_summary.offset - summary_offset;
+    a2l__binlog_pwrite(a2l__binlog_manifest_fd, entry, sizeof(*entry),
+                       sizeof(a2l_manifest_t) + entry->segment * sizeof(*entry));
+
+    a2l__binlog_segment_path(path, sizeof(path), entry->segment);
+    unlink(path);
+    return 1;
+}
+
+// compact what the policy says is due, oldest first
+static void
+a2l__retention_pass(void) {
+    a2l_manifest_segment_t entry;
+    a2l_manifest_t manifest;
+    int fd = a2l__binlog_manifest_fd;
+
+    if (a2l__retain_summary.fd == -1 ||
+        pread(fd, &manifest, sizeof(manifest), 0) != sizeof(manifest) || !manifest.num_segments)
+        return;
+
+    uint64_t now = a2l_clock_ns() - a2l__binlog_start_ns;
+    uint32_t open_segment = manifest.num_segments - 1;
+
+    // disk in use: raw segments, and the rest
+    uint64_t used = __atomic_load_n(&a2l__binlog_trace.offset, __ATOMIC_RELAXED) +
+                    __atomic_load_n(&a2l__binlog_defs.offset, __ATOMIC_RELAXED) +
+                    a2l__retain_summary.offset +
+                    sizeof(manifest) + manifest.num_segments * sizeof(entry);
+    for (uint32_t s = a2l__retain_next; s < open_segment; s++)
+        if (pread(fd, &entry, sizeof(entry), sizeof(manifest) + s * sizeof(entry)) == sizeof(entry))
+            used += entry.bytes;
+
+    for (; a2l__retain_next < open_segment; a2l__retain_next++) {
+        uint64_t offset = sizeof(manifest) + a2l__retain_next * sizeof(entry);
+
+        if (pread(fd, &entry, sizeof(entry), offset) != sizeof(entry) ||
+            (entry.flags & A2L_SEGMENT_OPEN))
+            return;
+
+        int old = a2l__retain_age_ns && entry.last_ts + a2l__retain_age_ns <= now;
+        // leave room for the open segment to fill
+        int over = a2l__retain_disk_cap && used + a2l__binlog_segment_size > a2l__retain_disk_cap;
+        if (!old && !over)
+            return;
+
+        uint64_t summary_before = a2l__retain_summary.offset;
+        if (!a2l__retention_compact(&entry))
+            return;
+        used -= entry.bytes;
+        used += a2l__retain_summary.offset - summary_before;
+    }
+}
+
+// binlog.c, at exit, once the background thread has stopped and
+// before the manifest closes: catch up on the segments the last
+// flushes closed, so the files left behind are within the cap.
+static void
+a2l_retention_shutdown(void) {
+    if (a2l__retain_summary.fd == -1)
+        return;
+
+    a2l__retention_pass();
+
+    a2l__spin_lock(&a2l__retain_summary.lock);
+    a2l__binlog_close(&a2l__retain_summary);
+    a2l__spin_unlock(&a2l__retain_summary.lock);
+}
@@ -0,0 +1,189 @@
+
+// self-instrumentation: what alloc2log itself costs, per hook stage.
+//
+// unlike FTG_STOPWATCH this is always compiled in.  a stage costs
+// one rdtsc and a few adds to the calling thread's own stats slot,
+// which lives in the shared region so a2l-top sees it too.
+//
+// usage, lap style:
+//   uint64_t lap = a2l_cycles();
+//   backtrace(...);
+//   a2l_stage_lap(A2L_STAGE_UNWIND, &lap);
+//   ...
+//
+// when a stage comes back more than once in a call, collect the laps
+// in an a2l_stagelaps_t and commit once, so each stage counts one
+// sample per call.
+
+static int a2l__selfprof_report = 1;
+
+static inline int
+a2l__log2_bucket(uint64_t cycles) {
+    int bucket = cycles ? 63 - __builtin_clzll(cycles) : 0;
+    return bucket < A2L_STAGE_HIST_BUCKETS ? bucket : A2L_STAGE_HIST_BUCKETS - 1;
+}
+
+static void
+a2l_stage_add(int stage, uint64_t cycles) {
+    if (!a2l__stats)
+        return;
+
+    a2l_stats_thread_t *t = a2l__stats_thread();
+    a2l_stats_stage_t *st = &t->stages[stage];
+    int b = a2l__log2_bucket(cycles);
+
+    // the shared slot has many writers
+    if (t == &a2l__stats->threads[A2L_STATS_SHARED_SLOT]) {
+        A2L_ATOMIC_ADD(&st->count, 1);
+        A2L_ATOMIC_ADD(&st->cycles, cycles);
+        A2L_ATOMIC_ADD(&st->hist[b], 1);
+        uint64_t max = __atomic_load_n(&st->max_cycles, __ATOMIC_RELAXED);
+        while (cycles > max &&
+               !__atomic_compare_exchange_n(&st->max_cycles, &max, cycles, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            ;
+        return;
+    }
+
+    // any other has one writer at a time, so plain read-modify-write
+    __atomic_store_n(&st->count, st->count + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&st->cycles, st->cycles + cycles, __ATOMIC_RELAXED);
+    if (cycles > st->max_cycles)
+        __atomic_store_n(&st->max_cycles, cycles, __ATOMIC_RELAXED);
+    __atomic_store_n(&st->hist[b], st->hist[b] + 1, __ATOMIC_RELAXED);
+}
+
+// charge the time since *lap to stage and restart the lap
+static inline void
+a2l_stage_lap(int stage, uint64_t *lap) {
+    uint64_t now = a2l_cycles();
+    a2l_stage_add(stage, now - *lap);
+    *lap = now;
+}
+
+typedef struct {
+    uint64_t lap;
+    uint32_t used;          // bit per stage
+    uint64_t cycles[A2L_STAGE_COUNT];
+}a2l_stagelaps_t;
+
+static inline void
+a2l_stagelaps_start(a2l_stagelaps_t *sl) {
+    sl->used = 0;
+    sl->lap = a2l_cycles();
+}
+
+static inline void
+a2l_stagelaps_lap(a2l_stagelaps_t *sl, int stage) {
+    uint64_t now = a2l_cycles();
+    if (!(sl->used & (1u << stage))) {
+        sl->used |= 1u << stage;
+        sl->cycles[stage] = 0;
+    }
+    sl->cycles[stage] += now - sl->lap;
+    sl->lap = now;
+}
+
+static void
+a2l_stagelaps_commit(const a2l_stagelaps_t *sl) {
+    for (int s = 0; s < A2L_STAGE_COUNT; s++)
+        if (sl->used & (1u << s))
+            a2l_stage_add(s, sl->cycles[s]);
+}
+
+static void
+a2l_selfprof_init(void) {
+    const char *report = getenv("A2L_SELF_REPORT");
+    if (report && report[0] == '0')
+        a2l__selfprof_report = 0;
+
+    if (a2l__stats) {
+        a2l__stats->start_ns = a2l_clock_ns();
+        a2l__stats->start_cycles = a2l_cycles();
+    }
+}
+
+static void
+a2l__selfprof_write(const char *line, int len) {
+    int result = write(2, line, len);
+    FTG_UNUSED(result);
+}
+
+// upper bound of the bucket holding the q'th quantile
+static uint64_t
+a2l__hist_quantile(const uint64_t *hist, uint64_t count, double q) {
+    uint64_t want = (uint64_t)(q * (double)count), seen = 0;
+
+    for (int b = 0; b < A2L_STAGE_HIST_BUCKETS; b++) {
+        seen += hist[b];
+        if (seen > want)
+            return (uint64_t)2 << b;
+    }
+    return (uint64_t)2 << (A2L_STAGE_HIST_BUCKETS - 1);
+}
+
+// at exit, one table on stderr.  unset by A2L_SELF_REPORT=0.
+static void
+a2l_selfprof_report(void) {
+    static const char *names[] = A2L_STAGE_NAMES;
+    a2l_stats_stage_t sum[A2L_STAGE_COUNT];
+    char line[256];
+    int len;
+
+    if (!a2l__stats || !a2l__selfprof_report)
+        return;
+
+    memset(sum, 0, sizeof(sum));
+    uint32_t num_threads = FTG_MIN(a2l__stats->num_threads, A2L_STATS_MAX_THREADS);
+    for (uint32_t t = 0; t < num_threads; t++) {
+        for (int s = 0; s < A2L_STAGE_COUNT; s++) {
+            const a2l_stats_stage_t *st = &a2l__stats->threads[t].stages[s];
+            sum[s].count += st->count;
+            sum[s].cycles += st->cycles;
+            sum[s].max_cycles = FTG_MAX(sum[s].max_cycles, st->max_cycles);
+            for (int b = 0; b < A2L_STAGE_HIST_BUCKETS; b++)
+                sum[s].hist[b] += st->hist[b];
+        }
+    }
+
+    if (sum[A2L_STAGE_WRAPPER].count == 0)
+        return;
+
+    uint64_t elapsed_ns = a2l_clock_ns() - a2l__stats->start_ns;
+    uint64_t elapsed_cycles = a2l_cycles() - a2l__stats->start_cycles;
+    double ns_per_cycle = elapsed_cycles ? (double)elapsed_ns / (double)elapsed_cycles : 1.0;
+
+    len = snprintf(line, sizeof(line),
+                   "alloc2log: self profile, pid %d, %.3f s, %.3f ns/cycle\n"
+                   "  %-10s %12s %12s %10s %10s %10s %12s %6s\n",
+                   getpid(), (double)elapsed_ns / 1e9, ns_per_cycle,
+                   "stage", "calls", "mean cyc", "p50 <", "p99 <", "max", "total ms", "%");
+    a2l__selfprof_write(line, len);
+
+    double wrapper_cycles = (double)sum[A2L_STAGE_WRAPPER].cycles;
+    for (int s = 0; s < A2L_STAGE_COUNT; s++) {
+        const a2l_stats_stage_t *st = &sum[s];
+        if (st->count == 0)
+            continue;
+
+        len = snprintf(line, sizeof(line),
+                       "  %-10s %12" PRIu64 " %12.0f %10" PRIu64 " %10" PRIu64
+                       " %10" PRIu64 " %12.2f %6.1f\n",
+                       names[s], st->count,
+                       (double)st->cycles / (double)st->count,
+                       a2l__hist_quantile(st->hist, st->count, 0.50),
+                       a2l__hist_quantile(st->hist, st->count, 0.99),
+                       st->max_cycles,
+                       (double)st->cycles * ns_per_cycle / 1e6,
+                       100.0 * (double)st->cycles / wrapper_cycles);
+        a2l__selfprof_write(line, len);
+    }
+
+    const a2l_stats_mem_t *mem = &a2l__stats->mem;
+    len = snprintf(line, sizeof(line),
+                   "  memory: peak %" PRIu64 " KiB, budget %" PRIu64 " KiB, degrade level %u, "
+                   "%" PRIu64 " sampled out, %" PRIu64 " untracked\n",
+                   mem->peak >> 10, mem->budget >> 10, mem->degrade_level,
+                   mem->events_sampled_out, mem->allocs_untracked);
+    a2l__selfprof_write(line, len);
+}
@@ -0,0 +1,273 @@
+
+// live counters exported through shared memory for a2l-top.
+// see a2lstats.h for the layout.
+
+#include "a2lstats.h"
+
+static a2l_stats_t *a2l__stats = NULL;
+static char a2l__stats_shm_name[32];
+static pid_t a2l__stats_owner = 0;      // the pid that created the name
+
+static __thread int a2l__thread_slot
+    __attribute__((tls_model("initial-exec"))) = -1;
+static pthread_key_t a2l__stats_key;
+
+static void a2l__stats_thread_exit(void *arg);
+
+// a fresh region for this pid, /a2l-<pid>, or private memory when
+// there is no /dev/shm.  NULL if neither maps.
+static a2l_stats_t *
+a2l__stats_map(void) {
+    size_t bytes = sizeof(a2l_stats_t);
+    void *region = MAP_FAILED;
+
+    snprintf(a2l__stats_shm_name, sizeof(a2l__stats_shm_name),
+             A2L_STATS_SHM_NAME_FMT, getpid());
+
+    int fd = shm_open(a2l__stats_shm_name, O_CREAT|O_RDWR|O_TRUNC, S_IRUSR|S_IWUSR);
+    if (fd != -1) {
+        if (ftruncate(fd, bytes) == 0)
+            region = mmap(NULL, bytes, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, 0);
+        close(fd);
+    }
+    if (region != MAP_FAILED) {
+        a2l__stats_owner = getpid();
+        return region;
+    }
+
+    // no /dev/shm: keep counting privately so nothing else has to care
+    a2l__stats_shm_name[0] = '\0';
+    region = mmap(NULL, bytes, PROT_READ|PROT_WRITE,
+                  MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE, -1, 0);
+    return region == MAP_FAILED ? NULL : region;
+}
+
+static void
+a2l__stats_publish(a2l_stats_t *region) {
+    a2l__stats = region;
+    a2l_mem_publish(&a2l__stats->mem);
+    a2l__stats->pid = getpid();
+    a2l__stats->max_threads = A2L_STATS_MAX_THREADS;
+    a2l__stats->max_sites = A2L_STATS_MAX_SITES;
+    a2l__stats->version = A2L_STATS_VERSION;
+    __atomic_store_n(&a2l__stats->magic, A2L_STATS_MAGIC, __ATOMIC_RELEASE);
+}
+
+// a forked child inherits the parent's mapping and name.  it counts
+// into a region of its own instead, so a2l-top keeps seeing the
+// parent as it was; site labels carry over, counts start at zero.
+static void
+a2l__stats_atfork_child(void) {
+    a2l_stats_t *parent = a2l__stats;
+
+    a2l__stats = NULL;
+    a2l__thread_slot = -1;
+    if (!parent)
+        return;
+
+    // the accounting lives in the region: hold it privately meanwhile
+    a2l__mem_early = *a2l__mem;
+    a2l__mem = &a2l__mem_early;
+
+    a2l_stats_t *region = a2l__stats_map();
+    if (region) {
+        for (uint32_t i = 0; i < A2L_STATS_MAX_SITES; i++) {
+            const a2l_stats_site_t *from = &parent->sites[i];
+            a2l_stats_site_t *to = &region->sites[i];
+
+            // same slots, so probes find them where they were
+            to->hash_id = from->hash_id;
+            if (from->label_ready == 1) {
+                memcpy(to->label, from->label, A2L_STATS_LABEL_LEN);
+                to->label_ready = 1;
+            }
+        }
+        region->start_ns = a2l_clock_ns();
+        region->start_cycles = a2l_cycles();
+    }
+    munmap(parent, sizeof(a2l_stats_t));
+    if (!region) {
+        a2l__mem_add(A2L_MEM_STATS, -(int64_t)sizeof(a2l_stats_t));
+        return;
+    }
+    a2l__stats_publish(region);
+}
+
+static void
+a2l_stats_init(void) {
+    a2l_stats_t *region = a2l__stats_map();
+
+    if (!region)
+        return;
+    a2l_mem_charge(A2L_MEM_STATS, sizeof(a2l_stats_t));
+    a2l__stats_publish(region);
+    pthread_key_create(&a2l__stats_key, a2l__stats_thread_exit);
+    pthread_atfork(NULL, NULL, a2l__stats_atfork_child);
+}
+
+// the name is the creating process's: a child that got here without
+// the atfork handler (a raw clone) must not take it from the parent
+static void
+a2l_stats_shutdown(void) {
+    if (a2l__stats_shm_name[0] != '\0' && a2l__stats_owner == getpid())
+        shm_unlink(a2l__stats_shm_name);
+}
+
+static uint32_t
+a2l_gettid(void) {
+    return (uint32_t)syscall(SYS_gettid);
+}
+
+// a slot a thread freed, else a new one, else the shared one.  a
+// slot's counts carry on from its last thread's, so they stay monotonic.
+static a2l_stats_thread_t *
+a2l__stats_thread(void) {
+    if (a2l__thread_slot == -1) {
+        uint32_t used = __atomic_load_n(&a2l__stats->num_threads, __ATOMIC_RELAXED);
+        int slot = -1;
+
+        for (uint32_t i = 0; i < used && i < A2L_STATS_SHARED_SLOT && slot < 0; i++) {
+            uint32_t expected = 1;
+            if (__atomic_load_n(&a2l__stats->threads[i].free, __ATOMIC_RELAXED) &&
+                __atomic_compare_exchange_n(&a2l__stats->threads[i].free, &expected, 0, 0,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                slot = (int)i;
+        }
+        // stops at max, so it can't wrap however many threads come and go
+        if (slot < 0 && used < A2L_STATS_MAX_THREADS)
+            slot = (int)A2L_ATOMIC_ADD(&a2l__stats->num_threads, 1);
+        if (slot < 0 || slot >= A2L_STATS_SHARED_SLOT)
+            slot = A2L_STATS_SHARED_SLOT;
+
+        a2l__thread_slot = slot;
+        a2l__stats->threads[slot].tid = a2l_gettid();
+        if (slot != A2L_STATS_SHARED_SLOT)
+            pthread_setspecific(a2l__stats_key, a2l__stats);
+    }
+
+    return &a2l__stats->threads[a2l__thread_slot];
+}
+
+// pthread key destructor: the thread is exiting.  whatever it counts
+// after this, in other destructors, goes to the shared slot.
+static void
+a2l__stats_thread_exit(void *arg) {
+    int slot = a2l__thread_slot;
+
+    a2l__thread_slot = A2L_STATS_SHARED_SLOT;
+    // a child's region isn't the one the value was set for
+    if (arg == a2l__stats && slot >= 0 && slot != A2L_STATS_SHARED_SLOT)
+        __atomic_store_n(&a2l__stats->threads[slot].free, 1, __ATOMIC_RELEASE);
+}
+
+// find or claim the site slot for hash_id.  NULL if the probe
+// window is full.
+static a2l_stats_site_t *
+a2l__stats_site(uint32_t hash_id) {
+    if (hash_id == 0)
+        hash_id = 1;
+
+    for (uint32_t i = 0; i < A2L_STATS_MAX_PROBE; i++) {
+        a2l_stats_site_t *site =
+            &a2l__stats->sites[(hash_id + i) & (A2L_STATS_MAX_SITES-1)];
+        uint32_t current = __atomic_load_n(&site->hash_id, __ATOMIC_ACQUIRE);
+
+        if (current == hash_id)
+            return site;
+
+        if (current == 0) {
+            uint32_t expected = 0;
+            if (__atomic_compare_exchange_n(&site->hash_id, &expected, hash_id, 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+                return site;
+            if (expected == hash_id)
+                return site;
+        }
+    }
+
+    return NULL;
+}
+
+// name a site from its first caller frame, once.
+static void
+a2l_stats_label_site(uint32_t hash_id, const char *frame_desc) {
+    if (!a2l__stats)
+        return;
+
+    a2l_stats_site_t *site = a2l__stats_site(hash_id);
+    if (!site || __atomic_load_n(&site->label_ready, __ATOMIC_ACQUIRE))
+        return;
+
+    uint32_t expected = 0;
+    if (!__atomic_compare_exchange_n(&site->label_ready, &expected, 2, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        return;
+
+    // label_ready: 0 unset, 2 being written, 1 ready
+    snprintf(site->label, A2L_STATS_LABEL_LEN, "%s", frame_desc);
+    __atomic_store_n(&site->label_ready, 1, __ATOMIC_RELEASE);
+}
+
+static void
+a2l__stats_count(a2l_stats_counters_t *c, int is_alloc, uint64_t bytes) {
+    if (is_alloc) {
+        A2L_ATOMIC_ADD(&c->allocs, 1);
+        A2L_ATOMIC_ADD(&c->bytes_alloced, bytes);
+    } else {
+        A2L_ATOMIC_ADD(&c->frees, 1);
+        A2L_ATOMIC_ADD(&c->bytes_freed, bytes);
+    }
+}
+
+static void
+a2l_stats_alloc(uint32_t hash_id, size_t bytes) {
+    if (!a2l__stats)
+        return;
+
+    a2l__stats_count(&a2l__stats_thread()->counters, 1, bytes);
+
+    a2l_stats_site_t *site = a2l__stats_site(hash_id);
+    if (site)
+        a2l__stats_count(&site->counters, 1, bytes);
+    else
+        A2L_ATOMIC_ADD(&a2l__stats->sites_dropped, 1);
+
+    uint64_t live = A2L_ATOMIC_ADD(&a2l__stats->live_bytes, bytes) + bytes;
+    uint64_t peak = __atomic_load_n(&a2l__stats->peak_live_bytes, __ATOMIC_RELAXED);
+    while (live > peak &&
+           !__atomic_compare_exchange_n(&a2l__stats->peak_live_bytes, &peak, live, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+// an alloc sampled out under the memory budget: it counts toward the
+// thread's rates, but not its site's or live bytes, since its free
+// can't be matched to it
+static void
+a2l_stats_alloc_sampled(size_t bytes) {
+    if (!a2l__stats)
+        return;
+
+    a2l__stats_count(&a2l__stats_thread()->counters, 1, bytes);
+}
+
+// record is the tracked allocation being freed, or NULL if the
+// pointer was never seen (allocated before init, or by calloc/realloc).
+static void
+a2l_stats_free(const a2l_allocrecord_t *record) {
+    if (!a2l__stats)
+        return;
+
+    uint64_t bytes = record ? record->bytes : 0;
+
+    a2l__stats_count(&a2l__stats_thread()->counters, 0, bytes);
+
+    if (!record)
+        return;
+
+    a2l_stats_site_t *site = a2l__stats_site(record->stack_hash_id);
+    if (site)
+        a2l__stats_count(&site->counters, 0, bytes);
+
+    A2L_ATOMIC_SUB(&a2l__stats->live_bytes, bytes);
+}
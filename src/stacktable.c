@@ -0,0 +1,213 @@
+
+// stack definitions: hash_id -> the stack's frames and their
+// symbolized, formatted text.
+//
+// backtrace_symbols() is most of the hook's cost, and a program only
+// has so many distinct stacks.  a hit skips symbolize and most of
+// format.  frames are compared on lookup, so a hash_id collision is
+// a miss, not a wrong stack.
+//
+// shards are an open addressed index into an append-only arena, both
+// budget-checked through memaccount.c.  a2l_stacktable_evict() drops
+// everything; definitions are rebuilt on the next miss.
+
+#define A2L_STACKTABLE_SHARDS 16                 // power of two
+#define A2L_STACKTABLE_INITIAL_SLOTS 256         // per shard, power of two
+#define A2L_STACKTABLE_INITIAL_ARENA (64*1024)   // per shard
+
+typedef struct {
+    uint32_t hash_id;
+    uint32_t offset;        // into arena, + 1; 0 marks an empty slot
+}a2l__stackslot_t;
+
+// arena entry, followed by frames then text
+typedef struct {
+    uint32_t num_frames;
+    uint32_t text_len;
+}a2l__stackdef_t;
+
+typedef struct {
+    int lock;
+    uint32_t count;
+    uint32_t mask;
+    a2l__stackslot_t *slots;
+    char *arena;
+    size_t arena_used, arena_size;
+}__attribute__((aligned(64))) a2l__stackshard_t;
+
+static a2l__stackshard_t a2l__stack_shards[A2L_STACKTABLE_SHARDS];
+
+static inline a2l__stackshard_t *
+a2l__stacktable_shard(uint32_t hash_id) {
+    return &a2l__stack_shards[(hash_id >> 24) & (A2L_STACKTABLE_SHARDS-1)];
+}
+
+static inline void
+a2l__stacktable_lock(a2l__stackshard_t *shard) {
+    while (__atomic_test_and_set(&shard->lock, __ATOMIC_ACQUIRE))
+        while (__atomic_load_n(&shard->lock, __ATOMIC_RELAXED))
+            A2L_CPU_RELAX();
+}
+
+static inline void
+a2l__stacktable_unlock(a2l__stackshard_t *shard) {
+    __atomic_clear(&shard->lock, __ATOMIC_RELEASE);
+}
+
+static const a2l__stackdef_t *
+a2l__stacktable_find(a2l__stackshard_t *shard, uint32_t hash_id,
+                     void * const *frames, int num_frames) {
+    if (!shard->slots)
+        return NULL;
+
+    for (uint32_t i = hash_id & shard->mask; shard->slots[i].offset; i = (i + 1) & shard->mask) {
+        if (shard->slots[i].hash_id != hash_id)
+            continue;
+
+        const a2l__stackdef_t *def =
+            (const a2l__stackdef_t *)(shard->arena + shard->slots[i].offset - 1);
+        if ((int)def->num_frames == num_frames &&
+            memcmp(def + 1, frames, num_frames * sizeof(void*)) == 0)
+            return def;
+    }
+    return NULL;
+}
+
+// copies the cached text for this stack to out.  returns its length,
+// or -1 on a miss or if out is too small.
+static int
+a2l_stacktable_get(uint32_t hash_id, void * const *frames, int num_frames,
+                   char *out, size_t out_len) {
+    a2l__stackshard_t *shard = a2l__stacktable_shard(hash_id);
+    int len = -1;
+
+    a2l__stacktable_lock(shard);
+    const a2l__stackdef_t *def = a2l__stacktable_find(shard, hash_id, frames, num_frames);
+    if (def && def->text_len <= out_len) {
+        memcpy(out, (const char *)(def + 1) + def->num_frames * sizeof(void*), def->text_len);
+        len = (int)def->text_len;
+    }
+    a2l__stacktable_unlock(shard);
+
+    return len;
+}
+
+static int
+a2l__stacktable_grow_slots(a2l__stackshard_t *shard) {
+    uint32_t old_capacity = shard->slots ? shard->mask + 1 : 0;
+    uint32_t new_capacity = old_capacity ? old_capacity * 2 : A2L_STACKTABLE_INITIAL_SLOTS;
+    a2l__stackslot_t *slots = a2l_mem_map(A2L_MEM_STACKS, new_capacity * sizeof(a2l__stackslot_t));
+
+    if (!slots)
+        return 0;
+
+    for (uint32_t i = 0; i < old_capacity; i++) {
+        if (!shard->slots[i].offset)
+            continue;
+        uint32_t j = shard->slots[i].hash_id & (new_capacity - 1);
+        while (slots[j].offset)
+            j = (j + 1) & (new_capacity - 1);
+        slots[j] = shard->slots[i];
+    }
+
+    a2l_mem_unmap(A2L_MEM_STACKS, shard->slots, old_capacity * sizeof(a2l__stackslot_t));
+    shard->slots = slots;
+    shard->mask = new_capacity - 1;
+    return 1;
+}
+
+static int
+a2l__stacktable_grow_arena(a2l__stackshard_t *shard, size_t need) {
+    size_t size = shard->arena_size ? shard->arena_size : A2L_STACKTABLE_INITIAL_ARENA;
+
+    while (size < shard->arena_used + need)
+        size *= 2;
+    if (size > UINT32_MAX)
+        return 0;
+
+    char *arena = a2l_mem_map(A2L_MEM_SYMBOLS, size);
+    if (!arena)
+        return 0;
+
+    if (shard->arena) {
+        memcpy(arena, shard->arena, shard->arena_used);
+        a2l_mem_unmap(A2L_MEM_SYMBOLS, shard->arena, shard->arena_size);
+    }
+    shard->arena = arena;
+    shard->arena_size = size;
+    return 1;
+}
+
+// define a stack.  silently does nothing if the budget won't allow it.
+static void
+a2l_stacktable_put(uint32_t hash_id, void * const *frames, int num_frames,
+                   const char *text, size_t text_len) {
+    a2l__stackshard_t *shard = a2l__stacktable_shard(hash_id);
+    size_t need = sizeof(a2l__stackdef_t) + num_frames * sizeof(void*) + text_len;
+    need = (need + 7) & ~(size_t)7;
+
+    a2l__stacktable_lock(shard);
+
+    if (a2l__stacktable_find(shard, hash_id, frames, num_frames))
+        goto done;
+
+    if (!shard->slots || (shard->count + 1) * 4 > (shard->mask + 1) * 3)
+        if (!a2l__stacktable_grow_slots(shard))
+            goto done;
+
+    if (shard->arena_used + need > shard->arena_size)
+        if (!a2l__stacktable_grow_arena(shard, need))
+            goto done;
+
+    a2l__stackdef_t *def = (a2l__stackdef_t *)(shard->arena + shard->arena_used);
+    def->num_frames = (uint32_t)num_frames;
+    def->text_len = (uint32_t)text_len;
+    memcpy(def + 1, frames, num_frames * sizeof(void*));
+    memcpy((char *)(def + 1) + num_frames * sizeof(void*), text, text_len);
+
+    uint32_t i = hash_id & shard->mask;
+    while (shard->slots[i].offset)
+        i = (i + 1) & shard->mask;
+    shard->slots[i].hash_id = hash_id;
+    shard->slots[i].offset = (uint32_t)shard->arena_used + 1;
+
+    shard->arena_used += need;
+    shard->count++;
+
+done:
+    a2l__stacktable_unlock(shard);
+}
+
+static void
+a2l_stacktable_evict(void) {
+    for (int i = 0; i < A2L_STACKTABLE_SHARDS; i++) {
+        a2l__stackshard_t *shard = &a2l__stack_shards[i];
+
+        a2l__stacktable_lock(shard);
+        if (shard->slots)
+            a2l_mem_unmap(A2L_MEM_STACKS, shard->slots, (shard->mask + 1) * sizeof(a2l__stackslot_t));
+        a2l_mem_unmap(A2L_MEM_SYMBOLS, shard->arena, shard->arena_size);
+        shard->slots = NULL;
+        shard->arena = NULL;
+        shard->mask = 0;
+        shard->count = 0;
+        shard->arena_used = shard->arena_size = 0;
+        a2l__stacktable_unlock(shard);
+    }
+}
+
+// in a fork child: a thread that held a shard lock is gone, and may
+// have left its shard half written.  a binary trace's child also has
+// to define every stack again in its own trace.
+static void
+a2l__stacktable_atfork_child(void) {
+    for (int i = 0; i < A2L_STACKTABLE_SHARDS; i++)
+        a2l__stack_shards[i].lock = 0;
+    a2l_stacktable_evict();
+}
+
+// shards are made on first use; only the fork handler needs setting up
+static void
+a2l_stacktable_init(void) {
+    pthread_atfork(NULL, NULL, a2l__stacktable_atfork_child);
+}
@@ -1,8 +1,4 @@
 
-#if A2L_TRACK_ALLOCS
-
-#define MAX_ALLOC_RECORDS_SOFT 4096  // hashindex soft limit
-
 //
 // Storage Records
 //
@@ -12,34 +8,210 @@ typedef struct {
     uint32_t stack_hash_id;
 }a2l_allocrecord_t;
 
-static ftgc_hashindex_s a2l_allocrecord_hindex;
-static a2l_allocrecord_t a2l_allocrecord_records[MAX_ALLOC_RECORDS_SOFT]; // todo: make this heap-based, realloc scheme
+#if A2L_TRACK_ALLOCS
 
-static void a2l_track_allocs_init(void) {
-    ftgc_hashindex_init(&a2l_allocrecord_hindex, MAX_ALLOC_RECORDS_SOFT);
+// live allocation map: heap ptr -> a2l_allocrecord_t.
+//
+// this runs inside malloc and free, so it can't use the heap, and it
+// sees every thread.  ptrs are spread over shards, each an open
+// addressed table behind its own spinlock.  tables are mapped through
+// memaccount.c and double when they pass 3/4 load.  when the memory
+// budget won't allow that, a table fills to 15/16 and then new blocks
+// go untracked.
+//
+// ftgc_hashindex isn't used here because it allocates through malloc
+// and has no removal that keeps probe chains intact.
+
+#define A2L_TRACK_SHARDS 64                  // power of two
+#define A2L_TRACK_INITIAL_RECORDS 256        // per shard, power of two
+
+typedef struct {
+    int lock;
+    uint32_t count;
+    uint32_t mask;                  // table capacity - 1
+    a2l_allocrecord_t *records;     // heap_ptr == NULL marks an empty slot
+}__attribute__((aligned(64))) a2l__trackshard_t;
+
+static a2l__trackshard_t a2l__track_shards[A2L_TRACK_SHARDS];
+
+static inline uint64_t
+a2l__track_hash(const void *ptr) {
+    // malloc ptrs are 16-byte aligned; fold and mix the rest
+    uint64_t h = (uint64_t)(uintptr_t)ptr >> 4;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline void
+a2l__track_lock(a2l__trackshard_t *shard) {
+    while (__atomic_test_and_set(&shard->lock, __ATOMIC_ACQUIRE))
+        while (__atomic_load_n(&shard->lock, __ATOMIC_RELAXED))
+            A2L_CPU_RELAX();
+}
+
+static inline void
+a2l__track_unlock(a2l__trackshard_t *shard) {
+    __atomic_clear(&shard->lock, __ATOMIC_RELEASE);
+}
+
+static void
+a2l__track_insert_nolock(a2l__trackshard_t *shard, const a2l_allocrecord_t *record) {
+    uint32_t i = (uint32_t)(a2l__track_hash(record->heap_ptr) >> 6) & shard->mask;
+
+    for (;;) {
+        a2l_allocrecord_t *slot = &shard->records[i];
+        if (slot->heap_ptr == NULL || slot->heap_ptr == record->heap_ptr) {
+            if (slot->heap_ptr == NULL)
+                shard->count++;
+            *slot = *record;
+            return;
+        }
+        i = (i + 1) & shard->mask;
+    }
+}
+
+// returns 0 if the table couldn't grow
+static int
+a2l__track_grow(a2l__trackshard_t *shard) {
+    uint32_t old_capacity = shard->mask + 1;
+    uint32_t new_capacity = shard->records ? old_capacity * 2 : A2L_TRACK_INITIAL_RECORDS;
+    a2l_allocrecord_t *old_records = shard->records;
+    a2l_allocrecord_t *new_records =
+        a2l_mem_map(A2L_MEM_LIVEMAP, sizeof(a2l_allocrecord_t) * new_capacity);
+
+    if (!new_records)
+        return 0;
+
+    shard->records = new_records;
+    shard->mask = new_capacity - 1;
+    shard->count = 0;
+
+    if (old_records) {
+        for (uint32_t i = 0; i < old_capacity; i++)
+            if (old_records[i].heap_ptr)
+                a2l__track_insert_nolock(shard, &old_records[i]);
+        a2l_mem_unmap(A2L_MEM_LIVEMAP, old_records, sizeof(a2l_allocrecord_t) * old_capacity);
+    }
+
+    return 1;
 }
 
-// todo:
-// implement ptr to a2l_alloc_record dictionary
+// in a fork child only the forking thread survives: a shard another
+// thread had locked stays locked, and the child would spin on it.  the
+// table is as that thread left it.
+static void
+a2l__track_atfork_child(void) {
+    for (int i = 0; i < A2L_TRACK_SHARDS; i++)
+        a2l__track_shards[i].lock = 0;
+}
 
+static void a2l_track_allocs_init(void) {
+    for (int i = 0; i < A2L_TRACK_SHARDS; i++)
+        a2l__track_grow(&a2l__track_shards[i]);
+    pthread_atfork(NULL, NULL, a2l__track_atfork_child);
+}
+
+// with ts, also reads the clock under the shard lock, so the time
+// orders the insert against a keyframe's copy of the shard.  *ts is
+// left alone if the block goes untracked.
 static void
-a2l_track_alloc(void *ptr) {
-    return;
+a2l_track_alloc(void *ptr, size_t bytes, uint32_t stack_hash_id, uint64_t *ts) {
     if (!ptr)
         return;
 
-    // generate a key based on the ptr.  the main reason
-    // this is done instead of using the hashindex key as the hash_id
-    // for the end-user log is because hashindex collisions have
-    // an in-program resolution, but hash_ids need collisions to be
-    // improbable.
-    ftgc_hashkey_t key;
+    a2l_allocrecord_t record = {ptr, bytes, stack_hash_id};
+    a2l__trackshard_t *shard =
+        &a2l__track_shards[a2l__track_hash(ptr) & (A2L_TRACK_SHARDS-1)];
+
+    a2l__track_lock(shard);
+    if (!shard->records ||
+        (shard->count + 1) * 4 > (shard->mask + 1) * 3) {
+        // can't grow: keep filling, but never so full that probes run long
+        if (!a2l__track_grow(shard) &&
+            (!shard->records || (shard->count + 1) * 16 > (shard->mask + 1) * 15)) {
+            a2l__track_unlock(shard);
+            A2L_ATOMIC_ADD(&a2l__mem->allocs_untracked, 1);
+            return;
+        }
+    }
+    a2l__track_insert_nolock(shard, &record);
+    if (ts)
+        *ts = a2l_clock_ns();
+    a2l__track_unlock(shard);
+}
+
+// removes ptr from the map.  returns 1 and fills *out if ptr was
+// being tracked, and with ts, the time as a2l_track_alloc() does.
+static int
+a2l_track_free(void *ptr, a2l_allocrecord_t *out, uint64_t *ts) {
+    if (!ptr)
+        return 0;
+
+    a2l__trackshard_t *shard =
+        &a2l__track_shards[a2l__track_hash(ptr) & (A2L_TRACK_SHARDS-1)];
+    int found = 0;
+
+    a2l__track_lock(shard);
+    if (!shard->records) {
+        a2l__track_unlock(shard);
+        return 0;
+    }
+
+    uint32_t mask = shard->mask;
+    uint32_t i = (uint32_t)(a2l__track_hash(ptr) >> 6) & mask;
+
+    while (shard->records[i].heap_ptr) {
+        if (shard->records[i].heap_ptr == ptr) {
+            found = 1;
+            *out = shard->records[i];
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+
+    if (found) {
+        // backward shift deletion keeps every probe chain unbroken
+        // without tombstones
+        uint32_t hole = i;
+        for (uint32_t j = (i + 1) & mask; shard->records[j].heap_ptr; j = (j + 1) & mask) {
+            uint32_t home = (uint32_t)(a2l__track_hash(shard->records[j].heap_ptr) >> 6) & mask;
+            if (((j - home) & mask) >= ((j - hole) & mask)) {
+                shard->records[hole] = shard->records[j];
+                hole = j;
+            }
+        }
+        shard->records[hole].heap_ptr = NULL;
+        shard->count--;
+        if (ts)
+            *ts = a2l_clock_ns();
+    }
+
+    a2l__track_unlock(shard);
+    return found;
+}
 
-    key = ftgc_hashindex_generate_key_ptr(&a2l_allocrecord_hindex, ptr);
+// copy shard's live records into out, which holds capacity of them.
+// returns how many there are; if more than capacity, nothing is
+// copied.
+static uint32_t
+a2l_track_snapshot(int shard_index, a2l_allocrecord_t *out, uint32_t capacity) {
+    a2l__trackshard_t *shard = &a2l__track_shards[shard_index];
+    uint32_t n = 0;
 
-    int record_index = 999; // todo: implement data structure
+    a2l__track_lock(shard);
+    if (shard->count > capacity || !shard->records) {
+        n = shard->count;
+        a2l__track_unlock(shard);
+        return n;
+    }
+    for (uint32_t i = 0; i <= shard->mask; i++)
+        if (shard->records[i].heap_ptr)
+            out[n++] = shard->records[i];
+    a2l__track_unlock(shard);
 
-    ftgc_hashindex_add_key(&a2l_allocrecord_hindex, key, record_index);
+    return n;
 }
 
 #endif
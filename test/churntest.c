@@ -0,0 +1,79 @@
+// churntest.c -- a heap that churns long enough to be compacted.
+//
+// usage: churntest [threads] [seconds]
+//
+// each thread leaks CHURN_LEAKS blocks up front, then churns a table of
+// blocks until time's up and frees them all.  so however much is
+// compacted away, the heap ends at the leaks alone, which it prints
+// in bytes.  retentiontest.sh runs it with a small disk cap and checks
+// the tools agree on that.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CHURN_LEAKS       1000
+#define CHURN_LEAK_SIZE   100
+#define CHURN_TABLE       4096
+
+static double churn_seconds = 5;
+
+// the optimizer may drop a malloc whose block goes nowhere
+void *volatile churn_sink;
+
+static double
+churn_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+__attribute__((noinline)) static void
+churn_leak(size_t bytes) {
+    churn_sink = malloc(bytes);
+}
+
+static void *
+churn_thread(void *arg) {
+    long id = (long)arg;
+    void *table[CHURN_TABLE] = {0};
+    unsigned r = (unsigned)id * 7919 + 1;
+    double end = churn_now() + churn_seconds;
+    long i = 0;
+
+    for (int j = 0; j < CHURN_LEAKS; j++)
+        churn_leak(CHURN_LEAK_SIZE);
+    while (churn_now() < end) {
+        for (int j = 0; j < 500; j++, i++) {
+            r = r * 1103515245 + 12345;
+            int k = (r >> 8) % CHURN_TABLE;
+            free(table[k]);
+            table[k] = (r & 1) ? malloc(16 + (i % 7) * 32 + id) : NULL;
+        }
+        usleep(500);
+    }
+    for (int k = 0; k < CHURN_TABLE; k++)
+        free(table[k]);
+    return NULL;
+}
+
+int
+main(int argc, char **argv) {
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    pthread_t t[64];
+
+    if (argc > 2)
+        churn_seconds = atof(argv[2]);
+    if (threads < 1 || threads > 64) {
+        fprintf(stderr, "usage: churntest [threads 1-64] [seconds]\n");
+        return 1;
+    }
+    for (long i = 0; i < threads; i++)
+        pthread_create(&t[i], NULL, churn_thread, (void *)i);
+    for (int i = 0; i < threads; i++)
+        pthread_join(t[i], NULL);
+    printf("%d\n", threads * CHURN_LEAKS * CHURN_LEAK_SIZE);
+    return 0;
+}
@@ -0,0 +1,81 @@
+// forktest.c -- fork while other threads allocate.
+//
+// usage: forktest [forks]
+//
+// FORK_THREADS threads churn malloc and free while the main thread
+// forks again and again.  each child allocates once and exits, so one
+// forked while another thread held a lock of the tracer's hangs.  a
+// child still running after FORK_WAIT_MS is killed and counted hung;
+// the exit status is how many were.  forktest.sh runs it under the
+// tracer.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define FORK_THREADS  4
+#define FORK_WAIT_MS  5000
+
+static volatile int fork_stop;
+
+static void *
+fork_churn(void *arg) {
+    void *volatile table[64] = {0};
+    unsigned i = 0;
+
+    (void)arg;
+    while (!fork_stop) {
+        free(table[i & 63]);
+        table[i & 63] = malloc(16 + (i % 13) * 24);
+        i++;
+    }
+    for (int k = 0; k < 64; k++)
+        free(table[k]);
+    return NULL;
+}
+
+int
+main(int argc, char **argv) {
+    int forks = argc > 1 ? atoi(argv[1]) : 200;
+    int hung = 0;
+    pthread_t t[FORK_THREADS];
+
+    for (int i = 0; i < FORK_THREADS; i++)
+        pthread_create(&t[i], NULL, fork_churn, NULL);
+    for (int i = 0; i < forks; i++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            break;
+        }
+        if (pid == 0) {
+            void *volatile p = malloc(100);
+            free(p);
+            _exit(0);
+        }
+
+        int status, waited = 0;
+        while (waitpid(pid, &status, WNOHANG) == 0) {
+            if (++waited == FORK_WAIT_MS) {
+                kill(pid, SIGKILL);
+                waitpid(pid, &status, 0);
+                hung++;
+                break;
+            }
+            usleep(1000);
+        }
+        // _exit skips the tracer's cleanup: drop the child's stats
+        char name[32];
+        snprintf(name, sizeof(name), "/a2l-%d", (int)pid);
+        shm_unlink(name);
+    }
+    fork_stop = 1;
+    for (int i = 0; i < FORK_THREADS; i++)
+        pthread_join(t[i], NULL);
+    printf("%d of %d children hung\n", hung, forks);
+    return hung > 255 ? 255 : hung;
+}